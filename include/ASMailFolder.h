@@ -126,6 +126,46 @@ public:
    */
    static Ticket GetTicket(void);
 
+   /**@name Background execution
+
+      The long operations, such as searching, copying or filtering the
+      messages, are executed by a worker thread, one per folder, so that the
+      operations on the same folder are still done one after another. The
+      other operations are always executed immediately in the main thread.
+   */
+   //@{
+   /// Returns true if the operations may be executed in background.
+   static bool RunsInBackground();
+
+   /** Cancel the operation with the given ticket.
+
+       If the operation hadn't started yet, it is not executed at all and its
+       result is sent with the failure code, otherwise it stops at the next
+       call to UpdateProgress().
+
+       @return false if there is no such operation (any more)
+   */
+   static bool Cancel(Ticket ticket);
+
+   /** Report the progress of the current operation.
+
+       This does nothing when called from the main thread. In a worker thread
+       it shows the progress in the status bar and lets the main thread use
+       the folders while a long operation is running.
+
+       @param done the number of items already processed
+       @param total the total number of items
+       @param text the message to show instead of the default one
+       @return false if the operation was cancelled and should stop
+   */
+   static bool UpdateProgress(unsigned long done,
+                              unsigned long total,
+                              const String& text = wxEmptyString);
+
+   /// Cancel all operations and wait until the worker threads terminate.
+   static void CleanUp();
+   //@}
+
    /**@name Asynchronous Access Functions, returning results in events.*/
    //@{
    /** Check whether mailbox has changed.
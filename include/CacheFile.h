@@ -22,7 +22,28 @@ class WXDLLIMPEXP_FWD_BASE wxTextFile;
 
 class CacheFile
 {
-   // no public methods nor data
+public:
+   /// return the name of the directory to use for the cache files
+   static String GetCacheDirName();
+
+   /**
+     Return the name of the cache file for the given folder.
+
+     The folder name is escaped so that different folders always use
+     different files and any folder name can be used as a file name.
+
+     @param subdir the subdirectory of the cache directory to use
+     @param folderName the full name of the folder
+    */
+   static String GetFolderCacheFileName(const String& subdir,
+                                        const String& folderName);
+
+   /**
+     Create the directory of the given file if it doesn't exist yet.
+
+     @return false if the directory couldn't be created
+    */
+   static bool CreateDirFor(const String& filename);
 
 protected:
    /// protected ctor
@@ -84,9 +105,6 @@ protected:
     */
    //@{
 
-   /// return the name of the direcotry to use for the cache files
-   static String GetCacheDirName();
-
    /// split an int version into major and minor parts
    static void SplitVersion(int version, int& verMaj, int& verMin);
 
@@ -104,5 +122,53 @@ private:
    CacheFile& operator=(const CacheFile&);
 };
 
+// ----------------------------------------------------------------------------
+// CacheFileData
+// ----------------------------------------------------------------------------
+
+/**
+   The contents of a binary cache file loaded in memory.
+
+   Under Unix the file is mapped in memory, elsewhere it is simply read into a
+   heap buffer. Notice that the file may be replaced (e.g. by committing a
+   wxTempFile) while it is mapped, but it must not be modified in any other
+   way.
+
+   All numbers in the binary cache files are stored in native byte order as
+   these files are not supposed to be shared between different machines.
+ */
+class CacheFileData
+{
+public:
+   /// create an empty object, call Load() to fill it
+   CacheFileData() { m_data = NULL; m_size = 0; m_isMapped = false; }
+
+   /// dtor frees the data
+   ~CacheFileData() { Free(); }
+
+   /**
+     Load the contents of the given file.
+
+     @return false if the file doesn't exist, is empty or couldn't be read
+    */
+   bool Load(const String& filename);
+
+   /// free the data, GetData() returns NULL after this
+   void Free();
+
+   /// get the data of the file or NULL if none
+   const char *GetData() const { return m_data; }
+
+   /// get the size of the data
+   size_t GetSize() const { return m_size; }
+
+private:
+   const char *m_data;
+   size_t m_size;
+   bool m_isMapped;
+
+   DECLARE_NO_COPY_CLASS(CacheFileData)
+};
+
 #endif // _M_CACHEFILE_H_
 
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   DnsblLookup.h: DnsblLookup class declaration
+// Purpose:     DnsblLookup checks IP addresses against DNS black lists
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _M_DNSBLLOOKUP_H_
+#define _M_DNSBLLOOKUP_H_
+
+#ifdef USE_RBL
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// the trace mask for the DNS black list lookups
+#define TRACE_DNSBL _T("dnsbl")
+
+/**
+   DnsblLookup checks whether any of the given IPv4 addresses is listed in any
+   of the given DNS black lists (also known as RBLs).
+
+   All DNS queries needed for a check are sent at once over UDP and the
+   answers are waited for concurrently, so a check never takes longer than
+   the timeout, whatever the number of addresses and lists. The answers are
+   cached, both positive and negative ones, for as long as their TTL allows,
+   so the same relays seen in many messages are only looked up once.
+
+   By default the name servers configured for the system are used, but a
+   different one can be specified with SetNameServer(), e.g. a local stub
+   resolver for testing.
+
+   This class is not MT-safe.
+ */
+class DnsblLookup
+{
+public:
+   /// an IPv4 address in host byte order
+   typedef unsigned long IPv4;
+
+   /// make an IPv4 address from its dotted quad components
+   static IPv4 MakeIPv4(int a, int b, int c, int d)
+   {
+      return ((IPv4)(a & 0xff) << 24) | ((IPv4)(b & 0xff) << 16) |
+             ((IPv4)(c & 0xff) << 8) | (IPv4)(d & 0xff);
+   }
+
+   DnsblLookup();
+   ~DnsblLookup();
+
+   /**
+     Use the given name server instead of the system ones.
+
+     This discards the name servers found previously, so it shouldn't be
+     called before each check.
+
+     @param server the numeric IPv4 address of the server optionally followed
+                   by a colon and the UDP port (53 by default) or empty
+                   string to use the system name servers
+     @return false if the address or port is invalid
+    */
+   bool SetNameServer(const String& server);
+
+   /// set the timeout for the entire check in milliseconds
+   void SetTimeout(long timeout) { m_timeout = timeout; }
+
+   /**
+     Check whether any of the addresses is listed in any of the lists.
+
+     @param ips the addresses to check
+     @param zones the domains of the DNS black lists to use
+     @param match if non-NULL, filled with the DNS name found in the list,
+                  i.e. the reversed address followed by the list domain
+     @return true if any address is listed, false if none is or if we didn't
+             get the answers before timeout
+    */
+   bool IsListed(const std::vector<IPv4>& ips,
+                 const wxArrayString& zones,
+                 String *match = NULL);
+
+   /// forget all the cached answers
+   void ClearCache() { m_cache.clear(); }
+
+private:
+   // the cached result of a query
+   struct CacheEntry
+   {
+      // true if the address is listed
+      bool listed;
+
+      // the time when this entry expires
+      time_t expires;
+   };
+
+   // the query waiting for the answer
+   struct Query
+   {
+      // the name we're looking up
+      std::string name;
+
+      // the DNS message ID used for this query
+      unsigned short id;
+
+      // true if we got the answer
+      bool done;
+   };
+
+   // the name server address
+   struct Server
+   {
+      IPv4 addr;
+      unsigned short port;
+   };
+
+   typedef std::map<std::string, CacheEntry> Cache;
+
+   // get the name to look up for the given address and list
+   static std::string GetQueryName(IPv4 ip, const String& zone);
+
+   // fill m_servers with the system name servers if not done yet
+   bool InitServers();
+
+   // send all queries which are not done yet to the given server, return
+   // false if we couldn't send any of them
+   bool SendQueries(int sock,
+                    const std::vector<Query>& queries,
+                    const Server& server);
+
+   // parse the answer and update the cache, return the index of the query
+   // it answers or -1 if it doesn't answer any of them and set listed to
+   // true if the address is listed in this list
+   int ProcessAnswer(const unsigned char *answer,
+                     size_t len,
+                     const std::vector<Query>& queries,
+                     bool *listed);
+
+   // remove the expired entries from the cache
+   void PurgeCache(time_t now);
+
+
+   // the name servers to use
+   std::vector<Server> m_servers;
+
+   // the timeout in milliseconds
+   long m_timeout;
+
+   // the cached answers indexed by the query name
+   Cache m_cache;
+
+   // the ID of the next DNS query
+   unsigned short m_nextId;
+
+   DECLARE_NO_COPY_CLASS(DnsblLookup)
+};
+
+#endif // USE_RBL
+
+#endif // _M_DNSBLLOOKUP_H_
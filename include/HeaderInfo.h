@@ -19,6 +19,8 @@
 
 #include "MailFolder.h"    // for MailFolder::MessageStatus
 
+#include "mail/InternedString.h"
+
 class WXDLLIMPEXP_FWD_BASE wxArrayString;
 class Sequence;
 
@@ -131,15 +133,21 @@ public:
                                  String *value);
 
 private:
-   /// header values
+   /// header values which are usually different for all messages
    String m_Subject,
-          m_From,
-          m_To,
-          m_NewsGroups,
-          m_References,
           m_InReplyTo,
           m_Id;
 
+   /**
+     Header values which are often the same for many messages: they are
+     shared between the headers of the same listing (see
+     HeaderInfoListImpl::InternHeaders())
+    */
+   InternedString m_From,
+                  m_To,
+                  m_NewsGroups,
+                  m_References;
+
    /// MailFolder::Flags combination
    int m_Status;
 
@@ -161,6 +169,24 @@ private:
    // these classes can create/manipulate the HeaderInfo objects directly
    friend class MailFolderCC;
    friend class MailFolderVirt;
+
+   // and this one stores and restores them to/from disk
+   friend class OverviewCache;
+
+   // and this one allocates them and shares their strings
+   friend class HeaderInfoListImpl;
+
+   // and this one creates them for testing the threading code
+   friend class JWZThreadingTest;
+
+   // and this one creates them for benchmarking the sorting code
+   friend class MessageSorterTest;
+
+   // and this one for measuring the memory used by them
+   friend class HeaderInfoMemoryTest;
+
+   // and this one for benchmarking their storage in OverviewCache
+   friend class OverviewCacheTest;
 };
 
 /**
@@ -178,8 +204,9 @@ private:
    Finally, a message also has an UID i.e. a unique identifier which doesn't
    change even as messages are added/deleted to/from the folder. We provide a
    function to find a message by UID (the reverse is simple as HeaderInfo has
-   GetUId() method) but it for now it is implemented as linear search in all
-   messages, i.e. it is very slow and should never be called.
+   GetUId() method) which is fast for the messages whose headers had been
+   already retrieved but may need to ask the folder (which is slow) for the
+   other ones.
 */
 class HeaderInfoList : public MObjectRC
 {
@@ -22,8 +22,69 @@
 
 #include "HeaderInfo.h"
 
+#include <vector>
+
 WX_DEFINE_ARRAY(HeaderInfo *, ArrayHeaderInfo);
 
+/**
+  HeaderInfoArena allocates HeaderInfo objects in big blocks (slabs) instead
+  of allocating each of them on the heap individually.
+
+  This is much faster for big folders and also results in better locality of
+  the headers in memory. The freed objects are reused by the subsequent
+  allocations and the slabs themselves are only freed when all the objects
+  allocated from them are freed.
+ */
+class HeaderInfoArena
+{
+public:
+   HeaderInfoArena();
+
+   /// dtor asserts that all objects had been freed
+   ~HeaderInfoArena();
+
+   /// allocate and construct a new HeaderInfo object
+   HeaderInfo *Alloc();
+
+   /// destroy and free an object previously returned by Alloc()
+   void Free(HeaderInfo *hi);
+
+   /// get the number of currently allocated objects
+   size_t GetCount() const { return m_countUsed; }
+
+   /// get the number of slabs we have
+   size_t GetSlabCount() const { return m_slabs.size(); }
+
+private:
+   // a slot in a slab: either contains a HeaderInfo or is in the free list
+   union Slot
+   {
+      Slot *next;
+      char data[sizeof(HeaderInfo)];
+
+      // only used to ensure the correct alignment
+      double dummyDouble;
+      wxLongLong_t dummyLong;
+   };
+
+   // allocate a new slab and add all its slots to the free list
+   void AddSlab();
+
+   // free all slabs (there must be no objects in them any more)
+   void FreeSlabs();
+
+   // all our slabs
+   std::vector<Slot *> m_slabs;
+
+   // the head of the list of the free slots
+   Slot *m_free;
+
+   // the number of objects allocated
+   size_t m_countUsed;
+
+   DECLARE_NO_COPY_CLASS(HeaderInfoArena)
+};
+
 /**
   This is a very simple HeaderInfoList implementation. It preallocates an
   array big enough to store the info for all the messages.
@@ -32,6 +93,10 @@ WX_DEFINE_ARRAY(HeaderInfo *, ArrayHeaderInfo);
   support folders with up to 100000 messages efficiently (probably not
   sorting/threading them though?).
 
+  The HeaderInfo objects themselves are allocated by HeaderInfoArena and the
+  values of the headers which are often the same for many messages are shared
+  using StringInterner.
+
   TODO:
    1. although there is nothing wrong with preallocating all the memory we need
       (even for 100000 message we take just 400Kb), it would still be nice to
@@ -112,6 +177,15 @@ private:
    /// build m_tableMsgno/m_tablePos from sort/thread data if not done yet
    void BuildTables();
 
+   /**
+       Update the existing tables to take into account the messages added
+       since they were built.
+
+       @return true if the tables were updated, false if they must be rebuilt
+               from scratch
+    */
+   bool UpdateTables();
+
    /// build m_tablePos from m_tableMsgno (call only if needed)
    void BuildPosTable();
 
@@ -169,6 +243,15 @@ private:
    /// cache the sequence of msgnos
    void Cache(const Sequence& seqmMsgnos);
 
+   /**
+     Process the newly retrieved headers: share their strings with the other
+     ones and add them to the UID index.
+    */
+   void OnHeadersRetrieved(const Sequence& seqMsgnos);
+
+   /// allocate a new header for the given index
+   void AllocHeader(MsgnoType n) { m_headers[n] = m_arena.Alloc(); }
+
    /// sort messages, i.e. set m_tableSort
    bool Sort();
 
@@ -188,6 +271,29 @@ private:
    /// the array of headers
    ArrayHeaderInfo m_headers;
 
+   /// the allocator for the elements of m_headers
+   HeaderInfoArena m_arena;
+
+   /// the table of the shared header strings
+   StringInterner m_strings;
+
+   /**
+     @name UID index
+
+     The hash map from the UIDs of all retrieved headers to their indices
+     allows to find a message by UID without asking the folder to do it
+     (which is a linear search in c-client).
+
+     Removing a message shifts the indices of all the following ones down,
+     OnRemove() updates them in the map as it does in m_headers.
+    */
+   //@{
+
+   /// the map from UID to index, never NULL
+   class HeaderInfoUIdMap *m_uidIndex;
+
+   //@}
+
    /// the number of messages in the folder
    MsgnoType m_count;
 
@@ -241,6 +347,12 @@ private:
    /// true if the sort/thread data is out of date and should be regenerated
    bool m_mustRebuildTables;
 
+   /// true if only new messages were added since the tables were built
+   bool m_canUpdateTables;
+
+   /// the sort order really used for m_tableSort (see Sort())
+   long m_sortOrderTable;
+
    //@}
 
    /// last modification "date": incremented each time the listing changes
@@ -58,6 +58,7 @@ enum MEventId
    MEventId_MailFolder_OnNewMail = 1100,
    MEventId_MailFolder_OnMsgStatus,
    MEventId_MailFolder_OnFlagsChange,
+   MEventId_MailFolder_OnListingChange,
 
    /// (invalid id for an event)
    MEventId_Max
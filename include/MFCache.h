@@ -13,16 +13,32 @@
 #ifndef  _MFCACHE_H_
 #define  _MFCACHE_H_
 
-#ifndef   USE_PCH
-#  include <wx/dynarray.h>        // for WX_DEFINE_ARRAY
-#endif // USE_PCH
+#include <wx/hashmap.h>
 
 #include "CacheFile.h"           // base class
 
 #include "MEvent.h"
 #include "MFStatus.h"
 
-WX_DEFINE_ARRAY(MailFolderStatus *, MfStatusArray);
+// the status of a folder kept in memory by MfStatusCache
+struct MfStatusCacheEntry
+{
+   MfStatusCacheEntry() { isDirty = isRemoved = isInJournal = false; }
+
+   // the status itself
+   MailFolderStatus status;
+
+   // true if this entry hadn't been written to disk yet
+   bool isDirty;
+
+   // true if the folder was deleted or renamed
+   bool isRemoved;
+
+   // true if this entry is stored in the journal and not in the data file
+   bool isInJournal;
+};
+
+WX_DECLARE_STRING_HASH_MAP(MfStatusCacheEntry, MfStatusCacheMap);
 
 // trace mask for logging MfStatusCache methods and other mailfolder
 // status-related activity
@@ -34,6 +50,13 @@ WX_DEFINE_ARRAY(MailFolderStatus *, MfStatusArray);
 // rebuilding of the entire folder listing if we're only interested in its
 // status (which we often are, for example when updating the status in the
 // tree)
+//
+// The status is stored in a binary file with a hash index which is mapped in
+// memory as is, so loading it doesn't depend on the number of folders and
+// looking up a folder takes constant time. The changes are kept in memory and
+// written either directly into the file, for the folders already in it, or
+// appended to a journal which is merged into the main file when it becomes
+// too big. The old text format is converted to the binary one when found.
 // ----------------------------------------------------------------------------
 
 class MfStatusCache : public CacheFile,
@@ -67,6 +90,9 @@ protected:
    // protected ctor for CreateStatusCache()
    MfStatusCache();
 
+   // ctor used by the test program to keep the files in the given directory
+   MfStatusCache(const String& dirname);
+
    // and protected dtor - CleanUp() should be called instead
    virtual ~MfStatusCache();
 
@@ -93,11 +119,72 @@ protected:
    virtual bool DoSave(wxTempFile& file);
 
 private:
-   // the names of the folders we have cached status for
-   wxSortedArrayString m_folderNames;
+   // the structures of the binary file, defined in MFCache.cpp
+   struct FileHeader;
+   struct FileRecord;
+   struct JournalHeader;
+   struct JournalRecord;
+
+   // common part of all ctors
+   void Init();
+
+   // get the names of the binary data and journal files
+   String GetDataFileName() const;
+   String GetJournalFileName() const;
+
+   // load the binary file and the journal, if any, return false if there is
+   // no valid binary file
+   bool LoadData();
+
+   // map the binary data file in memory and check that it is valid
+   bool MapData();
+
+   // release the data file
+   void Unmap();
 
-   // the data for the folders above
-   MfStatusArray m_folderData;
+   // replay the journal in m_entries
+   void LoadJournal();
+
+   // find the record for this folder in the data file, return NULL if none
+   const FileRecord *FindRecord(const String& folderName) const;
+
+   // find the current status for the given folder, return false if we don't
+   // have any, even invalid, status for it
+   bool FindStatus(const String& folderName, MailFolderStatus *status) const;
+
+   // forget everything about the given folder
+   void RemoveStatus(const String& folderName);
+
+   // write all the data to a new data file and remove the journal
+   bool WriteData();
+
+   // write the changed entries in place or to the journal
+   bool WriteJournal();
+
+
+   // the directory containing the cache files
+   const String m_dirname;
+
+   // the changes to the data file contents and the status of the folders
+   // which are not in it
+   MfStatusCacheMap m_entries;
+
+   // the contents of the data file
+   CacheFileData m_data;
+
+   // the pointers into m_data
+   const FileRecord *m_records;
+   size_t m_countRecords;
+   const wxUint32 *m_index;
+   size_t m_sizeIndex;
+   const char *m_names;
+   size_t m_sizeNames;
+
+   // the generation of the data file, the journal must have the same one
+   wxUint32 m_generation;
+
+   // the number of entries in the journal
+   size_t m_countJournal;
 
    // the MEventManager cookie
    void *m_evtmanHandle;
@@ -109,6 +196,8 @@ private:
    // again, and again, and again...
    bool m_hasFailedToSave;
 
+   friend class MfStatusCacheTest;
+
    DECLARE_NO_COPY_CLASS(MfStatusCache)
 };
 
@@ -17,6 +17,9 @@ class MFolder;
 class Profile;
 class WXDLLIMPEXP_FWD_CORE wxWindow;
 
+/// trace mask for the search timings
+#define TRACE_SEARCH _T("search")
+
 /**
   Search criterium for searching folders for certain messages.
  */
@@ -22,6 +22,8 @@
 #include "FolderType.h"         // for MFolderType
 #include <wx/fontenc.h>         // for wxFontEncoding
 
+#include <vector>
+
 // forward declarations
 class ArrayHeaderInfo;
 class Composer;
@@ -44,6 +46,7 @@ struct SortParams;
 struct ThreadData;
 struct ThreadParams;
 
+class WXDLLIMPEXP_FWD_BASE wxArrayString;
 class WXDLLIMPEXP_FWD_CORE wxFrame;
 class WXDLLIMPEXP_FWD_CORE wxWindow;
 
@@ -267,6 +270,29 @@ public:
     */
    static bool CheckFolder(const MFolder *mfolder, wxFrame *frame = NULL);
 
+   /**
+     Start watching the folder for changes instead of polling it.
+
+     This is only possible for the IMAP folders on the servers supporting the
+     IDLE extension: a separate connection to the server is kept open and the
+     folder is checked as soon as the server reports any changes in it.
+
+     The connection is opened in the background, so this function returns
+     false until it is established and must be called again after the next
+     check of the folder.
+
+     @param mfolder the folder to watch
+     @return true if the folder is watched and so doesn't need to be checked
+             with CheckFolder() periodically, false if it must be polled
+    */
+   static bool WatchFolder(const MFolder *mfolder);
+
+   /// stop watching the folder, does nothing if it's not watched
+   static void UnwatchFolder(const String& name);
+
+   /// is the folder with this full name being watched?
+   static bool IsWatched(const String& name);
+
    /**
        Suspend the folder by temporarily closing it.
 
@@ -586,6 +612,39 @@ public:
    virtual MsgnoType GetHeaderInfo(ArrayHeaderInfo& headers,
                                    const Sequence& seq) = 0;
 
+   /// the kinds of message data which can be retrieved by PrefetchMessages()
+   enum PrefetchData
+   {
+      /// the envelope (subject, addresses, date), size and flags
+      Prefetch_Overview = 1,
+
+      /// the header lines with the given names
+      Prefetch_HeaderLines = 2,
+
+      /// the entire message header
+      Prefetch_Header = 4,
+
+      /// the message text
+      Prefetch_Text = 8
+   };
+
+   /**
+      Retrieve the given data for all the specified messages at once, so that
+      accessing it for the individual messages later doesn't require a trip
+      to the server for each of them.
+
+      This is only an optimization and the default implementation doesn't do
+      anything. The implementation may also ignore any of the requested kinds
+      of data it can't retrieve in bulk.
+
+      @param uids the messages to retrieve the data for
+      @param what combination of PrefetchData bits
+      @param headers the names of the headers for Prefetch_HeaderLines
+    */
+   virtual void PrefetchMessages(const UIdArray& WXUNUSED(uids),
+                                 int WXUNUSED(what),
+                                 const wxArrayString& WXUNUSED(headers)) { }
+
    /**
       Get the total number of messages in the folder. This should be a fast
       operation unlike (possibly) CountXXXMessages() below.
@@ -624,6 +683,13 @@ public:
        @return msgno for the given UID or MSGNO_ILLEGAL if not found
    */
    virtual MsgnoType GetMsgnoFromUID(UIdType uid) const = 0;
+
+   /** Get the UID validity of the folder: if it changes, the UIDs of the
+       messages seen before can't be used any more.
+
+       @return UID validity or UID_ILLEGAL if the folder doesn't have it
+   */
+   virtual UIdType GetUIdValidity() const { return UID_ILLEGAL; }
    //@}
 
    /** @name Operations on the folder */
@@ -713,6 +779,37 @@ public:
    */
    virtual bool AppendMessage(const String& msg) = 0;
 
+   /// the message data used by AppendMessages()
+   struct RawMessage
+   {
+      RawMessage() { status = 0; uid = UID_ILLEGAL; }
+
+      /// the UID of the message in the folder it was retrieved from, if any
+      UIdType uid;
+
+      /// the full message text, as is
+      wxCharBuffer text;
+
+      /// the message status, combination of MSG_STAT_XXX values
+      int status;
+
+      /// the value of the message Date header, may be empty
+      String date;
+   };
+
+   typedef std::vector<RawMessage> RawMessages;
+
+   /** Appends several messages to this folder at once.
+
+       This is much more efficient than calling AppendMessage() for each of
+       them for the remote folders as all of them are sent in a single
+       command if the server supports it.
+
+       @param msgs the messages to append
+       @return true on success
+   */
+   virtual bool AppendMessages(const RawMessages& msgs) = 0;
+
    /** Expunge messages.
     */
    virtual void ExpungeMessages(void) = 0;
@@ -756,9 +853,14 @@ public:
 
        @param selections pointer to an array holding the message UIDs
        @param folder is the folder to save to, can't be NULL
+       @param uidLast if not NULL, filled with the UID of the last message
+              saved such that all the messages preceding it in selections
+              were saved too (or UID_ILLEGAL if none), even on failure
        @return true if messages got saved
    */
-   virtual bool SaveMessages(const UIdArray *selections, MFolder *folder) = 0;
+   virtual bool SaveMessages(const UIdArray *selections,
+                             MFolder *folder,
+                             UIdType *uidLast = NULL) = 0;
 
    /** Save the messages to a folder.
        @param selections the message UIDs
@@ -23,6 +23,8 @@
 
 #include <wx/fontenc.h>    // for wxFontEncoding
 
+#include <deque>
+
 // fwd decls
 class ASMailFolder;
 class MailFolderCC;
@@ -64,6 +66,58 @@ public:
 
    static bool CheckStatus(const MFolder *folder);
 
+   /**
+     @name Checking the folder status in another thread
+
+     CheckStatus() may ask the user for the password and processes the new
+     mail found, so it must be called from the main thread. These functions
+     split it in the parts done in the main thread before and after the check
+     and mail_status() call itself which may be done in any thread, so that
+     several folders could be checked at once. POP3 folders can't be checked
+     like this, see CheckStatus().
+    */
+   //@{
+
+   /// the data of a status check
+   struct StatusCheck
+   {
+      StatusCheck(const MFolder *folder_) : folder(folder_)
+      {
+         canCheck =
+         ok = false;
+         messages =
+         recent =
+         unseen = 0;
+      }
+
+      /// the folder to check, not IncRef()'d
+      const MFolder * const folder;
+
+      /// the login data to use if the server doesn't have any
+      String login,
+             password;
+
+      /// false if we couldn't get the login data
+      bool canCheck;
+
+      /// true if the check succeeded, then the fields below are valid
+      bool ok;
+      unsigned long messages,
+                    recent,
+                    unseen;
+   };
+
+   /// get the login data for the check, may ask the user for it
+   static void PrepareStatusCheck(StatusCheck& check);
+
+   /// check the folder status, may be called from any thread
+   static void DoStatusCheck(StatusCheck& check);
+
+   /// process the check results, returns false if it failed
+   static bool FinishStatusCheck(const StatusCheck& check);
+
+   //@}
+
    /// return the directory of the newsspool:
    static String GetNewsSpool(void);
 
@@ -125,6 +179,8 @@ public:
    // uid -> msgno
    virtual MsgnoType GetMsgnoFromUID(UIdType uid) const;
 
+   virtual UIdType GetUIdValidity() const { return m_uidValidity; }
+
    /** get message header
        @param uid mesage uid
        @return message header information class
@@ -147,11 +203,16 @@ public:
                                 bool set = true);
 
    /// override base class SaveMessages() to do server side copy if possible
-   virtual bool SaveMessages(const UIdArray *selections, MFolder *folder);
+   virtual bool SaveMessages(const UIdArray *selections,
+                             MFolder *folder,
+                             UIdType *uidLast = NULL);
 
    virtual bool AppendMessage(const Message & msg);
 
    virtual bool AppendMessage(const String& msg);
+
+   virtual bool AppendMessages(const RawMessages& msgs);
+
    virtual void ExpungeMessages(void);
 
 
@@ -209,12 +270,99 @@ public:
    virtual bool IsLocked(void) const;
    //@}
 
+   /**@name Multi-threading support */
+   //@{
+
+   /**
+     Locks the c-client stream of the folder for the current thread.
+
+     A c-client stream can't be used by several threads at once, so all the
+     methods using m_MailStream create an object of this class first. The
+     lock is recursive and waiting for it lets the other threads use c-client
+     in the meanwhile.
+
+     To avoid deadlocks, a thread may only wait for the stream of a folder
+     if it doesn't hold the stream of any folder coming after it in the fixed
+     order of the folders addresses. If it does, Lock() releases these
+     streams while waiting and takes them again afterwards, so the other
+     threads may use them in the meanwhile. It's better to avoid holding
+     more than one stream at all.
+    */
+   class StreamLocker
+   {
+   public:
+      StreamLocker(const MailFolderCC *mf) : m_mf(mf) { Lock(m_mf); }
+      ~StreamLocker() { Unlock(m_mf); }
+
+      /// lock the folder stream, see the class description
+      static void Lock(const MailFolderCC *mf);
+
+      /// undo a Lock() call
+      static void Unlock(const MailFolderCC *mf);
+
+   private:
+      /// add the folder to the list of the streams held by this thread
+      static void Link(MailFolderCC *mf);
+
+      /// remove the folder from this list
+      static void Unlink(MailFolderCC *mf);
+
+      const MailFolderCC * const m_mf;
+
+      DECLARE_NO_COPY_CLASS(StreamLocker)
+   };
+
+   /**
+     Allows using the mail folders from the threads other than the main one.
+
+     Must be called by the main thread before starting the worker threads.
+     It may be called more than once, each call must be matched by a call to
+     DisableWorkerThreads().
+    */
+   static void EnableWorkerThreads();
+
+   /**
+     Undoes EnableWorkerThreads().
+
+     Must be called by the main thread when the worker threads started after
+     the matching EnableWorkerThreads() call have terminated. The folders are
+     used without locking again after the last call.
+    */
+   static void DisableWorkerThreads();
+
+   /**
+     Must be called by a worker thread before using the mail folders.
+
+     This blocks until the main thread lets the worker run, which it only
+     does from its event loop. The other threads only run while this one is
+     waiting for the network or after it calls UnlockCClient(), so, except
+     for the network IO, all folder operations are still serialized.
+    */
+   static void LockCClient();
+
+   /// Must be called by a worker thread when it's done with the mail folders.
+   static void UnlockCClient();
+
+   /**
+      Return true if the current thread uses any folder stream currently.
+
+      Another thread can't be asked to do anything with the folders then as
+      it could need the same stream.
+    */
+   static bool IsUsingStream();
+
+   //@}
+
    /**@name Functions to get an overview of messages in the folder. */
    //@{
    virtual unsigned long GetMessageCount() const;
 
    virtual MsgnoType GetHeaderInfo(ArrayHeaderInfo& headers,
                                    const Sequence& seq);
+
+   virtual void PrefetchMessages(const UIdArray& uids,
+                                 int what,
+                                 const wxArrayString& headers);
    //@}
 
    virtual char GetFolderDelimiter() const;
@@ -263,6 +411,9 @@ public:
    /// called to generate MsgStatus event for many messages at once
    void OnMsgStatusChanged();
 
+   /// called to apply the changes reported to the worker threads
+   void ApplyListingChanges();
+
    //@}
 
 private:
@@ -324,8 +475,40 @@ private:
    MsgnoArray *DoSearch(struct search_program *pgm,
                         int flags = SEARCH_MSGNO) const;
 
+   /**
+     Check which of the candidates found by the server side TEXT search really
+     contain the search string in the decoded header.
+
+     Only the headers of the candidates are retrieved, see PrefetchHeaders().
+
+     @param candidates the UIDs of the messages containing the string
+     @param crit the header search criterium
+     @param flags either SEARCH_UID or SEARCH_MSGNO
+     @param bytes incremented by the number of bytes of headers retrieved
+     @return array containing either UIDs or msgnos of the found messages
+   */
+   UIdArray *CheckHeaderMatches(const UIdArray& candidates,
+                                const SearchCriterium *crit,
+                                int flags,
+                                unsigned long& bytes);
+
+   /**
+     Retrieve the headers of all the given messages using as few requests as
+     possible. Only does anything for IMAP folders.
+
+     @param uids the messages whose headers we need
+     @return the number of bytes of the headers retrieved
+   */
+   unsigned long PrefetchHeaders(const UIdArray& uids);
+
    /// called by CountAllMessages() to perform actual counting
    virtual bool DoCountMessages(MailFolderStatus *status) const;
+
+   /// return the full text index for the local folders, creating it if needed
+   virtual FullTextIndex *GetFullTextIndex();
+
+   /// return the cache of the locally built threads, creating it if needed
+   virtual ThreadCache *GetThreadCache();
    //@}
 
    /// Update the timeout values from a profile
@@ -337,6 +520,18 @@ private:
    /// helper of OverviewHeader
    static String ParseAddress(struct mail_address *adr);
 
+   /**
+     Called from GetHeaderInfo() to fill the headers from m_overviewCache.
+
+     @param headers the array to fill, indexed by msgno
+     @param seq the msgnos of the headers to retrieve
+     @param seqMissing filled with the msgnos of the headers not in cache
+     @return the number of headers retrieved from cache
+    */
+   MsgnoType GetCachedHeaderInfo(ArrayHeaderInfo& headers,
+                                 const Sequence& seq,
+                                 Sequence& seqMissing);
+
    /**
      Called from GetHeaderInfo() to process one header
 
@@ -380,6 +575,9 @@ private:
    */
    void ForceClose();
 
+   /// save and delete the persistent caches of this folder, if any
+   void CloseCaches();
+
    /// Updates the folder status after some messages were expunged
    void UpdateMsgFlagsOnExpunge(MsgnoType msgnoExpunged);
 
@@ -391,10 +589,6 @@ private:
 
    virtual void ReadConfig(MailFolderCmn::MFCmnOptions& config);
 
-   /// fill mailstatus with the results of c-client mail_status() call
-   static bool DoCheckStatus(const MFolder *folder,
-                             struct mbx_status *mailstatus);
-
    /**
       @name Notification handlers
 
@@ -402,11 +596,38 @@ private:
       c-client should be made from them. Normally they should just quickly
       update the internal state and maybe post an event to ourselves which will
       be processed (thanks to CCEventReflector) by OnXXX() methods.
+
+      They are always called in the main thread as they update the listing
+      shown to the user: if c-client reports the change to a worker thread,
+      QueueListingChange() defers it until ApplyListingChanges() call.
     */
    //@{
 
+   /// a change reported by mm_exists(), mm_expunged() or mm_flags()
+   struct ListingChange
+   {
+      enum Kind { Exists, Expunged, Flags } kind;
+
+      /// the new number of messages for Exists, the msgno otherwise
+      MsgnoType msgno;
+
+      /// the last UID in the folder for Exists only
+      UIdType uidLast;
+   };
+
+   /// call the handler for this change now or later in the main thread
+   void QueueListingChange(ListingChange::Kind kind,
+                           MsgnoType msgno,
+                           UIdType uidLast = UID_ILLEGAL);
+
+   /// update the listing of the current worker thread, if any, for it
+   void UpdateThreadHeaders(const ListingChange& change);
+
+   /// are there any changes not applied to the main listing yet?
+   bool HasListingChanges() const;
+
    /// called when the number of the messages in the folder changes
-   void HandleMailExists(struct mail_stream *stream, MsgnoType msgnoMax);
+   void HandleMailExists(MsgnoType msgnoMax, UIdType uidLast);
 
    /// called when the given msgno is expunged from the folder
    void HandleMailExpunge(MsgnoType msgno);
@@ -485,6 +706,15 @@ private:
    /// UID validity (in IMAP/c-client sense) for this folder
    UIdType m_uidValidity;
 
+   /// the persistent headers cache for this folder, may be NULL
+   class OverviewCache *m_overviewCache;
+
+   /// the full text index of a local folder, created on demand, may be NULL
+   class FullTextIndex *m_ftIndex;
+
+   /// the cache of the thread tree, created on demand, may be NULL
+   class ThreadCache *m_thrCache;
+
    //@}
 
    /** @name Temporary operation parameters */
@@ -536,6 +766,23 @@ private:
    /// locked while we're processing the new mail which just arrived
    MMutex m_mutexNewMail;
 
+   /// the thread using m_MailStream currently, only valid if m_nStreamLocks
+   wxThreadIdType m_streamOwner;
+
+   /// the number of StreamLockers for this folder existing in m_streamOwner
+   size_t m_nStreamLocks;
+
+   /// the next folder in the list of the streams held by m_streamOwner which
+   /// is sorted in the reverse order of the folders addresses
+   MailFolderCC *m_streamPrev;
+
+   /// the changes not applied yet, protected by m_csListingChanges
+   std::deque<ListingChange> m_listingChanges;
+   mutable wxCriticalSection m_csListingChanges;
+
+   /// true while ApplyListingChanges() is running
+   bool m_applyingListingChanges;
+
    //@}
 
    /** @name functions for mapping mailstreams and objects
@@ -547,6 +794,9 @@ private:
    /// lookup object in map by its stream
    static MailFolderCC *LookupObject(const MAILSTREAM *stream);
 
+   /// change m_MailStream updating the map used by LookupObject()
+   void SetStream(MAILSTREAM *stream);
+
    //@}
 
    /** @name c-client parameters */
@@ -575,6 +825,7 @@ private:
    friend void MailFolderCCCleanup();
 
    friend class SendMessageCC;
+   friend class ImapIdleManager;
 
 public:
    DEBUG_DEF
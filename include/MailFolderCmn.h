@@ -25,6 +25,10 @@
 #include "MEvent.h"     // for MEventOptionsChangeData
 #include "pointers.h"           // for DECLARE_REF_COUNTER
 
+#include <wx/thread.h>          // for wxCriticalSection
+
+#include <map>
+
 // define this for some additional checks of folder closing logic
 #undef DEBUG_FOLDER_CLOSE
 
@@ -36,6 +40,9 @@
 
 DECLARE_REF_COUNTER(FilterRule)
 
+class FullTextIndex;
+class ThreadCache;
+
 /**
    MailFolderCmn  class, common code shared by all implementations of
    the MailFolder ABC.
@@ -57,9 +64,13 @@ public:
 
        @param selections pointer to an array holding the message UIDs
        @param folder is the folder to save to, can't be NULL
+       @param uidLast if not NULL, filled with the UID of the last message
+              saved in order, see MailFolder::SaveMessages()
        @return true if messages got saved
    */
-   virtual bool SaveMessages(const UIdArray *selections, MFolder *folder);
+   virtual bool SaveMessages(const UIdArray *selections,
+                             MFolder *folder,
+                             UIdType *uidLast = NULL);
 
    /** Save the messages to a folder.
        @param selections the message indices which will be converted using the current listing
@@ -136,8 +147,22 @@ public:
    //@}
 
 
+   /**
+     Returns the listing of the folder.
+
+     The main thread gets the folder listing shown to the user, the other
+     threads get their own one, see GetThreadHeaders().
+    */
    virtual HeaderInfoList *GetHeaders(void) const;
 
+   /**
+     Frees all the listings created by GetHeaders() in the current thread.
+
+     This must be called by the threads other than the main one using the
+     folders when they are done with them.
+    */
+   static void ReleaseThreadHeaders();
+
    virtual bool ProcessNewMail(UIdArray& uidsNew,
                                const MFolder *folderDst = NULL);
 
@@ -217,6 +242,22 @@ protected:
     */
    void DiscardExpungeData();
 
+   /**
+     Get the full text index of this folder if it has one.
+
+     The index is used and updated by SearchMessages(). The base class version
+     returns NULL, i.e. the folders don't have any index by default.
+    */
+   virtual FullTextIndex *GetFullTextIndex() { return NULL; }
+
+   /**
+     Get the cache of the thread tree of this folder if it has one.
+
+     The cache is used and updated by ThreadMessages(). The base class version
+     returns NULL, i.e. the threads are not cached by default.
+    */
+   virtual ThreadCache *GetThreadCache() { return NULL; }
+
    /** @name Config management */
    //@{
    struct MFCmnOptions
@@ -258,7 +299,10 @@ protected:
    /// Destructor
    ~MailFolderCmn();
 
-   /// our listing or NULL if not created yet
+   /// the listing of the current thread if it's not the main one or NULL
+   HeaderInfoList *FindThreadHeaders() const;
+
+   /// our listing used by the main thread or NULL if not created yet
    HeaderInfoList *m_headers;
 
    /** @name Mail folder events data */
@@ -328,6 +372,24 @@ private:
                              MsgnoType countNew,
                              MailFolder *mf);
 
+   /**
+     GetHeaders() helper for the threads other than the main one.
+
+     The main thread may change m_headers at any moment, even while another
+     thread waits for the network in the middle of using it, so the other
+     threads never use it. Instead each of them gets a listing of its own
+     which retrieves the headers it needs using this thread. It also keeps
+     the folder alive until ReleaseThreadHeaders() is called.
+    */
+   HeaderInfoList *GetThreadHeaders() const;
+
+   /// the listings of the threads other than the main one
+   typedef std::map<wxThreadIdType, HeaderInfoList *> ThreadHeaders;
+   mutable ThreadHeaders m_threadHeaders;
+
+   /// the critical section protecting m_threadHeaders
+   mutable wxCriticalSection m_csThreadHeaders;
+
    /**
        @name Keep alive stuff.
     */
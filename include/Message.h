@@ -478,6 +478,20 @@ public:
    */
    virtual bool WriteToString(String &str, bool headerFlag = true) const = 0;
 
+   /** Get the raw message contents, including the header.
+
+       Unlike WriteToString() this doesn't convert the message to String but
+       returns its bytes exactly as they are stored in the folder, which is
+       what the C libraries processing the whole message need.
+
+       The default implementation uses WriteToString(), the derived classes
+       override it to avoid the conversions.
+
+       @param buf the buffer filled with NUL-terminated message contents
+       @return false on error
+   */
+   virtual bool WriteToBuffer(wxCharBuffer& buf) const;
+
    //@}
 
    // for backwards compatibility only, don't use
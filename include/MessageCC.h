@@ -120,6 +120,9 @@ public:
    */
    virtual bool WriteToString(String &str, bool headerFlag = true) const;
 
+   /// Write the raw message to a buffer without any conversions
+   virtual bool WriteToBuffer(wxCharBuffer& buf) const;
+
    /// Return the numeric uid
    virtual UIdType GetUId(void) const { return m_uid; }
 
@@ -172,6 +175,9 @@ private:
    /// Get the body and envelope information into member variables
    void GetBody(void);
 
+   /// get the raw text, fetching it if necessary, and its length
+   const char *GetRawText(unsigned long *len) const;
+
    /// call GetBody() if necessary
    void CheckBody() const { if ( !m_Body ) ((MessageCC *)this)->GetBody(); }
 
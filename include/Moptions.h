@@ -197,6 +197,9 @@ extern const MOption MP_FOLDER_PASSWORD;
 extern const MOption MP_LOGLEVEL;
 extern const MOption MP_SHOWBUSY_DURING_SORT;
 extern const MOption MP_FOLDERPROGRESS_THRESHOLD;
+extern const MOption MP_USE_HEADER_CACHE;
+extern const MOption MP_USE_FULLTEXT_INDEX;
+extern const MOption MP_USE_THREAD_CACHE;
 extern const MOption MP_MESSAGEPROGRESS_THRESHOLD_SIZE;
 extern const MOption MP_MESSAGEPROGRESS_THRESHOLD_TIME;
 extern const MOption MP_DEFAULT_SAVE_PATH;
@@ -245,6 +248,8 @@ extern const MOption MP_FOLDER_COMMENT;
 extern const MOption MP_UPDATEINTERVAL;
 extern const MOption MP_FOLDER_CLOSE_DELAY;
 extern const MOption MP_CONN_CLOSE_DELAY;
+extern const MOption MP_CONN_POOL_SIZE;
+extern const MOption MP_ASYNC_FOLDER_OPS;
 extern const MOption MP_AUTOMATIC_WORDWRAP;
 extern const MOption MP_WRAP_QUOTED;
 extern const MOption MP_WRAPMARGIN;
@@ -338,6 +343,7 @@ extern const MOption MP_CHECK_ATTACHMENTS_REGEX;
 // sorting/threading
 extern const MOption MP_MSGS_SERVER_SORT;
 extern const MOption MP_MSGS_SORTBY;
+extern const MOption MP_MSGS_SORT_PARALLEL_THRESHOLD;
 
 extern const MOption MP_MSGS_USE_THREADING;
 extern const MOption MP_MSGS_SERVER_THREAD;
@@ -394,7 +400,9 @@ extern const MOption MP_MAX_MESSAGE_SIZE;
 extern const MOption MP_MAX_HEADERS_NUM;
 extern const MOption MP_MAX_HEADERS_NUM_HARD;
 extern const MOption MP_SAFE_FILTERS;
+extern const MOption MP_SPAM_PARALLEL_THRESHOLD;
 extern const MOption MP_IMAP_LOOKAHEAD;
+extern const MOption MP_IMAP_IDLE;
 extern const MOption MP_TCP_OPENTIMEOUT;
 extern const MOption MP_TCP_READTIMEOUT;
 extern const MOption MP_TCP_WRITETIMEOUT;
@@ -430,6 +438,8 @@ extern const MOption MP_AWAY_REMEMBER;
 extern const MOption MP_AWAY_STATUS;
 extern const MOption MP_CREATE_INTERNAL_MESSAGE;
 extern const MOption MP_WHITE_LIST;
+extern const MOption MP_RBL_NAMESERVER;
+extern const MOption MP_RBL_TIMEOUT;
 
 // miscellaneous
 // -------------
@@ -802,6 +812,12 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 #define   MP_SHOWBUSY_DURING_SORT_NAME "BusyDuringSort"
 /// threshold for displaying mailfolder progress dialog
 #define   MP_FOLDERPROGRESS_THRESHOLD_NAME   "FolderProgressThreshold"
+/// cache the message headers on disk for IMAP folders
+#define   MP_USE_HEADER_CACHE_NAME           "UseHeaderCache"
+/// maintain full text index for searching in local folders
+#define   MP_USE_FULLTEXT_INDEX_NAME         "UseFullTextIndex"
+/// store the result of local threading in the cache directory
+#define   MP_USE_THREAD_CACHE_NAME           "UseThreadCache"
 /// size threshold for displaying message retrieval progress dialog
 #define   MP_MESSAGEPROGRESS_THRESHOLD_SIZE_NAME   "MsgProgressMinSize"
 /// time threshold for displaying message retrieval progress dialog
@@ -904,6 +920,10 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 #define MP_FOLDER_CLOSE_DELAY_NAME   "FolderCloseDelay"
 /// close of network connection delayed by
 #define MP_CONN_CLOSE_DELAY_NAME   "ConnCloseDelay"
+/// max number of idle connections kept per server
+#define MP_CONN_POOL_SIZE_NAME     "ConnPoolSize"
+/// run the folder operations in background threads?
+#define MP_ASYNC_FOLDER_OPS_NAME   "AsyncFolderOps"
 /// do automatic word wrap?
 #define MP_AUTOMATIC_WORDWRAP_NAME   "AutoWrap"
 /// Wrap quoted lines?
@@ -1089,6 +1109,8 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 #define MP_MSGS_SERVER_SORT_NAME    "SortOnServer"
 /// sort criterium for folder listing
 #define MP_MSGS_SORTBY_NAME         "SortMessagesBy"
+/// use parallel sort for folders with more messages than this (0 = never)
+#define MP_MSGS_SORT_PARALLEL_THRESHOLD_NAME "ParallelSortThreshold"
 /// use threading
 #define MP_MSGS_USE_THREADING_NAME  "ThreadMessages"
 /// use server side threading?
@@ -1195,11 +1217,15 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 
 /// setting this prevents the filters from expuning the msgs automatically
 #define MP_SAFE_FILTERS_NAME "SafeFilters"
+/// check this many or more messages for spam in worker threads (0 = never)
+#define MP_SPAM_PARALLEL_THRESHOLD_NAME "ParallelSpamThreshold"
 
 /** @name timeout values for c-client mail library */
 //@{
 /// IMAP lookahead value
 #define MP_IMAP_LOOKAHEAD_NAME "IMAPlookahead"
+/// wait for new mail in the monitored IMAP folders using IDLE if possible
+#define MP_IMAP_IDLE_NAME      "UseIMAPIdle"
 /// TCP/IP open timeout in seconds.
 #define MP_TCP_OPENTIMEOUT_NAME "TCPOpenTimeout"
 /// TCP/IP read timeout in seconds.
@@ -1294,6 +1320,11 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 
 /// name of addressbook to use in whitelist spam filter
 #define MP_WHITE_LIST_NAME "WhiteList"
+/// the name server ("address[:port]") to use for RBL lookups instead of the
+/// system ones
+#define MP_RBL_NAMESERVER_NAME "RBLNameServer"
+/// timeout for all RBL lookups for one message in milliseconds
+#define MP_RBL_TIMEOUT_NAME    "RBLTimeout"
 
 //@}
 
@@ -1669,6 +1700,12 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 #define   MP_SHOWBUSY_DURING_SORT_DEFVAL 1L
 /// threshold for displaying mailfolder progress dialog
 #define   MP_FOLDERPROGRESS_THRESHOLD_DEFVAL 20L
+/// cache the message headers on disk for IMAP folders
+#define   MP_USE_HEADER_CACHE_DEFVAL         1L
+/// maintain full text index for searching in local folders
+#define   MP_USE_FULLTEXT_INDEX_DEFVAL       1L
+/// store the result of local threading in the cache directory
+#define   MP_USE_THREAD_CACHE_DEFVAL         1L
 /// threshold for displaying message retrieval progress dialog (kbytes)
 #define   MP_MESSAGEPROGRESS_THRESHOLD_SIZE_DEFVAL  40L
 /// threshold for displaying message retrieval progress dialog (seconds)
@@ -1771,6 +1808,10 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 #define MP_FOLDER_CLOSE_DELAY_DEFVAL    0L
 /// close of network connection delayed by
 #define MP_CONN_CLOSE_DELAY_DEFVAL    60
+/// max number of idle connections kept per server
+#define MP_CONN_POOL_SIZE_DEFVAL      4L
+/// run the folder operations in background threads?
+#define MP_ASYNC_FOLDER_OPS_DEFVAL    1L
 /// Wrap quoted lines?
 #define MP_AUTOMATIC_WORDWRAP_DEFVAL   1L
 /// do automatic word wrap?
@@ -2071,6 +2112,8 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 #define MP_MSGS_SERVER_SORT_DEFVAL    1L
 /// sort criterium for folder listing (== MSO_NONE)
 #define MP_MSGS_SORTBY_DEFVAL         0L
+/// use parallel sort for folders with more messages than this (0 = never)
+#define MP_MSGS_SORT_PARALLEL_THRESHOLD_DEFVAL 50000L
 /// use threading
 #define MP_MSGS_USE_THREADING_DEFVAL  1L
 /// use server side threading?
@@ -2221,10 +2264,14 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 //@}
 /// setting this prevents the filters from expuning the msgs automatically
 #define MP_SAFE_FILTERS_DEFVAL 0L
+/// check this many or more messages for spam in worker threads (0 = never)
+#define MP_SPAM_PARALLEL_THRESHOLD_DEFVAL 20L
 /** @name timeout values for c-client mail library */
 //@{
 /// IMAP lookahead value
 #define MP_IMAP_LOOKAHEAD_DEFVAL 0L
+/// wait for new mail in the monitored IMAP folders using IDLE if possible
+#define MP_IMAP_IDLE_DEFVAL      1L
 /// TCP/IP open timeout in seconds.
 #define MP_TCP_OPENTIMEOUT_DEFVAL      30L
 /// TCP/IP read timeout in seconds.
@@ -2323,6 +2370,11 @@ extern const MOption MP_OPTION_ORIGIN_INHERITED;
 
 /// name of addressbook to use in whitelist spam filter
 #define MP_WHITE_LIST_DEFVAL ""
+/// the name server ("address[:port]") to use for RBL lookups instead of the
+/// system ones
+#define MP_RBL_NAMESERVER_DEFVAL ""
+/// timeout for all RBL lookups for one message in milliseconds
+#define MP_RBL_TIMEOUT_DEFVAL    3000L
 
 //@}
 
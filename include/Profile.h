@@ -145,6 +145,16 @@ public:
    /// Flush all (disk-based) profiles now, return true if ok, false on error
    static bool FlushAll();
 
+   /**
+      Invalidate the values cached by all profiles.
+
+      Profiles remember the values they read until anything is changed in the
+      config: this is done automatically when it is changed using the
+      profiles or wxConfig, but this function must be called if it is done in
+      some other way.
+    */
+   static void InvalidateCache();
+
    /// some characters are invalid in the profile name, replace them
    static String FilterProfileName(const String& profileName);
 
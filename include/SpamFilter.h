@@ -25,11 +25,17 @@
 
 #include "gui/MBookCtrl.h"
 
+#include <vector>
+
 class Message;
 class SpamOptionsPage;
+class SpamLearnData;
 
 class WXDLLIMPEXP_FWD_CORE wxFrame;
 
+/// the trace mask for the spam filters operations
+#define TRACE_SPAM _T("spam")
+
 
 /*
    Abstract base class for all concrete spam filters.
@@ -115,6 +121,59 @@ public:
                            const String& param = wxEmptyString,
                            String *result = NULL);
 
+   /**
+      Check if each of the given messages is a spam.
+
+      This is equivalent to calling CheckIfSpam() for all messages in turn but
+      is more efficient as the filters keep the resources they need (e.g. the
+      opened spam database) between the messages, see BeginBatch(). The time
+      taken by the classification of each message is logged using TRACE_SPAM.
+
+      The filters which support it (see CanCheckRaw()) check the raw messages
+      texts without learning from them. If there are at least
+      MP_SPAM_PARALLEL_THRESHOLD messages and more than one CPU, they do it
+      in worker threads, one per CPU, while the calling thread retrieves the
+      next messages and checks them with the other filters. All messages are
+      classified using the filters data as it was before the call, so the
+      results don't depend on the order in which the workers check them.
+
+      If learn is NULL, the filters then learn from all messages in their
+      order before this function returns. Otherwise they don't do it at all
+      and the data they need for it is appended to learn, see SpamLearnData.
+
+      @param msgs the messages to check, must not contain NULL pointers
+      @param param the filters options, as for CheckIfSpam()
+      @param isSpam filled with the results for all messages
+      @param results if non-NULL, filled with the explanations for all
+                     messages (empty if a message isn't a spam)
+      @param learn if non-NULL, receives the data for learning from the
+                   messages instead of doing it immediately
+      @return the number of messages deemed to be spam
+    */
+   static size_t CheckIfSpam(const std::vector<const Message *>& msgs,
+                             const String& param,
+                             std::vector<bool>& isSpam,
+                             wxArrayString *results = NULL,
+                             SpamLearnData *learn = NULL);
+
+   /**
+      Start a batch of spam checks.
+
+      Until the matching EndBatch() call, the filters used by CheckIfSpam()
+      don't release the resources they need for checking the messages, which
+      makes checking many messages in a row much faster.
+
+      The calls to BeginBatch() and EndBatch() may be nested, only the
+      outermost ones have any effect. Use SpamFilterBatch instead of calling
+      them directly to ensure that they're always matched.
+    */
+   static void BeginBatch();
+
+   /**
+      End the batch started by BeginBatch().
+    */
+   static void EndBatch();
+
    /**
       Show a GUI dialog allowing the user to configure all spam filters.
 
@@ -153,10 +212,21 @@ public:
 
 
 protected:
+   /**
+      Base class for the data needed by a filter to learn from a message.
+
+      See DoCheckRawIfSpam() and DoLearnRaw().
+    */
+   class LearnData
+   {
+   public:
+      virtual ~LearnData() { }
+   };
+
    /**
       Default ctor.
     */
-   SpamFilter() { m_next = NULL; }
+   SpamFilter() { m_next = NULL; m_inBatch = false; }
 
    /**
       Virtual dtor for the base class.
@@ -237,6 +307,61 @@ protected:
                              const String& param,
                              String *result) = 0;
 
+   /**
+      Return true if the filter implements DoCheckRawIfSpam().
+    */
+   virtual bool CanCheckRaw() const { return false; }
+
+   /**
+      Check if the raw message text is a spam without learning from it.
+
+      This is used instead of DoCheckIfSpam() when checking many messages at
+      once and is called from several worker threads at once, so it must not
+      use the profile nor any other objects which are not MT-safe and must
+      serialize the access to its own shared data itself. It is only called
+      inside a batch, i.e. after DoBeginBatch().
+
+      Unlike DoCheckIfSpam(), this method must not modify the filter data. If
+      the filter learns from the messages it checks, it must return what it
+      needs for doing it in learn instead and DoLearnRaw() is called with it
+      later if the result is really used.
+
+      @param text the NUL-terminated message header and body
+      @param learn set to a new object if the filter needs to learn from the
+                   message, left NULL otherwise
+      @return the same values as DoCheckIfSpam()
+    */
+   virtual int DoCheckRawIfSpam(const char *text,
+                                const String& param,
+                                String *result,
+                                LearnData **learn);
+
+   /**
+      Learn from the message checked by DoCheckRawIfSpam().
+
+      This is called from the thread which called CheckIfSpam(), never while
+      the worker threads call DoCheckRawIfSpam(), in the order in which the
+      results are used and only for the messages for which DoCheckRawIfSpam()
+      returned a non-NULL learn object. It doesn't take ownership of it.
+    */
+   virtual void DoLearnRaw(const LearnData& learn);
+
+   /**
+      Prepare for checking several messages in a row.
+
+      This is called before the first call to DoCheckIfSpam() done inside a
+      BeginBatch()/EndBatch() pair and may be overridden to acquire the
+      resources which are then reused for all messages in the batch.
+    */
+   virtual void DoBeginBatch() { }
+
+   /**
+      Release the resources acquired by DoBeginBatch().
+
+      This is only called if DoBeginBatch() was.
+    */
+   virtual void DoEndBatch() { }
+
    /**
       Return the name of the icon used by the option page.
 
@@ -300,14 +425,98 @@ private:
    // true if we had already loaded all available spam filters
    static bool ms_loaded;
 
+   // the nesting level of BeginBatch() calls, 0 if not inside a batch,
+   // protected by a critical section together with m_inBatch
+   static size_t ms_batchLevel;
+
 
    // the next filter in the linked list or NULL
    SpamFilter *m_next;
 
+   // true if DoBeginBatch() had been called for this filter
+   bool m_inBatch;
+
    friend class SpamOptionsDialog;
+   friend class SpamFilterChain;
+   friend class SpamLearnData;
+};
+
+
+/**
+   The data needed by the spam filters to learn from the checked messages.
+
+   The filters learn from the messages they check, e.g. DSPAM adds their
+   tokens to its database. When the messages are checked in advance, the
+   filters should only learn from those whose results are really used, so
+   SpamFilter::CheckIfSpam() stores the data for doing it in this object.
+ */
+class SpamLearnData
+{
+public:
+   SpamLearnData() { }
+
+   /// deletes the data of the messages the filters didn't learn from
+   ~SpamLearnData();
+
+   /// get the number of messages added by SpamFilter::CheckIfSpam()
+   size_t GetCount() const { return m_messages.size(); }
+
+   /**
+      Let the filters learn from the given message.
+
+      This must be called in the order in which the messages results are
+      used, before the end of the batch in which they were checked. Calling
+      it again for the same message does nothing.
+
+      @param n the index of the message, less than GetCount()
+    */
+   void Learn(size_t n);
+
+private:
+   // what a filter needs to learn from one message
+   struct Item
+   {
+      SpamFilter *filter;
+      SpamFilter::LearnData *data;
+   };
+
+   typedef std::vector<Item> Items;
+
+   // add n messages without any data and return the index of the first one
+   size_t Add(size_t n);
+
+   // get the data of the given message
+   Items& Get(size_t n) { return m_messages[n]; }
+
+   // delete the data of the given message
+   void Free(size_t n);
+
+
+   // the data of all messages, indexed by their order in CheckIfSpam() calls
+   std::vector<Items> m_messages;
+
+   friend class SpamFilter;
+   friend class SpamFilterChain;
+   friend class SpamCheckPipeline;
+
+   DECLARE_NO_COPY_CLASS(SpamLearnData)
 };
 
 
+/**
+   Helper class calling SpamFilter::BeginBatch() and EndBatch().
+
+   Create an object of this class before checking many messages in a row.
+ */
+class SpamFilterBatch
+{
+public:
+   SpamFilterBatch() { SpamFilter::BeginBatch(); }
+   ~SpamFilterBatch() { SpamFilter::EndBatch(); }
+
+   DECLARE_NO_COPY_CLASS(SpamFilterBatch)
+};
+
 // ----------------------------------------------------------------------------
 // Loading spam filters from modules support
 // ----------------------------------------------------------------------------
@@ -79,9 +79,19 @@ struct ThreadData
    /// Root of the built tree, must be allocated with fs_get()!
    THREADNODE *m_root;
 
-   /// free the existing tree, but not the other tables
+   /**
+      The index of the message ids and subjects of the messages in the tree
+      used by JWZThreadNewMessages(), it is only created by JWZThreadMessages()
+      and so is NULL if the messages were threaded by the server.
+    */
+   class JWZThreadIndex *m_jwzIndex;
+
+   /// free the existing tree (and its index), but not the other tables
    void killTree();
 
+   /// free the JWZ index only (implemented in ThreadJWZ.cpp)
+   void killIndex();
+
 
    /// ctor reserves memory for holding info about count messages
    ThreadData(MsgnoType count);
@@ -114,6 +124,44 @@ extern void JWZThreadMessages(const ThreadParams& thrParams,
 extern THREADNODE* JWZThreadMessages(const ThreadParams& thrParams,
                                      const HeaderInfoList *hil);
 
+/**
+   Add the new messages to the tree previously built by JWZThreadMessages()
+   without rethreading all the other ones.
+
+   This only works if the new messages can't change the position of any of
+   the existing ones in the tree, e.g. if none of them is referenced by the
+   messages already threaded. If this is not the case, nothing is done and
+   false is returned: the caller must rethread everything then.
+
+   The threading parameters used are the same as were passed to
+   JWZThreadMessages() when the tree was built.
+
+   @param hil the headers of all messages, including the new ones
+   @param thrData the existing thread data, only its m_root is modified
+   @param msgnoFirst the msgno of the first new message
+   @param msgnoLast the msgno of the last new message
+   @return true if the messages were added, false if full rethreading is needed
+ */
+extern bool JWZThreadNewMessages(const HeaderInfoList *hil,
+                                 ThreadData *thrData,
+                                 MsgnoType msgnoFirst,
+                                 MsgnoType msgnoLast);
+
+/**
+   Prepare the existing tree which wasn't built by JWZThreadMessages() for
+   use with JWZThreadNewMessages().
+
+   This is used for the trees restored from ThreadCache which must have been
+   built by JWZThreadMessages() with the same parameters initially.
+
+   @param thrParams the parameters used to build the tree
+   @param hil the headers of all messages in the tree
+   @param thrData the thread data containing the tree
+ */
+extern void JWZIndexThreadTree(const ThreadParams& thrParams,
+                               const HeaderInfoList *hil,
+                               ThreadData *thrData);
+
                               /**
    Show the dialog to configure the message threading for the folder using this
    profile.
@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/FullTextIndex.h: FullTextIndex class declaration
+// Purpose:     FullTextIndex is a persistent inverted index of the words of
+//              the messages of one folder
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MAIL_FULLTEXTINDEX_H_
+#define _MAIL_FULLTEXTINDEX_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class Message;
+
+/// the trace mask for the full text index operations
+#define TRACE_FTINDEX _T("ftindex")
+
+/**
+   FullTextIndex maps the words of the messages of a folder to the UIDs of
+   the messages containing them.
+
+   The words are extracted separately from the message header and from the
+   decoded contents of all its text parts and are stored in lower case, so the
+   index can only be used for case-insensitive searches. Only the beginning of
+   very long words is stored, so Find() considers all messages containing them
+   as candidates when looking for a part of a word.
+
+   The index is stored in a binary file in the cache directory keyed by the
+   folder UIDVALIDITY, just as OverviewCache. It is updated incrementally:
+   new messages are added to it by AddMessage() when they are searched for
+   the first time and the expunged ones are removed by Forget().
+ */
+class FullTextIndex
+{
+public:
+   /// the parts of the message which are indexed separately
+   enum
+   {
+      Field_Header = 1,
+      Field_Body = 2,
+      Field_All = Field_Header | Field_Body
+   };
+
+   /// the result of Find()
+   enum FindResult
+   {
+      /// the index can't be used to search for this string
+      Find_Unusable,
+
+      /// all messages found contain the string (ignoring the case)
+      Find_Exact,
+
+      /// the messages found may contain the string and must be checked
+      Find_Candidates
+   };
+
+   /**
+     Create the index object for the given folder.
+
+     Load() must be called before the index can be used.
+
+     @param folderName the full name of the folder
+     @param uidValidity the current UIDVALIDITY of the folder
+    */
+   FullTextIndex(const String& folderName, UIdType uidValidity);
+
+   /// dtor doesn't save the index, call Save() explicitly if needed
+   ~FullTextIndex();
+
+   /**
+     Load the index file for this folder if it exists.
+
+     @return false only if an existing file couldn't be read
+    */
+   bool Load();
+
+   /**
+     Save the index if it was modified since it was loaded.
+
+     @return true if the file was successfully written
+    */
+   bool Save();
+
+   /// is the message with this UID in the index?
+   bool IsIndexed(UIdType uid) const
+      { return m_uids.find(uid) != m_uids.end(); }
+
+   /// add the message to the index, does nothing if it's already there
+   void AddMessage(UIdType uid, const Message& msg);
+
+   /// remove the message with this UID (which was expunged) from the index
+   void Forget(UIdType uid);
+
+   /// get the number of the messages in the index
+   size_t GetCount() const { return m_uids.size(); }
+
+   /**
+     Find the indexed messages containing the given string.
+
+     @param key the string to search for
+     @param fields the combination of Field_XXX values to search in
+     @param uids filled with the sorted UIDs of the messages found unless
+                 Find_Unusable is returned
+     @return the kind of the results found
+    */
+   FindResult Find(const String& key,
+                   int fields,
+                   std::vector<UIdType>& uids) const;
+
+   /**
+     Get the text of the message which is indexed in the given fields.
+
+     This is the text which should be searched in the messages returned by
+     Find() with Find_Candidates result.
+    */
+   static String GetMessageText(const Message& msg, int fields);
+
+private:
+   // the postings of one field: map from word to the sorted UIDs
+   typedef std::map<std::string, std::vector<UIdType> > Postings;
+
+   // ctor used by the test program to store the index in the given file
+   FullTextIndex(const String& folderName,
+                 UIdType uidValidity,
+                 const String& filename);
+
+   // get the full name of the index file for the given folder
+   static String GetIndexFileName(const String& folderName);
+
+   // delete the index file for the given folder if it exists
+   static void Remove(const String& folderName);
+
+   // add all words of the text to the given postings
+   void AddWords(Postings& postings, UIdType uid, const String& text);
+
+   // add to uids all messages with the words containing the given one in
+   // the given postings, the words must start (end) with it if atStart
+   // (atEnd) is true
+   void FindWord(const Postings& postings,
+                 const std::string& word,
+                 bool atStart,
+                 bool atEnd,
+                 std::set<UIdType>& uids) const;
+
+
+   // the name of the folder and its index file
+   const String m_folderName,
+                m_filename;
+
+   // the UIDVALIDITY of the folder
+   const UIdType m_uidValidity;
+
+   // the UIDs of all indexed messages
+   std::set<UIdType> m_uids;
+
+   // the UIDs of the messages with the words which were only partially
+   // indexed because they were too long
+   std::set<UIdType> m_uidsLong;
+
+   // the postings for the header and the body
+   Postings m_header,
+            m_body;
+
+   // the UIDs removed from m_uids but which may still appear in postings
+   std::set<UIdType> m_forgotten;
+
+   // true if anything was changed since the last Load() or Save()
+   bool m_modified;
+
+   friend class FullTextIndexTest;
+
+   DECLARE_NO_COPY_CLASS(FullTextIndex)
+};
+
+#endif // _MAIL_FULLTEXTINDEX_H_
@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/InternedString.h: InternedString and StringInterner
+// Purpose:     sharing the same string values between many HeaderInfo objects
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MAIL_INTERNEDSTRING_H_
+#define _MAIL_INTERNEDSTRING_H_
+
+class StringInterner;
+
+/**
+   InternedString is an immutable reference counted string.
+
+   Copying InternedString objects never copies the string data. Moreover, if
+   the string is passed to StringInterner::Intern(), it starts sharing the
+   data with all the other strings with the same value interned by the same
+   StringInterner. This is used for the header fields which often have the
+   same values for many messages, e.g. From or References.
+
+   InternedString can be used as a normal const String and assigning a String
+   to it simply makes a new, not shared, copy of it.
+
+   This class is not MT-safe: all copies of the same string must be used by
+   the same thread only.
+ */
+class InternedString
+{
+public:
+   /// default ctor creates an empty string
+   InternedString() { m_data = NULL; }
+
+   /// copy ctor shares the data with the other string
+   InternedString(const InternedString& other)
+   {
+      m_data = other.m_data;
+      if ( m_data )
+         m_data->refs++;
+   }
+
+   /// assignment operator shares the data with the other string
+   InternedString& operator=(const InternedString& other);
+
+   /// assigning a String makes a new, not interned, copy of it
+   InternedString& operator=(const String& s);
+
+   /// dtor frees the data if it's not used any more
+   ~InternedString() { Release(); }
+
+   /// get the string value
+   const String& Get() const { return m_data ? m_data->str : ms_empty; }
+
+   /// implicit conversion to String allows to use us as a String
+   operator const String&() const { return Get(); }
+
+   /// is the string empty?
+   bool empty() const { return Get().empty(); }
+
+   // the shared data: this is an implementation detail, only public because
+   // StringInterner hash table needs to use it
+   struct Data
+   {
+      Data(const String& s) : str(s) { refs = 1; owner = NULL; }
+
+      // the string value itself
+      const String str;
+
+      // the number of InternedString objects using this data
+      size_t refs;
+
+      // the interner containing this data or NULL if it's not interned
+      StringInterner *owner;
+   };
+
+private:
+   // decrement the reference count and free the data if needed
+   void Release();
+
+   // the data or NULL if the string is empty
+   Data *m_data;
+
+   // the empty string returned by Get() if we don't have any data
+   static const String ms_empty;
+
+   friend class StringInterner;
+};
+
+/**
+   StringInterner contains the table of unique strings.
+
+   The strings are removed from the table automatically when the last
+   InternedString using them is destroyed. The StringInterner itself may be
+   destroyed before the strings it contains, they simply stop being shared
+   with any new strings then.
+ */
+class StringInterner
+{
+public:
+   StringInterner();
+   ~StringInterner();
+
+   /**
+     Make the given string share the data with the other strings with the
+     same value if there are any or add it to the table otherwise.
+
+     Empty strings and strings interned by another StringInterner are left
+     unchanged.
+    */
+   void Intern(InternedString& s);
+
+   /// get the number of unique strings in the table
+   size_t GetCount() const;
+
+private:
+   // called when the last reference to the data in the table is released
+   void Remove(InternedString::Data *data);
+
+   // the table of strings
+   class StringInternerSet *m_set;
+
+   friend class InternedString;
+
+   DECLARE_NO_COPY_CLASS(StringInterner)
+};
+
+#endif // _MAIL_INTERNEDSTRING_H_
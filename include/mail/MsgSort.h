@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/MsgSort.h: MessageSorter class declaration
+// Purpose:     MessageSorter implements local sorting of the message headers
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MAIL_MSGSORT_H_
+#define _MAIL_MSGSORT_H_
+
+#include "Sorting.h"
+
+#include <vector>
+
+class HeaderInfoList;
+
+/// the trace mask for the local sorting
+#define TRACE_SORT _T("msgsort")
+
+/**
+   MessageSorter sorts the messages of a folder locally according to the
+   given SortParams.
+
+   All the values used for sorting (normalized and case-folded subjects and
+   senders, dates, sizes and status scores) are extracted from the headers
+   only once, when the object is constructed, and stored in separate arrays
+   indexed by the message index. The sort itself then only compares these
+   precomputed keys and is stable, i.e. the messages which compare equal
+   according to all sort criteria keep their msgno order.
+
+   Alternatively, the keys may be extracted only when they are needed which
+   is much faster when only a few new messages are inserted into an already
+   sorted array using InsertNew().
+
+   This class doesn't use any global data, so different folders may be sorted
+   at the same time, possibly in different threads, as long as each one uses
+   its own MessageSorter object.
+ */
+class MessageSorter
+{
+public:
+   /// when are the sort keys extracted from the headers?
+   enum KeysMode
+   {
+      /// all of them in the ctor
+      Keys_All,
+
+      /// only when they are used by InsertNew()
+      Keys_OnDemand
+   };
+
+   /**
+     Extract the sort keys for all messages of the given listing.
+
+     All headers must have been already retrieved, i.e. the caller should call
+     HeaderInfoList::CacheMsgnos() for all of them before.
+
+     @param hil the listing to sort
+     @param sortParams the sort criteria to use
+     @param mode Keys_OnDemand to not extract any keys in the ctor, only
+                 InsertNew() can be used in this case and not Sort()
+    */
+   MessageSorter(HeaderInfoList *hil,
+                 const SortParams& sortParams,
+                 KeysMode mode = Keys_All);
+
+   /// get the number of messages we sort
+   MsgnoType GetCount() const { return m_count; }
+
+   /**
+     Compare two messages using all sort criteria.
+
+     @param idx1 the index (not msgno!) of the first message
+     @param idx2 the index of the second message
+     @return negative, 0 or positive number if the first message must
+             appear before, at the same position or after the second one
+    */
+   int Compare(MsgnoType idx1, MsgnoType idx2) const;
+
+   /**
+     Sort all the messages.
+
+     If the number of messages is at least equal to the given threshold and
+     there is more than one CPU, the messages are sorted using a parallel
+     merge sort. The result is exactly the same as with the serial sort.
+
+     @param msgnos the array of GetCount() elements filled with the msgnos in
+                   sorted order on return
+     @param thresholdParallel the minimal number of messages to use parallel
+                              sort for, 0 to never use it
+    */
+   void Sort(MsgnoType *msgnos, MsgnoType thresholdParallel = 0) const;
+
+   /**
+     Insert the new messages into the already sorted array.
+
+     The new messages are sorted among themselves and then merged into the
+     existing array, using binary search to find their positions, so only
+     O(log(countOld)) keys of the existing messages are used for each new
+     one. The result is exactly the same as if Sort() were called for all
+     messages.
+
+     @param msgnos the array of countNew elements, the first countOld of which
+                   contain the msgnos from 1 to countOld sorted by Sort()
+     @param countOld the number of already sorted messages
+     @param countNew the total number of messages, the msgnos from countOld + 1
+                     to countNew are inserted
+    */
+   void InsertNew(MsgnoType *msgnos, MsgnoType countOld, MsgnoType countNew);
+
+private:
+   // the comparison functor used with std::stable_sort()
+   class MsgnoLess;
+
+   // the unit of work of ParallelSort() and the thread executing it
+   struct SortTask;
+   class SortThread;
+
+   // sort the array using the given number of threads
+   void ParallelSort(MsgnoType *msgnos, unsigned nThreads) const;
+
+   // execute all the given tasks in parallel and wait for their completion
+   void RunTasks(const std::vector<SortTask>& tasks) const;
+
+   // extract the keys of the message with the given index
+   void ExtractKeys(MsgnoType n);
+
+   // same as ExtractKeys() but only if it wasn't done yet
+   void EnsureKeys(MsgnoType n);
+
+   // find the position after all elements of [first, last) range which are
+   // less than or equal to msgno, as std::upper_bound() does
+   MsgnoType *UpperBound(MsgnoType *first, MsgnoType *last, MsgnoType msgno);
+
+   // the listing we sort
+   HeaderInfoList * const m_hil;
+
+   // the number of messages
+   const MsgnoType m_count;
+
+   // the options for MSO_SENDER comparison
+   const bool m_detectOwnAddresses;
+   const wxArrayString m_ownAddresses;
+
+   // which keys do we need?
+   bool m_needDate,
+        m_needSize,
+        m_needStatus,
+        m_needSubject,
+        m_needSender;
+
+   // the sort criteria (without MSO_NONE) in order of decreasing priority
+   std::vector<MessageSortOrder> m_criteria;
+
+   // in Keys_OnDemand mode, true for the messages whose keys were extracted
+   std::vector<bool> m_extracted;
+
+   // the sort keys, only the ones needed by m_criteria are filled
+   std::vector<bool> m_valid;
+   std::vector<time_t> m_dates;
+   std::vector<unsigned long> m_sizes;
+   std::vector<int> m_statusScores;
+   std::vector<String> m_subjects;
+   std::vector<String> m_senders;
+
+   DECLARE_NO_COPY_CLASS(MessageSorter)
+};
+
+#endif // _MAIL_MSGSORT_H_
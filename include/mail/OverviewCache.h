@@ -0,0 +1,157 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/OverviewCache.h: OverviewCache class declaration
+// Purpose:     OverviewCache persistently stores the headers of the messages
+//              of one folder on disk
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MAIL_OVERVIEWCACHE_H_
+#define _MAIL_OVERVIEWCACHE_H_
+
+#include "HeaderInfo.h"
+#include "CacheFile.h"
+
+#include <map>
+#include <set>
+
+/// the trace mask for the overview cache operations
+#define TRACE_OVERVIEW_CACHE _T("ovcache")
+
+/**
+   OverviewCache stores the envelope information (i.e. everything in
+   HeaderInfo except the message flags which may change at any moment) for all
+   messages of a folder in a binary file in the cache directory.
+
+   The file is keyed by the folder UIDVALIDITY and is simply discarded if it
+   doesn't match the current one. Inside it, the entries are stored in an
+   array of fixed size records sorted by UID followed by the string pool, so
+   the file can be (and, under Unix, is) mapped in memory as is and looked up
+   using binary search without parsing it first.
+
+   The new entries added by Store() are kept in memory until Save() is
+   called which merges them with the existing ones and rewrites the file.
+ */
+class OverviewCache
+{
+public:
+   /**
+     Create the cache object for the given folder.
+
+     Load() must be called before the cache can be used.
+
+     @param folderName the full name of the folder
+     @param uidValidity the current UIDVALIDITY of the folder
+    */
+   OverviewCache(const String& folderName, UIdType uidValidity);
+
+   /// dtor doesn't save the cache, call Save() explicitly if needed
+   ~OverviewCache();
+
+   /**
+     Load the cache file for this folder if it exists.
+
+     If the file doesn't exist or is invalid or was created for a different
+     UIDVALIDITY, the cache is just empty.
+
+     @return false only if an existing file couldn't be read
+    */
+   bool Load();
+
+   /**
+     Save all the changes done since the last call to Load() or Save().
+
+     Does nothing if there were no changes.
+
+     @return true if the file was successfully written
+    */
+   bool Save();
+
+   /**
+     Find the message with the given UID in the cache.
+
+     Only the envelope fields of the header info are filled in, the UID and
+     the status are not modified by this function.
+
+     @param uid the UID of the message to find
+     @param hi the header info to fill
+     @return true if the message was found, false otherwise
+    */
+   bool Lookup(UIdType uid, HeaderInfo& hi) const;
+
+   /// remember the header info for the message with hi.GetUId() UID
+   void Store(const HeaderInfo& hi);
+
+   /// forget about the message with this UID (which was expunged)
+   void Forget(UIdType uid);
+
+   /// get the number of entries in the cache
+   size_t GetCount() const;
+
+   /// delete the cache file for the given folder if it exists
+   static void Remove(const String& folderName);
+
+private:
+   // the structures describing the file format
+   struct FileHeader;
+   struct FileRecord;
+
+   // ctor used by the test program to store the cache in the given file
+   OverviewCache(const String& folderName,
+                 UIdType uidValidity,
+                 const String& filename);
+
+   // common part of all ctors
+   void Init();
+
+   // get the full name of the cache file for the given folder
+   static String GetCacheFileName(const String& folderName);
+
+   // find the record with this UID in the file data, return NULL if none
+   const FileRecord *FindRecord(UIdType uid) const;
+
+   // get the string at the given offset in the string pool
+   String GetPoolString(size_t offset) const;
+
+   // fill the header info from a file record
+   void FillFromRecord(const FileRecord& rec, HeaderInfo& hi) const;
+
+   // release the file data we currently use
+   void Unmap();
+
+
+   // the name of the folder and its cache file
+   const String m_folderName,
+                m_filename;
+
+   // the UIDVALIDITY of the folder
+   const UIdType m_uidValidity;
+
+   // the file data
+   CacheFileData m_data;
+
+   // pointers into m_data (NULL if it's empty)
+   const FileRecord *m_records;
+   size_t m_countRecords;
+   const char *m_strings;
+   size_t m_sizeStrings;
+
+   // the entries added since the file was loaded
+   typedef std::map<UIdType, HeaderInfo> NewEntries;
+   NewEntries m_newEntries;
+
+   // the UIDs of the messages which were expunged since then
+   std::set<UIdType> m_forgotten;
+
+   friend class OverviewCacheTest;
+
+   DECLARE_NO_COPY_CLASS(OverviewCache)
+};
+
+#endif // _MAIL_OVERVIEWCACHE_H_
+
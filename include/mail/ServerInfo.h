@@ -44,6 +44,12 @@
    b) when closing the folder, don't close the connection with mail_close()
       but give it back to the folders server entry, it will close it later (if
       it's not reused)
+
+   c) at most MP_CONN_POOL_SIZE unused connections are kept for each server,
+      the oldest ones are closed if there are more of them
+
+   d) the worker threads don't open more than MP_CONN_POOL_SIZE connections
+      to the same server at once, they wait until another one is closed
  */
 
 class ServerInfoEntry
@@ -186,6 +192,50 @@ public:
    virtual bool CanBeUsedFor(const MFolder * /* folder */) const
       { return false; }
 
+   /// the statistics of the connection pool of a server
+   struct PoolStats
+   {
+      PoolStats()
+      {
+         connInUse =
+         connPooled = 0;
+         hits =
+         misses = 0;
+         latencyReuse =
+         latencyConnect = 0;
+      }
+
+      /// the number of connections currently used and kept for reuse
+      size_t connInUse,
+             connPooled;
+
+      /// the number of times a pooled connection was and wasn't found
+      unsigned long hits,
+                    misses;
+
+      /// the average time of opening a mailbox on a reused and new connection
+      long latencyReuse,
+           latencyConnect;
+   };
+
+   /**
+     Get the statistics of the connection pool of this server.
+
+     @param stats receives the statistics
+     @return false if this server doesn't pool connections
+    */
+   virtual bool GetPoolStats(PoolStats& /* stats */) const { return false; }
+
+   /// get the server name as shown to the user, e.g. in the debug messages
+   virtual String GetName() const { return m_login; }
+
+   /**
+     Return the description of the connection pools of all servers.
+
+     This is only used for debugging.
+    */
+   static String DescribeAllPools();
+
    //@}
 
 
@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/ThreadCache.h: ThreadCache class declaration
+// Purpose:     ThreadCache persistently stores the result of threading the
+//              messages of one folder on disk
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MAIL_THREADCACHE_H_
+#define _MAIL_THREADCACHE_H_
+
+#include <vector>
+
+class HeaderInfoList;
+struct ThreadData;
+struct ThreadParams;
+
+/// the trace mask for the thread cache operations
+#define TRACE_THREAD_CACHE _T("thrcache")
+
+/**
+   ThreadCache stores the thread tree computed by the local threading code for
+   a folder in a binary file in the cache directory.
+
+   The tree is stored in terms of the UIDs of the messages and is only valid
+   for the same UIDVALIDITY and threading parameters. It can be reused when
+   the folder is opened again if its messages are the same as when the tree
+   was stored, possibly followed by some new ones: in the latter case only
+   the new messages need to be added to the tree.
+
+   Only the tree itself is stored as the translation tables built from it
+   (including the indentation and the number of children of each message)
+   also depend on the current sort order.
+ */
+class ThreadCache
+{
+public:
+   /**
+     Create the cache object for the given folder.
+
+     Load() must be called before the cache can be used.
+
+     @param folderName the full name of the folder
+     @param uidValidity the current UIDVALIDITY of the folder
+    */
+   ThreadCache(const String& folderName, UIdType uidValidity);
+
+   /**
+     Load the cache file for this folder if it exists.
+
+     @return false only if an existing file couldn't be read
+    */
+   bool Load();
+
+   /**
+     Save the cache if it was modified since it was loaded.
+
+     @return true if the file was successfully written
+    */
+   bool Save();
+
+   /**
+     Restore the stored tree for the messages of the given listing.
+
+     The tree can only be restored if it was stored for the same threading
+     parameters and for the messages which are the first ones in the listing
+     now. All headers of the listing must be already cached.
+
+     @param thrParams the threading parameters which will be used
+     @param hil the listing of the folder
+     @param thrData the thread data to fill, its tree must be empty
+     @return the number of messages in the restored tree, 0 if the tree
+             couldn't be restored
+    */
+   MsgnoType Restore(const ThreadParams& thrParams,
+                     const HeaderInfoList *hil,
+                     ThreadData *thrData) const;
+
+   /**
+     Remember the tree built for the messages of the given listing.
+
+     @param thrParams the threading parameters which were used
+     @param hil the listing of the folder
+     @param thrData the thread data containing the tree
+    */
+   void Store(const ThreadParams& thrParams,
+              const HeaderInfoList *hil,
+              const ThreadData *thrData);
+
+   /// delete the cache file for the given folder if it exists
+   static void Remove(const String& folderName);
+
+private:
+   // the structures describing the file format
+   struct FileHeader;
+
+   // a node of the tree as stored in the file
+   struct Node
+   {
+      // the 1-based index of the message in m_uids or 0 for a dummy node
+      wxUint32 num;
+
+      // the depth of the node in the tree, 0 for the roots
+      wxUint32 depth;
+   };
+
+   // get the full name of the cache file for the given folder
+   static String GetCacheFileName(const String& folderName);
+
+   // forget all the data we have
+   void Clear();
+
+
+   // the name of the folder and its cache file
+   const String m_folderName,
+                m_filename;
+
+   // the UIDVALIDITY of the folder
+   const UIdType m_uidValidity;
+
+   // the hash of the parameters used to build the tree
+   wxUint32 m_hashParams;
+
+   // the UIDs of the messages in the tree in msgno order
+   std::vector<wxUint32> m_uids;
+
+   // the nodes of the tree in pre-order
+   std::vector<Node> m_nodes;
+
+   // true if anything was changed since the last Load() or Save()
+   bool m_modified;
+
+   DECLARE_NO_COPY_CLASS(ThreadCache)
+};
+
+#endif // _MAIL_THREADCACHE_H_
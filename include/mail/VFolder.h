@@ -97,6 +97,8 @@ public:
 
    virtual bool AppendMessage(const String& msg);
 
+   virtual bool AppendMessages(const RawMessages& msgs);
+
    virtual void ExpungeMessages();
 
    virtual MsgnoArray *SearchByFlag(MessageStatus flag,
@@ -194,7 +196,7 @@ protected:
 
    WX_DEFINE_ARRAY(Msg *, MsgArray);
 
-   /// the array of messages in the folder
+   /// the array of messages in the folder, always sorted by their uidVirt
    MsgArray m_messages;
 
    /// All physical folders our messages belong to.
@@ -236,7 +238,10 @@ protected:
    /// get the Msg corresponding to the given UID or NULL
    Msg *GetMsgFromUID(UIdType uid) const;
 
-   /// add a new message (takes ownership of it)
+   /// get the index in m_messages of the message with this UID or -1
+   size_t GetIndexFromUID(UIdType uid) const;
+
+   /// add a new message (takes ownership of it), its UID must be the biggest
    void AddMsg(Msg *msg);
 
    /// the opaque type used by GetFirst/NextMsg() and DeleteMsg()
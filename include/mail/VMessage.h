@@ -105,6 +105,9 @@ public:
    virtual bool WriteToString(String& str, bool headerFlag = true) const
       { return m_message->WriteToString(str, headerFlag); }
 
+   virtual bool WriteToBuffer(wxCharBuffer& buf) const
+      { return m_message->WriteToBuffer(buf); }
+
    //@}
 
 private:
@@ -100,6 +100,7 @@ typedef struct imap_local {
   char *reform;			/* reformed sequence */
   char tmp[IMAPTMPLEN];		/* temporary buffer */
   SEARCHSET *lookahead;		/* fetch lookahead */
+  char idletag[10];		/* tag of IDLE in progress or empty */
 } IMAPLOCAL;
 
 
@@ -2358,6 +2359,100 @@ long imap_ping (MAILSTREAM *stream)
 	  imap_OK (stream,imap_send (stream,"NOOP",NIL))) ? T : NIL;
 }
 
+/* IMAP start idling
+ * Accepts: MAIL stream
+ * Returns: T if server is now idling, NIL if failure or IDLE not supported
+ *
+ * While idling, the server sends untagged responses about the mailbox
+ * changes as they happen and they must be processed with imap_idle_read().
+ * Sending any other command terminates IDLE automatically.
+ */
+
+long imap_idle (MAILSTREAM *stream)
+{
+  IMAPPARSEDREPLY *reply;
+  char tag[10];
+  if (!LOCAL->netstream || !LEVELIDLE (stream)) return NIL;
+  if (LOCAL->idletag[0]) return T;
+				/* the tag imap_send() is going to use */
+  sprintf (tag,"%08lx",0xffffffff & stream->gensym);
+  reply = imap_send (stream,"IDLE",NIL);
+  if (!strcmp (reply->tag,"+")) {
+    strcpy (LOCAL->idletag,tag);/* server is idling now */
+    return T;
+  }
+  if (!imap_OK (stream,reply)) mm_log (reply->text,WARN);
+  return NIL;
+}
+
+
+/* IMAP read response while idling
+ * Accepts: MAIL stream
+ * Returns: T if still idling, NIL if IDLE terminated or connection lost
+ *
+ * Blocks until a response line is received, so should only be called when
+ * imap_idle_socket() reports that there is some input.
+ */
+
+long imap_idle_read (MAILSTREAM *stream)
+{
+  IMAPPARSEDREPLY *reply;
+  if (!LOCAL->netstream || !LOCAL->idletag[0]) return NIL;
+  if (reply = imap_parse_reply (stream,net_getline (LOCAL->netstream))) {
+    if (!strcmp (reply->tag,"*")) imap_parse_unsolicited (stream,reply);
+    else if (!compare_cstring (LOCAL->idletag,reply->tag)) {
+      LOCAL->idletag[0] = '\0';	/* server terminated IDLE itself */
+      if (!imap_OK (stream,reply)) mm_log (reply->text,WARN);
+      return NIL;
+    }
+    else {			/* report bogon */
+      sprintf (LOCAL->tmp,"Unexpected response while idling: %.80s %.80s",
+	       (char *) reply->tag,(char *) reply->text);
+      mm_notify (stream,LOCAL->tmp,WARN);
+      stream->unhealthy = T;
+    }
+  }
+  if (LOCAL->netstream) return T;
+  LOCAL->idletag[0] = '\0';	/* connection lost */
+  return NIL;
+}
+
+
+/* IMAP stop idling
+ * Accepts: MAIL stream
+ * Returns: T if successful, NIL if failure
+ */
+
+long imap_idle_done (MAILSTREAM *stream)
+{
+  IMAPPARSEDREPLY *reply;
+  char tag[10];
+  if (!LOCAL->idletag[0]) return T;
+  strcpy (tag,LOCAL->idletag);	/* no longer idling in any case */
+  LOCAL->idletag[0] = '\0';
+  if (!LOCAL->netstream) return NIL;
+  if (!imap_soutr (stream,"DONE"))
+    reply = imap_fake (stream,tag,"[CLOSED] IMAP connection broken (command)");
+  else reply = imap_reply (stream,tag);
+  if (imap_OK (stream,reply)) return T;
+  mm_log (reply->text,WARN);
+  return NIL;
+}
+
+
+/* IMAP get input socket of idling stream
+ * Accepts: MAIL stream
+ *	    pointer to return flag set if input is already buffered
+ * Returns: socket which becomes readable when server sends something, or -1
+ */
+
+int imap_idle_socket (MAILSTREAM *stream,long *pending)
+{
+  *pending = NIL;
+  return (LOCAL->netstream && LOCAL->idletag[0]) ?
+    net_socket (LOCAL->netstream,pending) : -1;
+}
+
 
 /* IMAP check mailbox
  * Accepts: MAIL stream
@@ -2909,6 +3004,8 @@ IMAPPARSEDREPLY *imap_send (MAILSTREAM *stream,char *cmd,IMAPARG *args[])
   size_t i;
   void *a;
   char c,*s,*t,tag[10];
+				/* can't send anything else while idling */
+  if (LOCAL->idletag[0]) imap_idle_done (stream);
   stream->unhealthy = NIL;	/* make stream healthy again */
   				/* gensym a new tag */
   sprintf (tag,"%08lx",0xffffffff & (stream->gensym++));
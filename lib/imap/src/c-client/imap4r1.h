@@ -267,6 +267,10 @@ IMAPCAP *imap_cap (MAILSTREAM *stream);
 char *imap_host (MAILSTREAM *stream);
 long imap_cache (MAILSTREAM *stream,unsigned long msgno,char *seg,
 		 STRINGLIST *stl,SIZEDTEXT *text);
+long imap_idle (MAILSTREAM *stream);
+long imap_idle_read (MAILSTREAM *stream);
+long imap_idle_done (MAILSTREAM *stream);
+int imap_idle_socket (MAILSTREAM *stream,long *pending);
 
 
 /* Temporary */
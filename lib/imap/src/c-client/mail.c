@@ -6129,7 +6129,8 @@ static NETDRIVER tcpdriver = {
   tcp_host,			/* return host name */
   tcp_remotehost,		/* return remote host name */
   tcp_port,			/* return port number */
-  tcp_localhost			/* return local host name */
+  tcp_localhost,		/* return local host name */
+  tcp_socket			/* return input socket */
 };
 
 
@@ -6329,3 +6330,17 @@ char *net_localhost (NETSTREAM *stream)
 {
   return (*stream->dtb->localhost) (stream->stream);
 }
+
+
+/* Network get input socket
+ * Accepts: Network stream
+ *	    pointer to return flag set if input is already buffered
+ * Returns: socket which becomes readable when input arrives, or -1
+ */
+
+int net_socket (NETSTREAM *stream,long *pending)
+{
+  *pending = NIL;
+  return stream->dtb->socket ? (*stream->dtb->socket) (stream->stream,pending)
+    : -1;
+}
@@ -1189,6 +1189,7 @@ NETDRIVER {
   char *(*remotehost) (void *stream);
   unsigned long (*port) (void *stream);
   char *(*localhost) (void *stream);
+  int (*socket) (void *stream,long *pending);
 };
 
 
@@ -1815,6 +1816,7 @@ char *net_host (NETSTREAM *stream);
 char *net_remotehost (NETSTREAM *stream);
 unsigned long net_port (NETSTREAM *stream);
 char *net_localhost (NETSTREAM *stream);
+int net_socket (NETSTREAM *stream,long *pending);
 
 long sm_subscribe (char *mailbox);
 long sm_unsubscribe (char *mailbox);
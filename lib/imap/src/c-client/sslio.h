@@ -40,6 +40,7 @@ struct ssl_driver {		/* must parallel NETDRIVER in mail.h */
   char *(*remotehost) (SSLSTREAM *stream);
   unsigned long (*port) (SSLSTREAM *stream);
   char *(*localhost) (SSLSTREAM *stream);
+  int (*socket) (SSLSTREAM *stream,long *pending);
 };
 
 
@@ -67,4 +68,5 @@ char *ssl_host (SSLSTREAM *stream);
 char *ssl_remotehost (SSLSTREAM *stream);
 unsigned long ssl_port (SSLSTREAM *stream);
 char *ssl_localhost (SSLSTREAM *stream);
+int ssl_socket (SSLSTREAM *stream,long *pending);
 long ssl_server_input_wait (long seconds);
@@ -49,6 +49,7 @@ char *tcp_host (TCPSTREAM *stream);
 char *tcp_remotehost (TCPSTREAM *stream);
 unsigned long tcp_port (TCPSTREAM *stream);
 char *tcp_localhost (TCPSTREAM *stream);
+int tcp_socket (TCPSTREAM *stream,long *pending);
 char *tcp_clientaddr (void);
 char *tcp_clienthost (void);
 long tcp_clientport (void);
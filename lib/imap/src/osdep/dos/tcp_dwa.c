@@ -323,6 +323,19 @@ char *tcp_localhost (TCPSTREAM *stream)
 }
 
 
+/* TCP/IP get input socket
+ * Accepts: TCP/IP stream
+ *	    pointer to return flag set if input is already buffered
+ * Returns: -1 since not supported on this platform
+ */
+
+int tcp_socket (TCPSTREAM *stream,long *pending)
+{
+  *pending = NIL;
+  return -1;
+}
+
+
 /* TCP/IP return canonical form of host name
  * Accepts: host name
  * Returns: canonical form of host name
@@ -623,6 +623,19 @@ char *tcp_localhost (TCPSTREAM *stream)
   }
   return stream->localhost;	/* return local host name */
 }
+
+
+/* TCP/IP get input socket
+ * Accepts: TCP/IP stream
+ *	    pointer to return flag set if input is already buffered
+ * Returns: input socket
+ */
+
+int tcp_socket (TCPSTREAM *stream,long *pending)
+{
+  *pending = (stream->ictr > 0) ? T : NIL;
+  return (int) stream->tcpsi;
+}
 
 /* TCP/IP get client host address (server calls only)
  * Returns: client host address
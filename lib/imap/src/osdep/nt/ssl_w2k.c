@@ -75,7 +75,8 @@ static struct ssl_driver ssldriver = {
   ssl_host,			/* return host name */
   ssl_remotehost,		/* return remote host name */
   ssl_port,			/* return port number */
-  ssl_localhost			/* return local host name */
+  ssl_localhost,		/* return local host name */
+  ssl_socket			/* return input socket */
 };
 
 static unsigned long ssltsz = 0;/* SSL maximum token length */
@@ -680,4 +681,19 @@ char *ssl_localhost (SSLSTREAM *stream)
   return tcp_localhost (stream->tcpstream);
 }
 
+
+/* SSL get input socket
+ * Accepts: SSL stream
+ *	    pointer to return flag set if input is already buffered
+ * Returns: input socket
+ */
+
+int ssl_socket (SSLSTREAM *stream,long *pending)
+{
+  long tcppending;
+  int sock = tcp_socket (stream->tcpstream,&tcppending);
+  *pending = (stream->ictr > 0) ? T : NIL;
+  return sock;
+}
+
 #include "ssl_none.c"		/* currently no server support */
@@ -332,6 +332,19 @@ char *tcp_localhost (TCPSTREAM *stream)
 {
   return stream->localhost;	/* return local host name */
 }
+
+
+/* TCP/IP get input socket
+ * Accepts: TCP/IP stream
+ *	    pointer to return flag set if input is already buffered
+ * Returns: -1 since not supported on this platform
+ */
+
+int tcp_socket (TCPSTREAM *stream,long *pending)
+{
+  *pending = NIL;
+  return -1;
+}
 
 /* Return my local host name
  * Returns: my local host name
@@ -30,10 +30,20 @@
 #endif // USE_PCH
 
 #include <wx/filefn.h>        // for wxMkdir
+#include <wx/file.h>
+#include <wx/filename.h>
 #include <wx/textfile.h>
 
 #include "CacheFile.h"
 
+#ifdef OS_UNIX
+#  include <sys/types.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif // OS_UNIX
+
 // ============================================================================
 // implementation
 // ============================================================================
@@ -51,6 +61,60 @@ String CacheFile::GetCacheDirName()
    return dirname;
 }
 
+/* static */
+String CacheFile::GetFolderCacheFileName(const String& subdir,
+                                         const String& folderName)
+{
+   // we can't just replace the slashes with something else as this would map
+   // "a/b" and "a_b" to the same file, so escape all characters which can't
+   // be used in the file names (and the escape character itself) as "%XX"
+   // instead, this is unambiguous
+   String folderNameFixed;
+   folderNameFixed.reserve(folderName.length());
+   for ( String::const_iterator i = folderName.begin();
+         i != folderName.end();
+         ++i )
+   {
+      const wxChar ch = *i;
+
+      // also escape the leading dot to avoid creating hidden files (or,
+      // worse, using "." or ".." as file name)
+      if ( ch < _T(' ') || wxStrchr(_T("%/\\:*?\"<>|"), ch) ||
+            (ch == _T('.') && i == folderName.begin()) )
+      {
+         folderNameFixed += String::Format(_T("%%%02X"), (unsigned)ch);
+      }
+      else
+      {
+         folderNameFixed += ch;
+      }
+   }
+
+   String filename;
+   filename << GetCacheDirName() << DIR_SEPARATOR
+            << subdir << DIR_SEPARATOR << folderNameFixed;
+
+   return filename;
+}
+
+/* static */
+bool CacheFile::CreateDirFor(const String& filename)
+{
+   const String dirname = wxFileName(filename).GetPath();
+   if ( wxDirExists(dirname) )
+      return true;
+
+   if ( !wxFileName::Mkdir(dirname, 0700, wxPATH_MKDIR_FULL) )
+   {
+      wxLogDebug(_T("Failed to create the cache directory \"%s\""),
+                 dirname.c_str());
+
+      return false;
+   }
+
+   return true;
+}
+
 // ----------------------------------------------------------------------------
 // version checking
 // ----------------------------------------------------------------------------
@@ -225,3 +289,83 @@ bool CacheFile::Load()
    return ok;
 }
 
+
+// ============================================================================
+// CacheFileData implementation
+// ============================================================================
+
+bool CacheFileData::Load(const String& filename)
+{
+   Free();
+
+   if ( !wxFileExists(filename) )
+      return false;
+
+   size_t size = 0;
+
+#ifdef OS_UNIX
+   int fd = open(filename.fn_str(), O_RDONLY);
+   if ( fd != -1 )
+   {
+      struct stat st;
+      if ( fstat(fd, &st) == 0 && st.st_size > 0 )
+      {
+         size = st.st_size;
+
+         void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+         if ( p != MAP_FAILED )
+         {
+            m_data = static_cast<const char *>(p);
+            m_isMapped = true;
+         }
+      }
+
+      close(fd);
+   }
+#endif // OS_UNIX
+
+   if ( !m_data )
+   {
+      // fall back to just reading the file in memory
+      wxFile file;
+      if ( !file.Open(filename) )
+         return false;
+
+      wxFileOffset len = file.Length();
+      if ( len <= 0 )
+         return false;
+
+      size = static_cast<size_t>(len);
+
+      char *buf = new char[size];
+      if ( file.Read(buf, size) != (ssize_t)size )
+      {
+         delete [] buf;
+         return false;
+      }
+
+      m_data = buf;
+   }
+
+   m_size = size;
+
+   return true;
+}
+
+void CacheFileData::Free()
+{
+   if ( m_data )
+   {
+#ifdef OS_UNIX
+      if ( m_isMapped )
+         munmap(const_cast<char *>(m_data), m_size);
+      else
+#endif // OS_UNIX
+         delete [] m_data;
+
+      m_data = NULL;
+   }
+
+   m_size = 0;
+   m_isMapped = false;
+}
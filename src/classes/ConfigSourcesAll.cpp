@@ -150,6 +150,9 @@ public:
       else
          path << m_path << _T('/') << key;
 
+      // this bypasses AllConfigSources::DeleteEntry() which does it normally
+      Profile::InvalidateCache();
+
       // we need to delete all these entries
       bool foundAny = false;
       for ( ;; )
@@ -173,6 +176,8 @@ public:
    {
       const wxString path = MakeFullPath(key);
 
+      Profile::InvalidateCache();
+
       bool foundAny = false;
       for ( ;; )
       {
@@ -476,6 +481,9 @@ AllConfigSources::Write(const String& path,
    }
 
 
+   // the values cached by the profiles may be not valid any more
+   Profile::InvalidateCache();
+
    // finally do write it
    return data.GetType() == LookupData::LD_LONG
             ? config->Write(fullpath, data.GetLong())
@@ -519,6 +527,8 @@ AllConfigSources::CopyGroup(ConfigSource *config,
 bool
 AllConfigSources::CopyGroup(const String& pathSrc, const String& pathDst)
 {
+   Profile::InvalidateCache();
+
    bool rc = true;
 
    const List::iterator end = m_sources.end();
@@ -599,6 +609,8 @@ bool AllConfigSources::FlushAll()
 
 bool AllConfigSources::Rename(const String& pathOld, const String& nameNew)
 {
+   Profile::InvalidateCache();
+
    bool rc = true;
    size_t numRenamed = 0;
 
@@ -632,6 +644,8 @@ bool AllConfigSources::Rename(const String& pathOld, const String& nameNew)
 
 bool AllConfigSources::DeleteEntry(const String& path)
 {
+   Profile::InvalidateCache();
+
    bool rc = true;
 
    String parent = path.BeforeLast(_T('/')),
@@ -661,6 +675,8 @@ bool AllConfigSources::DeleteEntry(const String& path)
 
 bool AllConfigSources::DeleteGroup(const String& path)
 {
+   Profile::InvalidateCache();
+
    bool rc = true;
 
    String parent = path.BeforeLast(_T('/')),
@@ -36,12 +36,19 @@
 #include "lists.h"
 #include "MFolder.h"
 #include "MailFolder.h"
+#include "MailFolderCC.h"       // for StatusCheck
 #include "NewMailNotifier.h"
 
 #include "FolderMonitor.h"
 
 #include "gui/wxMDialogs.h"      // MDialog_YesNoDialog
 
+#include <wx/stopwatch.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
 class MOption;
 
 // ----------------------------------------------------------------------------
@@ -49,6 +56,7 @@ class MOption;
 // ----------------------------------------------------------------------------
 
 extern const MOption MP_COLLECTATSTARTUP;
+extern const MOption MP_IMAP_IDLE;
 extern const MOption MP_POLL_OPENED_ONLY;
 extern const MOption MP_POLLINCOMINGDELAY;
 
@@ -65,6 +73,16 @@ extern const MPersMsgBox *M_MSGBOX_SUSPENDAUTOCOLLECT;
 // the number of times we try to open an unaccessible folder before giving up
 static const int MC_MAX_FAIL = 5;
 
+// the maximal time (in ms) to spend checking the folders during one
+// non-interactive CheckNewMail() call, the folders not checked yet when it
+// expires are checked during the next one
+static const long MC_MAX_CHECK_TIME = 5000;
+
+// the maximal number of threads checking the folders status at once and the
+// maximal number of them checking the folders on the same server
+static const size_t MC_MAX_CHECK_THREADS = 8;
+static const size_t MC_MAX_CHECKS_PER_SERVER = 2;
+
 // trace mask
 #define TRACE_MONITOR _T("monitor")
 
@@ -136,6 +154,20 @@ public:
    MFolder *GetFolder() const { return m_folder; } // NOT IncRef()'d!
    String GetName() const { return m_folder->GetFullName(); }
 
+   // get the string identifying the server of this folder, empty for all
+   // local folders
+   String GetServerKey() const
+   {
+      String key;
+      if ( m_folder->NeedsNetwork() )
+      {
+         key << (int)m_folder->GetType() << _T(':')
+             << m_folder->GetLogin() << _T('@') << m_folder->GetServer();
+      }
+
+      return key;
+   }
+
    // state
    void SetState(FolderState state) { m_state = state; }
    FolderState GetState() const { return m_state; }
@@ -184,6 +216,181 @@ private:
 // declare a list (owning the objects in it) of FolderMonitorFolderEntries
 M_LIST_OWN(FolderMonitorFolderList, FolderMonitorFolderEntry);
 
+// ----------------------------------------------------------------------------
+// FolderMonitorScheduler determines the order in which the folders are checked
+// ----------------------------------------------------------------------------
+
+// we avoid checking all folders on the same (maybe slow or not responding)
+// server before the other ones: this class groups the folders by server and
+// returns one folder of each server in turn, starting with the ones which
+// have been waiting for the check for the longest time
+class FolderMonitorScheduler
+{
+public:
+   FolderMonitorScheduler() { m_current = 0; }
+
+   // add a folder to check
+   void Add(FolderMonitorFolderEntry *entry)
+   {
+      const String key = entry->GetServerKey();
+
+      size_t n;
+      const size_t count = m_servers.size();
+      for ( n = 0; n < count; n++ )
+      {
+         if ( m_servers[n] == key )
+            break;
+      }
+
+      if ( n == count )
+      {
+         m_servers.push_back(key);
+         m_queues.push_back(Queue());
+      }
+
+      // keep the queue sorted by the check time
+      Queue& queue = m_queues[n];
+      Queue::iterator i;
+      for ( i = queue.begin(); i != queue.end(); ++i )
+      {
+         if ( (*i)->GetCheckTime() > entry->GetCheckTime() )
+            break;
+      }
+
+      queue.insert(i, entry);
+   }
+
+   // get the next folder to check or NULL if there are no more
+   FolderMonitorFolderEntry *GetNext()
+   {
+      const size_t count = m_queues.size();
+      for ( size_t n = 0; n < count; n++ )
+      {
+         Queue& queue = m_queues[m_current];
+         m_current = (m_current + 1) % count;
+
+         if ( !queue.empty() )
+         {
+            FolderMonitorFolderEntry * const entry = queue.front();
+            queue.pop_front();
+
+            return entry;
+         }
+      }
+
+      return NULL;
+   }
+
+   // get the number of different servers
+   size_t GetServerCount() const { return m_servers.size(); }
+
+private:
+   typedef std::deque<FolderMonitorFolderEntry *> Queue;
+
+   // the server keys and the folders to check on each of them
+   std::vector<String> m_servers;
+   std::vector<Queue> m_queues;
+
+   // the index of the queue to take the next folder from
+   size_t m_current;
+};
+
+// ----------------------------------------------------------------------------
+// FolderStatusChecker checks the status of several folders at once
+// ----------------------------------------------------------------------------
+
+// MailFolder::CheckFolder() may ask the user for the password, processes the
+// new mail (i.e. filters and notifies about it) and pings the opened folders,
+// so it must be called from the main thread. But for a not opened remote
+// folder it mostly waits for the server to answer mail_status(): this class
+// executes these calls in a bounded pool of threads, with only a few of them
+// using the same server, while the rest of the check is still done in the
+// main thread by MailFolderCC::PrepareStatusCheck() and FinishStatusCheck()
+class FolderStatusChecker
+{
+public:
+   // the check of one folder
+   struct Job
+   {
+      Job(FolderMonitorFolderEntry *entry_)
+         : entry(entry_),
+           server(entry_->GetServerKey()),
+           check(entry_->GetFolder())
+      {
+      }
+
+      FolderMonitorFolderEntry * const entry;
+      const String server;
+      MailFolderCC::StatusCheck check;
+   };
+
+   FolderStatusChecker();
+
+   // cancels the checks not started yet and waits for the running ones
+   ~FolderStatusChecker();
+
+   // can the folder of this entry be checked by us?
+   static bool CanCheck(FolderMonitorFolderEntry *entry);
+
+   // queue the check of the folder of this entry
+   void Add(FolderMonitorFolderEntry *entry);
+
+   // get the next completed check, waiting until there is one if necessary,
+   // returns NULL once all of them were returned (the caller must delete it)
+   Job *GetNext();
+
+   // don't start the checks which are still queued
+   void CancelQueued();
+
+private:
+   // a thread executing the checks
+   class Thread : public wxThread
+   {
+   public:
+      Thread(FolderStatusChecker *checker)
+         : wxThread(wxTHREAD_JOINABLE), m_checker(checker) { }
+
+   protected:
+      virtual void *Entry();
+
+   private:
+      FolderStatusChecker * const m_checker;
+   };
+
+   // called by the threads to get the next check to execute, returns NULL if
+   // they should terminate
+   Job *Take();
+
+   // called by the threads when the check is done
+   void Done(Job *job);
+
+
+   // the mutex protecting all the fields below and the condition signaled
+   // when any of them changes
+   wxMutex m_mutex;
+   wxCondition m_cond;
+
+   // the checks not started yet
+   std::deque<Job *> m_queue;
+
+   // the completed checks not returned by GetNext() yet
+   std::deque<Job *> m_done;
+
+   // the number of running checks for each server
+   std::map<String, size_t> m_running;
+
+   // the total number of running checks
+   size_t m_nRunning;
+
+   // set when the threads should terminate as soon as the queue is empty
+   bool m_finishing;
+
+   // the threads, only used by the main thread
+   std::vector<Thread *> m_threads;
+
+   DECLARE_NO_COPY_CLASS(FolderStatusChecker)
+};
+
 // ----------------------------------------------------------------------------
 // FolderMonitorTraversal used by FolderMonitor to find all incoming folders
 // ----------------------------------------------------------------------------
@@ -249,6 +456,12 @@ protected:
    bool CheckOneFolder(FolderMonitorFolderEntry *i,
                        MProgressInfo *progInfo);
 
+   /// return false if this folder shouldn't be checked now
+   bool ShouldCheckFolder(FolderMonitorFolderEntry *i);
+
+   /// update the folder state after checking it, return ok
+   bool OnFolderChecked(FolderMonitorFolderEntry *i, bool ok);
+
    /// return true if we already have this folder in the incoming list
    bool IsBeingMonitored(const MFolder *folder) const;
 
@@ -338,6 +551,15 @@ FolderMonitorImpl::~FolderMonitorImpl(void)
 void
 FolderMonitorImpl::BuildList(void)
 {
+   // the options affecting the folders might have changed, so stop watching
+   // them, they will be watched again after being checked if still needed
+   for ( FolderMonitorFolderList::iterator i = m_list.begin();
+         i != m_list.end();
+         ++i )
+   {
+      MailFolder::UnwatchFolder(i->GetName());
+   }
+
    m_list.clear();
 
    FolderMonitorTraversal t(m_list);
@@ -427,6 +649,8 @@ FolderMonitorImpl::RemoveFolder(const String& name)
    {
       if ( i->GetFolder()->GetFullName() == name )
       {
+         MailFolder::UnwatchFolder(name);
+
          m_list.erase(i);
 
          return true;
@@ -436,6 +660,230 @@ FolderMonitorImpl::RemoveFolder(const String& name)
    return false;
 }
 
+// ----------------------------------------------------------------------------
+// FolderStatusChecker
+// ----------------------------------------------------------------------------
+
+FolderStatusChecker::FolderStatusChecker()
+                   : m_cond(m_mutex)
+{
+   m_nRunning = 0;
+   m_finishing = false;
+}
+
+FolderStatusChecker::~FolderStatusChecker()
+{
+   CancelQueued();
+
+   if ( !m_threads.empty() )
+   {
+      // the threads may need c-client lock to terminate
+      MailFolderCC::UnlockCClient();
+      for ( size_t n = 0; n < m_threads.size(); n++ )
+      {
+         m_threads[n]->Wait();
+         delete m_threads[n];
+      }
+      MailFolderCC::LockCClient();
+
+      MailFolderCC::DisableWorkerThreads();
+   }
+
+   while ( !m_done.empty() )
+   {
+      delete m_done.front();
+      m_done.pop_front();
+   }
+}
+
+/* static */
+bool FolderStatusChecker::CanCheck(FolderMonitorFolderEntry *entry)
+{
+   // the other folders are checked without mail_status() or must be pinged
+   // if they're opened
+   const MFolder *folder = entry->GetFolder();
+   switch ( folder->GetType() )
+   {
+      case MF_IMAP:
+      case MF_NNTP:
+         break;
+
+      default:
+         return false;
+   }
+
+   MailFolder *mf = MailFolder::GetOpenedFolderFor(folder);
+   if ( mf )
+   {
+      mf->DecRef();
+      return false;
+   }
+
+   // we'd deadlock if a thread needed the stream we're using
+   return !MailFolderCC::IsUsingStream();
+}
+
+void FolderStatusChecker::Add(FolderMonitorFolderEntry *entry)
+{
+   CHECK_RET( wxThread::IsMain(), _T("must be called from the main thread") );
+
+   Job *job = new Job(entry);
+   MailFolderCC::PrepareStatusCheck(job->check);
+
+   size_t nJobs;
+   {
+      wxMutexLocker lock(m_mutex);
+      m_queue.push_back(job);
+      m_cond.Broadcast();
+
+      nJobs = m_queue.size() + m_nRunning;
+   }
+
+   // start another thread if all the existing ones are busy
+   if ( m_threads.size() < nJobs && m_threads.size() < MC_MAX_CHECK_THREADS )
+   {
+      if ( m_threads.empty() )
+         MailFolderCC::EnableWorkerThreads();
+
+      Thread *thread = new Thread(this);
+      if ( thread->Create() == wxTHREAD_NO_ERROR &&
+               thread->Run() == wxTHREAD_NO_ERROR )
+      {
+         m_threads.push_back(thread);
+      }
+      else
+      {
+         delete thread;
+
+         if ( m_threads.empty() )
+         {
+            MailFolderCC::DisableWorkerThreads();
+
+            // check the folder ourselves then
+            wxMutexLocker lock(m_mutex);
+            m_queue.pop_back();
+            m_done.push_back(job);
+            MailFolderCC::DoStatusCheck(job->check);
+         }
+      }
+   }
+}
+
+FolderStatusChecker::Job *FolderStatusChecker::GetNext()
+{
+   CHECK( wxThread::IsMain(), NULL, _T("must be called from the main thread") );
+
+   Job *job = NULL;
+
+   // the threads need c-client lock to do anything
+   MailFolderCC::UnlockCClient();
+   {
+      wxMutexLocker lock(m_mutex);
+
+      // there will be no more checks, let the threads terminate when the
+      // queue is empty
+      if ( !m_finishing )
+      {
+         m_finishing = true;
+         m_cond.Broadcast();
+      }
+
+      while ( m_done.empty() && (m_nRunning || !m_queue.empty()) )
+         m_cond.Wait();
+
+      if ( !m_done.empty() )
+      {
+         job = m_done.front();
+         m_done.pop_front();
+      }
+   }
+   MailFolderCC::LockCClient();
+
+   return job;
+}
+
+void FolderStatusChecker::CancelQueued()
+{
+   wxMutexLocker lock(m_mutex);
+
+   while ( !m_queue.empty() )
+   {
+      wxLogTrace(TRACE_MONITOR, _T("Postponing the check of '%s'."),
+                 m_queue.front()->entry->GetName().c_str());
+
+      delete m_queue.front();
+      m_queue.pop_front();
+   }
+
+   m_finishing = true;
+   m_cond.Broadcast();
+}
+
+FolderStatusChecker::Job *FolderStatusChecker::Take()
+{
+   wxMutexLocker lock(m_mutex);
+
+   for ( ;; )
+   {
+      // take the first check of a server which isn't used by too many
+      // threads already
+      for ( std::deque<Job *>::iterator i = m_queue.begin();
+            i != m_queue.end();
+            ++i )
+      {
+         Job * const job = *i;
+         size_t& running = m_running[job->server];
+         if ( running < MC_MAX_CHECKS_PER_SERVER )
+         {
+            running++;
+            m_nRunning++;
+            m_queue.erase(i);
+
+            return job;
+         }
+      }
+
+      if ( m_queue.empty() && m_finishing )
+         return NULL;
+
+      // wait until another check is done or added
+      m_cond.Wait();
+   }
+}
+
+void FolderStatusChecker::Done(Job *job)
+{
+   wxMutexLocker lock(m_mutex);
+
+   m_running[job->server]--;
+   m_nRunning--;
+   m_done.push_back(job);
+
+   m_cond.Broadcast();
+}
+
+void *FolderStatusChecker::Thread::Entry()
+{
+   Job *job;
+   while ( (job = m_checker->Take()) != NULL )
+   {
+      MailFolderCC::LockCClient();
+
+      wxStopWatch timer;
+      MailFolderCC::DoStatusCheck(job->check);
+
+      wxLogTrace(TRACE_MONITOR, _T("Checked status of '%s' in %ldms%s"),
+                 job->entry->GetName().c_str(), timer.Time(),
+                 job->check.ok ? _T("") : _T(" (failed)"));
+
+      MailFolderCC::UnlockCClient();
+
+      m_checker->Done(job);
+   }
+
+   return NULL;
+}
+
 // ----------------------------------------------------------------------------
 // FolderMonitorImpl worker function
 // ----------------------------------------------------------------------------
@@ -475,7 +923,8 @@ FolderMonitorImpl::CheckNewMail(int flags)
          rc = false;
    }
 
-   // check all incoming folders
+   // find all incoming folders to check
+   FolderMonitorScheduler scheduler;
    time_t timeCur = time(NULL);
    FolderMonitorFolderList::iterator i;
    for ( i = m_list.begin(); i != m_list.end(); ++i )
@@ -484,24 +933,86 @@ FolderMonitorImpl::CheckNewMail(int flags)
       // hasn't expired yet
       if ( (flags & Interactive) || (i->GetCheckTime() <= timeCur) )
       {
-         if ( !CheckOneFolder(*i, progInfo) )
-            rc = false;
-         // update the time of the next check only now, i.e. after CheckFolder() call
-         // as if it takes time longer than the check interval we might keep checking
-         // it all the time without doing anything else
-         i->UpdateCheckTime();
+         scheduler.Add(*i);
       }
       //else: don't check this folder yet
    }
 
+   // and check them: the status of the not opened remote folders is checked
+   // by the threads of the checker while we check the other ones
+   wxStopWatch timer;
+   size_t countChecked = 0;
+   FolderStatusChecker checker;
+   FolderMonitorFolderEntry *entry;
+   while ( (entry = scheduler.GetNext()) != NULL )
+   {
+      // don't block the program for too long when checking automatically,
+      // the remaining folders are still due and will be checked first the
+      // next time
+      if ( !(flags & Interactive) && timer.Time() > MC_MAX_CHECK_TIME )
+      {
+         wxLogTrace(TRACE_MONITOR,
+                    _T("Postponing the check of '%s' and other folders."),
+                    entry->GetName().c_str());
+         break;
+      }
+
+      if ( ShouldCheckFolder(entry) && FolderStatusChecker::CanCheck(entry) )
+      {
+         if ( progInfo )
+         {
+            progInfo->SetLabel(String::Format(_("Checking folder %s..."),
+                                              entry->GetName().c_str()));
+         }
+
+         checker.Add(entry);
+
+         // the time of the next check is updated when we get its result
+         continue;
+      }
+
+      if ( !CheckOneFolder(entry, progInfo) )
+         rc = false;
+
+      // update the time of the next check only now, i.e. after CheckFolder() call
+      // as if it takes time longer than the check interval we might keep checking
+      // it all the time without doing anything else
+      entry->UpdateCheckTime();
+
+      countChecked++;
+   }
+
+   // process the results of the status checks in this thread as it may
+   // notify the user about the new mail
+   FolderStatusChecker::Job *job;
+   while ( (job = checker.GetNext()) != NULL )
+   {
+      if ( !OnFolderChecked(job->entry,
+                            MailFolderCC::FinishStatusCheck(job->check)) )
+         rc = false;
+
+      job->entry->UpdateCheckTime();
+      delete job;
+
+      countChecked++;
+
+      // the running checks are still waited for but don't start the new ones
+      if ( !(flags & Interactive) && timer.Time() > MC_MAX_CHECK_TIME )
+         checker.CancelQueued();
+   }
+
+   wxLogTrace(TRACE_MONITOR, _T("Checked %lu folders on %lu servers in %ldms"),
+              (unsigned long)countChecked,
+              (unsigned long)scheduler.GetServerCount(),
+              timer.Time());
+
    delete progInfo;
 
    return rc;
 }
 
 bool
-FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
-                                  MProgressInfo *progInfo)
+FolderMonitorImpl::ShouldCheckFolder(FolderMonitorFolderEntry *i)
 {
    const MFolder *folder = i->GetFolder();
 
@@ -522,7 +1033,7 @@ FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
 
       case Folder_Unaccessible:
          // don't even try any more
-         return true;
+         return false;
 
       default:
          FAIL_MSG( _T("unknown folder state") );
@@ -543,7 +1054,7 @@ FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
       {
          wxLogTrace(TRACE_MONITOR, _T("Skipping not opened folder %s"),
                     folder->GetFullName().c_str());
-         return true;
+         return false;
       }
 
       mf->DecRef();
@@ -563,6 +1074,26 @@ FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
    }
 #endif // USE_DIALUP
 
+   // the folders watched by IDLE are checked as soon as they change
+   if ( MailFolder::IsWatched(folder->GetFullName()) )
+   {
+      wxLogTrace(TRACE_MONITOR, _T("Not polling watched folder '%s'."),
+                 i->GetName().c_str());
+      return false;
+   }
+
+   return true;
+}
+
+bool
+FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
+                                  MProgressInfo *progInfo)
+{
+   if ( !ShouldCheckFolder(i) )
+      return true;
+
+   const MFolder *folder = i->GetFolder();
+
    wxLogTrace(TRACE_MONITOR, _T("Checking for new mail in '%s'."),
               i->GetName().c_str());
 
@@ -573,9 +1104,23 @@ FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
                                         folder->GetFullName().c_str()));
    }
 
+   wxStopWatch timer;
+
    // don't show the dialogs in non-interactive mode
-   if ( !MailFolder::CheckFolder(folder,
-                                 progInfo ? progInfo->GetFrame() : NULL) )
+   const bool ok = MailFolder::CheckFolder(folder,
+                                           progInfo ? progInfo->GetFrame()
+                                                    : NULL);
+
+   wxLogTrace(TRACE_MONITOR, _T("Checked '%s' in %ldms%s"),
+              i->GetName().c_str(), timer.Time(), ok ? _T("") : _T(" (failed)"));
+
+   return OnFolderChecked(i, ok);
+}
+
+bool
+FolderMonitorImpl::OnFolderChecked(FolderMonitorFolderEntry *i, bool ok)
+{
+   if ( !ok )
    {
       if ( !i->IncreaseFailCount() )
       {
@@ -610,6 +1155,17 @@ FolderMonitorImpl::CheckOneFolder(FolderMonitorFolderEntry *i,
    // folders
    MEventManager::ForceDispatchPending();
 
+   // now that we know that the folder is accessible, try to watch it instead
+   // of polling it the next time: if this fails, we just continue polling
+   const MFolder *folder = i->GetFolder();
+   Profile_obj profile(folder->GetProfile());
+   if ( READ_CONFIG_BOOL(profile, MP_IMAP_IDLE) &&
+            MailFolder::WatchFolder(folder) )
+   {
+      wxLogTrace(TRACE_MONITOR, _T("Watching '%s' for changes."),
+                 i->GetName().c_str());
+   }
+
    return true;
 }
 
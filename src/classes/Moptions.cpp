@@ -258,6 +258,9 @@ const MOption MP_FOLDER_PASSWORD;
 const MOption MP_LOGLEVEL;
 const MOption MP_SHOWBUSY_DURING_SORT;
 const MOption MP_FOLDERPROGRESS_THRESHOLD;
+const MOption MP_USE_HEADER_CACHE;
+const MOption MP_USE_FULLTEXT_INDEX;
+const MOption MP_USE_THREAD_CACHE;
 const MOption MP_MESSAGEPROGRESS_THRESHOLD_SIZE;
 const MOption MP_MESSAGEPROGRESS_THRESHOLD_TIME;
 const MOption MP_DEFAULT_SAVE_PATH;
@@ -306,6 +309,8 @@ const MOption MP_FOLDER_COMMENT;
 const MOption MP_UPDATEINTERVAL;
 const MOption MP_FOLDER_CLOSE_DELAY;
 const MOption MP_CONN_CLOSE_DELAY;
+const MOption MP_CONN_POOL_SIZE;
+const MOption MP_ASYNC_FOLDER_OPS;
 const MOption MP_AUTOMATIC_WORDWRAP;
 const MOption MP_WRAP_QUOTED;
 const MOption MP_WRAPMARGIN;
@@ -395,6 +400,7 @@ const MOption MP_CHECK_ATTACHMENTS_REGEX;
 
 const MOption MP_MSGS_SERVER_SORT;
 const MOption MP_MSGS_SORTBY;
+const MOption MP_MSGS_SORT_PARALLEL_THRESHOLD;
 
 const MOption MP_MSGS_USE_THREADING;
 const MOption MP_MSGS_SERVER_THREAD;
@@ -454,8 +460,10 @@ const MOption MP_MAX_MESSAGE_SIZE;
 const MOption MP_MAX_HEADERS_NUM;
 const MOption MP_MAX_HEADERS_NUM_HARD;
 const MOption MP_SAFE_FILTERS;
+const MOption MP_SPAM_PARALLEL_THRESHOLD;
 
 const MOption MP_IMAP_LOOKAHEAD;
+const MOption MP_IMAP_IDLE;
 const MOption MP_TCP_OPENTIMEOUT;
 const MOption MP_TCP_READTIMEOUT;
 const MOption MP_TCP_WRITETIMEOUT;
@@ -492,6 +500,8 @@ const MOption MP_AWAY_REMEMBER;
 const MOption MP_AWAY_STATUS;
 const MOption MP_CREATE_INTERNAL_MESSAGE;
 const MOption MP_WHITE_LIST;
+const MOption MP_RBL_NAMESERVER;
+const MOption MP_RBL_TIMEOUT;
 
 const MOption MP_OPTION_SHOW_ORIGIN;
 const MOption MP_OPTION_ORIGIN_HERE;
@@ -681,6 +691,9 @@ static const MOptionData MOptions[] =
     DEFINE_OPTION(MP_LOGLEVEL),
     DEFINE_OPTION(MP_SHOWBUSY_DURING_SORT),
     DEFINE_OPTION(MP_FOLDERPROGRESS_THRESHOLD),
+    DEFINE_OPTION(MP_USE_HEADER_CACHE),
+    DEFINE_OPTION(MP_USE_FULLTEXT_INDEX),
+    DEFINE_OPTION(MP_USE_THREAD_CACHE),
     DEFINE_OPTION(MP_MESSAGEPROGRESS_THRESHOLD_SIZE),
     DEFINE_OPTION(MP_MESSAGEPROGRESS_THRESHOLD_TIME),
     DEFINE_OPTION(MP_DEFAULT_SAVE_PATH),
@@ -729,6 +742,8 @@ static const MOptionData MOptions[] =
     DEFINE_OPTION(MP_UPDATEINTERVAL),
     DEFINE_OPTION(MP_FOLDER_CLOSE_DELAY),
     DEFINE_OPTION(MP_CONN_CLOSE_DELAY),
+    DEFINE_OPTION(MP_CONN_POOL_SIZE),
+    DEFINE_OPTION(MP_ASYNC_FOLDER_OPS),
     DEFINE_OPTION(MP_AUTOMATIC_WORDWRAP),
     DEFINE_OPTION(MP_WRAP_QUOTED),
     DEFINE_OPTION(MP_WRAPMARGIN),
@@ -818,6 +833,7 @@ static const MOptionData MOptions[] =
 
     DEFINE_OPTION(MP_MSGS_SERVER_SORT),
     DEFINE_OPTION(MP_MSGS_SORTBY),
+    DEFINE_OPTION(MP_MSGS_SORT_PARALLEL_THRESHOLD),
 
     DEFINE_OPTION(MP_MSGS_USE_THREADING),
     DEFINE_OPTION(MP_MSGS_SERVER_THREAD),
@@ -875,7 +891,9 @@ static const MOptionData MOptions[] =
     DEFINE_OPTION(MP_MAX_HEADERS_NUM),
     DEFINE_OPTION(MP_MAX_HEADERS_NUM_HARD),
     DEFINE_OPTION(MP_SAFE_FILTERS),
+    DEFINE_OPTION(MP_SPAM_PARALLEL_THRESHOLD),
     DEFINE_OPTION(MP_IMAP_LOOKAHEAD),
+    DEFINE_OPTION(MP_IMAP_IDLE),
     DEFINE_OPTION(MP_TCP_OPENTIMEOUT),
     DEFINE_OPTION(MP_TCP_READTIMEOUT),
     DEFINE_OPTION(MP_TCP_WRITETIMEOUT),
@@ -911,6 +929,8 @@ static const MOptionData MOptions[] =
     DEFINE_OPTION(MP_AWAY_STATUS),
     DEFINE_OPTION(MP_CREATE_INTERNAL_MESSAGE),
     DEFINE_OPTION(MP_WHITE_LIST),
+    DEFINE_OPTION(MP_RBL_NAMESERVER),
+    DEFINE_OPTION(MP_RBL_TIMEOUT),
     DEFINE_OPTION(MP_OPTION_SHOW_ORIGIN),
     DEFINE_OPTION(MP_OPTION_ORIGIN_HERE),
     DEFINE_OPTION(MP_OPTION_ORIGIN_INHERITED),
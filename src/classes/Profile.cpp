@@ -34,6 +34,10 @@
 #endif // USE_PCH
 
 #include <wx/confbase.h>
+#include <wx/hashmap.h>
+#include <wx/atomic.h>
+#include <wx/thread.h>
+#include <wx/stopwatch.h>
 
 #include "lists.h"
 #include "pointers.h"
@@ -55,6 +59,11 @@ extern const MOption MP_CURRENT_IDENTITY;
 extern const MOption MP_PROFILE_IDENTITY;
 extern const MOption MP_PROFILE_TYPE;
 
+#ifdef DEBUG
+extern const MOption MP_DATE_FMT;
+extern const MOption MP_MSGS_SORTBY;
+#endif // DEBUG
+
 // ----------------------------------------------------------------------------
 // constants
 // ----------------------------------------------------------------------------
@@ -84,6 +93,22 @@ enum
 // private classes
 // ============================================================================
 
+/// the value of an entry cached by ProfileImpl::readEntry()
+struct ProfileCacheEntry
+{
+   /// the type of the value
+   LookupData::Type type;
+
+   /// where was the value found, Read_Default if it wasn't found at all
+   Profile::ReadResult found;
+
+   /// the value itself, only one of these fields is used depending on type
+   long valueLong;
+   String valueString;
+};
+
+WX_DECLARE_STRING_HASH_MAP(ProfileCacheEntry, ProfileCache);
+
 /**
    ProfileImpl class, managing configuration options on a per class basis.
    This class does essentially the same as the wxConfig class, but
@@ -156,6 +181,8 @@ public:
          ms_suspendCount++;
 
          m_wroteSuspended = false;
+
+         InvalidateCache();
       }
 
    /// Commit changes from suspended mode.
@@ -185,6 +212,7 @@ protected:
       {
          m_Suspended = 0;
          m_Identity = NULL;
+         m_cacheGeneration = ms_cacheGeneration;
       }
 
    /// Destructor, writes back those entries that got changed.
@@ -216,6 +244,9 @@ private:
    /// common part of all writeEntry() overloads
    bool DoWriteEntry(const LookupData& data);
 
+   /// readEntry() helper doing the real work without using the cache
+   bool DoReadEntry(LookupData &ld, int flags) const;
+
 
    /// suspend count: if positive, we're in suspend mode
    int m_Suspended;
@@ -226,9 +257,20 @@ private:
    /// Is this profile using a different Identity at present?
    ProfileImpl *m_Identity;
 
+   /// the values already read by readEntry()
+   mutable ProfileCache m_cache;
+
+   /// the generation of the config data m_cache contents corresponds to
+   mutable wxAtomicInt m_cacheGeneration;
+
    /// the count of all suspended profiles: if 0, nothing is suspended
    static size_t ms_suspendCount;
 
+   /// the generation of the config data, incremented when anything changes
+   static wxAtomicInt ms_cacheGeneration;
+
+   friend class Profile;
+
    MOBJECT_DEBUG(ProfileImpl)
 
    DECLARE_NO_COPY_CLASS(ProfileImpl)
@@ -237,6 +279,7 @@ private:
 };
 
 size_t ProfileImpl::ms_suspendCount = 0;
+wxAtomicInt ProfileImpl::ms_cacheGeneration = 0;
 
 //@}
 
@@ -550,6 +593,9 @@ Profile::CreateGlobalConfig(const String& filename)
 
    gs_allConfigSources = AllConfigSources::Init(filename);
 
+   // nothing could have been read without the config, forget it
+   InvalidateCache();
+
    Profile *p = ProfileImpl::CreateProfile(wxEmptyString,NULL);
    EnforcePolicy(p);
    return p;
@@ -562,6 +608,8 @@ Profile::DeleteGlobalConfig()
    {
       AllConfigSources::Cleanup();
       gs_allConfigSources = NULL;
+
+      InvalidateCache();
    }
 }
 
@@ -607,6 +655,11 @@ bool Profile::FlushAll()
    return gs_allConfigSources ? gs_allConfigSources->FlushAll() : true;
 }
 
+void Profile::InvalidateCache()
+{
+   wxAtomicInc(ProfileImpl::ms_cacheGeneration);
+}
+
 String Profile::ExpandEnvVarsIfNeeded(const String& val) const
 {
    String valExp = val;
@@ -654,6 +707,7 @@ ProfileImpl::ProfileImpl(const String & iName, Profile const *Parent)
       m_ProfileName << _T('/') << iName;
    m_Suspended = 0;
    m_Identity = NULL;
+   m_cacheGeneration = ms_cacheGeneration;
 
    String id = readEntry(GetOptionName(MP_PROFILE_IDENTITY),
                          GetStringDefault(MP_PROFILE_IDENTITY));
@@ -763,7 +817,12 @@ ProfileImpl::SetIdentity(const String & idName)
       ClearIdentity();
 
    if ( !idName.empty() )
+   {
       m_Identity = Identity::Create(idName);
+
+      // the identity only affects the values read from this profile
+      m_cache.clear();
+   }
 }
 
 void
@@ -775,6 +834,8 @@ ProfileImpl::ClearIdentity(void)
    {
       m_Identity->DecRef();
       m_Identity = NULL;
+
+      m_cache.clear();
    }
 }
 
@@ -859,9 +920,57 @@ int ProfileImpl::readEntryFromHere(const String& key, int defvalue) const
    return (int)ld.GetLong();
 }
 
-// the worker function which does all the work for both long and string data
 bool
 ProfileImpl::readEntry(LookupData &ld, int flags) const
+{
+   // the options are read very often, including from the code called for
+   // each message, and looking them up in all parent profiles is slow, so
+   // remember the values we had read until anything changes in the config
+   //
+   // the cache is not protected against concurrent access, so it's only used
+   // by the main thread, and only for the normal lookups
+   if ( flags != Lookup_All || !wxThread::IsMain() )
+      return DoReadEntry(ld, flags);
+
+   if ( m_cacheGeneration != ms_cacheGeneration )
+   {
+      m_cache.clear();
+      m_cacheGeneration = ms_cacheGeneration;
+   }
+
+   ProfileCache::const_iterator i = m_cache.find(ld.GetKey());
+   if ( i != m_cache.end() && i->second.type == ld.GetType() )
+   {
+      const ProfileCacheEntry& entry = i->second;
+      if ( entry.found == Profile::Read_Default )
+         return false;
+
+      if ( entry.type == LookupData::LD_LONG )
+         ld.SetResult(entry.valueLong);
+      else
+         ld.SetResult(entry.valueString);
+
+      ld.SetFound(entry.found);
+
+      return true;
+   }
+
+   const bool found = DoReadEntry(ld, flags);
+
+   ProfileCacheEntry& entry = m_cache[ld.GetKey()];
+   entry.type = ld.GetType();
+   entry.found = found ? ld.GetFound() : Profile::Read_Default;
+   if ( entry.type == LookupData::LD_LONG )
+      entry.valueLong = ld.GetLong();
+   else
+      entry.valueString = ld.GetString();
+
+   return found;
+}
+
+// the worker function which does all the work for both long and string data
+bool
+ProfileImpl::DoReadEntry(LookupData &ld, int flags) const
 {
    PCHECK();
 
@@ -1064,6 +1173,8 @@ ProfileImpl::Discard(void)
    ASSERT_MSG( ms_suspendCount > 0, _T("suspend count broken") );
 
    ms_suspendCount--;
+
+   InvalidateCache();
 }
 
 #ifdef DEBUG
@@ -1077,6 +1188,54 @@ ProfileImpl::DebugDump() const
                          MObjectRC::DebugDump().c_str(), m_ProfileName.c_str());
 }
 
+// measure how long READ_CONFIG() takes for a folder deep in the hierarchy with
+// and without the cached values, this is used from the debug menu
+void BenchmarkReadConfig()
+{
+   static const size_t BENCH_DEPTH = 5;
+   static const size_t BENCH_READS = 10000;
+
+   // MP_MSGS_SORTBY is set at the top of the hierarchy while MP_DATE_FMT is
+   // not set in it at all, so all its levels are looked at for both of them
+   const String root(_T("__BenchReadConfig__"));
+   String name = root;
+   for ( size_t n = 1; n < BENCH_DEPTH; n++ )
+      name << _T("/Level") << n;
+
+   {
+      Profile_obj profileTop(Profile::CreateProfile(root));
+      profileTop->writeEntry(GetOptionName(MP_MSGS_SORTBY), 1l);
+   }
+
+   Profile_obj profile(Profile::CreateProfile(name));
+
+   long times[2];
+   for ( size_t pass = 0; pass < WXSIZEOF(times); pass++ )
+   {
+      const bool useCache = pass == 0;
+
+      wxStopWatch sw;
+      for ( size_t n = 0; n < BENCH_READS; n++ )
+      {
+         if ( !useCache )
+            Profile::InvalidateCache();
+
+         (void)READ_CONFIG(profile, MP_MSGS_SORTBY);
+         (void)READ_CONFIG_TEXT(profile, MP_DATE_FMT);
+      }
+
+      times[pass] = sw.Time();
+   }
+
+   Profile_obj profileRoot(Profile::CreateProfile(wxEmptyString));
+   profileRoot->DeleteGroup(root);
+
+   wxLogMessage(_T("%lu READ_CONFIG() calls for a %lu levels deep folder took ")
+                _T("%ldms with cache and %ldms without it."),
+                (unsigned long)(2*BENCH_READS), (unsigned long)BENCH_DEPTH,
+                times[0], times[1]);
+}
+
 #endif // DEBUG
 
 
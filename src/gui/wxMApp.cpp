@@ -48,6 +48,7 @@
 
 #include <wx/fontmap.h>
 #include <wx/tokenzr.h>
+#include <wx/thread.h>        // for wxThread::IsMain()
 
 #include <wx/snglinst.h>
 
@@ -2771,6 +2772,11 @@ int g_busyCursorYield;
 
 extern void MBeginBusyCursor()
 {
+   // the operations executed in the background threads don't change the
+   // cursor, only the GUI thread can do it
+   if ( !wxThread::IsMain() )
+      return;
+
    ++g_busyCursorYield;
    wxBeginBusyCursor();
    --g_busyCursorYield;
@@ -2778,6 +2784,9 @@ extern void MBeginBusyCursor()
 
 extern void MEndBusyCursor()
 {
+   if ( !wxThread::IsMain() )
+      return;
+
    ++g_busyCursorYield;
    wxEndBusyCursor();
    --g_busyCursorYield;
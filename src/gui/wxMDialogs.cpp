@@ -59,6 +59,7 @@
 #include <wx/numdlg.h>
 #include <wx/statline.h>
 #include <wx/minifram.h>
+#include <wx/thread.h>
 #include <wx/fs_mem.h>
 #include <wx/html/htmlwin.h>
 
@@ -534,6 +535,14 @@ MDialog_ErrorMessage(const wxString& msg,
                      const wxString& title,
                      bool /* modal */)
 {
+   // we can't show any dialogs from the background threads, just log the
+   // message instead
+   if ( !wxThread::IsMain() )
+   {
+      wxLogError(_T("%s"), msg.c_str());
+      return;
+   }
+
    //MGuiLocker lock;
    CloseSplash();
    NoBusyCursor no;
@@ -600,6 +609,12 @@ MDialog_Message(const wxString& message,
    if ( wxPMessageBoxIsDisabled(configPath) )
       return true;
 
+   if ( !wxThread::IsMain() )
+   {
+      wxLogMessage(_T("%s"), message.c_str());
+      return true;
+   }
+
    CloseSplash();
    NoBusyCursor noBC;
 
@@ -645,6 +660,10 @@ MDlgResult MDialog_YesNoCancel(const wxString& message,
                                int flags,
                                const MPersMsgBox *persMsg)
 {
+   // nobody can answer the question in a background thread
+   if ( !wxThread::IsMain() )
+      return MDlg_Cancel;
+
    CloseSplash();
    NoBusyCursor noBC;
 
@@ -730,6 +749,11 @@ MDialog_YesNoDialog(const wxString& message,
          pathLocal = pathGlobal;
    }
 
+   // we can't ask the user from a background thread, so assume the answer
+   // is "no" which is always the safe choice
+   if ( !wxThread::IsMain() )
+      return false;
+
    NoBusyCursor noBC;
    CloseSplash();
 
@@ -3087,6 +3111,9 @@ bool MDialog_GetPassword(const wxString& folderName,
                          wxString *password,
                          wxWindow *parent)
 {
+   if ( !wxThread::IsMain() )
+      return false;
+
    MFolderPasswordDialog dlg(parent, folderName, username, password);
 
    return dlg.ShowModal() == wxID_OK;
@@ -3127,6 +3154,9 @@ bool MDialog_GetPassword(Protocol protocol,
                          wxString *username,
                          wxWindow *parent)
 {
+   if ( !wxThread::IsMain() )
+      return false;
+
    MSendPasswordDialog dlg(parent, server, protocol, username, password);
 
    return dlg.ShowModal() == wxID_OK;
@@ -57,6 +57,12 @@
 #undef HAS_DYNAMIC_MENU_SUPPORT
 
 #include "mail/FolderPool.h"
+#include "mail/ServerInfo.h"
+
+#include <wx/stopwatch.h>
+
+#include <deque>
+#include <vector>
 
 // ----------------------------------------------------------------------------
 // constants
@@ -75,7 +81,8 @@ enum
    WXMENU_DEBUG_SUSPEND,
    WXMENU_DEBUG_RESUME,
 #endif // wxHAS_POWER_EVENTS
-   WXMENU_DEBUG_VIEW_OPENED
+   WXMENU_DEBUG_VIEW_OPENED,
+   WXMENU_DEBUG_BENCH_CONFIG
 };
 
 #endif // DEBUG
@@ -300,20 +307,49 @@ private:
 // AsyncSearchData: data for one search operation
 // ----------------------------------------------------------------------------
 
+// the maximal number of folders searched at once in total and on the same
+// server: without background threads the search in each folder is done
+// synchronously, so don't start the next one before the results of the
+// previous one are shown
+static inline size_t GetSearchMaxActive()
+{
+   return ASMailFolder::RunsInBackground() ? 4 : 1;
+}
+
+static inline size_t GetSearchMaxActivePerServer()
+{
+   return ASMailFolder::RunsInBackground() ? 2 : 1;
+}
+
 class AsyncSearchData
 {
 public:
-   // default ctor
-   AsyncSearchData()
+   // create the search for all folders in crit.m_Folders, ContinueSearch()
+   // must be called to really start it
+   AsyncSearchData(const SearchCriterium& crit, wxFrame *frame, UserData ud)
+      : m_criterium(crit)
    {
+      m_frame = frame;
+      m_userData = ud;
+
       m_mfVirt = NULL;
 
       m_folderVirt = NULL;
 
       m_nMatchingMessages =
-      m_nMatchingFolders = 0;
+      m_nMatchingFolders =
+      m_nSearchedFolders =
+      m_nPending =
+      m_nextServer = 0;
+
+      m_viewShown = false;
 
-      m_allScheduled = false;
+      const wxArrayString& folderNames = crit.m_Folders;
+      const size_t count = folderNames.GetCount();
+      for ( size_t n = 0; n < count; n++ )
+      {
+         AddFolder(folderNames[n]);
+      }
    }
 
    ~AsyncSearchData()
@@ -325,22 +361,38 @@ public:
       }
    }
 
-   // add a record for another folder being searched
-   //
-   // NB: we take ownership of the mf pointer and will DecRef() it
-   bool AddSearchFolder(MailFolder *mf, Ticket t)
+   // start searching in as many folders as we can: the folders on different
+   // servers are taken in turn to avoid waiting for a slow server before
+   // searching anywhere else
+   void ContinueSearch()
    {
-      CHECK( mf && t != ILLEGAL_TICKET, false,
-             _T("invalid params in AsyncSearchData::AddSearchFolder") );
+      const size_t countServers = m_servers.size();
+      const size_t maxActive = GetSearchMaxActive(),
+                   maxActivePerServer = GetSearchMaxActivePerServer();
+      for ( size_t nSkipped = 0;
+            nSkipped < countServers &&
+               m_listSingleSearch.size() < maxActive; )
+      {
+         const size_t server = m_nextServer;
+         m_nextServer = (m_nextServer + 1) % countServers;
 
-      m_listSingleSearch.push_back(new SingleSearchData(t, mf));
+         ServerQueue& queue = m_servers[server];
+         if ( queue.pending.empty() ||
+               queue.active >= maxActivePerServer )
+         {
+            nSkipped++;
+            continue;
+         }
 
-      return true;
-   }
+         nSkipped = 0;
 
-   // tell us that AddSearchFolder() won't be called any more, must be called
-   // before the search results are shown!
-   void FinalizeSearch() { m_allScheduled = true; }
+         const String name = queue.pending.front();
+         queue.pending.pop_front();
+         m_nPending--;
+
+         StartFolderSearch(name, server);
+      }
+   }
 
    // process the search result if it concerns this search, in which case true
    // is returned (even if there were errors), otherwise return false to
@@ -354,6 +406,7 @@ public:
       {
          if ( i->GetTicket() == t )
          {
+            size_t nMatches = 0;
             if ( ((const ASMailFolder::ResultInt&)result).GetValue() )
             {
                const UIdArray *uidsMatching = result.GetSequence();
@@ -363,44 +416,27 @@ public:
                }
                else // have some messages to show
                {
-                  // create the virtual folder to show the results if not done
-                  // yet
-                  if ( GetResultsVFolder() )
-                  {
-                     const MailFolder *mf = i->GetMailFolder();
-
-                     // and append all matching messages to the results folder
-                     HeaderInfoList_obj hil(mf->GetHeaders());
-                     if ( hil )
-                     {
-                        size_t nMatches = 0;
-
-                        size_t count = uidsMatching->GetCount();
-                        for ( size_t n = 0; n < count; n++ )
-                        {
-                           Message_obj msg(mf->GetMessage((*uidsMatching)[n]));
-                           if ( msg )
-                           {
-                              m_mfVirt->AppendMessage(*msg.Get());
-
-                              nMatches++;
-                           }
-                        }
-
-                        if ( nMatches )
-                        {
-                           m_nMatchingMessages += nMatches;
-                           m_nMatchingFolders++;
-                        }
-                     }
-                  }
+                  nMatches = AddSearchResults(i->GetMailFolder(),
+                                              *uidsMatching);
                }
             }
             //else: nothing found at all in this folder, nothing to do
 
+            wxLogTrace(TRACE_SEARCH,
+                       _T("Searched \"%s\" in %ldms: %lu matches"),
+                       i->GetMailFolder()->GetName().c_str(),
+                       i->GetTime(),
+                       (unsigned long)nMatches);
+
+            m_nSearchedFolders++;
+            m_servers[i->GetServer()].active--;
+
             // we don't care about this one any more
             m_listSingleSearch.erase(i);
 
+            // the slot used by this folder is free now
+            ContinueSearch();
+
             // it was our result
             return true;
          }
@@ -413,18 +449,19 @@ public:
    // if we're still waiting for the completion of [another] search, return
    // false, otherwise return true
    bool IsSearchCompleted() const
-      { return m_allScheduled && m_listSingleSearch.empty(); }
+      { return !m_nPending && m_listSingleSearch.empty(); }
 
    // show the search results to the user
-   void ShowSearchResults(wxFrame *frame)
+   void ShowSearchResults()
    {
       ASSERT_MSG( IsSearchCompleted(), _T("shouldn't be called yet!") );
 
-      if ( m_folderVirt && m_nMatchingMessages )
-      {
-         OpenFolderViewFrame(m_folderVirt, frame);
+      wxLogTrace(TRACE_SEARCH, _T("Searched %lu folders in %ldms"),
+                 (unsigned long)m_nSearchedFolders, m_stopwatch.Time());
 
-         wxLogStatus(frame, _("Found %lu messages in %lu folders."),
+      if ( m_viewShown )
+      {
+         wxLogStatus(m_frame, _("Found %lu messages in %lu folders."),
                      (unsigned long)m_nMatchingMessages,
                      (unsigned long)m_nMatchingFolders);
 
@@ -436,7 +473,7 @@ public:
                _("No matching messages found.\n"
                "\n"
                "Would you like to search again?"),
-               frame,
+               m_frame,
                MDIALOG_YESNOTITLE,
                M_DLG_YES_DEFAULT,
                M_MSGBOX_SEARCH_AGAIN_IF_NO_MATCH
@@ -444,12 +481,135 @@ public:
          {
             wxCommandEvent event(wxEVT_COMMAND_MENU_SELECTED,
                                  WXMENU_FOLDER_SEARCH);
-            wxPostEvent(frame, event);
+            wxPostEvent(m_frame, event);
          }
       }
    }
 
 private:
+   // add the folder to the queue of the folders to search in
+   void AddFolder(const String& name)
+   {
+      MFolder_obj folder(name);
+      if ( !folder )
+      {
+         wxLogError(_("Can't search for messages in a "
+                      "non existent folder '%s'."),
+                    name.c_str());
+         return;
+      }
+
+      if ( !folder->CanOpen() )
+      {
+         // silently skip this one
+         return;
+      }
+
+      String key;
+      if ( folder->NeedsNetwork() )
+      {
+         key << (int)folder->GetType() << _T(':')
+             << folder->GetLogin() << _T('@') << folder->GetServer();
+      }
+
+      size_t n;
+      const size_t count = m_servers.size();
+      for ( n = 0; n < count; n++ )
+      {
+         if ( m_servers[n].key == key )
+            break;
+      }
+
+      if ( n == count )
+         m_servers.push_back(ServerQueue(key));
+
+      m_servers[n].pending.push_back(name);
+      m_nPending++;
+   }
+
+   // start searching in the given folder
+   void StartFolderSearch(const String& name, size_t server)
+   {
+      MFolder_obj folder(name);
+      CHECK_RET( folder, _T("folder to search in disappeared?") );
+
+      // the time includes opening the folder
+      wxStopWatch stopwatch;
+
+      wxLogStatus(m_frame, _("Searching in folder '%s'..."), name.c_str());
+
+      ASMailFolder *asmf = ASMailFolder::OpenFolder(folder);
+      if ( !asmf )
+      {
+         wxLogError(_("Can't search for messages in the "
+                      "folder '%s'."),
+                    name.c_str());
+
+         return;
+      }
+
+      // opened ok, search in it
+      Ticket t = asmf->SearchMessages(&m_criterium, m_userData);
+      if ( t != ILLEGAL_TICKET )
+      {
+         m_listSingleSearch.push_back(
+            new SingleSearchData(t, asmf->GetMailFolder(), server, stopwatch));
+
+         m_servers[server].active++;
+      }
+
+      asmf->DecRef();
+   }
+
+   // append the messages found in the given folder to the results folder,
+   // showing it if it's the first time we found anything, and return the
+   // number of messages added
+   size_t AddSearchResults(MailFolder *mf, const UIdArray& uidsMatching)
+   {
+      // create the virtual folder to show the results if not done yet
+      if ( !GetResultsVFolder() )
+         return 0;
+
+      HeaderInfoList_obj hil(mf->GetHeaders());
+      if ( !hil )
+         return 0;
+
+      size_t nMatches = 0;
+
+      size_t count = uidsMatching.GetCount();
+      for ( size_t n = 0; n < count; n++ )
+      {
+         Message_obj msg(mf->GetMessage(uidsMatching[n]));
+         if ( msg )
+         {
+            m_mfVirt->AppendMessage(*msg.Get());
+
+            nMatches++;
+         }
+      }
+
+      if ( nMatches )
+      {
+         m_nMatchingMessages += nMatches;
+         m_nMatchingFolders++;
+
+         // show the results found so far without waiting until we finish
+         // searching all the other folders
+         if ( m_viewShown )
+         {
+            m_mfVirt->RequestUpdate();
+         }
+         else
+         {
+            OpenFolderViewFrame(m_folderVirt, m_frame);
+
+            m_viewShown = true;
+         }
+      }
+
+      return nMatches;
+   }
+
    // returns, creating if necessary, the virtual folder in which we show the
    // search results
    //
@@ -497,10 +657,15 @@ private:
    class SingleSearchData
    {
    public:
-      SingleSearchData(Ticket ticket, MailFolder *mf)
+      SingleSearchData(Ticket ticket,
+                       MailFolder *mf,
+                       size_t server,
+                       const wxStopWatch& stopwatch)
+         : m_stopwatch(stopwatch)
       {
          m_ticket = ticket;
          m_mf = mf;
+         m_server = server;
       }
 
       ~SingleSearchData() { m_mf->DecRef(); }
@@ -511,6 +676,12 @@ private:
       /// get the the mail folder we're searching in (NOT IncRef()'d)
       MailFolder *GetMailFolder() const { return m_mf; }
 
+      /// get the index of the server of this folder in m_servers
+      size_t GetServer() const { return m_server; }
+
+      /// get the time since the search in this folder started
+      long GetTime() const { return m_stopwatch.Time(); }
+
    private:
       /// the associated async ticket
       Ticket m_ticket;
@@ -518,28 +689,67 @@ private:
       /// the folder we're searching in
       MailFolder *m_mf;
 
-      /// the UIDs found so far
-      UIdArray m_uidsFound;
+      /// the index of the server of this folder
+      size_t m_server;
+
+      /// measures the time taken by this search
+      wxStopWatch m_stopwatch;
+   };
+
+   // the folders still to be searched on one server
+   struct ServerQueue
+   {
+      ServerQueue(const String& key_) : key(key_) { active = 0; }
+
+      // the server key, empty for the local folders
+      String key;
+
+      // the names of the folders not searched yet
+      std::deque<String> pending;
+
+      // the number of folders being searched
+      size_t active;
    };
 
    // the list containing the individual search records for all folders we're
    // searching in
    M_LIST_OWN(SingleSearchDataList, SingleSearchData) m_listSingleSearch;
 
+   // what we're searching for
+   const SearchCriterium m_criterium;
+
+   // the frame to show the results and messages in and the user data to
+   // identify our results
+   wxFrame *m_frame;
+   UserData m_userData;
+
+   // the queues of the folders for all servers and the index of the next one
+   // to take the folder from
+   std::vector<ServerQueue> m_servers;
+   size_t m_nextServer;
+
+   // the total number of the folders in all queues
+   size_t m_nPending;
+
    // the virtual folder we show the search results in and the associated
    // MFolder object for it
    MailFolder *m_mfVirt;
    MFolder *m_folderVirt;
 
+   // true once the view of m_folderVirt was opened
+   bool m_viewShown;
+
    // the number of messages found so far
    size_t m_nMatchingMessages;
 
    // the number of folders containing the matching messages
    size_t m_nMatchingFolders;
 
-   // have all folders we search been already added to us using
-   // AddSearchFolder()?
-   bool m_allScheduled;
+   // the number of folders searched so far
+   size_t m_nSearchedFolders;
+
+   // measures the total search time
+   wxStopWatch m_stopwatch;
 };
 
 // ----------------------------------------------------------------------------
@@ -552,12 +762,21 @@ public:
    // ctor
    GlobalSearchData(wxFrame *frame) { m_frame = frame; }
 
-   // create a record for a new search operation
-   AsyncSearchData *StartNewSearch()
+   // start a new search operation
+   void StartNewSearch(const SearchCriterium& crit, UserData ud)
    {
-      AsyncSearchData *ssd = new AsyncSearchData;
-      m_listAsyncSearch.push_back(ssd);
-      return ssd;
+      AsyncSearchData *search = new AsyncSearchData(crit, m_frame, ud);
+      search->ContinueSearch();
+
+      // if we couldn't start searching in any folder, there is nothing to
+      // wait for and the errors had been already given
+      if ( search->IsSearchCompleted() )
+      {
+         delete search;
+         return;
+      }
+
+      m_listAsyncSearch.push_back(search);
    }
 
    // process the result of the async search operation
@@ -574,7 +793,7 @@ public:
             if ( i->IsSearchCompleted() )
             {
                // yes, show the results ...
-               i->ShowSearchResults(m_frame);
+               i->ShowSearchResults();
 
                // ... and delete the stale stale search record
                m_listAsyncSearch.erase(i);
@@ -691,6 +910,7 @@ wxMainFrame::wxMainFrame(const String &iname, wxFrame *parent)
 #endif // wxHAS_POWER_EVENTS
    menuDebug->AppendSeparator();
    menuDebug->Append(WXMENU_DEBUG_VIEW_OPENED, "View &opened folders");
+   menuDebug->Append(WXMENU_DEBUG_BENCH_CONFIG, "&Benchmark reading options");
 
    GetMenuBar()->Append(menuDebug, _T("&Debug"));
 #endif // debug
@@ -1232,9 +1452,21 @@ wxMainFrame::OnCommandEvent(wxCommandEvent &event)
 
                   wxLogMessage("%s", msg);
                }
+
+               const String pools = ServerInfoEntry::DescribeAllPools();
+               if ( !pools.empty() )
+               {
+                  wxLogMessage("Connection pools:%s", pools);
+               }
             }
             break;
 
+         case WXMENU_DEBUG_BENCH_CONFIG:
+            extern void BenchmarkReadConfig();
+
+            BenchmarkReadConfig();
+            break;
+
          default:
             FAIL_MSG( _T("unknown debug menu command?") );
       }
@@ -1375,61 +1607,10 @@ void wxMainFrame::DoFolderSearch()
    MFolder_obj folder(m_FolderTree->GetSelection());
    if ( ConfigureSearchMessages(&crit, profile, folder, this) )
    {
-      AsyncSearchData *searchData = NULL;
-
-      const wxArrayString& folderNames = crit.m_Folders;
-      size_t count = folderNames.GetCount();
-      for ( size_t n = 0; n < count; n++ )
-      {
-         const String& name = folderNames[n];
-
-         MFolder_obj folder(name);
-         if ( !folder )
-         {
-            wxLogError(_("Can't search for messages in a "
-                         "non existent folder '%s'."),
-                       name.c_str());
-            continue;
-         }
+      // create the search data on demand if necessary
+      InitSearchData();
 
-         if ( folder->CanOpen() )
-         {
-            ASMailFolder *asmf = ASMailFolder::OpenFolder(folder);
-            if ( !asmf )
-            {
-               wxLogError(_("Can't search for messages in the "
-                            "folder '%s'."),
-                          name.c_str());
-
-               continue;
-            }
-
-            // opened ok, search in it
-            Ticket t = asmf->SearchMessages(&crit, this);
-            if ( t != ILLEGAL_TICKET )
-            {
-               // create a new single search data on the fly
-               if ( !searchData )
-               {
-                  // create the search data on demand as well if necessary
-                  InitSearchData();
-
-                  searchData = m_searchData->StartNewSearch();
-               }
-
-               searchData->AddSearchFolder(asmf->GetMailFolder(), t);
-            }
-
-            asmf->DecRef();
-         }
-         //else: silently skip this one
-      }
-
-      if ( searchData )
-      {
-         // no more calls to AddSearchFolder() scheduled
-         searchData->FinalizeSearch();
-      }
+      m_searchData->StartNewSearch(crit, this);
    }
    //else: cancelled by user
 }
@@ -1004,25 +1004,39 @@ void MsgCmdProcImpl::CheckIfSpam(const UIdArray& uids)
    wxString status(_("Checking message using spam filters..."));
    wxLogStatus(GetFrame(), status);
 
+   // retrieve all messages first to check them all at once
+   std::vector<const Message *> msgs;
    const size_t n = uids.Count();
+   msgs.reserve(n);
    for ( size_t i = 0; i < n; i++ )
    {
-      Message_obj msg(GetMessage(uids[i]));
+      Message *msg = GetMessage(uids[i]);
       if ( !msg )
       {
          wxLogError(_("Failed to retrieve the message to check in spam filter."));
          continue;
       }
 
+      msgs.push_back(msg);
+   }
+
+   std::vector<bool> isSpam;
+   wxArrayString results;
+   SpamFilter::CheckIfSpam(msgs, wxEmptyString, isSpam, &results);
+
+   const size_t count = msgs.size();
+   for ( size_t i = 0; i < count; i++ )
+   {
+      const Message * const msg = msgs[i];
+
       String str(_("The message with subject \"%s\" from \"%s\"\n"));
 
-      String result;
-      if ( SpamFilter::CheckIfSpam(*msg, wxEmptyString, &result) )
+      if ( isSpam[i] )
       {
          wxLogWarning(str + _("seems to be a spam (%s)."),
                       msg->Subject().c_str(),
                       msg->From().c_str(),
-                      result.c_str());
+                      results[i].c_str());
       }
       else // !spam
       {
@@ -1030,6 +1044,8 @@ void MsgCmdProcImpl::CheckIfSpam(const UIdArray& uids)
                       msg->Subject().c_str(),
                       msg->From().c_str());
       }
+
+      const_cast<Message *>(msg)->DecRef();
    }
 
    wxLogStatus(GetFrame(), status + _("done"));
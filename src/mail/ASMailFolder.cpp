@@ -11,6 +11,8 @@
 #ifndef USE_PCH
 #   include "Mcommon.h"
 #   include "guidef.h"    // only for high-level functions
+#   include "MApplication.h"
+#   include "Mdefaults.h"
 #endif // USE_PCH
 
 #include "Sequence.h"
@@ -20,6 +22,36 @@
 
 #include "ASMailFolder.h"
 #include "MailFolderCC.h"
+#include "modules/Filters.h"      // for FilterRule::Error
+
+#include <wx/thread.h>
+#include <wx/tls.h>
+#include <wx/stopwatch.h>           // for wxGetLocalTimeMillis()
+
+#include <deque>
+#include <map>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// options we use here
+// ----------------------------------------------------------------------------
+
+extern const MOption MP_ASYNC_FOLDER_OPS;
+
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the minimal interval between the progress messages shown in the status bar
+// by the background operations
+static const long PROGRESS_STATUS_INTERVAL = 500; // ms
+
+// the maximal time during which a background operation may keep c-client to
+// itself without giving the main thread a chance to use it
+static const long PROGRESS_YIELD_INTERVAL = 100; // ms
+
+// trace mask for the background operations
+#define TRACE_ASYNC _T("async")
 
 /// Call this always before using it.
 #ifdef DEBUG
@@ -44,8 +76,8 @@ ASMailFolderResultImpl::~ASMailFolderResultImpl()
 
  ASMailFolderImpl creates a MailThread object for each operation
  that it wants to perform. These MailThread objects run either
- synchronously or asynchronously (derived from wxThread), depending
- on whether Mahogany was configured --with-threads or without.
+ synchronously or asynchronously, in the MailWorker thread of their
+ folder, depending on the operation and MP_ASYNC_FOLDER_OPS value.
 
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -61,15 +93,10 @@ ASMailFolder::GetTicket(void)
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 
-   MailThread - one thread for each operation to be done
+   MailThread - one object for each operation to be done
 
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-#ifdef USE_THREADS
-#   include <wx/thread.h>       // for wxThread
-#endif
-
-
 static
 UIdArray *Copy(const UIdArray *old)
 {
@@ -80,11 +107,6 @@ UIdArray *Copy(const UIdArray *old)
 }
 
 class MailThread
-
-#ifdef USE_THREADS
-   : public wxThread
-#endif
-
 {
 public:
    MailThread(ASMailFolder *mf, UserData ud)
@@ -95,33 +117,31 @@ public:
          m_UserData = ud;
       }
 
-   Ticket Start(void)
-      {
-         m_Ticket = ASMailFolder::GetTicket();
-#ifdef USE_THREADS
-         if ( Create() != wxTHREAD_NO_ERROR )
-         {
-            wxLogError(_("Cannot create thread!"));
-         }
-#endif
-         Run();
+   /// execute the operation now or queue it, it deletes itself when done
+   Ticket Start(void);
 
-         Ticket ticketSave = m_Ticket;  // can't use m_XXX after delete this
-#ifndef USE_THREADS
-         // We are not using wxThread, so we must delete this when we
-         // are done.
-         delete this;
-#endif
-         return ticketSave;
-      }
-
-//#ifndef USE_THREADS
    virtual ~MailThread()
       {
          SafeDecRef(m_MailFolder);
          SafeDecRef(m_ASMailFolder);
       }
-//#endif
+
+   /// execute the operation in the current thread
+   void Run(void);
+
+   /// can this operation be executed in background?
+   virtual bool CanRunInBackground(void) const { return false; }
+
+   /// the name of the folder, the operations on it are done one by one
+   String GetFolderName(void) const { return m_MailFolder->GetName(); }
+
+   /**
+      Called instead of Run() if the operation is cancelled before being
+      executed: should send the failure result if the operation sends any.
+    */
+   virtual void OnCancel(void) { }
+
+   Ticket GetTicket(void) const { return m_Ticket; }
 
 protected:
    void SendEvent(ASMailFolder::Result *result);
@@ -130,11 +150,6 @@ protected:
    inline void UnLockFolder(void)
       { if ( m_ASMailFolder ) m_ASMailFolder->UnLockFolder(); };
 
-   virtual void *Entry();
-#ifndef USE_THREADS
-   virtual void Run(void) { Entry(); }
-#endif
-
    virtual void  WorkFunction(void) = 0;
 
 protected:
@@ -146,16 +161,13 @@ protected:
 };
 
 
-void *
-MailThread::Entry()
+void
+MailThread::Run()
 {
-   MBusyCursor bc;
-
    //FIXME-MT: IS THIS TRUE? MailFolderCC does sufficient locking
    //LockFolder();
    WorkFunction();
    //UnLockFolder();
-   return NULL; // no return value
 }
 
 
@@ -166,6 +178,11 @@ MailThread::SendEvent(ASMailFolder::Result *result)
    // now we sent an  event to update folderviews etc
    MEventManager::Send(new MEventASFolderResultData (result) );
    result->DecRef(); // we no longer need it
+
+   // the events are dispatched in idle time, so make sure the main thread
+   // wakes up if we're running in a worker one
+   if ( !wxThread::IsMain() )
+      wxWakeUpIdle();
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -402,7 +419,7 @@ public:
       }
    ~MT_AppendMessage()
       {
-         m_Message->DecRef();
+         SafeDecRef(m_Message);
       }
    virtual void WorkFunction(void)
       {
@@ -468,12 +485,23 @@ public:
    virtual void WorkFunction(void)
       {
          UIdArray *msgs = m_MailFolder->SearchMessages(&m_Criterium);
+         if ( !msgs )
+            msgs = new UIdArray;
          SendEvent(ASMailFolder::ResultInt::Create(m_ASMailFolder,
                                                    m_Ticket,
                                                    ASMailFolder::Op_SearchMessages,
                                                    msgs,
                                                    msgs->Count(), m_UserData));
       }
+   virtual bool CanRunInBackground(void) const { return true; }
+   virtual void OnCancel(void)
+      {
+         SendEvent(ASMailFolder::ResultInt::Create(m_ASMailFolder,
+                                                   m_Ticket,
+                                                   ASMailFolder::Op_SearchMessages,
+                                                   new UIdArray,
+                                                   0, m_UserData));
+      }
 private:
    SearchCriterium m_Criterium;
 };
@@ -500,6 +528,19 @@ public:
                             rc, m_UserData));
 #ifdef DEBUG
          m_Seq = NULL;
+#endif
+      }
+   virtual bool CanRunInBackground(void) const { return true; }
+   virtual void OnCancel(void)
+      {
+         SendEvent(ASMailFolder::ResultInt
+                   ::Create(m_ASMailFolder,
+                            m_Ticket,
+                            ASMailFolder::Op_SaveMessages,
+                            m_Seq,
+                            false, m_UserData));
+#ifdef DEBUG
+         m_Seq = NULL;
 #endif
       }
 private:
@@ -526,6 +567,18 @@ public:
                                                    rc, m_UserData));
 #ifdef DEBUG
          m_Seq = NULL;
+#endif
+      }
+   virtual bool CanRunInBackground(void) const { return true; }
+   virtual void OnCancel(void)
+      {
+         SendEvent(ASMailFolder::ResultInt::Create(m_ASMailFolder,
+                                                   m_Ticket,
+                                                   ASMailFolder::Op_SaveMessagesToFile,
+                                                   m_Seq,
+                                                   false, m_UserData));
+#ifdef DEBUG
+         m_Seq = NULL;
 #endif
       }
 private:
@@ -545,10 +598,15 @@ public:
       {
          m_Parent = parent;
          m_Folder = folder;
+         SafeIncRef(m_Folder);
          m_Op = op;
          ASSERT(m_Op == ASMailFolder::Op_SaveMessagesToFile ||
                 m_Op == ASMailFolder::Op_SaveMessagesToFolder);
       }
+   ~MT_SaveMessagesToFileOrFolder()
+      {
+         SafeDecRef(m_Folder);
+      }
    virtual void WorkFunction(void)
       {
          int rc = m_Op == ASMailFolder::Op_SaveMessagesToFile
@@ -560,6 +618,19 @@ public:
                                                    rc, m_UserData));
 #ifdef DEBUG
          m_Seq = NULL;
+#endif
+      }
+   // saving to file asks the user for the file name
+   virtual bool CanRunInBackground(void) const
+      { return m_Op == ASMailFolder::Op_SaveMessagesToFolder; }
+   virtual void OnCancel(void)
+      {
+         SendEvent(ASMailFolder::ResultInt::Create(m_ASMailFolder,
+                                                   m_Ticket, m_Op,
+                                                   m_Seq,
+                                                   false, m_UserData));
+#ifdef DEBUG
+         m_Seq = NULL;
 #endif
       }
 private:
@@ -615,6 +686,16 @@ public:
             result, m_UserData));
 #ifdef DEBUG
          m_Seq = NULL;
+#endif
+      }
+   virtual bool CanRunInBackground(void) const { return true; }
+   virtual void OnCancel(void)
+      {
+         SendEvent(ASMailFolder::ResultInt::Create(
+            m_ASMailFolder, m_Ticket, ASMailFolder::Op_ApplyFilterRules, m_Seq,
+            FilterRule::Error, m_UserData));
+#ifdef DEBUG
+         m_Seq = NULL;
 #endif
       }
 private:
@@ -686,6 +767,504 @@ private:
    bool  m_SubOnly;
 };
 
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+   MailWorker - the thread executing the operations on one folder
+
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+class MailWorkers;
+
+/**
+   The operations on the same folder must be executed one after another as
+   they use the same MAILSTREAM and c-client is not reentrant, so there is a
+   single thread per folder which exists as long as it has any operations to
+   execute. It needs c-client lock for executing them (see MailFolderCC) but
+   releases it while waiting for the network, so the operations on different
+   folders do progress in parallel.
+ */
+class MailWorker : public wxThread
+{
+public:
+   MailWorker(MailWorkers *workers, const String& name)
+      : wxThread(wxTHREAD_JOINABLE),
+        m_workers(workers),
+        m_name(name)
+      {
+         m_current = NULL;
+         m_cancelled = false;
+      }
+
+   /// implements ASMailFolder::UpdateProgress() for the current operation
+   bool UpdateProgress(unsigned long done,
+                       unsigned long total,
+                       const String& text);
+
+protected:
+   virtual void *Entry();
+
+private:
+   /// the object managing us
+   MailWorkers * const m_workers;
+
+   /// the full name of the folder we're working on
+   const String m_name;
+
+   /// the operations waiting to be executed, protected by MailWorkers mutex
+   std::deque<MailThread *> m_ops;
+
+   /// the current operation and its cancel flag, also protected by it
+   MailThread *m_current;
+   bool m_cancelled;
+
+   /// the time of the last status message and of the last c-client yield
+   wxMilliClock_t m_lastStatus,
+                  m_lastYield;
+
+   friend class MailWorkers;
+
+   DECLARE_NO_COPY_CLASS(MailWorker)
+};
+
+/// the worker executing the current thread, if it's a worker one
+static wxTLS_TYPE(MailWorker *) tls_worker;
+
+/**
+   MailWorkers creates the worker threads when needed and deletes the
+   operations executed by them and the threads themselves when they are done
+   in the main thread.
+ */
+class MailWorkers : public wxEvtHandler
+{
+public:
+   /// get the single object of this class, creating it if necessary
+   static MailWorkers *Get();
+
+   /// get the object only if it had been already created
+   static MailWorkers *GetIfExists() { return ms_workers; }
+
+   /// cancel all operations, wait for the threads and delete the object
+   static void Delete();
+
+   /// queue the operation for its folder thread, return false on failure
+   bool Queue(MailThread *op);
+
+   /// implements ASMailFolder::Cancel()
+   bool Cancel(Ticket ticket);
+
+   /**
+      Called by the worker threads to get the next operation to execute,
+      opDone is the previous one which is deleted later by us. Returns NULL
+      if there are no more operations and the thread should terminate.
+    */
+   MailThread *GetNext(MailWorker *worker, MailThread *opDone);
+
+   /// is the current operation of this worker cancelled?
+   bool IsCancelled(const MailWorker *worker);
+
+private:
+   MailWorkers();
+   virtual ~MailWorkers();
+
+   /// cancel all operations: the running ones will stop soon
+   void CancelAll();
+
+   /// delete the executed operations and the terminated threads
+   void ProcessDone();
+
+   /// handler of the worker threads notifications
+   void OnWorkerEvent(wxThreadEvent& event);
+
+
+   typedef std::map<String, MailWorker *> Workers;
+
+   /// the mutex protecting everything below and the workers queues
+   wxMutex m_mutex;
+
+   /// signalled when a thread terminates, used with m_mutex
+   wxCondition m_condWorkers;
+
+   /// the running threads indexed by their folder names
+   Workers m_workers;
+
+   /// the operations executed by the threads, to be deleted
+   std::vector<MailThread *> m_opsDone;
+
+   /// the terminated threads, to be joined and deleted
+   std::vector<MailWorker *> m_workersDone;
+
+   static MailWorkers *ms_workers;
+
+   DECLARE_NO_COPY_CLASS(MailWorkers)
+};
+
+// ----------------------------------------------------------------------------
+// MailThread::Start()
+// ----------------------------------------------------------------------------
+
+Ticket
+MailThread::Start(void)
+{
+   m_Ticket = ASMailFolder::GetTicket();
+
+   Ticket ticketSave = m_Ticket;  // can't use m_XXX after delete this
+
+   if ( m_MailFolder && CanRunInBackground() && wxThread::IsMain() &&
+         ASMailFolder::RunsInBackground() && MailWorkers::Get()->Queue(this) )
+   {
+      return ticketSave;
+   }
+
+   // execute it synchronously
+   {
+      MBusyCursor bc;
+      Run();
+   }
+
+   delete this;
+
+   return ticketSave;
+}
+
+// ----------------------------------------------------------------------------
+// MailWorker
+// ----------------------------------------------------------------------------
+
+void *
+MailWorker::Entry()
+{
+   wxTLS_VALUE(tls_worker) = this;
+
+   MailThread *op = NULL;
+   while ( (op = m_workers->GetNext(this, op)) != NULL )
+   {
+      MailFolderCC::LockCClient();
+
+      wxLogTrace(TRACE_ASYNC, _T("Executing operation %d in folder '%s'"),
+                 (int)op->GetTicket(), m_name.c_str());
+
+      m_lastStatus =
+      m_lastYield = wxGetLocalTimeMillis();
+
+      op->Run();
+
+      // the listings created by the operation keep their folders alive
+      MailFolderCmn::ReleaseThreadHeaders();
+
+      MailFolderCC::UnlockCClient();
+   }
+
+   wxTLS_VALUE(tls_worker) = NULL;
+
+   return NULL;
+}
+
+bool
+MailWorker::UpdateProgress(unsigned long done,
+                           unsigned long total,
+                           const String& text)
+{
+   const wxMilliClock_t now = wxGetLocalTimeMillis();
+
+   if ( now - m_lastStatus >= PROGRESS_STATUS_INTERVAL )
+   {
+      m_lastStatus = now;
+
+      if ( text.empty() )
+      {
+         wxLogStatus(_("Folder '%s': %lu of %lu messages processed..."),
+                     m_name.c_str(), done, total);
+      }
+      else
+      {
+         wxLogStatus(_T("%s"), text.c_str());
+      }
+   }
+
+   // don't keep c-client for ourselves for too long, the main thread can't
+   // do anything with the folders while we have it
+   if ( now - m_lastYield >= PROGRESS_YIELD_INTERVAL )
+   {
+      MailFolderCC::UnlockCClient();
+      MailFolderCC::LockCClient();
+
+      m_lastYield = wxGetLocalTimeMillis();
+   }
+
+   return !m_workers->IsCancelled(this);
+}
+
+// ----------------------------------------------------------------------------
+// MailWorkers
+// ----------------------------------------------------------------------------
+
+MailWorkers *MailWorkers::ms_workers = NULL;
+
+MailWorkers::MailWorkers()
+           : m_condWorkers(m_mutex)
+{
+   Bind(wxEVT_THREAD, &MailWorkers::OnWorkerEvent, this);
+}
+
+MailWorkers::~MailWorkers()
+{
+   ASSERT_MSG( m_workers.empty(), _T("deleting MailWorkers while in use") );
+}
+
+/* static */
+MailWorkers *MailWorkers::Get()
+{
+   if ( !ms_workers )
+   {
+      ms_workers = new MailWorkers;
+   }
+
+   return ms_workers;
+}
+
+/* static */
+void MailWorkers::Delete()
+{
+   if ( !ms_workers )
+      return;
+
+   ms_workers->CancelAll();
+
+   bool hasWorkers;
+   {
+      wxMutexLocker lock(ms_workers->m_mutex);
+      hasWorkers = !ms_workers->m_workers.empty() ||
+                     !ms_workers->m_workersDone.empty();
+   }
+
+   // if there are no threads, c-client lock may not exist any more
+   if ( hasWorkers )
+   {
+      // the threads need c-client lock to finish their current operations
+      MailFolderCC::UnlockCClient();
+
+      {
+         wxMutexLocker lock(ms_workers->m_mutex);
+         while ( !ms_workers->m_workers.empty() )
+            ms_workers->m_condWorkers.Wait();
+      }
+
+      MailFolderCC::LockCClient();
+
+      ms_workers->ProcessDone();
+   }
+
+   delete ms_workers;
+   ms_workers = NULL;
+}
+
+bool MailWorkers::Queue(MailThread *op)
+{
+   const String name = op->GetFolderName();
+
+   // each running thread keeps c-client lock active until ProcessDone() and
+   // this can't be done while holding our mutex
+   MailFolderCC::EnableWorkerThreads();
+
+   bool ok = true,
+        created = false;
+   {
+      wxMutexLocker lock(m_mutex);
+
+      MailWorker *worker;
+      Workers::iterator i = m_workers.find(name);
+      if ( i == m_workers.end() )
+      {
+         worker = new MailWorker(this, name);
+         if ( worker->Create() != wxTHREAD_NO_ERROR ||
+               worker->Run() != wxTHREAD_NO_ERROR )
+         {
+            wxLogDebug(_T("Failed to start worker thread for '%s'."),
+                       name.c_str());
+
+            delete worker;
+            worker = NULL;
+
+            ok = false;
+         }
+         else
+         {
+            m_workers[name] = worker;
+            created = true;
+         }
+      }
+      else // there is already a thread for this folder
+      {
+         worker = i->second;
+      }
+
+      if ( worker )
+      {
+         // notice that the thread can't get it before we unlock the mutex
+         worker->m_ops.push_back(op);
+
+         wxLogTrace(TRACE_ASYNC,
+                    _T("Queued operation %d for folder '%s' (%lu)"),
+                    (int)op->GetTicket(), name.c_str(),
+                    (unsigned long)worker->m_ops.size());
+      }
+   }
+
+   if ( !created )
+      MailFolderCC::DisableWorkerThreads();
+
+   return ok;
+}
+
+bool MailWorkers::Cancel(Ticket ticket)
+{
+   MailThread *op = NULL;
+
+   {
+      wxMutexLocker lock(m_mutex);
+
+      for ( Workers::iterator i = m_workers.begin();
+            i != m_workers.end() && !op;
+            ++i )
+      {
+         MailWorker * const worker = i->second;
+         if ( worker->m_current && worker->m_current->GetTicket() == ticket )
+         {
+            // it will stop at the next UpdateProgress() call
+            worker->m_cancelled = true;
+
+            return true;
+         }
+
+         std::deque<MailThread *>& ops = worker->m_ops;
+         for ( std::deque<MailThread *>::iterator j = ops.begin();
+               j != ops.end();
+               ++j )
+         {
+            if ( (*j)->GetTicket() == ticket )
+            {
+               op = *j;
+               ops.erase(j);
+               break;
+            }
+         }
+      }
+   }
+
+   if ( !op )
+      return false;
+
+   op->OnCancel();
+   delete op;
+
+   return true;
+}
+
+void MailWorkers::CancelAll()
+{
+   std::vector<MailThread *> ops;
+
+   {
+      wxMutexLocker lock(m_mutex);
+
+      for ( Workers::iterator i = m_workers.begin();
+            i != m_workers.end();
+            ++i )
+      {
+         MailWorker * const worker = i->second;
+         if ( worker->m_current )
+            worker->m_cancelled = true;
+
+         ops.insert(ops.end(), worker->m_ops.begin(), worker->m_ops.end());
+         worker->m_ops.clear();
+      }
+   }
+
+   for ( size_t n = 0; n < ops.size(); n++ )
+   {
+      ops[n]->OnCancel();
+      delete ops[n];
+   }
+}
+
+MailThread *MailWorkers::GetNext(MailWorker *worker, MailThread *opDone)
+{
+   wxMutexLocker lock(m_mutex);
+
+   worker->m_current = NULL;
+   worker->m_cancelled = false;
+
+   bool notify = false;
+   if ( opDone )
+   {
+      // it's not safe to delete it here as this would DecRef() the folder
+      m_opsDone.push_back(opDone);
+      notify = true;
+   }
+
+   MailThread *op = NULL;
+   if ( worker->m_ops.empty() )
+   {
+      // the thread is going to terminate
+      m_workers.erase(worker->m_name);
+      m_workersDone.push_back(worker);
+      notify = true;
+
+      m_condWorkers.Broadcast();
+   }
+   else
+   {
+      op = worker->m_ops.front();
+      worker->m_ops.pop_front();
+
+      worker->m_current = op;
+   }
+
+   if ( notify )
+      wxQueueEvent(this, new wxThreadEvent);
+
+   return op;
+}
+
+bool MailWorkers::IsCancelled(const MailWorker *worker)
+{
+   wxMutexLocker lock(m_mutex);
+
+   return worker->m_cancelled;
+}
+
+void MailWorkers::ProcessDone()
+{
+   std::vector<MailThread *> ops;
+   std::vector<MailWorker *> workers;
+
+   {
+      wxMutexLocker lock(m_mutex);
+
+      ops.swap(m_opsDone);
+      workers.swap(m_workersDone);
+   }
+
+   size_t n;
+   for ( n = 0; n < ops.size(); n++ )
+      delete ops[n];
+
+   // the threads don't need anything from us to finish, so this doesn't block
+   // for any noticeable time
+   for ( n = 0; n < workers.size(); n++ )
+   {
+      workers[n]->Wait();
+      delete workers[n];
+
+      MailFolderCC::DisableWorkerThreads();
+   }
+}
+
+void MailWorkers::OnWorkerEvent(wxThreadEvent& WXUNUSED(event))
+{
+   ProcessDone();
+}
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
 
    ASMailFolderImpl implementation, common code
@@ -1194,6 +1773,37 @@ ASMailFolder::ListFolders(const String &pattern,
                                                   reference, ud);
 }
 
+/* static */
+bool ASMailFolder::RunsInBackground()
+{
+   return READ_APPCONFIG_BOOL(MP_ASYNC_FOLDER_OPS);
+}
+
+/* static */
+bool ASMailFolder::Cancel(Ticket ticket)
+{
+   MailWorkers * const workers = MailWorkers::GetIfExists();
+
+   return workers && workers->Cancel(ticket);
+}
+
+/* static */
+bool ASMailFolder::UpdateProgress(unsigned long done,
+                                  unsigned long total,
+                                  const String& text)
+{
+   MailWorker * const worker = wxTLS_VALUE(tls_worker);
+
+   // nothing to do when not running in background
+   return !worker || worker->UpdateProgress(done, total, text);
+}
+
+/* static */
+void ASMailFolder::CleanUp()
+{
+   MailWorkers::Delete();
+}
+
 char ASMailFolder::GetFolderDelimiter() const
 {
    MailFolder *mf = GetMailFolder();
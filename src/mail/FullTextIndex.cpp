@@ -0,0 +1,1146 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/FullTextIndex.cpp: FullTextIndex class implementation
+// Purpose:     persistent inverted index of the words of the messages
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+// ============================================================================
+// declarations
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// headers
+// ----------------------------------------------------------------------------
+
+#include  "Mpch.h"
+
+#ifndef  USE_PCH
+#  include "Mcommon.h"
+#endif // USE_PCH
+
+#include <wx/file.h>
+#include <wx/stopwatch.h>
+
+#include "CacheFile.h"
+#include "Message.h"
+#include "MimePart.h"
+
+#include "mail/FullTextIndex.h"
+
+#include <algorithm>
+#include <iterator>
+
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the signature at the start of the file
+static const char FULLTEXT_INDEX_MAGIC[8] = { 'M', 'F', 'T', 'I', 'N', 'D', 'E', 'X' };
+
+// the current version of the file format
+static const wxUint32 FULLTEXT_INDEX_VERSION = 2;
+
+// the words shorter than this are not indexed, they're too common to be
+// useful anyhow
+static const size_t FULLTEXT_MIN_WORD_LEN = 2;
+
+// only the first characters of the words longer than this are indexed, they're
+// usually just some encoded binary data, and the messages containing them are
+// remembered as the index can't be used to find the words inside them
+static const size_t FULLTEXT_MAX_WORD_LEN = 64;
+
+// ----------------------------------------------------------------------------
+// file format
+// ----------------------------------------------------------------------------
+
+// the file starts with this header followed by countUIds UIDs of all indexed
+// messages, countLong UIDs of the messages with the words longer than
+// FULLTEXT_MAX_WORD_LEN and then by the postings of the header and of the body
+// words
+// (countWords[0] and countWords[1] of them respectively), each of which is
+// stored as the word length, the word itself in UTF-8, the number of UIDs and
+// the sorted UIDs of the messages containing this word
+struct FullTextIndexHeader
+{
+   char magic[8];
+   wxUint32 version;
+   wxUint32 uidValidity;
+   wxUint32 countUIds;
+   wxUint32 countLong;
+   wxUint32 countWords[2];
+};
+
+// ----------------------------------------------------------------------------
+// private functions
+// ----------------------------------------------------------------------------
+
+// call the functor for all words of the given text, the functor is called
+// with the lower case word and the flags indicating whether it was delimited
+// from the left and from the right in the text
+template <class F>
+static void ForEachWord(const String& text, F& f)
+{
+   const String lower = text.Lower();
+
+   String word;
+   bool atStart = false;
+   for ( String::const_iterator i = lower.begin(); ; ++i )
+   {
+      const bool atEnd = i == lower.end();
+      if ( !atEnd && wxIsalnum(*i) )
+      {
+         word += *i;
+         continue;
+      }
+
+      if ( !word.empty() )
+      {
+         f(word, atStart, !atEnd);
+         word.clear();
+      }
+
+      if ( atEnd )
+         break;
+
+      atStart = true;
+   }
+}
+
+// check if the word is too long to be indexed entirely
+static inline bool IsLongWord(const String& word)
+{
+   return word.length() > FULLTEXT_MAX_WORD_LEN;
+}
+
+// convert the word to the representation used in the postings
+static inline std::string WordToKey(const String& word)
+{
+   return std::string(word.Left(FULLTEXT_MAX_WORD_LEN).utf8_str());
+}
+
+// check if the word has acceptable length to be in the index
+static inline bool IsIndexable(const String& word)
+{
+   return word.length() >= FULLTEXT_MIN_WORD_LEN;
+}
+
+// ============================================================================
+// FullTextIndex implementation
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// ctor/dtor
+// ----------------------------------------------------------------------------
+
+FullTextIndex::FullTextIndex(const String& folderName, UIdType uidValidity)
+             : m_folderName(folderName),
+               m_filename(GetIndexFileName(folderName)),
+               m_uidValidity(uidValidity)
+{
+   m_modified = false;
+}
+
+FullTextIndex::FullTextIndex(const String& folderName,
+                             UIdType uidValidity,
+                             const String& filename)
+             : m_folderName(folderName),
+               m_filename(filename),
+               m_uidValidity(uidValidity)
+{
+   m_modified = false;
+}
+
+FullTextIndex::~FullTextIndex()
+{
+}
+
+/* static */
+String FullTextIndex::GetIndexFileName(const String& folderName)
+{
+   return CacheFile::GetFolderCacheFileName(_T("index"), folderName);
+}
+
+/* static */
+void FullTextIndex::Remove(const String& folderName)
+{
+   const String filename = GetIndexFileName(folderName);
+   if ( wxFileExists(filename) )
+   {
+      if ( !wxRemoveFile(filename) )
+      {
+         wxLogDebug(_T("Failed to remove the full text index file \"%s\""),
+                    filename.c_str());
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+// loading
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+// helper class used to read the data from the file buffer
+class IndexReader
+{
+public:
+   IndexReader(const char *data, size_t size)
+   {
+      m_data = data;
+      m_end = data + size;
+   }
+
+   bool Read(void *p, size_t size)
+   {
+      if ( (size_t)(m_end - m_data) < size )
+         return false;
+
+      memcpy(p, m_data, size);
+      m_data += size;
+
+      return true;
+   }
+
+   bool ReadUInt32(wxUint32& n) { return Read(&n, sizeof(n)); }
+
+   bool ReadPostings(std::map<std::string, std::vector<UIdType> >& postings,
+                     wxUint32 count)
+   {
+      for ( wxUint32 n = 0; n < count; n++ )
+      {
+         wxUint32 len;
+         if ( !ReadUInt32(len) || (size_t)(m_end - m_data) < len )
+            return false;
+
+         std::vector<UIdType>& uids = postings[std::string(m_data, len)];
+         m_data += len;
+
+         wxUint32 countUIds;
+         if ( !ReadUInt32(countUIds) ||
+                  (size_t)(m_end - m_data) / sizeof(wxUint32) < countUIds )
+            return false;
+
+         uids.reserve(countUIds);
+         for ( wxUint32 i = 0; i < countUIds; i++ )
+         {
+            wxUint32 uid;
+            if ( !ReadUInt32(uid) )
+               return false;
+
+            uids.push_back(uid);
+         }
+      }
+
+      return true;
+   }
+
+   bool IsAtEnd() const { return m_data == m_end; }
+
+private:
+   const char *m_data,
+              *m_end;
+};
+
+} // anonymous namespace
+
+bool FullTextIndex::Load()
+{
+   m_uids.clear();
+   m_uidsLong.clear();
+   m_header.clear();
+   m_body.clear();
+   m_forgotten.clear();
+   m_modified = false;
+
+   if ( !wxFileExists(m_filename) )
+   {
+      // no index yet, not an error
+      return true;
+   }
+
+   wxStopWatch sw;
+
+   // we only need the data while parsing it
+   CacheFileData data;
+   if ( !data.Load(m_filename) )
+      return false;
+
+   IndexReader reader(data.GetData(), data.GetSize());
+
+   FullTextIndexHeader hdr;
+   bool ok = reader.Read(&hdr, sizeof(hdr)) &&
+               memcmp(hdr.magic, FULLTEXT_INDEX_MAGIC, sizeof(hdr.magic)) == 0 &&
+                  hdr.version == FULLTEXT_INDEX_VERSION;
+
+   if ( ok && hdr.uidValidity != m_uidValidity )
+   {
+      wxLogTrace(TRACE_FTINDEX,
+                 _T("UIDVALIDITY of '%s' changed, discarding its index"),
+                 m_folderName.c_str());
+
+      // it's useless now
+      Remove(m_folderName);
+
+      return true;
+   }
+
+   for ( wxUint32 n = 0; ok && n < hdr.countUIds; n++ )
+   {
+      wxUint32 uid;
+      ok = reader.ReadUInt32(uid);
+      if ( ok )
+         m_uids.insert(m_uids.end(), uid);
+   }
+
+   for ( wxUint32 n = 0; ok && n < hdr.countLong; n++ )
+   {
+      wxUint32 uid;
+      ok = reader.ReadUInt32(uid);
+      if ( ok )
+         m_uidsLong.insert(m_uidsLong.end(), uid);
+   }
+
+   ok = ok && reader.ReadPostings(m_header, hdr.countWords[0])
+           && reader.ReadPostings(m_body, hdr.countWords[1])
+           && reader.IsAtEnd();
+
+   if ( !ok )
+   {
+      wxLogTrace(TRACE_FTINDEX,
+                 _T("Discarding invalid full text index file \"%s\""),
+                 m_filename.c_str());
+
+      m_uids.clear();
+      m_uidsLong.clear();
+      m_header.clear();
+      m_body.clear();
+
+      return true;
+   }
+
+   wxLogTrace(TRACE_FTINDEX,
+              _T("Loaded index of %lu messages (%lu words) for '%s' in %ldms"),
+              (unsigned long)m_uids.size(),
+              (unsigned long)(m_header.size() + m_body.size()),
+              m_folderName.c_str(), sw.Time());
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+// saving
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+// helper class used to build the file contents in memory
+class IndexWriter
+{
+public:
+   void Write(const void *p, size_t size)
+   {
+      const char * const data = static_cast<const char *>(p);
+      m_buf.insert(m_buf.end(), data, data + size);
+   }
+
+   void WriteUInt32(wxUint32 n) { Write(&n, sizeof(n)); }
+
+   // write the postings without the forgotten UIDs, return the number of
+   // words written
+   wxUint32 WritePostings(const std::map<std::string, std::vector<UIdType> >& postings,
+                          const std::set<UIdType>& forgotten)
+   {
+      wxUint32 countWords = 0;
+
+      std::vector<UIdType> uids;
+      for ( std::map<std::string, std::vector<UIdType> >::const_iterator
+               i = postings.begin(); i != postings.end(); ++i )
+      {
+         uids.clear();
+         for ( std::vector<UIdType>::const_iterator j = i->second.begin();
+               j != i->second.end();
+               ++j )
+         {
+            if ( forgotten.find(*j) == forgotten.end() )
+               uids.push_back(*j);
+         }
+
+         if ( uids.empty() )
+            continue;
+
+         WriteUInt32(i->first.length());
+         Write(i->first.data(), i->first.length());
+         WriteUInt32(uids.size());
+         for ( size_t n = 0; n < uids.size(); n++ )
+            WriteUInt32(uids[n]);
+
+         countWords++;
+      }
+
+      return countWords;
+   }
+
+   std::vector<char>& GetBuffer() { return m_buf; }
+
+private:
+   std::vector<char> m_buf;
+};
+
+} // anonymous namespace
+
+bool FullTextIndex::Save()
+{
+   if ( !m_modified )
+   {
+      // nothing changed
+      return true;
+   }
+
+   wxStopWatch sw;
+
+   if ( !CacheFile::CreateDirFor(m_filename) )
+      return false;
+
+   IndexWriter writer;
+
+   // reserve space for the header, it will be filled in later when we know
+   // the number of words
+   FullTextIndexHeader hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   writer.Write(&hdr, sizeof(hdr));
+
+   for ( std::set<UIdType>::const_iterator i = m_uids.begin();
+         i != m_uids.end();
+         ++i )
+   {
+      writer.WriteUInt32(*i);
+   }
+
+   for ( std::set<UIdType>::const_iterator i = m_uidsLong.begin();
+         i != m_uidsLong.end();
+         ++i )
+   {
+      writer.WriteUInt32(*i);
+   }
+
+   memcpy(hdr.magic, FULLTEXT_INDEX_MAGIC, sizeof(hdr.magic));
+   hdr.version = FULLTEXT_INDEX_VERSION;
+   hdr.uidValidity = m_uidValidity;
+   hdr.countUIds = m_uids.size();
+   hdr.countLong = m_uidsLong.size();
+   hdr.countWords[0] = writer.WritePostings(m_header, m_forgotten);
+   hdr.countWords[1] = writer.WritePostings(m_body, m_forgotten);
+
+   std::vector<char>& buf = writer.GetBuffer();
+   memcpy(&buf[0], &hdr, sizeof(hdr));
+
+   wxTempFile file;
+   if ( !file.Open(m_filename) ||
+            !file.Write(&buf[0], buf.size()) ||
+               !file.Commit() )
+   {
+      wxLogDebug(_T("Failed to write the full text index file \"%s\""),
+                 m_filename.c_str());
+
+      return false;
+   }
+
+   m_modified = false;
+
+   wxLogTrace(TRACE_FTINDEX,
+              _T("Saved index of %lu messages for '%s' (%lu bytes) in %ldms"),
+              (unsigned long)m_uids.size(), m_folderName.c_str(),
+              (unsigned long)buf.size(), sw.Time());
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+// updating the index
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+// the functor used with ForEachWord() by AddWords()
+class WordAdder
+{
+public:
+   WordAdder(std::map<std::string, std::vector<UIdType> >& postings,
+             UIdType uid)
+      : m_postings(postings), m_uid(uid)
+   {
+      m_hasLongWords = false;
+   }
+
+   void operator()(const String& word, bool, bool)
+   {
+      if ( !IsIndexable(word) )
+         return;
+
+      if ( IsLongWord(word) )
+         m_hasLongWords = true;
+
+      std::vector<UIdType>& uids = m_postings[WordToKey(word)];
+
+      // the messages are usually added in increasing UID order, so optimize
+      // for this case
+      if ( uids.empty() || uids.back() < m_uid )
+      {
+         uids.push_back(m_uid);
+      }
+      else
+      {
+         std::vector<UIdType>::iterator i =
+            std::lower_bound(uids.begin(), uids.end(), m_uid);
+         if ( *i != m_uid )
+            uids.insert(i, m_uid);
+      }
+   }
+
+   // true if some of the words were only partially indexed
+   bool m_hasLongWords;
+
+private:
+   std::map<std::string, std::vector<UIdType> >& m_postings;
+   const UIdType m_uid;
+
+   DECLARE_NO_COPY_CLASS(WordAdder)
+};
+
+} // anonymous namespace
+
+void FullTextIndex::AddWords(Postings& postings,
+                             UIdType uid,
+                             const String& text)
+{
+   WordAdder adder(postings, uid);
+   ForEachWord(text, adder);
+
+   if ( adder.m_hasLongWords )
+      m_uidsLong.insert(uid);
+}
+
+void FullTextIndex::AddMessage(UIdType uid, const Message& msg)
+{
+   CHECK_RET( uid != UID_ILLEGAL, _T("can't index message without UID") );
+
+   if ( IsIndexed(uid) )
+      return;
+
+   // if the message was forgotten before, its old postings must be discarded
+   // before adding the new ones but this can't happen as UIDs are never
+   // reused in the same folder
+   ASSERT_MSG( m_forgotten.find(uid) == m_forgotten.end(),
+               _T("reindexing an expunged message?") );
+
+   AddWords(m_header, uid, GetMessageText(msg, Field_Header));
+   AddWords(m_body, uid, GetMessageText(msg, Field_Body));
+
+   m_uids.insert(uid);
+   m_modified = true;
+}
+
+void FullTextIndex::Forget(UIdType uid)
+{
+   if ( m_uids.erase(uid) )
+   {
+      m_uidsLong.erase(uid);
+      m_forgotten.insert(uid);
+      m_modified = true;
+   }
+}
+
+/* static */
+String FullTextIndex::GetMessageText(const Message& msg, int fields)
+{
+   String text;
+
+   if ( fields & Field_Header )
+   {
+      text = msg.GetHeader();
+   }
+
+   if ( fields & Field_Body )
+   {
+      // concatenate the decoded contents of all text parts
+      const MimePart *part = msg.GetTopMimePart();
+      while ( part )
+      {
+         if ( part->GetType().GetPrimary() == MimeType::TEXT )
+         {
+            if ( !text.empty() )
+               text += _T('\n');
+
+            text += part->GetTextContent();
+         }
+
+         // depth first traversal of the MIME tree
+         const MimePart *next = part->GetNested();
+         if ( !next )
+         {
+            while ( part && !part->GetNext() )
+               part = part->GetParent();
+
+            if ( part )
+               next = part->GetNext();
+         }
+
+         part = next;
+      }
+   }
+
+   return text;
+}
+
+// ----------------------------------------------------------------------------
+// searching
+// ----------------------------------------------------------------------------
+
+void FullTextIndex::FindWord(const Postings& postings,
+                             const std::string& word,
+                             bool atStart,
+                             bool atEnd,
+                             std::set<UIdType>& uids) const
+{
+   Postings::const_iterator i;
+   if ( atStart && atEnd )
+   {
+      // the simplest case: the word must be found exactly
+      i = postings.find(word);
+      if ( i != postings.end() )
+         uids.insert(i->second.begin(), i->second.end());
+   }
+   else if ( atStart )
+   {
+      // all words starting with this one are adjacent in the map
+      for ( i = postings.lower_bound(word);
+            i != postings.end() && i->first.compare(0, word.length(), word) == 0;
+            ++i )
+      {
+         uids.insert(i->second.begin(), i->second.end());
+      }
+   }
+   else // we have to check all words
+   {
+      for ( i = postings.begin(); i != postings.end(); ++i )
+      {
+         const std::string& w = i->first;
+         if ( w.length() < word.length() )
+            continue;
+
+         const bool matches = atEnd
+            ? w.compare(w.length() - word.length(), word.length(), word) == 0
+            : w.find(word) != std::string::npos;
+         if ( matches )
+            uids.insert(i->second.begin(), i->second.end());
+      }
+   }
+}
+
+namespace
+{
+
+// the functor used with ForEachWord() by Find()
+class WordCollector
+{
+public:
+   WordCollector() { m_countAll = 0; }
+
+   void operator()(const String& word, bool atStart, bool atEnd)
+   {
+      m_countAll++;
+
+      // we can't look up the words which are not indexed, but we can still
+      // use the others
+      if ( IsIndexable(word) )
+      {
+         Word w;
+         w.word = WordToKey(word);
+         w.isLong = IsLongWord(word);
+         w.atStart = atStart;
+         w.atEnd = atEnd;
+         m_words.push_back(w);
+      }
+   }
+
+   struct Word
+   {
+      // the key used in the postings, i.e. possibly truncated word
+      std::string word;
+
+      // true if the word was truncated
+      bool isLong;
+
+      bool atStart,
+           atEnd;
+   };
+
+   // the words we can look up
+   std::vector<Word> m_words;
+
+   // the total number of words in the key
+   size_t m_countAll;
+};
+
+} // anonymous namespace
+
+FullTextIndex::FindResult
+FullTextIndex::Find(const String& key,
+                    int fields,
+                    std::vector<UIdType>& uids) const
+{
+   WordCollector collector;
+   ForEachWord(key, collector);
+
+   const size_t count = collector.m_words.size();
+   if ( !count )
+      return Find_Unusable;
+
+   wxStopWatch sw;
+
+   // set to true if the messages found may not contain the words looked up
+   // even if all of them are in the index
+   bool approx = false;
+
+   // find the messages containing all the words of the key
+   std::set<UIdType> found;
+   for ( size_t n = 0; n < count; n++ )
+   {
+      const WordCollector::Word& w = collector.m_words[n];
+
+      // only the start of a long word is in the index, so we can only look
+      // for it if it doesn't need to end there
+      const bool atEnd = w.atEnd && !w.isLong;
+      if ( w.isLong )
+         approx = true;
+
+      std::set<UIdType> foundWord;
+      if ( fields & Field_Header )
+         FindWord(m_header, w.word, w.atStart, atEnd, foundWord);
+      if ( fields & Field_Body )
+         FindWord(m_body, w.word, w.atStart, atEnd, foundWord);
+
+      // if the word may be found in the middle of another one, it can also
+      // be in the part of a long word which is not indexed, so all messages
+      // with the long words are candidates
+      if ( !w.atStart && !m_uidsLong.empty() )
+      {
+         foundWord.insert(m_uidsLong.begin(), m_uidsLong.end());
+         approx = true;
+      }
+
+      if ( n == 0 )
+      {
+         found.swap(foundWord);
+      }
+      else
+      {
+         std::set<UIdType> both;
+         std::set_intersection(found.begin(), found.end(),
+                               foundWord.begin(), foundWord.end(),
+                               std::inserter(both, both.end()));
+         found.swap(both);
+      }
+
+      if ( found.empty() )
+         break;
+   }
+
+   uids.clear();
+   for ( std::set<UIdType>::const_iterator i = found.begin();
+         i != found.end();
+         ++i )
+   {
+      // skip the messages expunged since the index was loaded
+      if ( IsIndexed(*i) )
+         uids.push_back(*i);
+   }
+
+   // if the key is just a single word, without any delimiters around it, the
+   // messages containing it in any word contain the key itself and no
+   // further checks are needed
+   const WordCollector::Word& first = collector.m_words[0];
+   const bool exact = collector.m_countAll == 1 &&
+                        !first.atStart && !first.atEnd && !approx;
+
+   wxLogTrace(TRACE_FTINDEX,
+              _T("Found %lu %s for \"%s\" in the index of '%s' in %ldms"),
+              (unsigned long)uids.size(),
+              exact ? _T("matches") : _T("candidates"),
+              key.c_str(), m_folderName.c_str(), sw.Time());
+
+   return exact ? Find_Exact : Find_Candidates;
+}
+
+#ifdef TEST_FULLTEXT_INDEX
+
+// ----------------------------------------------------------------------------
+// search benchmark
+// ----------------------------------------------------------------------------
+
+// define this to build a program generating an mbox file with the given number
+// of synthetic messages, indexing it and comparing the time taken by the
+// searches using the index with the linear scan of all messages done without
+// it, as well as checking that both find the same messages (it must be linked
+// with the rest of the program objects)
+
+#include <wx/init.h>
+#include <wx/ffile.h>
+#include <wx/filename.h>
+
+#include <stdio.h>
+
+class FullTextIndexTest
+{
+public:
+   FullTextIndexTest(const String& filenameMbox, const String& filenameIndex);
+   ~FullTextIndexTest();
+
+   // write the mbox file with the given number of messages
+   bool Generate(size_t count);
+
+   // read the messages from the mbox file and index them
+   bool Index();
+
+   // save the index and load it back
+   bool SaveAndLoad();
+
+   // look for the key using the index and the linear scan and compare them
+   bool Search(const String& key);
+
+private:
+   // find the messages containing the key by looking at all of them
+   void Scan(const String& key, std::vector<UIdType>& uids) const;
+
+   // check if the message contains the string in lower case
+   bool Contains(UIdType uid, const String& keyLower) const
+      { return m_texts[uid - 1].find(keyLower) != String::npos; }
+
+   const String m_filenameMbox,
+                m_filenameIndex;
+
+   // the lower case text of all messages, the message with UID n is at n - 1
+   std::vector<String> m_texts;
+
+   FullTextIndex *m_index;
+
+   DECLARE_NO_COPY_CLASS(FullTextIndexTest)
+};
+
+FullTextIndexTest::FullTextIndexTest(const String& filenameMbox,
+                                     const String& filenameIndex)
+                 : m_filenameMbox(filenameMbox),
+                   m_filenameIndex(filenameIndex)
+{
+   m_index = NULL;
+}
+
+FullTextIndexTest::~FullTextIndexTest()
+{
+   delete m_index;
+}
+
+bool FullTextIndexTest::Generate(size_t count)
+{
+   wxFFile file(m_filenameMbox, _T("w"));
+   if ( !file.IsOpened() )
+      return false;
+
+   static const wxChar *words[] =
+   {
+      _T("the"), _T("mail"), _T("folder"), _T("message"), _T("server"),
+      _T("report"), _T("quarterly"), _T("meeting"), _T("tomorrow"),
+      _T("attached"), _T("please"), _T("review"), _T("release"), _T("build"),
+      _T("patch"), _T("thread"), _T("search"), _T("index"), _T("Mahogany"),
+      _T("configuration"), _T("problem"), _T("solution"), _T("thanks"),
+   };
+
+   // use a fixed pseudo random sequence to have the same data for all runs
+   unsigned long seed = 1;
+
+   const unsigned long countThreads = count / 10 + 1,
+                       countSenders = count / 100 + 1;
+
+   for ( size_t n = 0; n < count; n++ )
+   {
+      seed = seed * 1103515245 + 12345;
+      const unsigned long r = (seed >> 8) & 0xffffff;
+
+      String msg;
+      msg << _T("From sender") << r % countSenders
+          << _T("@example.com Sat Oct 17 12:00:00 2026\n")
+          << _T("From: Sender ") << r % countSenders
+          << _T(" <sender") << r % countSenders << _T("@example.com>\n")
+          << _T("To: list@example.org\n")
+          << _T("Subject: ") << (r % 3 ? _T("Re: ") : _T(""))
+          << _T("Thread number ") << r % countThreads << _T('\n')
+          << _T("Message-Id: <") << n << _T("@example.com>\n")
+          << _T('\n');
+
+      // the bodies use a small vocabulary and some rarer words, and a few of
+      // them contain long lines of encoded data which are indexed only
+      // partially
+      const size_t countLines = 5 + r % 20;
+      for ( size_t line = 0; line < countLines; line++ )
+      {
+         for ( size_t w = 0; w < 10; w++ )
+         {
+            seed = seed * 1103515245 + 12345;
+            const unsigned long rw = (seed >> 8) & 0xffffff;
+            if ( w )
+               msg << _T(' ');
+
+            if ( rw % 50 )
+               msg << words[rw % WXSIZEOF(words)];
+            else
+               msg << _T("word") << rw % 10000;
+         }
+
+         msg << _T('\n');
+      }
+
+      if ( !(r % 100) )
+      {
+         msg << String(_T('Q'), FULLTEXT_MAX_WORD_LEN)
+             << _T("report") << r << _T('\n');
+      }
+
+      msg << _T('\n');
+
+      if ( !file.Write(msg) )
+         return false;
+   }
+
+   return file.Close();
+}
+
+bool FullTextIndexTest::Index()
+{
+   wxFFile file(m_filenameMbox);
+   String mbox;
+   if ( !file.IsOpened() || !file.ReadAll(&mbox) )
+      return false;
+
+   delete m_index;
+   m_index = new FullTextIndex(_T("test"), 1, m_filenameIndex);
+
+   m_texts.clear();
+
+   // split the mbox in messages at the "From " lines and each message in
+   // the header and the body at the first empty line
+   static const wxChar *FROM_LINE = _T("\nFrom ");
+
+   size_t start = mbox.find(FROM_LINE + 1) == 0 ? 0 : String::npos;
+   while ( start != String::npos )
+   {
+      size_t end = mbox.find(FROM_LINE, start);
+      const String msg = mbox.substr(start, end == String::npos
+                                                ? String::npos
+                                                : end + 1 - start);
+      start = end == String::npos ? end : end + 1;
+
+      // skip the "From " line itself
+      const size_t posHeader = msg.find(_T('\n')) + 1;
+      size_t posBody = msg.find(_T("\n\n"), posHeader);
+      if ( posBody == String::npos )
+         posBody = msg.length();
+      else
+         posBody++;
+
+      const String header = msg.substr(posHeader, posBody - posHeader),
+                   body = msg.substr(posBody);
+
+      const UIdType uid = m_texts.size() + 1;
+      m_index->AddWords(m_index->m_header, uid, header);
+      m_index->AddWords(m_index->m_body, uid, body);
+      m_index->m_uids.insert(uid);
+
+      // this is what GetMessageText() returns for Field_All
+      m_texts.push_back((header + _T('\n') + body).Lower());
+   }
+
+   m_index->m_modified = true;
+
+   return !m_texts.empty();
+}
+
+bool FullTextIndexTest::SaveAndLoad()
+{
+   if ( !m_index->Save() )
+      return false;
+
+   delete m_index;
+   m_index = new FullTextIndex(_T("test"), 1, m_filenameIndex);
+
+   return m_index->Load() && m_index->GetCount() == m_texts.size();
+}
+
+void FullTextIndexTest::Scan(const String& key,
+                             std::vector<UIdType>& uids) const
+{
+   const String keyLower = key.Lower();
+
+   uids.clear();
+   for ( UIdType uid = 1; uid <= m_texts.size(); uid++ )
+   {
+      if ( Contains(uid, keyLower) )
+         uids.push_back(uid);
+   }
+}
+
+bool FullTextIndexTest::Search(const String& key)
+{
+   printf("Searching for \"%s\": ", (const char *)key.mb_str());
+   fflush(stdout);
+
+   const String keyLower = key.Lower();
+
+   wxStopWatch sw;
+   std::vector<UIdType> uids;
+   const FullTextIndex::FindResult
+      rc = m_index->Find(key, FullTextIndex::Field_All, uids);
+
+   // the candidates must be checked, just as MailFolderCmn does it
+   const size_t countCandidates = uids.size();
+   if ( rc == FullTextIndex::Find_Candidates )
+   {
+      std::vector<UIdType> uidsFound;
+      for ( size_t n = 0; n < uids.size(); n++ )
+      {
+         if ( Contains(uids[n], keyLower) )
+            uidsFound.push_back(uids[n]);
+      }
+
+      uids.swap(uidsFound);
+   }
+
+   const long timeIndex = sw.Time();
+
+   sw.Start();
+   std::vector<UIdType> uidsScan;
+   Scan(key, uidsScan);
+   const long timeScan = sw.Time();
+
+   if ( rc == FullTextIndex::Find_Unusable )
+   {
+      printf("index can't be used, scan %ldms\n", timeScan);
+      return true;
+   }
+
+   const bool ok = uids == uidsScan;
+   printf("%s\n"
+          "\t%lu found (%s, %lu candidates) using the index in %ldms, "
+          "%lu found by scan in %ldms\n",
+          ok ? "ok" : "ERROR",
+          (unsigned long)uids.size(),
+          rc == FullTextIndex::Find_Exact ? "exact" : "approximate",
+          (unsigned long)countCandidates, timeIndex,
+          (unsigned long)uidsScan.size(), timeScan);
+
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   unsigned long count = 10000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &count) != 1 || !count) )
+   {
+      fprintf(stderr, "Usage: %s [number of messages]\n", argv[0]);
+      return 2;
+   }
+
+   const String filenameMbox = wxFileName::CreateTempFileName(_T("mbox")),
+                filenameIndex = wxFileName::CreateTempFileName(_T("index"));
+   if ( filenameMbox.empty() || filenameIndex.empty() )
+   {
+      fprintf(stderr, "Failed to create the temporary files.\n");
+      return 2;
+   }
+
+   bool ok = true;
+
+   {
+      FullTextIndexTest test(filenameMbox, filenameIndex);
+
+      printf("Generating %lu messages: ", count);
+      fflush(stdout);
+
+      wxStopWatch sw;
+      if ( !test.Generate(count) )
+      {
+         printf("ERROR\n");
+         ok = false;
+      }
+      else
+      {
+         printf("ok (%ldms)\nIndexing them: ", sw.Time());
+         fflush(stdout);
+
+         sw.Start();
+         if ( !test.Index() )
+         {
+            printf("ERROR\n");
+            ok = false;
+         }
+         else
+         {
+            printf("ok (%ldms)\nSaving and loading the index: ", sw.Time());
+            fflush(stdout);
+
+            sw.Start();
+            if ( !test.SaveAndLoad() )
+            {
+               printf("ERROR\n");
+               ok = false;
+            }
+            else
+            {
+               printf("ok (%ldms)\n", sw.Time());
+            }
+         }
+      }
+
+      if ( ok )
+      {
+         static const wxChar *keys[] =
+         {
+            _T("quarterly"),          // common word
+            _T("word1234"),           // rare word
+            _T("Mahogany"),           // mixed case
+            _T("port"),               // part of a word
+            _T("quarterly report"),   // phrase
+            _T("sender12@example"),   // address
+            _T("review please "),     // ends at the word end
+            _T("qqqqreport"),         // inside the long words
+            _T("nonexistent"),        // not found at all
+            _T("a"),                  // too short for the index
+         };
+
+         for ( size_t n = 0; n < WXSIZEOF(keys); n++ )
+         {
+            if ( !test.Search(keys[n]) )
+               ok = false;
+         }
+      }
+   }
+
+   wxRemoveFile(filenameMbox);
+   wxRemoveFile(filenameIndex);
+
+   return ok ? 0 : 1;
+}
+
+#endif // TEST_FULLTEXT_INDEX
@@ -30,6 +30,7 @@
 #endif // USE_PCH
 
 #include "HeaderInfoImpl.h"
+#include "mail/MsgSort.h"
 
 #include "Sequence.h"
 #include "UIdArray.h"
@@ -39,12 +40,30 @@
 
 #include "gui/wxMDialogs.h"         // for MProgressInfo
 
+#include <wx/stopwatch.h>
+#include <wx/hashmap.h>
+
+#include <new>                   // for placement new
+
 // ----------------------------------------------------------------------------
 // options we use
 // ----------------------------------------------------------------------------
 
 extern const MOption MP_SHOWBUSY_DURING_SORT;
 
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the trace mask for the memory used by the headers
+#define TRACE_HIL_MEMORY _T("hilmem")
+
+// the number of HeaderInfo objects in the first slab of HeaderInfoArena, the
+// subsequent slabs are twice bigger than the previous ones up to the maximal
+// size
+static const size_t HEADERS_SLAB_SIZE_MIN = 256;
+static const size_t HEADERS_SLAB_SIZE_MAX = 16384;
+
 // ----------------------------------------------------------------------------
 // macros
 // ----------------------------------------------------------------------------
@@ -93,6 +112,11 @@ static inline MsgnoArray *SearchFolderByFlag(MailFolder *mf,
 // private classes
 // ----------------------------------------------------------------------------
 
+// the map used for HeaderInfoListImpl::m_uidIndex
+WX_DECLARE_HASH_MAP(UIdType, MsgnoType,
+                    wxIntegerHash, wxIntegerEqual,
+                    HeaderInfoUIdMap);
+
 // FindHeaderHelper just calls SearchByFlag() and deletes the results returned
 // by it automatically
 class FindHeaderHelper
@@ -376,6 +400,84 @@ BusyIndicator::~BusyIndicator()
    delete m_progInfo;
 }
 
+// ----------------------------------------------------------------------------
+// HeaderInfoArena
+// ----------------------------------------------------------------------------
+
+HeaderInfoArena::HeaderInfoArena()
+{
+   m_free = NULL;
+   m_countUsed = 0;
+}
+
+HeaderInfoArena::~HeaderInfoArena()
+{
+   ASSERT_MSG( !m_countUsed, _T("some HeaderInfo objects were not freed") );
+
+   FreeSlabs();
+}
+
+void HeaderInfoArena::AddSlab()
+{
+   size_t size = HEADERS_SLAB_SIZE_MIN << m_slabs.size();
+   if ( size > HEADERS_SLAB_SIZE_MAX || !size )
+      size = HEADERS_SLAB_SIZE_MAX;
+
+   Slot * const slab = new Slot[size];
+   m_slabs.push_back(slab);
+
+   // add all slots to the free list keeping them in order of increasing
+   // addresses as they're taken from its head
+   for ( size_t n = size; n > 0; n-- )
+   {
+      slab[n - 1].next = m_free;
+      m_free = &slab[n - 1];
+   }
+}
+
+void HeaderInfoArena::FreeSlabs()
+{
+   for ( size_t n = 0; n < m_slabs.size(); n++ )
+   {
+      delete [] m_slabs[n];
+   }
+
+   m_slabs.clear();
+   m_free = NULL;
+}
+
+HeaderInfo *HeaderInfoArena::Alloc()
+{
+   if ( !m_free )
+      AddSlab();
+
+   Slot * const slot = m_free;
+   m_free = slot->next;
+
+   m_countUsed++;
+
+   return new(slot->data) HeaderInfo;
+}
+
+void HeaderInfoArena::Free(HeaderInfo *hi)
+{
+   if ( !hi )
+      return;
+
+   ASSERT_MSG( m_countUsed, _T("freeing HeaderInfo not allocated by us?") );
+
+   hi->~HeaderInfo();
+
+   Slot * const slot = (Slot *)hi;
+   slot->next = m_free;
+   m_free = slot;
+
+   // release the memory as soon as possible: this happens when the folder
+   // is closed or all messages in it are deleted
+   if ( !--m_countUsed )
+      FreeSlabs();
+}
+
 // ----------------------------------------------------------------------------
 // HeaderInfo
 // ----------------------------------------------------------------------------
@@ -488,6 +590,11 @@ inline bool HeaderInfoListImpl::MustRebuildTables() const
    // exist at all yet
    if ( !HasTransTable() || m_mustRebuildTables )
    {
+      // if only new messages were added since the tables were built, don't
+      // free them as BuildTables() may be able to just update them
+      if ( HasTransTable() && m_canUpdateTables )
+         return true;
+
       ((HeaderInfoListImpl *)this)->FreeSortAndThreadData(); // const_cast
 
       // there is no need to rebuild tables for 1 msesage onl
@@ -510,6 +617,9 @@ inline void HeaderInfoListImpl::ScheduleTableRebuild()
    // simply set the flag: we keep the table data for GetOldPosFromIdx() needs,
    // but we will rebuild them as soon as possible
    m_mustRebuildTables = true;
+
+   // and we can't just insert the new messages into them any more
+   m_canUpdateTables = false;
 }
 
 // ----------------------------------------------------------------------------
@@ -539,6 +649,8 @@ HeaderInfoListImpl::HeaderInfoListImpl(MailFolder *mf)
    m_count = mf->GetMessageCount();
    m_headers.Alloc(m_count);
 
+   m_uidIndex = new HeaderInfoUIdMap;
+
    // no sorting/threading yet
    m_sizeTables = 0;
    m_tableSort =
@@ -552,14 +664,30 @@ HeaderInfoListImpl::HeaderInfoListImpl(MailFolder *mf)
 
    m_reverseOrder = false;
    m_mustRebuildTables = false;
+   m_canUpdateTables = false;
+   m_sortOrderTable = MSO_NONE;
 }
 
 void HeaderInfoListImpl::CleanUp()
 {
+   wxLogTrace(TRACE_HIL_MEMORY,
+              _T("Freeing %lu headers (%lu slabs, %lu shared strings)"),
+              (unsigned long)m_arena.GetCount(),
+              (unsigned long)m_arena.GetSlabCount(),
+              (unsigned long)m_strings.GetCount());
+
    // TODO: maintain first..last range of allocated headers to avoid iterating
-   //       over the entire array just to call delete for many NULL pointers?
+   //       over the entire array just to call Free() for many NULL pointers?
 
-   WX_CLEAR_ARRAY(m_headers);
+   const size_t count = m_headers.GetCount();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      m_arena.Free(m_headers[n]);
+   }
+
+   m_headers.Empty();
+
+   m_uidIndex->clear();
 
    m_lastMod++;
 
@@ -573,11 +701,14 @@ void HeaderInfoListImpl::FreeSortAndThreadData()
    FreeTables();
 
    m_sizeTables = 0;
+   m_canUpdateTables = false;
 }
 
 HeaderInfoListImpl::~HeaderInfoListImpl()
 {
    CleanUp();
+
+   delete m_uidIndex;
 }
 
 // ----------------------------------------------------------------------------
@@ -600,12 +731,14 @@ HeaderInfo *HeaderInfoListImpl::GetItemByIndex(MsgnoType n) const
       self->ExpandToMakeIndexValid(n);
 
       // alloc space for new header
-      const_cast<HeaderInfoListImpl *>(this)->m_headers[n] = new HeaderInfo;
+      self->AllocHeader(n);
 
       // get header info for the new header
       Sequence seq;
       seq.Add(n + 1);   // make msgno from index
       m_mf->GetHeaderInfo(self->m_headers, seq);
+
+      self->OnHeadersRetrieved(seq);
    }
 
    // the caller will crash...
@@ -620,6 +753,17 @@ HeaderInfo *HeaderInfoListImpl::GetItemByIndex(MsgnoType n) const
 
 MsgnoType HeaderInfoListImpl::GetIdxFromUId(UIdType uid) const
 {
+   HeaderInfoUIdMap::const_iterator i = m_uidIndex->find(uid);
+   if ( i != m_uidIndex->end() )
+   {
+      const MsgnoType idx = i->second;
+      if ( IsHeaderValid(idx) && m_headers[idx]->GetUId() == uid )
+         return idx;
+
+      FAIL_MSG( _T("UID index out of sync with the headers") );
+   }
+
+   // we don't have this header yet, fall back to asking the folder
    MsgnoType msgno = m_mf->GetMsgnoFromUID(uid);
 
    // this will return INDEX_ILLEGAL if msgno == MSGNO_ILLEGAL
@@ -757,7 +901,24 @@ void HeaderInfoListImpl::OnRemove(MsgnoType n)
 
    if ( n < m_headers.GetCount() )
    {
-      delete m_headers[n];
+      HeaderInfo * const hi = m_headers[n];
+      if ( hi && hi->IsValid() )
+         m_uidIndex->erase(hi->GetUId());
+
+      // the indices of all the headers after this one are shifted down
+      const size_t count = m_headers.GetCount();
+      for ( size_t idx = n + 1; idx < count; idx++ )
+      {
+         const HeaderInfo * const hiNext = m_headers[idx];
+         if ( !hiNext || !hiNext->IsValid() )
+            continue;
+
+         HeaderInfoUIdMap::iterator i = m_uidIndex->find(hiNext->GetUId());
+         if ( i != m_uidIndex->end() )
+            i->second = idx - 1;
+      }
+
+      m_arena.Free(hi);
       m_headers.RemoveAt(n);
 
       // the indices are shifted (and one is even removed completely), so
@@ -1106,6 +1267,10 @@ void HeaderInfoListImpl::OnAdd(MsgnoType countNew)
       the sort/thread data only when we need it next. Of course, for this to
       work the code should always check for m_mustRebuildTables or call
       MustRebuildTables() before using them.
+
+      Moreover, if no messages are removed before the tables are needed, we
+      don't even rebuild them but just insert the new messages in them, see
+      UpdateTables().
     */
 
    m_mustRebuildTables = true;
@@ -1473,7 +1638,19 @@ void HeaderInfoListImpl::BuildTables()
    {
       ASSERT_MSG( m_tablePos, _T("should have inverse table as well!") );
 
-      return;
+      if ( !m_mustRebuildTables )
+         return;
+
+      // they're out of date because of the new messages, but we may be able
+      // to just insert them into the existing tables
+      if ( UpdateTables() )
+         return;
+
+      FreeSortAndThreadData();
+
+      // normally can't happen as we only get here if new messages were added
+      if ( m_count < 2 )
+         return;
    }
 
    // what is it inverse for?
@@ -1581,7 +1758,125 @@ void HeaderInfoListImpl::BuildTables()
    // first sorting/threading done
    m_firstSort = false;
 
+   // the new messages may be added to these tables later
+   m_canUpdateTables = HasTransTable();
+
+   CHECK_TABLES();
+}
+
+bool HeaderInfoListImpl::UpdateTables()
+{
+   // we can only add the new messages if no old ones were removed in the
+   // meanwhile and if we still have all the data the tables were built from
+   if ( !m_canUpdateTables || m_sizeTables >= m_count )
+      return false;
+
+   if ( GetSortCritDirect(m_sortParams.sortOrder) != MSO_NONE && !m_tableSort )
+      return false;
+
+   // and we can only add the messages to the tree if it was built locally
+   if ( IsThreading() &&
+         (!m_thrData || !m_thrData->m_root || !m_thrData->m_jwzIndex) )
+      return false;
+
+   wxStopWatch stopwatch;
+
+   const MsgnoType countOld = m_sizeTables;
+   MsgnoType countNew = m_count;
+
+   // get all new headers at once: note that this calls cclient and so
+   // OnAdd() and OnRemove() may be called from here
+   CacheMsgnos(countOld + 1, countNew);
+
+   // if any of the old messages was removed, we can't update the tables
+   if ( !m_canUpdateTables || m_sizeTables != countOld )
+      return false;
+
+   // but if only the new ones were, it's fine, just add less messages
+   if ( countNew > m_count )
+      countNew = m_count;
+
+   // insert the new messages into the sort table in the same order as was
+   // used when it was built by Sort() (notice that if it was sorted on the
+   // server, we still insert the new messages using local comparison)
+   MsgnoType *tableSort = NULL;
+   if ( m_tableSort )
+   {
+      SortParams sortParams = m_sortParams;
+      sortParams.sortOrder = m_sortOrderTable;
+
+      tableSort = new MsgnoType[countNew];
+      memcpy(tableSort, m_tableSort, countOld*sizeof(MsgnoType));
+
+      MessageSorter sorter(this, sortParams, MessageSorter::Keys_OnDemand);
+      sorter.InsertNew(tableSort, countOld, countNew);
+   }
+
+   // and attach them to the existing threads
+   ThreadData *thrData = NULL;
+   if ( IsThreading() )
+   {
+      // the arrays must be reallocated but the tree is just moved
+      thrData = new ThreadData(countNew);
+      thrData->m_root = m_thrData->m_root;
+      thrData->m_jwzIndex = m_thrData->m_jwzIndex;
+      m_thrData->m_root = NULL;
+      m_thrData->m_jwzIndex = NULL;
+
+      if ( !JWZThreadNewMessages(this, thrData, countOld + 1, countNew) )
+      {
+         // the tree is partially modified, get rid of it
+         delete thrData;
+         delete [] tableSort;
+
+         return false;
+      }
+   }
+
+   // everything succeeded, replace the old data with the new one
+   FreeTables();
+
+   if ( tableSort )
+   {
+      delete [] m_tableSort;
+      m_tableSort = tableSort;
+   }
+
+   if ( thrData )
+   {
+      delete m_thrData;
+      m_thrData = thrData;
+   }
+
+   m_sizeTables = countNew;
+
+   // more messages could have arrived while we were retrieving the headers
+   m_mustRebuildTables = m_sizeTables != m_count;
+
+   if ( IsThreading() )
+   {
+      // the sort table was built for the direct order even if the messages
+      // were reversed when the tables were built, see BuildTables()
+      m_reverseOrder = m_sortOrderTable != m_sortParams.sortOrder;
+
+      CombineSortAndThread();
+
+      m_reverseOrder = false;
+   }
+   else // just sorting
+   {
+      m_tableMsgno = m_tableSort;
+      m_dontFreeMsgnos = true;
+
+      BuildPosTable();
+   }
+
+   wxLogTrace(TRACE_SORT, _T("Added %lu new messages to the tables in %ldms"),
+              (unsigned long)(countNew - countOld), stopwatch.Time());
+
    CHECK_TABLES();
+
+   return true;
 }
 
 bool HeaderInfoListImpl::RebuildTablesIfNecessary()
@@ -1687,6 +1982,9 @@ bool HeaderInfoListImpl::Sort()
             m_sortParams.sortOrder &= ~1;
          }
 
+         // remember the order the table is really sorted in for UpdateTables()
+         m_sortOrderTable = m_sortParams.sortOrder;
+
          bool ok = m_mf->SortMessages(m_tableSort, m_sortParams);
          if ( ok )
          {
@@ -1910,10 +2208,7 @@ void HeaderInfoListImpl::ExpandToMakeIndexValid(MsgnoType n)
       // pointers
       m_lastMod++;
 
-      while ( count++ <= n )
-      {
-         m_headers.Add(NULL);
-      }
+      m_headers.Add(NULL, n + 1 - count);
    }
 }
 
@@ -1940,7 +2235,7 @@ void HeaderInfoListImpl::Cache(const Sequence& seq)
       {
          countNotInCache++;
 
-         m_headers[idx] = new HeaderInfo;
+         AllocHeader(idx);
       }
    }
 
@@ -1951,6 +2246,30 @@ void HeaderInfoListImpl::Cache(const Sequence& seq)
                              _("Retrieving %u headers..."), countNotInCache);
 
       m_mf->GetHeaderInfo(m_headers, seq);
+
+      OnHeadersRetrieved(seq);
+   }
+}
+
+void HeaderInfoListImpl::OnHeadersRetrieved(const Sequence& seq)
+{
+   // note that the headers array could have changed while we were retrieving
+   // the headers, so check that the indices are still valid
+   size_t n;
+   for ( UIdType i = seq.GetFirst(n); i != UID_ILLEGAL; i = seq.GetNext(i, n) )
+   {
+      const MsgnoType idx = GetIdxFromMsgno(i);
+      if ( !IsHeaderValid(idx) )
+         continue;
+
+      HeaderInfo * const hi = m_headers[idx];
+      m_strings.Intern(hi->m_From);
+      m_strings.Intern(hi->m_To);
+      m_strings.Intern(hi->m_NewsGroups);
+      m_strings.Intern(hi->m_References);
+
+      if ( hi->IsValid() )
+         (*m_uidIndex)[hi->GetUId()] = idx;
    }
 }
 
@@ -2051,7 +2370,7 @@ bool HeaderInfoListImpl::ReallyGet(MsgnoType pos)
       FAIL_MSG( _T("not supposed to be called") );
 
       // but still don't crash
-      m_headers[idx] = new HeaderInfo;
+      AllocHeader(idx);
    }
 
    if ( m_headers[idx]->IsValid() )
@@ -2064,7 +2383,12 @@ bool HeaderInfoListImpl::ReallyGet(MsgnoType pos)
    Sequence seq;
    seq.Add(GetMsgnoFromIdx(idx));
 
-   return m_mf->GetHeaderInfo(m_headers, seq) == 1;
+   if ( m_mf->GetHeaderInfo(m_headers, seq) != 1 )
+      return false;
+
+   OnHeadersRetrieved(seq);
+
+   return true;
 }
 
 // ----------------------------------------------------------------------------
@@ -2082,3 +2406,204 @@ String HeaderInfoListImpl::DebugDump() const
 }
 
 #endif // DEBUG
+
+#ifdef TEST_HEADER_MEMORY
+
+// ----------------------------------------------------------------------------
+// headers memory test
+// ----------------------------------------------------------------------------
+
+// define this to build a program measuring the memory used by a big listing
+// and the time needed to create and destroy it when its headers are allocated
+// from HeaderInfoArena and share their strings using StringInterner, as done
+// by HeaderInfoListImpl, and when each header is allocated separately and has
+// its own strings, as before (it must be linked with the rest of the program
+// objects)
+
+#include <wx/init.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __LINUX__
+   #include <unistd.h>
+   #include <sys/wait.h>
+#endif // __LINUX__
+
+// return the resident memory size of this process in KB or 0 if unknown
+static unsigned long GetResidentMemory()
+{
+   unsigned long rss = 0;
+
+#ifdef __LINUX__
+   FILE *fp = fopen("/proc/self/statm", "r");
+   if ( fp )
+   {
+      unsigned long size;
+      if ( fscanf(fp, "%lu %lu", &size, &rss) == 2 )
+         rss *= sysconf(_SC_PAGESIZE) / 1024;
+      else
+         rss = 0;
+
+      fclose(fp);
+   }
+#endif // __LINUX__
+
+   return rss;
+}
+
+// fills the synthetic headers
+class HeaderInfoMemoryTest
+{
+public:
+   // fill the header for the message n of the folder
+   static void Fill(HeaderInfo *hi, size_t n)
+   {
+      // the values are chosen to be similar to a mailing list archive: there
+      // are many messages in each thread, written by the same people
+      const size_t thread = n / 20,
+                   sender = (n * 7) % 500;
+
+      hi->m_UId = n + 1;
+      hi->m_Subject = String::Format(_T("Re: [list] thread number %lu"),
+                                     (unsigned long)thread);
+      hi->m_Id = String::Format(_T("<%lu.message@example.com>"),
+                                (unsigned long)n);
+      hi->m_InReplyTo = String::Format(_T("<%lu.message@example.com>"),
+                                       (unsigned long)(thread * 20));
+      hi->m_From = String::Format(_T("Sender %lu <sender%lu@example.com>"),
+                                  (unsigned long)sender,
+                                  (unsigned long)sender);
+      hi->m_To = String(_T("Mailing List <list@lists.example.com>"));
+
+      String refs;
+      for ( size_t m = thread * 20; m < n && m < thread * 20 + 5; m++ )
+      {
+         refs += String::Format(_T("<%lu.message@example.com>"),
+                                (unsigned long)m);
+      }
+      hi->m_References = refs;
+
+      hi->m_Date = 1000000000 + n * 60;
+      hi->m_Size = 2000 + n % 10000;
+      hi->m_Status = MailFolder::MSG_STAT_SEEN;
+   }
+
+   // intern the strings of the header
+   static void Intern(StringInterner& strings, HeaderInfo *hi)
+   {
+      strings.Intern(hi->m_From);
+      strings.Intern(hi->m_To);
+      strings.Intern(hi->m_NewsGroups);
+      strings.Intern(hi->m_References);
+   }
+};
+
+// create and destroy count headers and report the time and memory this took
+static void TestHeaders(size_t count, bool useArena)
+{
+   const unsigned long rssStart = GetResidentMemory();
+
+   wxStopWatch sw;
+
+   std::vector<HeaderInfo *> headers(count);
+
+   HeaderInfoArena arena;
+   StringInterner strings;
+   for ( size_t n = 0; n < count; n++ )
+   {
+      HeaderInfo *hi = useArena ? arena.Alloc() : new HeaderInfo;
+      HeaderInfoMemoryTest::Fill(hi, n);
+      if ( useArena )
+         HeaderInfoMemoryTest::Intern(strings, hi);
+
+      headers[n] = hi;
+   }
+
+   const long timeCreate = sw.Time();
+   const unsigned long rss = GetResidentMemory();
+
+   sw.Start();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      if ( useArena )
+         arena.Free(headers[n]);
+      else
+         delete headers[n];
+   }
+
+   const long timeDelete = sw.Time();
+
+   printf("%s: %lu headers created in %ldms and deleted in %ldms, ",
+          useArena ? "arena and interned strings" : "separate allocations",
+          (unsigned long)count, timeCreate, timeDelete);
+
+   if ( rss )
+   {
+      printf("using %luKB (%lu bytes per header)",
+             rss - rssStart,
+             (unsigned long)(((rss - rssStart) * 1024.) / count));
+   }
+   else
+   {
+      printf("memory use unknown");
+   }
+
+   if ( useArena )
+   {
+      printf(", %lu shared strings", (unsigned long)strings.GetCount());
+   }
+
+   printf("\n");
+   fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   unsigned long count = 500000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &count) != 1 || !count) )
+   {
+      fprintf(stderr, "Usage: %s [number of headers] [old|new]\n", argv[0]);
+      return 2;
+   }
+
+   if ( argc > 2 )
+   {
+      TestHeaders(count, strcmp(argv[2], "old") != 0);
+      return 0;
+   }
+
+#ifdef __LINUX__
+   // the memory freed by the first test is reused by the second one, so run
+   // each of them in its own process to measure it correctly
+   for ( int useArena = 0; useArena < 2; useArena++ )
+   {
+      const pid_t pid = fork();
+      if ( pid == -1 )
+      {
+         perror("fork");
+         return 1;
+      }
+
+      if ( !pid )
+      {
+         TestHeaders(count, useArena != 0);
+         return 0;
+      }
+
+      int status;
+      waitpid(pid, &status, 0);
+   }
+#else // !__LINUX__
+   TestHeaders(count, false);
+   TestHeaders(count, true);
+#endif // __LINUX__/!__LINUX__
+
+   return 0;
+}
+
+#endif // TEST_HEADER_MEMORY
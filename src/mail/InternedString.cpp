@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/InternedString.cpp: InternedString and StringInterner
+// Purpose:     sharing the same string values between many HeaderInfo objects
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+// ============================================================================
+// declarations
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// headers
+// ----------------------------------------------------------------------------
+
+#include  "Mpch.h"
+
+#ifndef  USE_PCH
+#  include "Mcommon.h"
+#endif // USE_PCH
+
+#include "mail/InternedString.h"
+
+#include <wx/hashset.h>
+
+// ----------------------------------------------------------------------------
+// StringInternerSet: the hash set of the interned strings data
+// ----------------------------------------------------------------------------
+
+struct StringInternerHash
+{
+   unsigned long operator()(const InternedString::Data *data) const
+   {
+      return wxStringHash()(data->str);
+   }
+
+   StringInternerHash& operator=(const StringInternerHash&) { return *this; }
+};
+
+struct StringInternerEqual
+{
+   bool operator()(const InternedString::Data *data1,
+                   const InternedString::Data *data2) const
+   {
+      return data1->str == data2->str;
+   }
+
+   StringInternerEqual& operator=(const StringInternerEqual&) { return *this; }
+};
+
+WX_DECLARE_HASH_SET(InternedString::Data *,
+                    StringInternerHash,
+                    StringInternerEqual,
+                    StringInternerSet);
+
+// ============================================================================
+// InternedString implementation
+// ============================================================================
+
+const String InternedString::ms_empty;
+
+InternedString& InternedString::operator=(const InternedString& other)
+{
+   // increment first to handle self assignment correctly
+   if ( other.m_data )
+      other.m_data->refs++;
+
+   Release();
+
+   m_data = other.m_data;
+
+   return *this;
+}
+
+InternedString& InternedString::operator=(const String& s)
+{
+   Release();
+
+   // don't allocate anything for the empty strings, they're very common
+   m_data = s.empty() ? NULL : new Data(s);
+
+   return *this;
+}
+
+void InternedString::Release()
+{
+   if ( m_data && !--m_data->refs )
+   {
+      if ( m_data->owner )
+         m_data->owner->Remove(m_data);
+
+      delete m_data;
+   }
+
+   m_data = NULL;
+}
+
+// ============================================================================
+// StringInterner implementation
+// ============================================================================
+
+StringInterner::StringInterner()
+{
+   m_set = new StringInternerSet;
+}
+
+StringInterner::~StringInterner()
+{
+   // the strings may still be used by somebody else (e.g. copies of the
+   // HeaderInfo objects), so don't delete them but just detach them from us
+   for ( StringInternerSet::iterator i = m_set->begin();
+         i != m_set->end();
+         ++i )
+   {
+      (*i)->owner = NULL;
+   }
+
+   delete m_set;
+}
+
+size_t StringInterner::GetCount() const
+{
+   return m_set->size();
+}
+
+void StringInterner::Intern(InternedString& s)
+{
+   InternedString::Data * const data = s.m_data;
+
+   // nothing to do for empty strings nor those already interned (either by
+   // us or by another interner: we don't want to steal them from it)
+   if ( !data || data->owner )
+      return;
+
+   StringInternerSet::iterator i = m_set->find(data);
+   if ( i == m_set->end() )
+   {
+      // this is a new string, just add it to the table
+      data->owner = this;
+      m_set->insert(data);
+   }
+   else // use the existing data, this will free the one used by s
+   {
+      InternedString::Data * const dataShared = *i;
+      dataShared->refs++;
+
+      s.Release();
+      s.m_data = dataShared;
+   }
+}
+
+void StringInterner::Remove(InternedString::Data *data)
+{
+   ASSERT_MSG( data->owner == this, _T("removing string not interned by us") );
+
+   m_set->erase(data);
+}
@@ -26,6 +26,9 @@
    #include <wx/wxchar.h>
 #endif // USE_PCH
 
+#include <wx/file.h>
+#include <wx/filename.h>
+#include <wx/stopwatch.h>
 #include <wx/textfile.h>
 
 #include "MEvent.h"
@@ -33,18 +36,24 @@
 #include "MFCache.h"
 #include "MFStatus.h"
 
+#include <vector>
+
 // ----------------------------------------------------------------------------
 // constants
 // ----------------------------------------------------------------------------
 
-// location of the cache file
+// location of the old text cache file
 #define CACHE_FILENAME _T("status")
 
+// location of the binary cache file and its journal
+#define CACHE_DATA_FILENAME _T("status.db")
+#define CACHE_JOURNAL_FILENAME _T("status.log")
+
 // the delimiter in the text file lines
 #define CACHE_DELIMITER _T(":")      // string, not char, to allow concatenating
 #define CACHE_DELIMITER_CH (CACHE_DELIMITER[0])
 
-// the versions of the file format we know about
+// the versions of the text file format we know about
 enum CacheFileFormat
 {
    CacheFile_1_0,    // name:total:unread:flagged
@@ -53,12 +62,126 @@ enum CacheFileFormat
    CacheFile_Max
 };
 
+// the signatures at the start of the binary data and journal files
+static const char STATUS_DATA_MAGIC[8] = { 'M', 'F', 'S', 'T', 'A', 'T', 'U', 'S' };
+static const char STATUS_JOURNAL_MAGIC[8] = { 'M', 'F', 'S', 'T', 'J', 'R', 'N', 'L' };
+
+// the current version of the binary format: increment it if any of the file
+// structures below change, the old files will be simply discarded then
+static const wxUint32 STATUS_FORMAT_VERSION = 1;
+
+// the value used for the invalid total number of messages in the file
+static const wxUint32 STATUS_INVALID_COUNT = 0xffffffff;
+
+// the journal is merged into the data file when it has more entries than this
+// or than a quarter of the data file entries, whichever is bigger
+static const size_t STATUS_JOURNAL_MIN_SIZE = 256;
+
+// ----------------------------------------------------------------------------
+// binary file format
+// ----------------------------------------------------------------------------
+
+// the data file consists of the header, the records, the hash index and the
+// names of all folders in UTF-8 (without trailing NULs)
+struct MfStatusCache::FileHeader
+{
+   char magic[8];
+   wxUint32 version;
+
+   // incremented every time the file is rewritten
+   wxUint32 generation;
+
+   wxUint32 countRecords;
+
+   // the number of slots in the index, always a power of 2
+   wxUint32 sizeIndex;
+
+   wxUint32 sizeNames;
+
+   wxUint32 padding;
+};
+
+struct MfStatusCache::FileRecord
+{
+   // the hash of the folder name
+   wxUint32 hash;
+
+   // the location of the folder name in the names part of the file
+   wxUint32 offsetName;
+   wxUint32 lenName;
+
+   // the status of the folder, we don't store the number of recent messages
+   // because they won't be recent the next time we run anyhow nor the number
+   // of messages matching the search criteria as this is hardly ever useful
+   wxUint32 total;
+   wxUint32 newmsgs;
+   wxUint32 unread;
+   wxUint32 flagged;
+
+   wxUint32 padding;
+};
+
+// the index is an open addressing hash table with linear probing containing
+// the record indices plus 1 or 0 for the empty slots
+
+// the journal consists of the header followed by the records, each of them
+// immediately followed by the folder name in UTF-8
+struct MfStatusCache::JournalHeader
+{
+   char magic[8];
+   wxUint32 version;
+
+   // the generation of the data file this journal applies to
+   wxUint32 generation;
+};
+
+struct MfStatusCache::JournalRecord
+{
+   wxUint32 lenName;
+
+   // non zero if the folder was removed, the other fields are unused then
+   wxUint32 isRemoved;
+
+   wxUint32 total;
+   wxUint32 newmsgs;
+   wxUint32 unread;
+   wxUint32 flagged;
+};
+
 // ----------------------------------------------------------------------------
 // globals
 // ----------------------------------------------------------------------------
 
 static MfStatusCache *gs_mfStatusCache = NULL;
 
+// ----------------------------------------------------------------------------
+// helper functions
+// ----------------------------------------------------------------------------
+
+// FNV-1a hash of the folder name in UTF-8
+static wxUint32 HashFolderName(const char *name, size_t len)
+{
+   wxUint32 hash = 2166136261u;
+   for ( size_t n = 0; n < len; n++ )
+   {
+      hash ^= (unsigned char)name[n];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+// convert the total number of messages to and from its stored form
+static inline wxUint32 TotalToFile(unsigned long total)
+{
+   return total == UID_ILLEGAL ? STATUS_INVALID_COUNT : (wxUint32)total;
+}
+
+static inline unsigned long TotalFromFile(wxUint32 total)
+{
+   return total == STATUS_INVALID_COUNT ? UID_ILLEGAL : total;
+}
+
 // ============================================================================
 // implementation
 // ============================================================================
@@ -89,15 +212,55 @@ void MfStatusCache::CleanUp()
 }
 
 MfStatusCache::MfStatusCache()
+             : m_dirname(GetCacheDirName())
 {
-   Load();
+   Init();
+}
 
-   // register for folder rename events
-   m_evtmanHandle = MEventManager::Register(*this, MEventId_FolderTreeChange);
+MfStatusCache::MfStatusCache(const String& dirname)
+             : m_dirname(dirname)
+{
+   Init();
+}
+
+void MfStatusCache::Init()
+{
+   m_records = NULL;
+   m_countRecords = 0;
+   m_index = NULL;
+   m_sizeIndex = 0;
+   m_names = NULL;
+   m_sizeNames = 0;
+
+   m_generation = 0;
+   m_countJournal = 0;
 
    // no changes yet
    m_isDirty =
    m_hasFailedToSave = false;
+
+   if ( !LoadData() && wxFileExists(GetFileName()) )
+   {
+      // convert the cache file in the old text format to the new one
+      Load();
+
+      if ( !m_entries.empty() )
+      {
+         m_isDirty = true;
+
+         if ( Save() )
+         {
+            wxLogTrace(M_TRACE_MFSTATUS,
+                       _T("Converted status cache of %lu folders to binary"),
+                       (unsigned long)m_entries.size());
+
+            wxRemoveFile(GetFileName());
+         }
+      }
+   }
+
+   // register for folder rename events
+   m_evtmanHandle = MEventManager::Register(*this, MEventId_FolderTreeChange);
 }
 
 MfStatusCache::~MfStatusCache()
@@ -109,8 +272,7 @@ MfStatusCache::~MfStatusCache()
 
    Save();
 
-   // delete the elements too
-   WX_CLEAR_ARRAY(m_folderData);
+   Unmap();
 }
 
 // ----------------------------------------------------------------------------
@@ -120,14 +282,33 @@ MfStatusCache::~MfStatusCache()
 bool MfStatusCache::OnMEvent(MEventData& ev)
 {
    MEventFolderTreeChangeData& event = (MEventFolderTreeChangeData&)ev;
-   if ( event.GetChangeKind() == MEventFolderTreeChangeData::Rename )
+   switch ( event.GetChangeKind() )
    {
-      // keep the status cache entry for the old folder
-      int index = m_folderNames.Index(event.GetFolderFullName());
-      if ( index != wxNOT_FOUND )
-      {
-         m_folderNames[index] = event.GetNewFolderName();
-      }
+      case MEventFolderTreeChangeData::Rename:
+         {
+            // keep the status cache entry for the old folder
+            MailFolderStatus status;
+            if ( FindStatus(event.GetFolderFullName(), &status) )
+            {
+               RemoveStatus(event.GetFolderFullName());
+
+               MfStatusCacheEntry& entry = m_entries[event.GetNewFolderName()];
+               entry.status = status;
+               entry.isDirty = true;
+               entry.isRemoved = false;
+
+               m_isDirty = true;
+            }
+         }
+         break;
+
+      case MEventFolderTreeChangeData::Delete:
+         RemoveStatus(event.GetFolderFullName());
+         break;
+
+      default:
+         // nothing to do
+         ;
    }
 
    // continue with the event processing
@@ -138,11 +319,85 @@ bool MfStatusCache::OnMEvent(MEventData& ev)
 // MfStatusCache data access
 // ----------------------------------------------------------------------------
 
+const MfStatusCache::FileRecord *
+MfStatusCache::FindRecord(const String& folderName) const
+{
+   if ( !m_sizeIndex )
+      return NULL;
+
+   const wxCharBuffer buf(folderName.utf8_str());
+   const char * const name = buf.data();
+   const size_t len = strlen(name);
+   const wxUint32 hash = HashFolderName(name, len);
+
+   const size_t mask = m_sizeIndex - 1;
+   for ( size_t slot = hash & mask, n = 0;
+         n < m_sizeIndex;
+         slot = (slot + 1) & mask, n++ )
+   {
+      const wxUint32 index = m_index[slot];
+      if ( !index )
+      {
+         // an empty slot, so the folder is not in the table
+         break;
+      }
+
+      if ( index > m_countRecords )
+      {
+         // corrupted file, don't crash at least
+         break;
+      }
+
+      const FileRecord& rec = m_records[index - 1];
+      if ( rec.hash == hash &&
+            rec.lenName == len &&
+             rec.offsetName + len <= m_sizeNames &&
+              memcmp(m_names + rec.offsetName, name, len) == 0 )
+      {
+         return &rec;
+      }
+   }
+
+   return NULL;
+}
+
+bool MfStatusCache::FindStatus(const String& folderName,
+                               MailFolderStatus *status) const
+{
+   // the entries in memory override the contents of the data file
+   MfStatusCacheMap::const_iterator i = m_entries.find(folderName);
+   if ( i != m_entries.end() )
+   {
+      if ( i->second.isRemoved )
+         return false;
+
+      if ( status )
+         *status = i->second.status;
+
+      return true;
+   }
+
+   const FileRecord *rec = FindRecord(folderName);
+   if ( !rec )
+      return false;
+
+   if ( status )
+   {
+      status->Init();
+      status->total = TotalFromFile(rec->total);
+      status->newmsgs = rec->newmsgs;
+      status->unread = rec->unread;
+      status->flagged = rec->flagged;
+   }
+
+   return true;
+}
+
 bool MfStatusCache::GetStatus(const String& folderName,
                               MailFolderStatus *status)
 {
-   int n = m_folderNames.Index(folderName);
-   if ( n == wxNOT_FOUND || !m_folderData[(size_t)n]->IsValid() )
+   MailFolderStatus statusCached;
+   if ( !FindStatus(folderName, &statusCached) || !statusCached.IsValid() )
    {
       // no status or at least no valid status
       return false;
@@ -150,7 +405,7 @@ bool MfStatusCache::GetStatus(const String& folderName,
 
    if ( status )
    {
-      *status = *m_folderData[(size_t)n];
+      *status = statusCached;
    }
 
    return true;
@@ -161,21 +416,17 @@ void MfStatusCache::UpdateStatus(const String& folderName,
 {
    CHECK_RET( status.IsValid(), _T("invalid status in MfStatusCache") );
 
-   int n = m_folderNames.Index(folderName);
-   if ( n == wxNOT_FOUND )
+   MailFolderStatus statusOld;
+   if ( !FindStatus(folderName, &statusOld) )
    {
       wxLogTrace(M_TRACE_MFSTATUS,
                  _T("Added status for '%s' (%lu total, %lu unread)"),
                  folderName.c_str(), status.total, status.unread);
-
-      // add it
-      n = m_folderNames.Add(folderName);
-      m_folderData.Insert(new MailFolderStatus, (size_t)n);
    }
    else // already have it
    {
       // did it really change?
-      if ( *m_folderData[(size_t)n] == status )
+      if ( statusOld == status )
       {
          // no, avoid sending the event below
          return;
@@ -187,7 +438,11 @@ void MfStatusCache::UpdateStatus(const String& folderName,
    }
 
    // update
-   *m_folderData[(size_t)n] = status;
+   MfStatusCacheEntry& entry = m_entries[folderName];
+   entry.status = status;
+   entry.isDirty = true;
+   entry.isRemoved = false;
+
    m_isDirty = true;
 
    // and tell everyone about it
@@ -199,14 +454,17 @@ void MfStatusCache::InvalidateStatus(const String& folderName)
    wxLogTrace(M_TRACE_MFSTATUS, _T("Invalidated status for '%s'"),
               folderName.c_str());
 
-   int n = m_folderNames.Index(folderName);
-   if ( n != wxNOT_FOUND )
+   MailFolderStatus status;
+   if ( FindStatus(folderName, &status) )
    {
       // don't remove it because chances are that an UpdateStatus() for the
       // same folder will follow soon (as we typically invalidate the status
       // when noticing new mail in the folder and then update it as soon as we
       // know how many new messages we have got) but just invalidate for now
-      m_folderData[(size_t)n]->total = UID_ILLEGAL;
+      MfStatusCacheEntry& entry = m_entries[folderName];
+      entry.status = status;
+      entry.status.total = UID_ILLEGAL;
+      entry.isDirty = true;
 
       m_isDirty = true;
    }
@@ -215,20 +473,78 @@ void MfStatusCache::InvalidateStatus(const String& folderName)
    MEventManager::Send(new MEventFolderStatusData(folderName));
 }
 
+void MfStatusCache::RemoveStatus(const String& folderName)
+{
+   const bool isInFile = FindRecord(folderName) != NULL;
+
+   MfStatusCacheMap::iterator i = m_entries.find(folderName);
+   if ( i == m_entries.end() )
+   {
+      if ( !isInFile )
+      {
+         // we don't have anything for it
+         return;
+      }
+
+      i = m_entries.insert(
+            MfStatusCacheMap::value_type(folderName, MfStatusCacheEntry())).first;
+   }
+   else if ( !isInFile && !i->second.isInJournal )
+   {
+      // it had never been written to disk, so just forget it
+      m_entries.erase(i);
+
+      return;
+   }
+
+   wxLogTrace(M_TRACE_MFSTATUS, _T("Removed status for '%s'"),
+              folderName.c_str());
+
+   // we need to keep the entry to override the data on disk
+   i->second.isRemoved = true;
+   i->second.isDirty = true;
+
+   m_isDirty = true;
+}
+
 // ----------------------------------------------------------------------------
 // MfStatusCache loading/saving
 // ----------------------------------------------------------------------------
 
 /*
-   We use a simple text file for cache right now - if this proves to be too
-   slow or disk space consuming, we can always switch to something more
-   efficient here, the only methods to change are those below.
+   The status is kept in a binary file described at the top of this file
+   which is never parsed but just mapped in memory and the changes to it are
+   kept in memory in m_entries.
+
+   When saving, the changed status of the folders already present in the data
+   file is written directly over their records and the status of the new or
+   removed folders is appended to the journal. When the journal becomes too
+   big, both files are merged into a new data file.
+
+   The old text file is only read, if there is no binary file yet, using the
+   CacheFile methods.
  */
 
 String MfStatusCache::GetFileName() const
 {
    String filename;
-   filename << GetCacheDirName() << DIR_SEPARATOR << CACHE_FILENAME;
+   filename << m_dirname << DIR_SEPARATOR << CACHE_FILENAME;
+
+   return filename;
+}
+
+String MfStatusCache::GetDataFileName() const
+{
+   String filename;
+   filename << m_dirname << DIR_SEPARATOR << CACHE_DATA_FILENAME;
+
+   return filename;
+}
+
+String MfStatusCache::GetJournalFileName() const
+{
+   String filename;
+   filename << m_dirname << DIR_SEPARATOR << CACHE_JOURNAL_FILENAME;
 
    return filename;
 }
@@ -243,6 +559,189 @@ int MfStatusCache::GetFormatVersion() const
    return BuildVersion(1, 1);
 }
 
+void MfStatusCache::Unmap()
+{
+   m_data.Free();
+
+   m_records = NULL;
+   m_countRecords = 0;
+   m_index = NULL;
+   m_sizeIndex = 0;
+   m_names = NULL;
+   m_sizeNames = 0;
+}
+
+bool MfStatusCache::MapData()
+{
+   Unmap();
+
+   const String filename = GetDataFileName();
+   if ( !wxFileExists(filename) )
+      return false;
+
+   if ( !m_data.Load(filename) )
+      return false;
+
+   const char * const data = m_data.GetData();
+   const size_t sizeData = m_data.GetSize();
+
+   // check that the file is valid: notice that we don't check all the
+   // records here to keep loading fast, FindRecord() checks them instead
+   bool ok = sizeData >= sizeof(FileHeader);
+
+   const FileHeader *hdr = reinterpret_cast<const FileHeader *>(data);
+   if ( ok )
+   {
+      ok = memcmp(hdr->magic, STATUS_DATA_MAGIC, sizeof(hdr->magic)) == 0 &&
+               hdr->version == STATUS_FORMAT_VERSION;
+   }
+
+   if ( ok )
+   {
+      ok = hdr->sizeIndex > hdr->countRecords &&
+            (hdr->sizeIndex & (hdr->sizeIndex - 1)) == 0 &&
+             sizeData == sizeof(FileHeader) +
+                         hdr->countRecords*sizeof(FileRecord) +
+                         hdr->sizeIndex*sizeof(wxUint32) +
+                         hdr->sizeNames;
+   }
+
+   if ( !ok )
+   {
+      wxLogTrace(M_TRACE_MFSTATUS,
+                 _T("Discarding invalid status cache file \"%s\""),
+                 filename.c_str());
+
+      Unmap();
+
+      // the journal is useless without the data file
+      wxRemoveFile(filename);
+      if ( wxFileExists(GetJournalFileName()) )
+         wxRemoveFile(GetJournalFileName());
+
+      return false;
+   }
+
+   m_generation = hdr->generation;
+
+   m_countRecords = hdr->countRecords;
+   m_records = reinterpret_cast<const FileRecord *>(data + sizeof(FileHeader));
+
+   m_sizeIndex = hdr->sizeIndex;
+   m_index = reinterpret_cast<const wxUint32 *>(m_records + m_countRecords);
+
+   m_sizeNames = hdr->sizeNames;
+   m_names = reinterpret_cast<const char *>(m_index + m_sizeIndex);
+
+   return true;
+}
+
+void MfStatusCache::LoadJournal()
+{
+   m_countJournal = 0;
+
+   const String filename = GetJournalFileName();
+   if ( !wxFileExists(filename) )
+      return;
+
+   std::vector<char> buf;
+
+   wxFile file;
+   if ( file.Open(filename) )
+   {
+      const wxFileOffset len = file.Length();
+      if ( len > 0 )
+      {
+         buf.resize(static_cast<size_t>(len));
+         if ( file.Read(&buf[0], buf.size()) != (ssize_t)buf.size() )
+            buf.clear();
+      }
+   }
+
+   JournalHeader hdr;
+   if ( buf.size() < sizeof(hdr) )
+   {
+      wxRemoveFile(filename);
+      return;
+   }
+
+   memcpy(&hdr, &buf[0], sizeof(hdr));
+   if ( memcmp(hdr.magic, STATUS_JOURNAL_MAGIC, sizeof(hdr.magic)) != 0 ||
+         hdr.version != STATUS_FORMAT_VERSION ||
+          hdr.generation != m_generation )
+   {
+      // this journal must have been left from before the data file was
+      // rewritten the last time, it's already included in it
+      wxLogTrace(M_TRACE_MFSTATUS,
+                 _T("Discarding stale status cache journal \"%s\""),
+                 filename.c_str());
+
+      wxRemoveFile(filename);
+      return;
+   }
+
+   const char *p = &buf[0] + sizeof(hdr);
+   const char * const end = &buf[0] + buf.size();
+   while ( p != end )
+   {
+      JournalRecord rec;
+      if ( (size_t)(end - p) < sizeof(rec) )
+         break;
+
+      memcpy(&rec, p, sizeof(rec));
+      p += sizeof(rec);
+
+      if ( (size_t)(end - p) < rec.lenName )
+         break;
+
+      MfStatusCacheEntry& entry = m_entries[String::FromUTF8(p, rec.lenName)];
+      p += rec.lenName;
+
+      entry.isRemoved = rec.isRemoved != 0;
+      entry.isInJournal = true;
+      entry.isDirty = false;
+
+      entry.status.Init();
+      if ( !entry.isRemoved )
+      {
+         entry.status.total = TotalFromFile(rec.total);
+         entry.status.newmsgs = rec.newmsgs;
+         entry.status.unread = rec.unread;
+         entry.status.flagged = rec.flagged;
+      }
+
+      m_countJournal++;
+   }
+
+   if ( p != end )
+   {
+      // we must have crashed while writing the journal the last time, don't
+      // append anything to the garbage at its end but rewrite everything
+      wxLogTrace(M_TRACE_MFSTATUS,
+                 _T("Status cache journal \"%s\" is truncated, rewriting it"),
+                 filename.c_str());
+
+      WriteData();
+   }
+}
+
+bool MfStatusCache::LoadData()
+{
+   wxStopWatch sw;
+
+   if ( !MapData() )
+      return false;
+
+   LoadJournal();
+
+   wxLogTrace(M_TRACE_MFSTATUS,
+              _T("Loaded status of %lu folders and %lu journal entries in %ldms"),
+              (unsigned long)m_countRecords, (unsigned long)m_countJournal,
+              sw.Time());
+
+   return true;
+}
+
 bool MfStatusCache::DoLoad(const wxTextFile& file, int version)
 {
    bool isFmtOk = true;
@@ -341,8 +840,9 @@ bool MfStatusCache::DoLoad(const wxTextFile& file, int version)
          folder->DecRef();
 
          // do add the entry to the cache
-         size_t entry = m_folderNames.Add(name);
-         m_folderData.Insert(new MailFolderStatus(status), entry);
+         MfStatusCacheEntry& entry = m_entries[name];
+         entry.status = status;
+         entry.isDirty = true;
       }
       else
       {
@@ -364,58 +864,165 @@ bool MfStatusCache::DoLoad(const wxTextFile& file, int version)
 
 bool MfStatusCache::Save()
 {
-   // avoid doing anything if we don't have anything to cache
-   if ( !m_folderNames.IsEmpty() )
+   if ( !m_isDirty )
+   {
+      // nothing to do
+      return true;
+   }
+
+   wxStopWatch sw;
+
+   if ( !wxDirExists(m_dirname) )
    {
-      if ( !CacheFile::Save() )
+      if ( !wxFileName::Mkdir(m_dirname, 0700, wxPATH_MKDIR_FULL) )
       {
          // set a flag to indicate that we shouldn't be called any more by
          // Flush() -- but we'll still be called from our dtor for one last
          // attempt to save our contents
          m_hasFailedToSave = true;
 
+         wxLogError(_("Failed to create directory for cache files."));
+
          return false;
       }
    }
 
+   // count the entries which can and can't be updated in place
+   size_t countNew = 0,
+          countChanged = 0;
+   for ( MfStatusCacheMap::const_iterator i = m_entries.begin();
+         i != m_entries.end();
+         ++i )
+   {
+      const MfStatusCacheEntry& entry = i->second;
+      if ( !entry.isDirty )
+         continue;
+
+      if ( entry.isInJournal || entry.isRemoved || !FindRecord(i->first) )
+         countNew++;
+      else
+         countChanged++;
+   }
+
+   // merge the journal into the data file if it becomes too big, so that it
+   // doesn't take too long to load it, and also rewrite the file if most of
+   // it changed anyhow as this is faster than updating it in place
+   const size_t countMax = wxMax(STATUS_JOURNAL_MIN_SIZE, m_countRecords / 4);
+   const bool rewrite = !m_data.GetData() ||
+                        m_countJournal + countNew > countMax ||
+                        countChanged > countMax;
+
+   if ( !(rewrite ? WriteData() : WriteJournal()) )
+   {
+      m_hasFailedToSave = true;
+
+      wxLogMessage(_("Some non vital information could be lost, please "
+                     "try to correct the problem and restart the program."));
+
+      wxLogError(_("Failed to write cache file."));
+
+      return false;
+   }
+
+   wxLogTrace(M_TRACE_MFSTATUS,
+              _T("Saved folder status cache (%s, %lu changed and %lu new ")
+              _T("entries) in %ldms"),
+              rewrite ? _T("rewritten") : _T("updated"),
+              (unsigned long)countChanged, (unsigned long)countNew, sw.Time());
+
    // reset the dirty flag - we're saved now
    m_isDirty = false;
 
    return true;
 }
 
-bool MfStatusCache::DoSave(wxTempFile& file)
+bool MfStatusCache::WriteJournal()
 {
-   wxString str, name;
-   str.reserve(1024);
-   name.reserve(512);
+   const String filenameData = GetDataFileName(),
+                filenameJournal = GetJournalFileName();
 
-   // write data
-   size_t count = m_folderNames.GetCount();
-   for ( size_t n = 0; n < count; n++ )
+   wxFile fileData,
+          fileJournal;
+
+   // all the new journal entries are accumulated here to write them at once
+   std::vector<char> journal;
+
+   if ( !m_countJournal )
    {
-      const MailFolderStatus *status = m_folderData[n];
+      // start a new journal for the current data file
+      JournalHeader hdr;
+      memcpy(hdr.magic, STATUS_JOURNAL_MAGIC, sizeof(hdr.magic));
+      hdr.version = STATUS_FORMAT_VERSION;
+      hdr.generation = m_generation;
+
+      const char * const p = reinterpret_cast<const char *>(&hdr);
+      journal.insert(journal.end(), p, p + sizeof(hdr));
+   }
 
-      // double all delimiters in the folder name
-      name = m_folderNames[n];
-      name.Replace(CACHE_DELIMITER, CACHE_DELIMITER CACHE_DELIMITER);
+   const size_t sizeJournalHeader = journal.size();
 
-      // and write info to file: note that we don't remember the number of
-      // recent messages because they won't be recent the next time we run
-      // anyhow nor the number of messages matching the search criteria as
-      // this is hardly ever useful
-      str.Printf(_T("%s") CACHE_DELIMITER
-                 _T("%lu") CACHE_DELIMITER
-                 _T("%lu") CACHE_DELIMITER
-                 _T("%lu") CACHE_DELIMITER
-                 _T("%lu\n"),
-                 name.c_str(),
-                 status->total,
-                 status->newmsgs,
-                 status->unread,
-                 status->flagged);
+   for ( MfStatusCacheMap::iterator i = m_entries.begin();
+         i != m_entries.end();
+         ++i )
+   {
+      MfStatusCacheEntry& entry = i->second;
+      if ( !entry.isDirty )
+         continue;
+
+      const FileRecord *rec = entry.isInJournal || entry.isRemoved
+                                 ? NULL
+                                 : FindRecord(i->first);
+      if ( rec )
+      {
+         // update the existing record in place
+         if ( !fileData.IsOpened() &&
+                !fileData.Open(filenameData, wxFile::read_write) )
+         {
+            return false;
+         }
+
+         FileRecord recNew = *rec;
+         recNew.total = TotalToFile(entry.status.total);
+         recNew.newmsgs = entry.status.newmsgs;
+         recNew.unread = entry.status.unread;
+         recNew.flagged = entry.status.flagged;
+
+         if ( fileData.Seek(reinterpret_cast<const char *>(rec) - m_data.GetData())
+                  == wxInvalidOffset ||
+               fileData.Write(&recNew, sizeof(recNew)) != sizeof(recNew) )
+         {
+            return false;
+         }
+      }
+      else // append it to the journal
+      {
+         const wxCharBuffer name(i->first.utf8_str());
+
+         JournalRecord recNew;
+         recNew.lenName = strlen(name);
+         recNew.isRemoved = entry.isRemoved;
+         recNew.total = TotalToFile(entry.status.total);
+         recNew.newmsgs = entry.status.newmsgs;
+         recNew.unread = entry.status.unread;
+         recNew.flagged = entry.status.flagged;
+
+         const char * const p = reinterpret_cast<const char *>(&recNew);
+         journal.insert(journal.end(), p, p + sizeof(recNew));
+         journal.insert(journal.end(), name.data(), name.data() + recNew.lenName);
+
+         entry.isInJournal = true;
+         m_countJournal++;
+      }
+
+      entry.isDirty = false;
+   }
 
-      if ( !file.Write(str) )
+   if ( journal.size() > sizeJournalHeader )
+   {
+      if ( !fileJournal.Open(filenameJournal,
+                             sizeJournalHeader ? wxFile::write
+                                               : wxFile::write_append) ||
+            fileJournal.Write(&journal[0], journal.size()) != journal.size() )
       {
          return false;
       }
@@ -424,6 +1031,163 @@ bool MfStatusCache::DoSave(wxTempFile& file)
    return true;
 }
 
+bool MfStatusCache::WriteData()
+{
+   // collect the records from the data file which are still valid
+   std::vector<FileRecord> records;
+   records.reserve(m_countRecords + m_entries.size());
+
+   std::vector<char> names;
+   names.reserve(m_sizeNames);
+
+   std::vector<bool> overridden(m_countRecords);
+   for ( MfStatusCacheMap::const_iterator i = m_entries.begin();
+         i != m_entries.end();
+         ++i )
+   {
+      const FileRecord *rec = FindRecord(i->first);
+      if ( rec )
+         overridden[rec - m_records] = true;
+   }
+
+   for ( size_t n = 0; n < m_countRecords; n++ )
+   {
+      const FileRecord& rec = m_records[n];
+      if ( overridden[n] || rec.offsetName + rec.lenName > m_sizeNames )
+         continue;
+
+      FileRecord recNew = rec;
+      recNew.offsetName = names.size();
+      names.insert(names.end(),
+                   m_names + rec.offsetName,
+                   m_names + rec.offsetName + rec.lenName);
+
+      records.push_back(recNew);
+   }
+
+   // and add all the others
+   for ( MfStatusCacheMap::const_iterator i = m_entries.begin();
+         i != m_entries.end();
+         ++i )
+   {
+      const MfStatusCacheEntry& entry = i->second;
+      if ( entry.isRemoved )
+         continue;
+
+      const wxCharBuffer name(i->first.utf8_str());
+
+      FileRecord rec;
+      memset(&rec, 0, sizeof(rec));
+
+      rec.lenName = strlen(name);
+      rec.hash = HashFolderName(name, rec.lenName);
+      rec.offsetName = names.size();
+      rec.total = TotalToFile(entry.status.total);
+      rec.newmsgs = entry.status.newmsgs;
+      rec.unread = entry.status.unread;
+      rec.flagged = entry.status.flagged;
+
+      names.insert(names.end(), name.data(), name.data() + rec.lenName);
+
+      records.push_back(rec);
+   }
+
+   // build the index keeping it at most half full
+   size_t sizeIndex = 8;
+   while ( sizeIndex < 2*records.size() )
+      sizeIndex *= 2;
+
+   std::vector<wxUint32> index(sizeIndex);
+   const size_t mask = sizeIndex - 1;
+   for ( size_t n = 0; n < records.size(); n++ )
+   {
+      size_t slot = records[n].hash & mask;
+      while ( index[slot] )
+         slot = (slot + 1) & mask;
+
+      index[slot] = n + 1;
+   }
+
+   FileHeader hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, STATUS_DATA_MAGIC, sizeof(hdr.magic));
+   hdr.version = STATUS_FORMAT_VERSION;
+   hdr.generation = m_generation + 1;
+   hdr.countRecords = records.size();
+   hdr.sizeIndex = sizeIndex;
+   hdr.sizeNames = names.size();
+
+   const String filename = GetDataFileName();
+
+   wxTempFile file;
+   bool ok = file.Open(filename) &&
+               file.Write(&hdr, sizeof(hdr));
+   if ( ok && !records.empty() )
+   {
+      ok = file.Write(&records[0], records.size()*sizeof(FileRecord));
+   }
+
+   if ( ok )
+   {
+      ok = file.Write(&index[0], index.size()*sizeof(wxUint32));
+   }
+
+   if ( ok && !names.empty() )
+   {
+      ok = file.Write(&names[0], names.size());
+   }
+
+   // don't release the old data before the new file is committed as we
+   // still need it if we fail to do it
+   if ( ok )
+   {
+      ok = file.Commit();
+   }
+
+   if ( !ok )
+   {
+      wxLogDebug(_T("Failed to write the status cache file \"%s\""),
+                 filename.c_str());
+
+      return false;
+   }
+
+   // the journal is merged in the data file now
+   if ( wxFileExists(GetJournalFileName()) )
+      wxRemoveFile(GetJournalFileName());
+
+   m_countJournal = 0;
+
+   // all entries are saved in the data file now, but keep them in memory as
+   // they can contain the information not stored in it (e.g. the number of
+   // recent messages)
+   MfStatusCacheMap::iterator i = m_entries.begin();
+   while ( i != m_entries.end() )
+   {
+      if ( i->second.isRemoved )
+      {
+         m_entries.erase(i++);
+      }
+      else
+      {
+         i->second.isDirty =
+         i->second.isInJournal = false;
+
+         ++i;
+      }
+   }
+
+   // and start using the new file
+   return MapData();
+}
+
+bool MfStatusCache::DoSave(wxTempFile& WXUNUSED(file))
+{
+   FAIL_MSG( _T("MfStatusCache is saved in binary format by Save()") );
+
+   return false;
+}
+
 /* static */
 void MfStatusCache::Flush()
 {
@@ -437,3 +1201,341 @@ void MfStatusCache::Flush()
    }
 }
 
+#ifdef TEST_STATUS_CACHE
+
+// ----------------------------------------------------------------------------
+// status cache benchmark
+// ----------------------------------------------------------------------------
+
+// define this to build a program measuring the time needed to save and load
+// the status of the given number of folders (10000 by default) in the binary
+// format and in the text format used before it, as well as to update some or
+// all of them, and checking that the status is correctly read back (it must
+// be linked with the rest of the program objects)
+
+#include <wx/init.h>
+
+#include <stdio.h>
+
+class MfStatusCacheTest
+{
+public:
+   MfStatusCacheTest(const String& dirname, size_t count);
+
+   // save and load the status of all folders in the text format
+   bool TestText();
+
+   // create the cache, save and load it and check its contents
+   bool TestBinary();
+
+   // change the status of every step-th folder, save and load the cache
+   bool TestUpdate(size_t step);
+
+private:
+   // get the name of the folder with the given index
+   String GetFolderName(size_t n) const;
+
+   // check that the cache has the expected status for all folders
+   bool Check(MfStatusCache *cache) const;
+
+   // create a new cache object, loading the data from the files
+   MfStatusCache *Create() const { return new MfStatusCache(m_dirname); }
+
+   // save the cache if needed and delete it
+   static void Delete(MfStatusCache *cache) { delete cache; }
+
+   const String m_dirname;
+
+   // the expected status of all folders
+   std::vector<MailFolderStatus> m_status;
+
+   // incremented by TestUpdate() to change the status of the folders
+   unsigned long m_generation;
+
+   DECLARE_NO_COPY_CLASS(MfStatusCacheTest)
+};
+
+MfStatusCacheTest::MfStatusCacheTest(const String& dirname, size_t count)
+                 : m_dirname(dirname),
+                   m_status(count)
+{
+   m_generation = 0;
+
+   for ( size_t n = 0; n < count; n++ )
+   {
+      MailFolderStatus& status = m_status[n];
+      status.total = n % 1000;
+      status.newmsgs = n % 3;
+      status.unread = n % 10;
+      status.flagged = n % 7;
+   }
+}
+
+String MfStatusCacheTest::GetFolderName(size_t n) const
+{
+   // use a few servers with many folders each, as in the real IMAP trees,
+   // and include the delimiter which must be quoted in the text format
+   return String::Format(_T("IMAP/server%lu/Lists/list %lu: archive %lu"),
+                         (unsigned long)(n % 10),
+                         (unsigned long)(n / 100),
+                         (unsigned long)n);
+}
+
+bool MfStatusCacheTest::Check(MfStatusCache *cache) const
+{
+   for ( size_t n = 0; n < m_status.size(); n++ )
+   {
+      MailFolderStatus status;
+      if ( !cache->GetStatus(GetFolderName(n), &status) ||
+            !(status == m_status[n]) )
+      {
+         printf("ERROR: wrong status for folder %lu\n", (unsigned long)n);
+         return false;
+      }
+   }
+
+   if ( cache->GetStatus(_T("IMAP/nonexistent")) )
+   {
+      printf("ERROR: status found for nonexistent folder\n");
+      return false;
+   }
+
+   return true;
+}
+
+bool MfStatusCacheTest::TestText()
+{
+   const size_t count = m_status.size();
+   printf("Text format with %lu folders: ", (unsigned long)count);
+   fflush(stdout);
+
+   // this is what CacheFile::Save() and MfStatusCache::DoSave() did
+   const String filename = m_dirname + DIR_SEPARATOR + _T("status.txt");
+
+   wxStopWatch sw;
+
+   wxTempFile fileOut(filename);
+   bool ok = fileOut.Write(
+               _T("Mahogany Folder Status Cache File (version 1.1)\n"));
+
+   wxString str, name;
+   for ( size_t n = 0; ok && n < count; n++ )
+   {
+      const MailFolderStatus& status = m_status[n];
+
+      name = GetFolderName(n);
+      name.Replace(CACHE_DELIMITER, CACHE_DELIMITER CACHE_DELIMITER);
+
+      str.Printf(_T("%s") CACHE_DELIMITER
+                 _T("%lu") CACHE_DELIMITER
+                 _T("%lu") CACHE_DELIMITER
+                 _T("%lu") CACHE_DELIMITER
+                 _T("%lu\n"),
+                 name.c_str(),
+                 status.total,
+                 status.newmsgs,
+                 status.unread,
+                 status.flagged);
+
+      ok = fileOut.Write(str);
+   }
+
+   ok = ok && fileOut.Commit();
+
+   const long timeSave = sw.Time();
+
+   // and this is what CacheFile::Load() and MfStatusCache::DoLoad() did,
+   // keeping the folders in a sorted array
+   sw.Start();
+
+   wxTextFile fileIn;
+   ok = ok && fileIn.Open(filename);
+
+   wxSortedArrayString folderNames;
+   std::vector<MailFolderStatus> folderData;
+
+   const size_t countLines = ok ? fileIn.GetLineCount() : 0;
+   for ( size_t n = 1; ok && n < countLines; n++ )
+   {
+      str = fileIn[n];
+
+      const wxChar *p = wxStrchr(str, CACHE_DELIMITER_CH);
+      while ( p && p[1] == CACHE_DELIMITER_CH )
+      {
+         p = wxStrchr(p + 2, CACHE_DELIMITER_CH);
+      }
+
+      if ( !p )
+      {
+         ok = false;
+         break;
+      }
+
+      name = wxString(str.c_str(), p);
+      name.Replace(CACHE_DELIMITER CACHE_DELIMITER, CACHE_DELIMITER);
+
+      MailFolderStatus status;
+      ok = wxSscanf(p + 1,
+                    _T("%lu") CACHE_DELIMITER
+                    _T("%lu") CACHE_DELIMITER
+                    _T("%lu") CACHE_DELIMITER
+                    _T("%lu"),
+                    &status.total,
+                    &status.newmsgs,
+                    &status.unread,
+                    &status.flagged) == 4;
+
+      const size_t entry = folderNames.Add(name);
+      folderData.insert(folderData.begin() + entry, status);
+   }
+
+   const long timeLoad = sw.Time();
+
+   // look up all folders as Check() does for the binary format
+   sw.Start();
+   for ( size_t n = 0; ok && n < count; n++ )
+   {
+      const int entry = folderNames.Index(GetFolderName(n));
+      ok = entry != wxNOT_FOUND && folderData[(size_t)entry] == m_status[n];
+   }
+
+   const long timeLookup = sw.Time();
+
+   wxRemoveFile(filename);
+
+   printf("%s\n\tsave %ldms, load %ldms, look up all %ldms\n",
+          ok ? "ok" : "ERROR", timeSave, timeLoad, timeLookup);
+
+   return ok;
+}
+
+bool MfStatusCacheTest::TestBinary()
+{
+   const size_t count = m_status.size();
+   printf("Binary format with %lu folders: ", (unsigned long)count);
+   fflush(stdout);
+
+   MfStatusCache *cache = Create();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      cache->UpdateStatus(GetFolderName(n), m_status[n]);
+   }
+
+   wxStopWatch sw;
+   bool ok = cache->Save();
+   const long timeSave = sw.Time();
+
+   Delete(cache);
+
+   sw.Start();
+   cache = Create();
+   const long timeLoad = sw.Time();
+
+   ok = ok && cache->m_countRecords == count;
+
+   sw.Start();
+   ok = ok && Check(cache);
+   const long timeLookup = sw.Time();
+
+   Delete(cache);
+
+   printf("%s\n\tsave %ldms, load %ldms, look up all %ldms\n",
+          ok ? "ok" : "ERROR", timeSave, timeLoad, timeLookup);
+
+   return ok;
+}
+
+bool MfStatusCacheTest::TestUpdate(size_t step)
+{
+   const size_t count = m_status.size();
+   printf("Updating %lu folders: ", (unsigned long)((count + step - 1) / step));
+   fflush(stdout);
+
+   m_generation++;
+
+   MfStatusCache *cache = Create();
+   for ( size_t n = 0; n < count; n += step )
+   {
+      MailFolderStatus& status = m_status[n];
+      status.total = n % 1000 + m_generation;
+      status.unread = (status.unread + 1) % 10;
+
+      cache->UpdateStatus(GetFolderName(n), status);
+   }
+
+   // the generation only changes if the data file is rewritten
+   const wxUint32 generation = cache->m_generation;
+
+   wxStopWatch sw;
+   bool ok = cache->Save();
+   const long timeSave = sw.Time();
+
+   const bool rewritten = cache->m_generation != generation;
+
+   Delete(cache);
+
+   sw.Start();
+   cache = Create();
+   const long timeLoad = sw.Time();
+
+   ok = ok && Check(cache);
+
+   Delete(cache);
+
+   printf("%s\n\tsave %ldms (%s), load %ldms\n",
+          ok ? "ok" : "ERROR",
+          timeSave, rewritten ? "rewritten" : "updated", timeLoad);
+
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   unsigned long count = 10000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &count) != 1 || !count) )
+   {
+      fprintf(stderr, "Usage: %s [number of folders]\n", argv[0]);
+      return 2;
+   }
+
+   // use a new directory for the cache files
+   const String dirname = wxFileName::CreateTempFileName(_T("status"));
+   if ( dirname.empty() ||
+         !wxRemoveFile(dirname) ||
+          !wxFileName::Mkdir(dirname, 0700) )
+   {
+      fprintf(stderr, "Failed to create the temporary directory.\n");
+      return 2;
+   }
+
+   bool ok;
+
+   {
+      MfStatusCacheTest test(dirname, count);
+
+      ok = test.TestText();
+
+      if ( !test.TestBinary() )
+         ok = false;
+
+      // a few changes are written in place while changing most of the
+      // folders rewrites the file
+      if ( !test.TestUpdate(100) )
+         ok = false;
+      if ( !test.TestUpdate(1) )
+         ok = false;
+   }
+
+   wxRemoveFile(dirname + DIR_SEPARATOR + CACHE_DATA_FILENAME);
+   if ( wxFileExists(dirname + DIR_SEPARATOR + CACHE_JOURNAL_FILENAME) )
+      wxRemoveFile(dirname + DIR_SEPARATOR + CACHE_JOURNAL_FILENAME);
+   wxRmdir(dirname);
+
+   return ok ? 0 : 1;
+}
+
+#endif // TEST_STATUS_CACHE
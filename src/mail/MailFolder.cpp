@@ -38,6 +38,7 @@
 #include "Sequence.h"
 #include "LogCircle.h"
 #include "MThread.h"
+#include "ASMailFolder.h"
 
 #include "MFPrivate.h"
 #include "mail/Driver.h"
@@ -147,6 +148,9 @@ MailFolder::CleanUp()
    // one init/shutdown cycle.
    gs_mfInitDone = false;
 
+   // stop the background operations before closing the folders they use
+   ASMailFolder::CleanUp();
+
    ServerInfoEntry::DeleteAll();
    MFPool::DeleteAll();
 
@@ -1467,3 +1471,37 @@ bool MailFolder::GetAuthInfoForFolder(const MFolder *mfolder,
    return true;
 }
 
+// ----------------------------------------------------------------------------
+// ServerInfoEntry
+// ----------------------------------------------------------------------------
+
+/* static */
+String ServerInfoEntry::DescribeAllPools()
+{
+   String desc;
+   for ( ServerInfoList::iterator i = ms_servers.begin();
+         i != ms_servers.end();
+         ++i )
+   {
+      PoolStats stats;
+      if ( !i->GetPoolStats(stats) )
+         continue;
+
+      desc << String::Format
+              (
+               _T("\n    %s: %lu connections used and %lu kept, ")
+               _T("%lu hits and %lu misses, ")
+               _T("opened in %ldms when reused and %ldms when new"),
+               i->GetName().c_str(),
+               (unsigned long)stats.connInUse,
+               (unsigned long)stats.connPooled,
+               stats.hits,
+               stats.misses,
+               stats.latencyReuse,
+               stats.latencyConnect
+              );
+   }
+
+   return desc;
+}
+
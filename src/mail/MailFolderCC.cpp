@@ -67,11 +67,29 @@
 #include "mail/Driver.h"
 #include "mail/FolderPool.h"
 #include "mail/MimeDecode.h"
+#include "mail/FullTextIndex.h"
+#include "mail/OverviewCache.h"
+#include "mail/ThreadCache.h"
 #include "mail/ServerInfo.h"
 
 // just to use wxFindFirstFile()/wxFindNextFile() for lockfile checking and
 // wxFile::Exists() too
 #include <wx/file.h>
+#include <wx/stopwatch.h>
+#include <wx/thread.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <errno.h>
+#ifdef OS_UNIX
+   #include <sys/select.h>           // for select() in ImapIdleThread
+#elif defined(OS_WIN)
+   #include <winsock2.h>             // ditto
+#endif // OS_UNIX/OS_WIN
 
 class MPersMsgBox;
 
@@ -107,19 +125,17 @@ extern "C"
 #undef CreateDialog
 
 #define USE_READ_PROGRESS
-//#define USE_BLOCK_NOTIFY
-
-#ifdef USE_BLOCK_NOTIFY
-   #include <wx/datetime.h>
-#endif
 
 #include <wx/tls.h>
+#include <wx/timer.h>
+#include <wx/hashmap.h>
 
 // ----------------------------------------------------------------------------
 // options we use here
 // ----------------------------------------------------------------------------
 
 extern const MOption MP_CONN_CLOSE_DELAY;
+extern const MOption MP_CONN_POOL_SIZE;
 extern const MOption MP_DEBUG_CCLIENT;
 extern const MOption MP_FOLDERPROGRESS_THRESHOLD;
 extern const MOption MP_IMAP_LOOKAHEAD;
@@ -139,6 +155,9 @@ extern const MOption MP_TCP_READTIMEOUT;
 extern const MOption MP_TCP_WRITETIMEOUT;
 extern const MOption MP_TCP_RSHTIMEOUT;
 extern const MOption MP_TCP_SSHTIMEOUT;
+extern const MOption MP_USE_FULLTEXT_INDEX;
+extern const MOption MP_USE_THREAD_CACHE;
+extern const MOption MP_USE_HEADER_CACHE;
 
 // ----------------------------------------------------------------------------
 // persistent msgboxes we use here
@@ -153,6 +172,22 @@ extern const MPersMsgBox *M_MSGBOX_NO_NET_PING_ANYWAY;
 /// invalid value for MailFolderCC::m_chDelimiter
 #define ILLEGAL_DELIMITER ((char)-1)
 
+/// time in ms after which ImapIdleThread checks whether it should exit
+static const long IMAP_IDLE_WAKEUP_INTERVAL = 1000;
+
+/// reissue IDLE after this many seconds (RFC 2177 requires less than 29 min)
+static const time_t IMAP_IDLE_RESTART_INTERVAL = 25*60;
+
+/// don't try to use IDLE for this many seconds after it failed
+static const time_t IMAP_IDLE_RETRY_DELAY = 10*60;
+
+/// delay in ms before trying to let the worker threads use c-client again
+static const int CCLIENT_LOCK_RETRY_DELAY = 100;
+
+/// the number of the following messages whose headers imap_msgdata() gets
+/// together with the requested one (IMAPLOOKAHEAD in imap4r1.c)
+static const MsgnoType IMAP_HEADER_LOOKAHEAD = 20;
+
 // ----------------------------------------------------------------------------
 // trace masks used (you have to wxLog::AddTraceMask() to enable the
 // correpsonding kind of messages)
@@ -164,6 +199,12 @@ extern const MPersMsgBox *M_MSGBOX_NO_NET_PING_ANYWAY;
 // turn on logging of MailFolderCC operations
 #define TRACE_MF_CALLS _T("mfcall")
 
+// turn on logging of IMAP IDLE connections
+#define TRACE_IMAP_IDLE _T("imapidle")
+
+// turn on logging of c-client use by the worker threads
+#define TRACE_CCLIENT_LOCK _T("cclock")
+
 // ----------------------------------------------------------------------------
 // functions prototypes
 // ----------------------------------------------------------------------------
@@ -216,20 +257,54 @@ static class CCEventReflector *gs_CCEventReflector = NULL;
 static class CCStreamCleaner *gs_CCStreamCleaner = NULL;
 #endif // USE_DIALUP
 
+/*
+   The variables below modify the behaviour of c-client callbacks during a
+   single operation, so they are per thread as the callbacks are called in
+   the thread doing the operation and several threads may use c-client.
+ */
+
 /// handler for temporarily redirected mm_list calls
-static mm_list_handler gs_mmListRedirect = NULL;
+static wxTLS_TYPE(mm_list_handler) tls_mmListRedirect;
+
+#define gs_mmListRedirect wxTLS_VALUE(tls_mmListRedirect)
 
 /// handler for temporarily redirected mm_status calls
-static mm_status_handler gs_mmStatusRedirect = NULL;
+static wxTLS_TYPE(mm_status_handler) tls_mmStatusRedirect;
+
+#define gs_mmStatusRedirect wxTLS_VALUE(tls_mmStatusRedirect)
 
 // a variable telling c-client to shut up
-static bool mm_ignore_errors = false;
+static wxTLS_TYPE(bool) tls_mm_ignore_errors;
+
+#define mm_ignore_errors wxTLS_VALUE(tls_mm_ignore_errors)
 
 /// a variable disabling most events (not mm_list or mm_lsub though)
-static bool mm_disable_callbacks = false;
+static wxTLS_TYPE(bool) tls_mm_disable_callbacks;
+
+#define mm_disable_callbacks wxTLS_VALUE(tls_mm_disable_callbacks)
 
 /// another one for disabling just mm_flags() callback (used by ClearFolder())
-static bool mm_disable_flags = false;
+static wxTLS_TYPE(bool) tls_mm_disable_flags;
+
+#define mm_disable_flags wxTLS_VALUE(tls_mm_disable_flags)
+
+/// true if the current thread holds the c-client lock (see CClientLock)
+static wxTLS_TYPE(bool) tls_cclientLocked;
+
+/// true if the current thread released the lock while waiting for network
+static wxTLS_TYPE(bool) tls_cclientBlocked;
+
+/// the number of StreamLockers existing in the current thread
+static wxTLS_TYPE(size_t) tls_nStreamLocks;
+
+/// the folders whose streams are held by the current thread, see StreamLocker
+static wxTLS_TYPE(MailFolderCC *) tls_streamLast;
+
+/// the number of CClientLockKeepers existing in the current thread
+static wxTLS_TYPE(size_t) tls_nCClientKeepers;
+
+/// the default c-client block notification handler we chain to
+static blocknotify_t gs_ccBlockNotifyDefault = NULL;
 
 /// show cclient debug output (accessed from
 static bool mm_show_debug = false;
@@ -262,9 +337,10 @@ extern "C"
    void mahogany_read_progress(GETS_DATA *md, unsigned long count);
 #endif
 
-#ifdef USE_BLOCK_NOTIFY
    void *mahogany_block_notify(int reason, void *data);
-#endif
+
+   long mahogany_append_next(MAILSTREAM *stream, void *data,
+                             char **flags, char **date, STRING **message);
 };
 
 namespace
@@ -353,17 +429,74 @@ public:
     */
    //@{
 
-   /// return an existing connection to this server or NULL if none
-   MAILSTREAM *GetStream();
+   /**
+     Return an existing connection to this server or NULL if none.
+
+     If there are several connections in the pool, the one which can be
+     reused for the given mailbox most cheaply is returned: i.e. a half
+     opened one if OP_HALFOPEN is specified as there is no need to UNSELECT
+     it then or the one which already has this mailbox selected otherwise.
+
+     @param spec the full spec of the mailbox to be opened, may be empty
+     @param options the flags to be used for mail_open()
+     @return the connection removed from the pool or NULL
+    */
+   MAILSTREAM *GetStream(const String& spec = String(), long options = 0);
+
+   /**
+     Open the mailbox on the given connection or a new one.
+
+     This is the same as MailOpen() except that it also updates the pool
+     statistics and bounds the number of connections to this server: when
+     a worker thread needs a new connection while MP_CONN_POOL_SIZE of them
+     are already used, it waits until one of them is given back with
+     KeepStream() or ReleaseStream() (the main thread never waits).
+
+     @param stream the connection returned by GetStream() or NULL
+     @param spec the full spec of the mailbox to open
+     @param options the flags to be used for mail_open()
+     @return the opened stream or NULL on failure
+    */
+   MAILSTREAM *OpenStream(MAILSTREAM *stream,
+                          const String& spec,
+                          long options = 0);
 
    /// give us a stream to reuse later (or close if nobody wants it)
    void KeepStream(MAILSTREAM *stream, const MFolder *folder);
 
+   /// must be called when a stream opened by OpenStream() is closed
+   void ReleaseStream(MAILSTREAM *stream);
+
    /// close those of our connections which have timed out
    virtual bool CheckTimeout();
 
    //@}
 
+   /**
+     @name Pool statistics
+    */
+   //@{
+
+   /// get the number of times a pooled connection was reused
+   unsigned long GetPoolHits() const { return m_poolHits; }
+
+   /// get the number of times a new connection had to be made
+   unsigned long GetPoolMisses() const { return m_poolMisses; }
+
+   /// get the average time of opening a mailbox on a reused connection in ms
+   long GetReuseLatency() const
+      { return m_nReused ? (long)(m_timeReused / m_nReused) : 0; }
+
+   /// get the average time of opening a mailbox on a new connection in ms
+   long GetConnectLatency() const
+      { return m_nConnected ? (long)(m_timeConnected / m_nConnected) : 0; }
+
+   virtual bool GetPoolStats(PoolStats& stats) const;
+
+   virtual String GetName() const;
+
+   //@}
+
    // dtor must be public in order to use M_LIST_OWN() but nobody should delete
    // us directly!
    virtual ~ServerInfoEntryCC();
@@ -372,6 +505,9 @@ private:
    // ctor is private, nobody except GetOrCreate() can create us
    ServerInfoEntryCC(const MFolder *folder);
 
+   // wait until a new connection to this server may be opened
+   void WaitForConnection();
+
    // parse the folder to ms_lastParsed: this function caches the last folder
    // used thus avoiding calling mail_valid_net_parse() unnecessarily
    static bool Parse(const MFolder *folder);
@@ -397,6 +533,25 @@ private:
    // close them
    M_LIST(TimeList, time_t) m_timeouts;
 
+   // the connections opened by OpenStream() and not given back to us yet
+   std::set<MAILSTREAM *> m_streamsInUse;
+
+   // signaled when a stream is removed from m_streamsInUse, the mutex is only
+   // used with it as the rest of this class relies on c-client lock
+   wxMutex m_mutexInUse;
+   wxCondition m_condInUse;
+
+   // the number of GetStream() calls which did and didn't find a connection
+   unsigned long m_poolHits,
+                 m_poolMisses;
+
+   // the number of OpenStream() calls on reused and new connections and the
+   // total time they took in ms
+   unsigned long m_nReused,
+                 m_nConnected;
+   unsigned long m_timeReused,
+                 m_timeConnected;
+
    /**
      A small class to close the cached connections periodically.
     */
@@ -437,11 +592,13 @@ static bool IsReusableFolder(const MFolder *folder)
 /// close the stream associated with the given folder and server
 static void CloseOrKeepStream(MAILSTREAM *stream,
                               const MFolder *folder,
-                              ServerInfoEntryCC *server)
+                              ServerInfoEntryCC *server,
+                              bool mayKeep = true)
 {
    // don't cache the connections if we're going to shutdown (and hence close
    // them all) soon anyhow
-   if ( server && IsReusableFolder(folder) && !mApplication->IsShuttingDown() )
+   if ( mayKeep && server && IsReusableFolder(folder) &&
+            !mApplication->IsShuttingDown() )
    {
       server->KeepStream(stream, folder);
    }
@@ -450,10 +607,396 @@ static void CloseOrKeepStream(MAILSTREAM *stream,
       wxLogTrace(TRACE_MF_CALLS, _T("Closing connection to '%s'"),
                  folder->GetFullName().c_str());
 
+      if ( server )
+         server->ReleaseStream(stream);
+
       mail_close(stream);
    }
 }
 
+// ----------------------------------------------------------------------------
+// IMAP IDLE support
+// ----------------------------------------------------------------------------
+
+/*
+  The folders watched with MailFolder::WatchFolder() are not polled for new
+  mail but have a separate connection to the server in IDLE state instead: the
+  server then sends EXISTS, EXPUNGE and FETCH responses as soon as the mailbox
+  changes and we check the folder in the usual way when this happens.
+
+  Opening the connection may take a long time, so it is done by
+  ImapIdleConnector thread, using c-client lock like the other worker threads,
+  and the folder is polled as usual until it is done. After this, the
+  connection is only used from the main thread: the only thing ImapIdleThread
+  does is to wait until there is some input on its socket and post an event to
+  ImapIdleManager which reads it and then lets the thread wait again.
+ */
+
+// the ids of the events posted by ImapIdleThread
+enum
+{
+   // there is some input on the IDLE connection
+   ImapIdle_Input,
+
+   // IDLE should be reissued to avoid being disconnected by the server
+   ImapIdle_Restart,
+
+   // ImapIdleConnector has terminated
+   ImapIdle_Connected
+};
+
+// ImapIdleConnector opens the IDLE connection for one folder
+class ImapIdleConnector : public wxThread
+{
+public:
+   ImapIdleConnector(wxEvtHandler *handler,
+                     const MFolder *folder,
+                     const String& login,
+                     const String& password);
+   virtual ~ImapIdleConnector();
+
+   // these functions can only be used after the thread terminated
+
+   MFolder *GetFolder() const { return m_folder; }
+
+   // get the idling stream or NULL if we failed to open it, the caller
+   // becomes its owner
+   MAILSTREAM *DetachStream()
+   {
+      MAILSTREAM * const stream = m_stream;
+      m_stream = NULL;
+      return stream;
+   }
+
+   // return true if the server doesn't support IDLE
+   bool IsUnsupported() const { return m_unsupported; }
+
+   // these functions can only be used by the main thread
+
+   // discard the connection as soon as it is opened
+   void Cancel(bool cancel = true) { m_cancelled = cancel; }
+   bool IsCancelled() const { return m_cancelled; }
+
+protected:
+   virtual void *Entry();
+
+private:
+   wxEvtHandler * const m_handler;
+   MFolder *m_folder;
+   const String m_spec,
+                m_login,
+                m_password;
+
+   MAILSTREAM *m_stream;
+   bool m_unsupported,
+        m_cancelled;
+
+   DECLARE_NO_COPY_CLASS(ImapIdleConnector)
+};
+
+// ImapIdleThread waits until the socket of the IDLE connection becomes readable
+class ImapIdleThread : public wxThread
+{
+public:
+   ImapIdleThread(wxEvtHandler *handler,
+                  const String& name,
+                  int sock,
+                  wxSemaphore& semResume)
+      : wxThread(wxTHREAD_JOINABLE),
+        m_handler(handler),
+        m_name(name),
+        m_sock(sock),
+        m_semResume(semResume)
+   {
+   }
+
+protected:
+   virtual void *Entry();
+
+private:
+   // wait for the input during the given time, return 1 if there is some, 0
+   // if there is none and -1 on error
+   int WaitForInput(long timeout);
+
+   // post the event with the given id and wait until the main thread is done
+   // with it, return false if we should exit
+   bool Notify(int id);
+
+
+   wxEvtHandler * const m_handler;
+   const String m_name;
+   const int m_sock;
+   wxSemaphore& m_semResume;
+
+   DECLARE_NO_COPY_CLASS(ImapIdleThread)
+};
+
+// ImapIdleConnection is the IDLE connection for one watched folder
+class ImapIdleConnection
+{
+public:
+   // takes ownership of the stream which must be already idling
+   ImapIdleConnection(const MFolder *folder, MAILSTREAM *stream);
+   ~ImapIdleConnection();
+
+   // start the thread waiting for the input, return false if we can't
+   bool Start(wxEvtHandler *handler);
+
+   MFolder *GetFolder() const { return m_folder; }
+   MAILSTREAM *GetStream() const { return m_stream; }
+
+   // process the responses from the server: if wait is true, block until at
+   // least one of them is received, otherwise only process the already
+   // buffered ones
+   //
+   // return false if the connection is not idling any more
+   bool ReadInput(bool wait);
+
+   // reissue IDLE command, return false if it failed
+   bool Restart();
+
+   // called when the server reports any changes in the mailbox
+   void OnChange() { m_changed = true; }
+
+   // return true if there were any changes since the last call
+   bool GetAndResetChanged()
+   {
+      const bool changed = m_changed;
+      m_changed = false;
+      return changed;
+   }
+
+   // let the thread wait for the next input
+   void Resume() { m_semResume.Post(); }
+
+private:
+   MFolder *m_folder;
+   MAILSTREAM *m_stream;
+
+   ImapIdleThread *m_thread;
+   wxSemaphore m_semResume;
+
+   bool m_changed;
+
+   DECLARE_NO_COPY_CLASS(ImapIdleConnection)
+};
+
+// ImapIdleManager keeps all IDLE connections and handles the thread events
+class ImapIdleManager : public wxEvtHandler
+{
+public:
+   // get the unique manager object, creating it if necessary and allowed
+   static ImapIdleManager *Get(bool create = true);
+
+   // delete the manager and close all its connections
+   static void Delete();
+
+   // called from c-client callbacks: returns true if the stream is one of
+   // IDLE connections and remembers that the folder needs to be checked
+   static bool OnChange(const MAILSTREAM *stream);
+
+   // implement MailFolder::WatchFolder() &c
+   bool Watch(const MFolder *folder);
+   void Unwatch(const String& name);
+   bool IsWatched(const String& name) const
+      { return m_connections.find(name) != m_connections.end(); }
+
+private:
+   ImapIdleManager();
+   virtual ~ImapIdleManager();
+
+   // start opening the IDLE connection for the folder in the background
+   void Connect(const MFolder *folder);
+
+   // finish opening the connection when ImapIdleConnector terminates
+   void OnConnected(const String& name);
+
+   void OnThreadEvent(wxThreadEvent& event);
+
+   // open the connection and start idling, this is called by
+   // ImapIdleConnector with c-client lock held
+   //
+   // return the idling stream or NULL and set unsupported to true if the
+   // server doesn't support IDLE
+   static MAILSTREAM *OpenIdleStream(const String& spec,
+                                     const String& login,
+                                     const String& password,
+                                     bool *unsupported);
+
+
+   typedef std::map<String, ImapIdleConnection *> Connections;
+   typedef std::map<String, ImapIdleConnector *> Connectors;
+
+   // the IDLE connections indexed by the folder name
+   Connections m_connections;
+
+   // the threads opening the connections indexed by the folder name
+   Connectors m_connectors;
+
+   // the folders whose servers don't support IDLE
+   std::set<String> m_unsupported;
+
+   // the time before which we shouldn't try to connect again after a failure
+   std::map<String, time_t> m_retryAfter;
+
+   static ImapIdleManager *ms_manager;
+
+   friend class ImapIdleConnector;
+
+   DECLARE_NO_COPY_CLASS(ImapIdleManager)
+};
+
+// ----------------------------------------------------------------------------
+// CClientLock: serializes the use of c-client by several threads
+// ----------------------------------------------------------------------------
+
+/*
+   Neither c-client nor our code using it (which is, in fact, most of the
+   program) is reentrant, so only one thread may execute it at any moment.
+   This is ensured by a single global lock which must be held to do anything
+   with the mail folders.
+
+   The main thread holds the lock all the time except when
+
+    - it waits for the network (see mahogany_block_notify() below)
+    - it waits for a stream used by another thread (see StreamLocker)
+    - a worker thread asks for the lock: it is then given away from the event
+      loop, i.e. when the main thread has nothing else to do anyhow, unless it
+      is in the middle of some folder operation.
+
+   The worker threads release the lock while waiting for the network too, and
+   this is where most of the time goes for the remote folders, so the network
+   operations on different streams do overlap even if all the rest is
+   serialized. This is safe because c-client only reads from or writes to the
+   stream socket while blocking and doesn't touch anything else.
+
+   Nothing of this happens before the first worker thread is started, until
+   then all c-client calls are done from the main thread as before.
+ */
+class CClientLock : public wxEvtHandler
+{
+public:
+   // create the lock if not done yet and acquire it by the main thread
+   static void Activate();
+
+   // undo one Activate() call and destroy the lock if it was the last one:
+   // can only be called when the threads started after it have terminated
+   static void Deactivate();
+
+   // release the lock in the main thread and destroy it: can only be called
+   // when there are no more worker threads
+   static void Destroy();
+
+   // get the lock if it is used or NULL
+   static CClientLock *Get() { return ms_lock; }
+
+   // get the lock if the current thread had released it while waiting for
+   // the network or NULL
+   static CClientLock *GetIfBlocked()
+      { return ms_lock && wxTLS_VALUE(tls_cclientBlocked) ? ms_lock : NULL; }
+
+   // acquire the lock, waiting as long as necessary
+   void Acquire();
+
+   // release the lock acquired by Acquire()
+   void Release();
+
+   // called by c-client before and after blocking
+   void OnBlock(int reason);
+
+private:
+   CClientLock();
+
+   // the handlers for the worker threads requests
+   void OnRequest(wxThreadEvent& event);
+   void OnTimer(wxTimerEvent& event);
+
+   // let the waiting worker threads run if we can do it now or retry later
+   void ProcessRequests();
+
+   // give the lock to the waiting worker threads
+   void LetWorkersRun();
+
+
+   // the mutex protecting the fields below and the condition signaled when
+   // any of them changes
+   wxMutex m_mutex;
+   wxCondition m_cond;
+
+   // is the lock currently held by some thread?
+   bool m_held;
+
+   // does the main thread wait for the lock? it has priority over the workers
+   bool m_mainWaiting;
+
+   // is there a request from a worker thread not processed yet?
+   bool m_requestPending;
+
+   // the number of worker threads waiting for the lock and the number of
+   // times the lock was acquired by them
+   size_t m_nWaiting,
+          m_nGranted;
+
+   // the timer used to retry LetWorkersRun() if it can't be done immediately
+   wxTimer m_timer;
+
+   static CClientLock *ms_lock;
+
+   // the number of Activate() calls not undone by Deactivate() yet
+   static size_t ms_nActivations;
+
+   DECLARE_NO_COPY_CLASS(CClientLock)
+};
+
+// reacquire the c-client lock temporarily if it had been released while
+// waiting for the network: this is needed for the callbacks which c-client
+// may call from inside its network functions
+class CClientLockReacquirer
+{
+public:
+   CClientLockReacquirer()
+   {
+      m_lock = CClientLock::GetIfBlocked();
+      if ( m_lock )
+         m_lock->Acquire();
+   }
+
+   ~CClientLockReacquirer()
+   {
+      if ( m_lock )
+         m_lock->Release();
+   }
+
+private:
+   CClientLock *m_lock;
+
+   DECLARE_NO_COPY_CLASS(CClientLockReacquirer)
+};
+
+// prevent the current thread from releasing the c-client lock while waiting
+// for the network: this is needed while it changes the global c-client
+// parameters which mustn't affect the other threads
+class CClientLockKeeper
+{
+public:
+   CClientLockKeeper(bool keep = true) : m_keep(keep)
+   {
+      if ( m_keep )
+         wxTLS_VALUE(tls_nCClientKeepers)++;
+   }
+
+   ~CClientLockKeeper()
+   {
+      if ( m_keep )
+         wxTLS_VALUE(tls_nCClientKeepers)--;
+   }
+
+private:
+   const bool m_keep;
+
+   DECLARE_NO_COPY_CLASS(CClientLockKeeper)
+};
+
 /**
    The idea behind CCEventReflector is to allow postponing some actions in
    MailFolderCC code, i.e. instead of doing something immediately after getting
@@ -506,6 +1049,15 @@ public:
       : MEventWithFolderData(MEventId_MailFolder_OnFlagsChange, folder) { }
 };
 
+/// MEventFolderOnListingChangeData - used to apply the changes reported to
+/// the worker threads in the main one
+class MEventFolderOnListingChangeData : public MEventWithFolderData
+{
+public:
+   MEventFolderOnListingChangeData(MailFolder *folder)
+      : MEventWithFolderData(MEventId_MailFolder_OnListingChange, folder) { }
+};
+
 // ----------------------------------------------------------------------------
 // CCEventReflector
 // ----------------------------------------------------------------------------
@@ -523,6 +1075,7 @@ public:
          MEventId_MailFolder_OnNewMail,      &m_cookieNewMail,
          MEventId_MailFolder_OnMsgStatus,    &m_cookieMsgStatus,
          MEventId_MailFolder_OnFlagsChange,  &m_cookieFlagsChange,
+         MEventId_MailFolder_OnListingChange, &m_cookieListingChange,
          MEventId_Null
       );
    }
@@ -542,6 +1095,10 @@ public:
             mfCC->OnMsgStatusChanged();
             break;
 
+         case MEventId_MailFolder_OnListingChange:
+            mfCC->ApplyListingChanges();
+            break;
+
          default:
             FAIL_MSG( _T("unexpected event in CCEventReflector!") );
             return true;
@@ -558,6 +1115,7 @@ public:
          &m_cookieNewMail,
          &m_cookieMsgStatus,
          &m_cookieFlagsChange,
+         &m_cookieListingChange,
          NULL
       );
    }
@@ -565,7 +1123,8 @@ public:
 private:
    void *m_cookieNewMail,
         *m_cookieMsgStatus,
-        *m_cookieFlagsChange;
+        *m_cookieFlagsChange,
+        *m_cookieListingChange;
 };
 
 #ifdef USE_DIALUP
@@ -954,32 +1513,35 @@ class MMStatusRedirector
 public:
    MMStatusRedirector(const char *mailbox, MAILSTATUS *mailstatus)
    {
-      ms_mailstatus = mailstatus;
-      memset(ms_mailstatus, 0, sizeof(*ms_mailstatus));
+      m_mailstatus = mailstatus;
+      memset(m_mailstatus, 0, sizeof(*m_mailstatus));
 
-      if ( !CanonicalizeMailbox(mailbox, &ms_mbx, &ms_filename) )
+      if ( !CanonicalizeMailbox(mailbox, &m_mbx, &m_filename) )
       {
          FAIL_MSG( _T("c-client failed to parse our spec?") );
       }
 
+      wxTLS_VALUE(ms_active) = this;
       gs_mmStatusRedirect = MMStatusRedirectorHandler;
    }
 
    ~MMStatusRedirector()
    {
       gs_mmStatusRedirect = NULL;
-
-      ms_mailstatus = NULL;
+      wxTLS_VALUE(ms_active) = NULL;
    }
 
 private:
    // we have either the filename for the local folders or the parsed struct
    // for the remote ones
-   static String ms_filename;
-   static NETMBX ms_mbx;
+   String m_filename;
+   NETMBX m_mbx;
 
    // we store the result of mm_status() here
-   static MAILSTATUS *ms_mailstatus;
+   MAILSTATUS *m_mailstatus;
+
+   // the redirector active in the current thread
+   static wxTLS_TYPE(MMStatusRedirector *) ms_active;
 
    // bring the folder name to the canonical form: for the filenames this means
    // making it absolute, for the remote folders - parsing it into a NETMBX
@@ -1018,6 +1580,9 @@ private:
       // NB: note that simply comparing the names doesn't work because the
       //     name we have might not be in the canonical form while c-client's
       //     name already is
+      MMStatusRedirector * const self = wxTLS_VALUE(ms_active);
+      CHECK_RET( self, _T("no active MMStatusRedirector") );
+
       String filename;
       NETMBX mbx;
       if ( !CanonicalizeMailbox(wxString::FromAscii(name), &mbx, &filename) )
@@ -1036,11 +1601,12 @@ private:
             // mail_status() and compare MAILSTREAMs instead of NETMBXs
 
             // remote spec
-            if ( // strcmp(ms_mbx.host, mbx.host) ||
-                 strcmp(ms_mbx.user, mbx.user) ||
-                 strcmp(ms_mbx.mailbox, mbx.mailbox) ||
-                 strcmp(ms_mbx.service, mbx.service) ||
-                 (ms_mbx.port && (ms_mbx.port != mbx.port)) )
+            const NETMBX& mbxOur = self->m_mbx;
+            if ( // strcmp(mbxOur.host, mbx.host) ||
+                 strcmp(mbxOur.user, mbx.user) ||
+                 strcmp(mbxOur.mailbox, mbx.mailbox) ||
+                 strcmp(mbxOur.service, mbx.service) ||
+                 (mbxOur.port && (mbxOur.port != mbx.port)) )
             {
                // skip the assignment below
                return;
@@ -1048,21 +1614,21 @@ private:
          }
          else // local file
          {
-            if ( !strutil_compare_filenames(filename, ms_filename) )
+            if ( !strutil_compare_filenames(filename, self->m_filename) )
             {
                // skip the assignment below
                return;
             }
          }
 
-         memcpy(ms_mailstatus, mailstatus, sizeof(*ms_mailstatus));
+         memcpy(self->m_mailstatus, mailstatus, sizeof(*self->m_mailstatus));
       }
    }
+
+   DECLARE_NO_COPY_CLASS(MMStatusRedirector)
 };
 
-String MMStatusRedirector::ms_filename;
-NETMBX MMStatusRedirector::ms_mbx;
-MAILSTATUS *MMStatusRedirector::ms_mailstatus = NULL;
+wxTLS_TYPE(MMStatusRedirector *) MMStatusRedirector::ms_active;
 
 // ----------------------------------------------------------------------------
 // ReadProgressInfo: create an instance of this object to start showing progress
@@ -1649,6 +2215,9 @@ MailFolderCC::Create(MFolderType /* type */, int /* flags */)
 {
    m_MailStream = NIL;
    m_nMessages = 0;
+   m_overviewCache = NULL;
+   m_ftIndex = NULL;
+   m_thrCache = NULL;
 
    UpdateTimeoutValues();
 
@@ -1657,6 +2226,12 @@ MailFolderCC::Create(MFolderType /* type */, int /* flags */)
    m_listData = NULL;
 
    m_SearchMessagesFound = NULL;
+
+   m_streamOwner = 0;
+   m_nStreamLocks = 0;
+   m_streamPrev = NULL;
+
+   m_applyingListingChanges = false;
 }
 
 void MailFolderCC::Init()
@@ -1692,6 +2267,11 @@ MailFolderCC::~MailFolderCC()
    {
       Close();
    }
+   else
+   {
+      // we could still have created the caches if we failed to open later
+      CloseCaches();
+   }
 
    // check that our temporary data isn't hanging around
    if ( m_SearchMessagesFound )
@@ -2049,6 +2629,8 @@ MailFolderCC::CheckForFileLock()
 bool
 MailFolderCC::Open(OpenMode openmode)
 {
+   StreamLocker lockStream(this);
+
    wxLogTrace(TRACE_MF_CALLS, _T("%s \"'%s'\""),
               GetOperationName(openmode).c_str(), GetName().c_str());
 
@@ -2162,20 +2744,24 @@ MailFolderCC::Open(OpenMode openmode)
       if ( !m_MailStream && tryOpen )
       {
          // try to reuse an existing stream if possible
-         MAILSTREAM *stream = NIL;
+         ServerInfoEntryCC *server = NULL;
          if ( IsReusableFolder(m_mfolder) )
          {
-            ServerInfoEntryCC *server = ServerInfoEntryCC::Get(m_mfolder);
-            if ( server )
-            {
-               stream = server->GetStream();
-            }
+            server = ServerInfoEntryCC::GetOrCreate(m_mfolder);
          }
 
          wxLogTrace(TRACE_MF_CALLS, _T("Opening MailFolderCC '%s'."),
                     m_ImapSpec.c_str());
 
-         m_MailStream = MailOpen(stream, m_ImapSpec, ccOptions);
+         if ( server )
+         {
+            MAILSTREAM *stream = server->GetStream(m_ImapSpec, ccOptions);
+            SetStream(server->OpenStream(stream, m_ImapSpec, ccOptions));
+         }
+         else
+         {
+            SetStream(MailOpen(NIL, m_ImapSpec, ccOptions));
+         }
       }
    } // end of CCDefaultFolder scope
 
@@ -2215,7 +2801,7 @@ MailFolderCC::Open(OpenMode openmode)
       }
       //else: it can't be opened at all
 
-      m_MailStream = NIL;
+      SetStream(NIL);
    }
 
    // so did we eventually succeed in opening it or not?
@@ -2265,6 +2851,23 @@ MailFolderCC::Open(OpenMode openmode)
       Pop3_RestoreFlags(GetName(), m_MailStream);
    }
 
+   // use the headers cached during the previous sessions if possible: this
+   // only makes sense for IMAP as retrieving the headers of the local folders
+   // is as fast as reading them from our cache
+   if ( GetType() == MF_IMAP &&
+         openmode != HalfOpen &&
+            m_uidValidity &&
+               READ_CONFIG_BOOL(m_Profile, MP_USE_HEADER_CACHE) )
+   {
+      delete m_overviewCache;
+      m_overviewCache = new OverviewCache(GetName(), m_uidValidity);
+      if ( !m_overviewCache->Load() )
+      {
+         wxLogDebug(_T("Failed to load the headers cache for '%s'"),
+                    GetName().c_str());
+      }
+   }
+
    if ( frame )
    {
       String msg;
@@ -2302,9 +2905,38 @@ MailFolderCC::Open(OpenMode openmode)
 // MailFolderCC closing
 // ----------------------------------------------------------------------------
 
+void MailFolderCC::CloseCaches()
+{
+   if ( m_overviewCache )
+   {
+      (void)m_overviewCache->Save();
+
+      delete m_overviewCache;
+      m_overviewCache = NULL;
+   }
+
+   if ( m_ftIndex )
+   {
+      (void)m_ftIndex->Save();
+
+      delete m_ftIndex;
+      m_ftIndex = NULL;
+   }
+
+   if ( m_thrCache )
+   {
+      (void)m_thrCache->Save();
+
+      delete m_thrCache;
+      m_thrCache = NULL;
+   }
+}
+
 void
 MailFolderCC::Close(bool mayLinger)
 {
+   StreamLocker lockStream(this);
+
    wxLogTrace(TRACE_MF_CALLS, _T("Closing folder '%s'"), GetName().c_str());
 
    MailFolderCmn::Close(mayLinger);
@@ -2317,9 +2949,28 @@ MailFolderCC::Close(bool mayLinger)
        */
       CCAllDisabler no;
 
+      // the stream may be reused by another folder as soon as we give it back
+      // to the server, so forget about it before doing it
+      MAILSTREAM * const stream = m_MailStream;
+      SetStream(NIL);
+
       if ( GetType() == MF_POP )
       {
-         Pop3_SaveFlags(GetName(), m_MailStream);
+         Pop3_SaveFlags(GetName(), stream);
+      }
+
+      // if possible, don't close the stream immediately, we might reuse it
+      // later, but even if we don't, the server must know that it's not used
+      // any more
+      ServerInfoEntryCC *server;
+      if ( IsReusableFolder(m_mfolder) )
+      {
+         server = mayLinger ? ServerInfoEntryCC::GetOrCreate(m_mfolder)
+                            : ServerInfoEntryCC::Get(m_mfolder);
+      }
+      else // no server
+      {
+         server = NULL;
       }
 
 #ifdef USE_DIALUP
@@ -2327,29 +2978,16 @@ MailFolderCC::Close(bool mayLinger)
       {
          // a remote folder but we're not connected: delay closing as we can't
          // do it properly right now
-         gs_CCStreamCleaner->Add(m_MailStream);
+         if ( server )
+            server->ReleaseStream(stream);
+
+         gs_CCStreamCleaner->Add(stream);
       }
       else
 #endif // USE_DIALUP
       {
-         // if possible, don't close the stream immediately, we might reuse it
-         // later
-         ServerInfoEntryCC *server;
-         if ( mayLinger && IsReusableFolder(m_mfolder) )
-         {
-            // do look for the server
-            server = ServerInfoEntryCC::GetOrCreate(m_mfolder);
-         }
-         else // no need
-         {
-            // this will just call mail_close() in CloseOrKeepStream()
-            server = NULL;
-         }
-
-         CloseOrKeepStream(m_MailStream, m_mfolder, server);
+         CloseOrKeepStream(stream, m_mfolder, server, mayLinger);
       }
-
-      m_MailStream = NIL;
    }
 
    // we could be closing before we had time to process all events
@@ -2357,6 +2995,15 @@ MailFolderCC::Close(bool mayLinger)
    // FIXME: is this really true, i.e. does it ever happen?
    DiscardExpungeData();
 
+   // the changes reported to the worker threads don't matter any more neither
+   {
+      wxCriticalSectionLocker lock(m_csListingChanges);
+
+      m_listingChanges.clear();
+   }
+
+   CloseCaches();
+
    if ( m_statusChangeData )
    {
       delete m_statusChangeData;
@@ -2399,7 +3046,7 @@ void
 MailFolderCC::ForceClose()
 {
    // now folder is dead
-   m_MailStream = NIL;
+   SetStream(NIL);
 
    Close();
 
@@ -2490,29 +3137,48 @@ MailFolderCC::UpdateTimeoutValues(void)
 // Working with the list of all open mailboxes
 // ----------------------------------------------------------------------------
 
+// the streams of all opened folders: LookupObject() is called from all
+// c-client callbacks, some of which are called for each message, so it must
+// be fast
+WX_DECLARE_HASH_MAP(const MAILSTREAM *, MailFolderCC *,
+                    wxPointerHash, wxPointerEqual,
+                    StreamFolderMap);
+
+static StreamFolderMap gs_streamFolders;
+
+// protects gs_streamFolders as the folders can be opened by worker threads
+static wxCriticalSection gs_csStreamFolders;
+
+void MailFolderCC::SetStream(MAILSTREAM *stream)
+{
+   wxCriticalSectionLocker lock(gs_csStreamFolders);
+
+   if ( m_MailStream )
+   {
+      // the stream could be already used by another folder if we had given
+      // it back to the server, don't remove its entry then
+      StreamFolderMap::iterator i = gs_streamFolders.find(m_MailStream);
+      if ( i != gs_streamFolders.end() && i->second == this )
+         gs_streamFolders.erase(i);
+   }
+
+   m_MailStream = stream;
+
+   if ( stream )
+      gs_streamFolders[stream] = this;
+}
+
 // this function should normally always return a non NULL folder
 /* static */
 MailFolderCC *
 MailFolderCC::LookupObject(const MAILSTREAM *stream)
 {
-   // try to match the stream
-   String driverName;
-   MFPool::Cookie cookie;
-   for ( MailFolder *mf = MFPool::GetFirst(cookie, &driverName);
-         mf;
-         mf = MFPool::GetNext(cookie, &driverName) )
    {
-      mf->DecRef();
-
-      if ( driverName != CCLIENT_DRIVER_NAME )
-         continue;
+      wxCriticalSectionLocker lock(gs_csStreamFolders);
 
-      // the cast is valid because of the check above
-      MailFolderCC *mfCC = ((MailFolderCC *)mf);
-      if ( mfCC->Stream() == stream )
-      {
-         return mfCC;
-      }
+      StreamFolderMap::const_iterator i = gs_streamFolders.find(stream);
+      if ( i != gs_streamFolders.end() )
+         return i->second;
    }
 
    if ( gs_ccCallbackDefaultObj )
@@ -2566,6 +3232,8 @@ void MailFolderCC::ReadConfig(MailFolderCmn::MFCmnOptions& config)
 void
 MailFolderCC::Checkpoint(void)
 {
+   StreamLocker lockStream(this);
+
    if ( m_MailStream == NULL )
      return; // nothing we can do anymore
 
@@ -2608,6 +3276,8 @@ MailFolderCC::Checkpoint(void)
 bool
 MailFolderCC::Ping(void)
 {
+   StreamLocker lockStream(this);
+
    // we don't want to reopen the folder from here, this leads to inifinite
    // loops if the network connection goes down because we are called from a
    // timer event and so if folder pinging taks too long, we will be called
@@ -2677,6 +3347,8 @@ MailFolderCC::Ping(void)
 bool
 MailFolderCC::PingOpenedFolder()
 {
+   StreamLocker lockStream(this);
+
    // caller must check for this
    CHECK( m_MailStream, false, _T("PingOpenedFolder() called for closed folder") );
 
@@ -2686,12 +3358,45 @@ MailFolderCC::PingOpenedFolder()
 }
 
 /* static */
-bool
-MailFolderCC::DoCheckStatus(const MFolder *folder, MAILSTATUS *mailstatus)
+void MailFolderCC::PrepareStatusCheck(StatusCheck& check)
+{
+   const MFolder * const folder = check.folder;
+
+   // we don't need anything if the server already has the login data
+   if ( IsReusableFolder(folder) )
+   {
+      ServerInfoEntryCC * const server = ServerInfoEntryCC::GetOrCreate(folder);
+      if ( !server )
+         return;
+
+      String login, password;
+      if ( server->GetAuthInfo(login, password) )
+      {
+         check.canCheck = true;
+
+         return;
+      }
+   }
+
+   check.login = folder->GetLogin();
+   check.password = folder->GetPassword();
+
+   // We don't have any valid window here but currently we're always called
+   // in response to a user action so pass a non-NULL window parameter to
+   // let GetAuthInfoForFolder() ask the user for password if necessary.
+   check.canCheck = GetAuthInfoForFolder(folder, check.login, check.password,
+                                         mApplication->TopLevelFrame());
+}
+
+/* static */
+void MailFolderCC::DoStatusCheck(StatusCheck& check)
 {
    static const int STATUS_FLAGS = SA_MESSAGES | SA_RECENT | SA_UNSEEN;
 
-   MBusyCursor busyCursor;
+   if ( !check.canCheck )
+      return;
+
+   const MFolder * const folder = check.folder;
 
    // instead of calling mail_status() with NIL stream we always open the
    // connection to the folder manually before as this gives us a
@@ -2709,7 +3414,7 @@ MailFolderCC::DoCheckStatus(const MFolder *folder, MAILSTATUS *mailstatus)
 
       if ( !server )
       {
-         return false;
+         return;
       }
    }
    else
@@ -2717,33 +3422,26 @@ MailFolderCC::DoCheckStatus(const MFolder *folder, MAILSTATUS *mailstatus)
       server = NULL;
    }
 
+   // we only need a half opened stream for mail_status(), so prefer to reuse
+   // one of those
    MAILSTREAM *stream;
    if ( server )
    {
-      stream = server->GetStream();
+      stream = server->GetStream(String(), OP_HALFOPEN);
    }
    else // no connection to reuse
    {
       stream = NULL;
    }
 
-   // find out the login and password we need: first see if we don't already
-   // have them
+   // use the login data of the server if it has it, it could have got it
+   // since PrepareStatusCheck() call
    String login, password;
    bool hasAuthInfo = server && server->GetAuthInfo(login, password);
    if ( !hasAuthInfo )
    {
-      login = folder->GetLogin();
-      password = folder->GetPassword();
-
-      // We don't have any valid window here but currently we're always called
-      // in response to a user action so pass a non-NULL window parameter to
-      // let GetAuthInfoForFolder() ask the user for password if necessary.
-      if ( !GetAuthInfoForFolder(folder, login, password,
-                                 mApplication->TopLevelFrame()) )
-      {
-         return false;
-      }
+      login = check.login;
+      password = check.password;
    }
 
    SetLoginData(login, password);
@@ -2756,16 +3454,17 @@ MailFolderCC::DoCheckStatus(const MFolder *folder, MAILSTATUS *mailstatus)
       // we're not interested in mm_exists() and what not
       CCCallbackDisabler noCallbacks;
 
-      stream = MailOpen(NULL, spec, OP_HALFOPEN | OP_READONLY);
+      stream = server->OpenStream(NULL, spec, OP_HALFOPEN | OP_READONLY);
       if ( !stream )
       {
          // if we failed to open it, checking its status won't work neither
-         return false;
+         return;
       }
    }
 
    // finally call mail_status()
-   MMStatusRedirector statusRedir(spec, mailstatus);
+   MAILSTATUS mailstatus;
+   MMStatusRedirector statusRedir(spec, &mailstatus);
 
    wxLogTrace(TRACE_MF_CALLS, _T("MailFolderCC::CheckStatus() on %s."),
               spec.c_str());
@@ -2786,7 +3485,58 @@ MailFolderCC::DoCheckStatus(const MFolder *folder, MAILSTATUS *mailstatus)
 
    // we succeed only if we managed to get the values of all flags included in
    // STATUS_FLAGS
-   return (mailstatus->flags & STATUS_FLAGS) == STATUS_FLAGS;
+   check.ok = (mailstatus.flags & STATUS_FLAGS) == STATUS_FLAGS;
+   if ( check.ok )
+   {
+      check.messages = mailstatus.messages;
+      check.recent = mailstatus.recent;
+      check.unseen = mailstatus.unseen;
+   }
+}
+
+/* static */
+bool MailFolderCC::FinishStatusCheck(const StatusCheck& check)
+{
+   const MFolder * const folder = check.folder;
+
+   if ( !check.ok )
+   {
+      ERRORMESSAGE(( _("Failed to check status of the folder '%s'"),
+                     folder->GetFullName().c_str() ));
+      return false;
+   }
+
+   // get the old status of the folder
+   MfStatusCache *mfStatusCache = MfStatusCache::Get();
+   MailFolderStatus status;
+   (void)mfStatusCache->GetStatus(folder->GetFullName(), &status);
+
+   // has anything changed?
+   if ( check.messages != status.total ||
+        check.recent != status.recent ||
+        check.unseen != status.unread )
+   {
+      // do we have any new mail? there is no way to [efficiently] test for new
+      // messages but assume that if there are unread and recent ones, then
+      // there are new ones as well - and also take this as the guess for their
+      // number
+      MsgnoType newmsgs = check.recent < check.unseen ? check.recent
+                                                      : check.unseen;
+
+      if ( newmsgs )
+      {
+         ProcessNewMail(folder, newmsgs);
+      }
+
+      // update the status shown in the tree anyhow
+      status.total = check.messages;
+      status.recent = check.recent;
+      status.unread = check.unseen;
+
+      mfStatusCache->UpdateStatus(folder->GetFullName(), status);
+   }
+
+   return true;
 }
 
 /* static */
@@ -2816,47 +3566,16 @@ bool MailFolderCC::CheckStatus(const MFolder *folder)
       return true;
    }
 
-   // remember the old status of the folder
-   MfStatusCache *mfStatusCache = MfStatusCache::Get();
-   MailFolderStatus status;
-   (void)mfStatusCache->GetStatus(folder->GetFullName(), &status);
-
-   // and check for the new one
-   MAILSTATUS mailstatus;
-   if ( !DoCheckStatus(folder, &mailstatus) )
-   {
-      ERRORMESSAGE(( _("Failed to check status of the folder '%s'"),
-                     folder->GetFullName().c_str() ));
-      return false;
-   }
+   StatusCheck check(folder);
+   PrepareStatusCheck(check);
 
-   // has anything changed?
-   if ( mailstatus.messages != status.total ||
-        mailstatus.recent != status.recent ||
-        mailstatus.unseen != status.unread )
    {
-      // do we have any new mail? there is no way to [efficiently] test for new
-      // messages but assume that if there are unread and recent ones, then
-      // there are new ones as well - and also take this as the guess for their
-      // number
-      MsgnoType newmsgs = mailstatus.recent < mailstatus.unseen
-                                 ? mailstatus.recent
-                                 : mailstatus.unseen;
-
-      if ( newmsgs )
-      {
-         ProcessNewMail(folder, newmsgs);
-      }
-
-      // update the status shown in the tree anyhow
-      status.total = mailstatus.messages;
-      status.recent = mailstatus.recent;
-      status.unread = mailstatus.unseen;
+      MBusyCursor busyCursor;
 
-      mfStatusCache->UpdateStatus(folder->GetFullName(), status);
+      DoStatusCheck(check);
    }
 
-   return true;
+   return FinishStatusCheck(check);
 }
 
 // ----------------------------------------------------------------------------
@@ -2916,6 +3635,8 @@ MailFolderCC::UpdateAfterAppend()
 bool
 MailFolderCC::AppendMessage(const String& msg)
 {
+   StreamLocker lockStream(this);
+
    wxLogTrace(TRACE_MF_CALLS, _T("MailFolderCC(%s)::AppendMessage(string)"),
               GetName().c_str());
 
@@ -2975,6 +3696,10 @@ MailFolderCC::AppendMessage(const Message& msg)
 
    String flags = GetImapFlags(msg.GetStatus());
 
+   // only lock our stream now that we're done with the message which can be
+   // in another folder
+   StreamLocker lockStream(this);
+
    if ( CheckConnection() )
    {
       // keep the char buffer alive until after mail_append_full() returns
@@ -3006,9 +3731,68 @@ MailFolderCC::AppendMessage(const Message& msg)
    return false;
 }
 
+// the data used by mahogany_append_next() called from AppendMessages()
+struct AppendMessagesData
+{
+   AppendMessagesData(const MailFolder::RawMessages& msgs_) : msgs(msgs_)
+   {
+      next = 0;
+   }
+
+   // the messages to append and the index of the next one
+   const MailFolder::RawMessages& msgs;
+   size_t next;
+
+   // the data of the current message which must be kept until the next call
+   STRING str;
+   wxCharBuffer flags;
+   char date[128];
+
+private:
+   DECLARE_NO_COPY_CLASS(AppendMessagesData)
+};
+
+bool
+MailFolderCC::AppendMessages(const RawMessages& msgs)
+{
+   StreamLocker lockStream(this);
+
+   wxLogTrace(TRACE_MF_CALLS, _T("MailFolderCC(%s)::AppendMessages(%lu)"),
+              GetName().c_str(), (unsigned long)msgs.size());
+
+   if ( msgs.empty() )
+      return true;
+
+   if ( CheckConnection() )
+   {
+      // this uses MULTIAPPEND if the server supports it and a separate APPEND
+      // command for each message otherwise
+      AppendMessagesData data(msgs);
+      if ( mail_append_multiple(m_MailStream,
+                                m_ImapSpec.char_str(),
+                                mahogany_append_next,
+                                &data) )
+      {
+         UpdateAfterAppend();
+
+         return true;
+      }
+   }
+
+   wxLogError(_("Failed to save messages to the folder '%s'"),
+              GetName().c_str());
+
+   return false;
+}
+
 bool
-MailFolderCC::SaveMessages(const UIdArray *selections, MFolder *folder)
+MailFolderCC::SaveMessages(const UIdArray *selections,
+                           MFolder *folder,
+                           UIdType *uidLast)
 {
+   if ( uidLast )
+      *uidLast = UID_ILLEGAL;
+
    CHECK( folder, false, _T("SaveMessages() needs a valid folder pointer") );
 
    size_t count = selections->Count();
@@ -3042,6 +3826,8 @@ MailFolderCC::SaveMessages(const UIdArray *selections, MFolder *folder)
          // been done yet
          if ( CreateIfNeeded(folder, GetInteractiveFrame()) )
          {
+            StreamLocker lockStream(this);
+
             if ( !CheckConnection() )
             {
                wxLogError(_("Failed to save messages to closed folder '%s'"),
@@ -3060,6 +3846,10 @@ MailFolderCC::SaveMessages(const UIdArray *selections, MFolder *folder)
                                 CP_UID) )
             {
                didServerSideCopy = true;
+
+               // the server copies all of them or none
+               if ( uidLast )
+                  *uidLast = (*selections)[count - 1];
             }
             else
             {
@@ -3078,7 +3868,7 @@ MailFolderCC::SaveMessages(const UIdArray *selections, MFolder *folder)
    if ( !didServerSideCopy )
    {
       // use the inefficient retrieve-append way
-      if ( MailFolderCmn::SaveMessages(selections, folder) )
+      if ( MailFolderCmn::SaveMessages(selections, folder, uidLast) )
          return true;
 
       // if we failed to copy the message on server above also show the
@@ -3128,15 +3918,16 @@ MailFolderCC::SaveMessages(const UIdArray *selections, MFolder *folder)
    HeaderInfoList_obj headers(GetHeaders());
    for ( size_t n = 0; n < count; n++ )
    {
-      MsgnoType msgno = GetMsgnoFromUID(selections->Item(n));
-      if ( msgno == MSGNO_ILLEGAL )
+      // use the headers UID index instead of GetMsgnoFromUID() which does a
+      // linear search in c-client and so would make this loop quadratic
+      size_t idx = headers->GetIdxFromUId(selections->Item(n));
+      if ( idx == INDEX_ILLEGAL )
       {
          FAIL_MSG(_T("inexistent message was copied??"));
 
          continue;
       }
 
-      size_t idx = headers->GetIdxFromMsgno(msgno);
       HeaderInfo *hi = headers->GetItemByIndex(idx);
       if ( !hi )
       {
@@ -3207,6 +3998,8 @@ MailFolderCC::SaveMessages(const UIdArray *selections, MFolder *folder)
 void
 MailFolderCC::ExpungeMessages(void)
 {
+   StreamLocker lockStream(this);
+
    wxLogTrace(TRACE_MF_CALLS, _T("MailFolderCC(%s)::ExpungeMessages()"),
               GetName().c_str());
 
@@ -3286,6 +4079,8 @@ unsigned long MailFolderCC::CountDeletedMessages() const
 
 bool MailFolderCC::DoCountMessages(MailFolderStatus *status) const
 {
+   StreamLocker lockStream(this);
+
    CHECK( status, false, _T("DoCountMessages: NULL pointer") );
 
    CHECK( m_MailStream, false, _T("DoCountMessages: folder is closed") );
@@ -3330,6 +4125,8 @@ bool MailFolderCC::DoCountMessages(MailFolderStatus *status) const
 MsgnoType
 MailFolderCC::GetMsgnoFromUID(UIdType uid) const
 {
+   StreamLocker lockStream(this);
+
    // garbage in, garbage out
    CHECK( uid != UID_ILLEGAL, MSGNO_ILLEGAL, _T("GetMsgnoFromUID: bad uid") );
 
@@ -3369,6 +4166,8 @@ MailFolderCC::GetMessage(unsigned long uid) const
 MsgnoArray *
 MailFolderCC::DoSearch(struct search_program *pgm, int flags) const
 {
+   StreamLocker lockStream(this);
+
    ASSERT_MSG( flags == SEARCH_UID || flags == SEARCH_MSGNO,
                "DoSearch(): invalid flags value" );
 
@@ -3441,6 +4240,8 @@ MsgnoArray *MailFolderCC::SearchByFlag(MessageStatus flag,
                                        int flags,
                                        MsgnoType last) const
 {
+   StreamLocker lockStream(this);
+
    SEARCHPGM *pgm = mail_newsearchpgm();
 
    // do we look for messages with this flag or without?
@@ -3541,11 +4342,75 @@ MsgnoArray *MailFolderCC::SearchByFlag(MessageStatus flag,
    return DoSearch(pgm, flags & (SEARCH_UID | SEARCH_MSGNO));
 }
 
+FullTextIndex *MailFolderCC::GetFullTextIndex()
+{
+   if ( !m_ftIndex )
+   {
+      // the IMAP servers can search themselves, the index is only useful for
+      // the local folders which c-client searches by reading all messages
+      if ( !m_MailStream ||
+            !m_uidValidity ||
+               !IsFileOrDirFolder(GetType()) ||
+                  !READ_CONFIG_BOOL(m_Profile, MP_USE_FULLTEXT_INDEX) )
+      {
+         return NULL;
+      }
+
+      m_ftIndex = new FullTextIndex(GetName(), m_uidValidity);
+      if ( !m_ftIndex->Load() )
+      {
+         wxLogDebug(_T("Failed to load the full text index for '%s'"),
+                    GetName().c_str());
+      }
+   }
+
+   return m_ftIndex;
+}
+
+ThreadCache *MailFolderCC::GetThreadCache()
+{
+   if ( !m_thrCache )
+   {
+      if ( !m_MailStream ||
+            !m_uidValidity ||
+               !READ_CONFIG_BOOL(m_Profile, MP_USE_THREAD_CACHE) )
+      {
+         return NULL;
+      }
+
+      m_thrCache = new ThreadCache(GetName(), m_uidValidity);
+      if ( !m_thrCache->Load() )
+      {
+         wxLogDebug(_T("Failed to load the thread cache for '%s'"),
+                    GetName().c_str());
+      }
+   }
+
+   return m_thrCache;
+}
+
 UIdArray *
 MailFolderCC::SearchMessages(const SearchCriterium *crit, int flags)
 {
    CHECK( crit, NULL, _T("no criterium in SearchMessages") );
 
+   // searching in the message text is much faster using the index than
+   // letting c-client read all the messages, so do it ourselves if we can
+   switch ( crit->m_What )
+   {
+      case SearchCriterium::SC_FULL:
+      case SearchCriterium::SC_BODY:
+      case SearchCriterium::SC_HEADER:
+      case SearchCriterium::SC_CC:
+         if ( GetFullTextIndex() )
+            return MailFolderCmn::SearchMessages(crit, flags);
+         break;
+
+      default:
+         // the index can't be used for the other criteria
+         break;
+   }
+
    // server side searching doesn't support all possible search criteria,
    // check if it can do this search first
    SEARCHPGM *pgm = mail_newsearchpgm();
@@ -3561,6 +4426,13 @@ MailFolderCC::SearchMessages(const SearchCriterium *crit, int flags)
          slistMatch = &pgm->body;
          break;
 
+      case SearchCriterium::SC_HEADER:
+         // IMAP HEADER search needs the name of the header field, so use TEXT
+         // search, which includes the header too, to find the candidates and
+         // then check just their headers in CheckHeaderMatches()
+         slistMatch = &pgm->text;
+         break;
+
       case SearchCriterium::SC_SUBJECT:
          slistMatch = &pgm->subject;
          break;
@@ -3594,6 +4466,33 @@ MailFolderCC::SearchMessages(const SearchCriterium *crit, int flags)
    (*slistMatch)->text.data = (unsigned char *)keystr;
    (*slistMatch)->text.size = strlen(keystr);
 
+   if ( crit->m_What == SearchCriterium::SC_HEADER )
+   {
+      wxStopWatch sw;
+
+      // the candidates are inverted, if needed, by CheckHeaderMatches() later
+      UIdArray * const candidates = DoSearch(pgm, SEARCH_UID);
+      if ( !candidates )
+         return MailFolderCmn::SearchMessages(crit, flags);
+
+      unsigned long bytes = 0;
+      UIdArray * const results =
+         CheckHeaderMatches(*candidates, crit, flags, bytes);
+
+      wxLogTrace(TRACE_SEARCH,
+                 _T("Header search in \"%s\": %lu of %lu candidates ")
+                 _T("matched in %ldms, %lu bytes of headers retrieved"),
+                 GetName().c_str(),
+                 (unsigned long)results->GetCount(),
+                 (unsigned long)candidates->GetCount(),
+                 sw.Time(),
+                 bytes);
+
+      delete candidates;
+
+      return results;
+   }
+
    if ( crit->m_Invert )
    {
       // represent the inverted search as "TRUE && !pgm"
@@ -3617,6 +4516,110 @@ MailFolderCC::SearchMessages(const SearchCriterium *crit, int flags)
    return results ? results : MailFolderCmn::SearchMessages(crit, flags);
 }
 
+UIdArray *
+MailFolderCC::CheckHeaderMatches(const UIdArray& candidates,
+                                 const SearchCriterium *crit,
+                                 int flags,
+                                 unsigned long& bytes)
+{
+   // server searches are case-insensitive, so make this one too
+   const String key = crit->m_Key.Lower();
+
+   // only the headers of the candidates need to be retrieved, the other
+   // messages can't match, so get all of them at once instead of making a
+   // round trip to the server for each message below
+   bytes += PrefetchHeaders(candidates);
+
+   // and they must be decoded as the user searches for the text as it is
+   // shown and not for its RFC 2047 encoded form
+   std::vector<UIdType> uids;
+   const size_t count = candidates.GetCount();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      const UIdType uid = candidates[n];
+
+      Message_obj msg(GetMessage(uid));
+      if ( msg &&
+            MIME::DecodeHeader(msg->GetHeader()).Lower().find(key)
+               != String::npos )
+      {
+         uids.push_back(uid);
+      }
+   }
+
+   std::sort(uids.begin(), uids.end());
+
+   if ( !crit->m_Invert )
+   {
+      if ( flags & SEARCH_UID )
+      {
+         UIdArray *results = new UIdArray;
+         for ( size_t n = 0; n < uids.size(); n++ )
+            results->Add(uids[n]);
+
+         return results;
+      }
+
+      if ( uids.empty() )
+         return new UIdArray;
+   }
+
+   // let c-client translate the UIDs to msgnos or find all the other messages
+   // for us, this doesn't need to retrieve anything
+   SEARCHPGM *pgm = mail_newsearchpgm();
+
+   SEARCHSET *set = NULL;
+   for ( size_t n = 0; n < uids.size(); n++ )
+   {
+      const UIdType uid = uids[n];
+      if ( set && (set->last ? set->last : set->first) + 1 == uid )
+      {
+         set->last = uid;
+         continue;
+      }
+
+      SEARCHSET * const setNew = mail_newsearchset();
+      setNew->first = uid;
+      if ( set )
+         set->next = setNew;
+      else
+         pgm->uid = setNew;
+      set = setNew;
+   }
+
+   if ( crit->m_Invert )
+   {
+      // represent the inverted search as "TRUE && !pgm" as in SearchMessages()
+      SEARCHPGM *pgmReal = pgm;
+
+      pgm = mail_newsearchpgm();
+      pgm->msgno = mail_newsearchset();
+      pgm->msgno->first = 1;
+      pgm->msgno->last = GetMessageCount();
+
+      if ( pgmReal->uid )
+      {
+         pgm->cc_not = mail_newsearchpgmlist();
+         pgm->cc_not->pgm = pgmReal;
+      }
+      else // nothing matched, so all messages are found
+      {
+         mail_free_searchpgm(&pgmReal);
+      }
+   }
+
+   UIdArray * const results = DoSearch(pgm, flags);
+   if ( !results )
+   {
+      wxLogError(_("Failed to search for messages in the folder '%s'."),
+                 GetName().c_str());
+
+      return new UIdArray;
+   }
+
+   return results;
+}
+
 // ----------------------------------------------------------------------------
 // Message flags
 // ----------------------------------------------------------------------------
@@ -3652,6 +4655,8 @@ MailFolderCC::SetSequenceFlag(SequenceKind kind,
                               int flag,
                               bool set)
 {
+   StreamLocker lockStream(this);
+
    if ( !CanSetFlag(flag) )
    {
       ERRORMESSAGE((_("Impossible to set this flag for the folder '%s'."),
@@ -3699,6 +4704,8 @@ MailFolderCC::SetSequenceFlag(SequenceKind kind,
 
 void MailFolderCC::OnMsgStatusChanged()
 {
+   StreamLocker lockStream(this);
+
    CHECK_RET( m_statusChangeData, _T("OnMsgStatusChanged() shouldn't be called!") );
 
    HeaderInfoList_obj headers(GetHeaders());
@@ -3914,6 +4921,8 @@ MailFolderCC::DebugDump() const
 bool
 MailFolderCC::SortMessages(MsgnoType *msgnos, const SortParams& sortParams)
 {
+   StreamLocker lockStream(this);
+
    CHECK( m_MailStream, false, _T("can't sort closed folder") );
 
    /*
@@ -4146,6 +5155,8 @@ static THREADNODE *CopyTree(THREADNODE* th)
 bool MailFolderCC::ThreadMessages(const ThreadParams& thrParams,
                                   ThreadData *thrData)
 {
+   StreamLocker lockStream(this);
+
    CHECK( m_MailStream, false, _T("can't thread closed folder") );
 
    // does the server support threading at all?
@@ -4239,19 +5250,59 @@ bool MailFolderCC::ThreadMessages(const ThreadParams& thrParams,
 MsgnoType MailFolderCC::GetHeaderInfo(ArrayHeaderInfo& headers,
                                       const Sequence& seq)
 {
+   StreamLocker lockStream(this);
+
    CHECK( m_MailStream, 0, _T("GetHeaderInfo: folder is closed") );
 
-   MailFolderLocker lockFolder(this);
+   // the msgnos in the main listing don't correspond to the stream ones until
+   // the changes made by a worker thread are applied to it, the headers will
+   // be retrieved after the listing update triggered by them
+   if ( wxThread::IsMain() && HasListingChanges() )
+   {
+      wxLogTrace(TRACE_MF_CALLS, _T("Not retrieving headers for '%s' now, "
+                                    "its listing is out of date."),
+                 GetName().c_str());
+
+      return 0;
+   }
+
+   MailFolderLocker lockFolder(this);
 
    String sequence = seq.GetString();
    wxLogTrace(TRACE_MF_CALLS, _T("Retrieving headers %s for '%s'..."),
               sequence.c_str(), GetName().c_str());
 
+   // first take all the headers we can from the cache
+   // ------------------------------------------------
+
+   MsgnoType nCached = 0;
+   Sequence seqMissing;
+   if ( m_overviewCache )
+   {
+      nCached = GetCachedHeaderInfo(headers, seq, seqMissing);
+      if ( !m_MailStream )
+      {
+         ERRORMESSAGE((_("Error retrieving the message headers from folder '%s'"),
+                       GetName().c_str()));
+
+         return nCached;
+      }
+
+      if ( !seqMissing.GetCount() )
+      {
+         // nothing to retrieve from server
+         return nCached;
+      }
+   }
+
+   // and get the remaining ones from the server
+   const Sequence& seqToGet = m_overviewCache ? seqMissing : seq;
+
    // prepare overviewData to be used by OverviewHeaderEntry()
    // --------------------------------------------------------
 
-   MsgnoType nMessages = seq.GetCount();
-   OverviewData overviewData(seq, headers, nMessages);
+   MsgnoType nMessages = seqToGet.GetCount();
+   OverviewData overviewData(seqToGet, headers, nMessages);
 
    // don't show the progress dialog if we're not in interactive mode
    if ( GetInteractiveFrame() && !mApplication->IsInAwayMode() )
@@ -4276,7 +5327,7 @@ MsgnoType MailFolderCC::GetHeaderInfo(ArrayHeaderInfo& headers,
    // scroll down soon
    //
    // the user can disable this by setting the option to -1
-   int lookAhead = m_LookAhead == -1 ? 0 : seq.GetCount() + 1;
+   int lookAhead = m_LookAhead == -1 ? 0 : nMessages + 1;
    if ( lookAhead < m_LookAhead )
    {
       // if the user wants to cache more headers than this, do as he says
@@ -4287,9 +5338,9 @@ MsgnoType MailFolderCC::GetHeaderInfo(ArrayHeaderInfo& headers,
 
    // do fill the listing
    size_t n;
-   for ( UIdType i = seq.GetFirst(n);
+   for ( UIdType i = seqToGet.GetFirst(n);
          i != UID_ILLEGAL && m_MailStream;
-         i = seq.GetNext(i, n) )
+         i = seqToGet.GetNext(i, n) )
    {
       MESSAGECACHE *elt = mail_elt(m_MailStream, i);
       if ( !elt )
@@ -4323,7 +5374,192 @@ MsgnoType MailFolderCC::GetHeaderInfo(ArrayHeaderInfo& headers,
                     GetName().c_str()));
    }
 
-   return overviewData.GetRetrievedCount();
+   return nCached + overviewData.GetRetrievedCount();
+}
+
+void MailFolderCC::PrefetchMessages(const UIdArray& uids,
+                                    int what,
+                                    const wxArrayString& headers)
+{
+   StreamLocker lockStream(this);
+
+   CHECK_RET( m_MailStream, _T("PrefetchMessages: folder is closed") );
+
+   if ( what & Prefetch_Header )
+      PrefetchHeaders(uids);
+
+   // c-client doesn't provide any way to retrieve the texts of several
+   // messages at once, so they're still fetched one message at a time when
+   // they're accessed and we only get the envelopes here (and the header
+   // lines which are retrieved together with them)
+   if ( uids.IsEmpty() || !(what & (Prefetch_Overview | Prefetch_HeaderLines)) )
+      return;
+
+   MailFolderLocker lockFolder(this);
+
+   wxStopWatch sw;
+
+   // for IMAP4rev1 servers c-client can fetch the additional header lines
+   // together with the envelopes, which is exactly what we need, but notice
+   // that this is only done for the messages whose envelopes are not cached
+   // yet: the header lines of the others will be retrieved on demand
+   const char *extraOld = NULL;
+   wxCharBuffer extraBuf;
+   const bool extraHeaders = (what & Prefetch_HeaderLines) &&
+                              !headers.empty() &&
+                              GetType() == MF_IMAP;
+
+   // the list of these headers is global, so don't let the other threads use
+   // c-client, and see our list, until we restore it
+   CClientLockKeeper keepLock(extraHeaders);
+
+   if ( extraHeaders )
+   {
+      extraOld = (const char *)mail_parameters(NIL, GET_IMAPEXTRAHEADERS, NIL);
+
+      String extra(extraOld ? wxString::From8BitData(extraOld) : String());
+      const size_t count = headers.size();
+      for ( size_t n = 0; n < count; n++ )
+      {
+         if ( !extra.empty() )
+            extra += _T(' ');
+
+         extra += headers[n];
+      }
+
+      extraBuf = wxCharBuffer(extra.To8BitData());
+      mail_parameters(NIL, SET_IMAPEXTRAHEADERS, extraBuf.data());
+   }
+
+   // this retrieves the envelopes, flags, sizes and dates of all messages
+   // which don't have them yet in a single request
+   String sequence = BuildSequence(uids);
+   mail_fetch_overview(m_MailStream, sequence.char_str(), NIL);
+
+   if ( extraHeaders )
+      mail_parameters(NIL, SET_IMAPEXTRAHEADERS, CONST_CCAST(extraOld));
+
+   wxLogTrace(TRACE_MF_CALLS,
+              _T("Prefetched data of %lu messages of '%s' in %ldms"),
+              (unsigned long)uids.GetCount(), GetName().c_str(), sw.Time());
+}
+
+unsigned long MailFolderCC::PrefetchHeaders(const UIdArray& uids)
+{
+   StreamLocker lockStream(this);
+
+   // the other drivers read the headers from the local files anyhow
+   if ( !m_MailStream || GetType() != MF_IMAP || uids.IsEmpty() )
+      return 0;
+
+   MailFolderLocker lockFolder(this);
+
+   wxStopWatch sw;
+
+   // we can only use the msgnos with imap_msgdata() below
+   std::vector<MsgnoType> msgnos;
+   msgnos.reserve(uids.GetCount());
+
+   const size_t count = uids.GetCount();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      const MsgnoType msgno = mail_msgno(m_MailStream, uids[n]);
+      if ( msgno )
+         msgnos.push_back(msgno);
+   }
+
+   std::sort(msgnos.begin(), msgnos.end());
+
+   // c-client doesn't have any function to fetch the headers of an arbitrary
+   // set of messages, but with FT_SEARCHLOOKAHEAD imap_msgdata() gets the
+   // headers of the messages following the given one in the same request, so
+   // we only need to ask for the headers which are still missing after that
+   unsigned long bytes = 0;
+   size_t nRequests = 0;
+   std::vector<MsgnoType> missing;
+   for ( size_t n = 0; n < msgnos.size() && m_MailStream; n++ )
+   {
+      const MsgnoType msgno = msgnos[n];
+      if ( mail_elt(m_MailStream, msgno)->private.msg.header.text.data )
+         continue;
+
+      const MsgnoType last = wxMin(msgno + IMAP_HEADER_LOOKAHEAD,
+                                   m_MailStream->nmsgs);
+
+      missing.clear();
+      for ( MsgnoType m = msgno; m <= last; m++ )
+      {
+         if ( !mail_elt(m_MailStream, m)->private.msg.header.text.data )
+            missing.push_back(m);
+      }
+
+      if ( !imap_msgdata(m_MailStream, msgno, CONST_CCAST("HEADER"), 0, 0,
+                         NIL, FT_PEEK | FT_SEARCHLOOKAHEAD) )
+         break;
+
+      nRequests++;
+
+      for ( size_t m = 0; m < missing.size() && m_MailStream; m++ )
+      {
+         bytes +=
+            mail_elt(m_MailStream, missing[m])->private.msg.header.text.size;
+      }
+   }
+
+   wxLogTrace(TRACE_MF_CALLS,
+              _T("Prefetched headers of %lu messages of '%s' in %lu requests ")
+              _T("(%lu bytes) in %ldms"),
+              (unsigned long)msgnos.size(), GetName().c_str(),
+              (unsigned long)nRequests, bytes, sw.Time());
+
+   return bytes;
+}
+
+MsgnoType MailFolderCC::GetCachedHeaderInfo(ArrayHeaderInfo& headers,
+                                            const Sequence& seq,
+                                            Sequence& seqMissing)
+{
+   wxStopWatch sw;
+
+   // we need the flags anyhow as they are not cached, so get them for all
+   // messages at once: this also avoids fetching them one by one below
+   String sequence = seq.GetString();
+   mail_fetch_flags(m_MailStream, sequence.char_str(), NIL);
+
+   // notice that mail_uid() retrieves the UIDs in batches for IMAP (see
+   // SET_UIDLOOKAHEAD) so we don't need to do anything special here
+   MsgnoType nCached = 0;
+   size_t n;
+   for ( UIdType i = seq.GetFirst(n);
+         i != UID_ILLEGAL && m_MailStream;
+         i = seq.GetNext(i, n) )
+   {
+      MESSAGECACHE *elt = mail_elt(m_MailStream, i);
+      if ( !elt )
+         continue;
+
+      const UIdType uid = mail_uid(m_MailStream, i);
+
+      HeaderInfo& entry = *headers[i - 1];
+      if ( uid && m_overviewCache->Lookup(uid, entry) )
+      {
+         entry.m_UId = uid;
+         entry.m_Status = GetMsgStatus(elt);
+
+         nCached++;
+      }
+      else
+      {
+         seqMissing.Add(i);
+      }
+   }
+
+   wxLogTrace(TRACE_OVERVIEW_CACHE,
+              _T("Found %lu of %lu headers of '%s' in cache in %ldms"),
+              (unsigned long)nCached, (unsigned long)seq.GetCount(),
+              GetName().c_str(), sw.Time());
+
+   return nCached;
 }
 
 /* static */
@@ -4366,8 +5602,10 @@ MailFolderCC::OverviewHeaderEntry(OverviewData *overviewData,
    mail_parse_date(&selt, env->date);
    entry.m_Date = (time_t) mail_longdate(&selt);
 
-   // from and to
-   entry.m_From = ParseAddress(env->from);
+   // from and to: notice that we use temporary strings for them as
+   // assigning to the HeaderInfo fields makes a copy of the string
+   String from = ParseAddress(env->from),
+          to;
 
    MFolderType folderType = GetType();
    if ( folderType == MF_NNTP || folderType == MF_NEWS )
@@ -4376,23 +5614,24 @@ MailFolderCC::OverviewHeaderEntry(OverviewData *overviewData,
    }
    else
    {
-      entry.m_To = ParseAddress(env->to);
+      to = ParseAddress(env->to);
    }
 
    // deal with encodings for the text header fields
    wxFontEncoding encoding;
-   if ( !entry.m_To.empty() )
+   if ( !to.empty() )
    {
-      entry.m_To = MIME::DecodeHeader(entry.m_To, &encoding);
+      entry.m_To = MIME::DecodeHeader(to, &encoding);
    }
    else
    {
+      entry.m_To = String();
       encoding = wxFONTENCODING_SYSTEM;
    }
 
    wxFontEncoding encodingMsg = encoding;
 
-   entry.m_From = MIME::DecodeHeader(entry.m_From, &encoding);
+   entry.m_From = MIME::DecodeHeader(from, &encoding);
    if ( (encoding != wxFONTENCODING_SYSTEM) &&
         (encoding != encodingMsg) )
    {
@@ -4427,6 +5666,12 @@ MailFolderCC::OverviewHeaderEntry(OverviewData *overviewData,
    // set the font encoding to be used for displaying this entry
    entry.m_Encoding = encodingMsg;
 
+   // remember it to avoid retrieving it from server the next time
+   if ( m_overviewCache )
+   {
+      m_overviewCache->Store(entry);
+   }
+
    // update the progress dialog and also check if it wasn't cancelled by the
    // user in the meantime
    if ( !overviewData->UpdateProgress(entry) )
@@ -4446,27 +5691,129 @@ MailFolderCC::OverviewHeaderEntry(OverviewData *overviewData,
 // ----------------------------------------------------------------------------
 
 void
-MailFolderCC::HandleMailExists(struct mail_stream *stream, MsgnoType msgnoMax)
+MailFolderCC::QueueListingChange(ListingChange::Kind kind,
+                                 MsgnoType msgno,
+                                 UIdType uidLast)
 {
-   // NB: use stream and not m_MailStream because the latter might not be set
-   //     yet if we're called from mail_open()
+   ListingChange change;
+   change.kind = kind;
+   change.msgno = msgno;
+   change.uidLast = uidLast;
 
-   // ignore any callbacks for closed or half opened folders: normally we
-   // shouldn't get them at all but somehow we do (ask c-client why...)
-   if ( !stream || stream->halfopen )
+   bool first;
    {
-#ifdef DEBUG
-      if ( !GetName().empty() )
+      wxCriticalSectionLocker lock(m_csListingChanges);
+
+      first = m_listingChanges.empty();
+      m_listingChanges.push_back(change);
+   }
+
+   if ( wxThread::IsMain() )
+   {
+      // apply it now, after any changes reported before it to the workers
+      ApplyListingChanges();
+
+      return;
+   }
+
+   UpdateThreadHeaders(change);
+
+   // one event is enough for all the changes queued until it's processed
+   if ( first )
+   {
+      MEventManager::Send(new MEventFolderOnListingChangeData(this));
+
+      wxWakeUpIdle();
+   }
+}
+
+void MailFolderCC::UpdateThreadHeaders(const ListingChange& change)
+{
+   // the worker using its own listing needs it to be in sync with the stream
+   // immediately, it doesn't have to notify anybody about the changes though
+   HeaderInfoList * const headers = FindThreadHeaders();
+   if ( !headers )
+      return;
+
+   const MsgnoType idx = change.msgno - 1;
+   switch ( change.kind )
+   {
+      case ListingChange::Exists:
+         headers->OnAdd(change.msgno);
+         break;
+
+      case ListingChange::Expunged:
+         if ( idx < headers->Count() )
+            headers->OnRemove(idx);
+         break;
+
+      case ListingChange::Flags:
+         // only update the headers we already have, we can't retrieve the
+         // others from inside c-client
+         if ( m_MailStream && headers->IsInCache(idx) )
+         {
+            MESSAGECACHE * const elt = mail_elt(m_MailStream, change.msgno);
+            HeaderInfo * const hi = headers->GetItemByIndex(idx);
+            if ( elt && hi )
+               hi->m_Status = GetMsgStatus(elt);
+         }
+         break;
+   }
+}
+
+bool MailFolderCC::HasListingChanges() const
+{
+   wxCriticalSectionLocker lock(m_csListingChanges);
+
+   return !m_listingChanges.empty();
+}
+
+void MailFolderCC::ApplyListingChanges()
+{
+   ASSERT_MSG( wxThread::IsMain(), _T("must be called from the main thread") );
+
+   // the handlers may result in more changes being reported to us, they must
+   // be applied after the current ones by the outer call
+   if ( m_applyingListingChanges )
+      return;
+
+   m_applyingListingChanges = true;
+
+   for ( ;; )
+   {
+      ListingChange change;
       {
-         // this is strange...
-         wxLogDebug(_T("mm_exists() for not opened folder '%s' ignored."),
-                    GetName().c_str());
+         wxCriticalSectionLocker lock(m_csListingChanges);
+
+         if ( m_listingChanges.empty() )
+            break;
+
+         change = m_listingChanges.front();
+         m_listingChanges.pop_front();
       }
-#endif // DEBUG
 
-      return;
+      switch ( change.kind )
+      {
+         case ListingChange::Exists:
+            HandleMailExists(change.msgno, change.uidLast);
+            break;
+
+         case ListingChange::Expunged:
+            HandleMailExpunge(change.msgno);
+            break;
+
+         case ListingChange::Flags:
+            HandleMsgFlags(change.msgno);
+            break;
+      }
    }
 
+   m_applyingListingChanges = false;
+}
+
+void
+MailFolderCC::HandleMailExists(MsgnoType msgnoMax, UIdType uidLast)
+{
    // special case: when we get the first mm_exists() for an empty folder,
    // msgnoMax will be equal to m_nMessages (both will be 0), so catch this
    // with an additional check for m_uidLast
@@ -4522,7 +5869,7 @@ MailFolderCC::HandleMailExists(struct mail_stream *stream, MsgnoType msgnoMax)
 
    // update it so that it won't be UID_ILLEGAL the next time and the test
    // above works as expected
-   m_uidLast = stream->uid_last;
+   m_uidLast = uidLast;
 }
 
 void
@@ -4753,9 +6100,9 @@ MailFolderCC::CClientInit(void)
    (*imapdriver.parameters)(SET_MAXLOGINTRIALS, (void *)1);
    (*pop3driver.parameters)(SET_MAXLOGINTRIALS, (void *)1);
 
-#ifdef USE_BLOCK_NOTIFY
+   gs_ccBlockNotifyDefault =
+      (blocknotify_t)mail_parameters(NULL, GET_BLOCKNOTIFY, NULL);
    mail_parameters(NULL, SET_BLOCKNOTIFY, (void *)mahogany_block_notify);
-#endif // USE_BLOCK_NOTIFY
 
 #ifdef USE_READ_PROGRESS
    mail_parameters(NULL, SET_READPROGRESS, (void *)mahogany_read_progress);
@@ -4838,6 +6185,11 @@ CCStreamCleaner::~CCStreamCleaner()
 
 void MailFolderCCCleanup(void)
 {
+   ImapIdleManager::Delete();
+
+   // all worker threads are gone by now
+   CClientLock::Destroy();
+
    ServerInfoEntryCC::DeleteAll();
 
    // as c-client lib doesn't seem to think that deallocating memory is
@@ -4896,6 +6248,11 @@ const String& MailFolder::InitializeNewsSpool()
 void
 MailFolderCC::mm_exists(MAILSTREAM *stream, unsigned long msgnoMax)
 {
+   // the changes reported on IDLE connections are handled by rechecking the
+   // folder itself later
+   if ( ImapIdleManager::OnChange(stream) )
+      return;
+
    MailFolderCC *mf = LookupObject(stream);
    // We can get callback for temporary c-client stream
    // which of course doesn't exist in our folder list.
@@ -4905,17 +6262,54 @@ MailFolderCC::mm_exists(MAILSTREAM *stream, unsigned long msgnoMax)
       return;
    }
 
-   mf->HandleMailExists(stream, msgnoMax);
+   // NB: use stream and not mf->m_MailStream because the latter might not be
+   //     set yet if we're called from mail_open()
+
+   // ignore any callbacks for closed or half opened folders: normally we
+   // shouldn't get them at all but somehow we do (ask c-client why...)
+   if ( !stream || stream->halfopen )
+   {
+#ifdef DEBUG
+      if ( !mf->GetName().empty() )
+      {
+         // this is strange...
+         wxLogDebug(_T("mm_exists() for not opened folder '%s' ignored."),
+                    mf->GetName().c_str());
+      }
+#endif // DEBUG
+
+      return;
+   }
+
+   mf->QueueListingChange(ListingChange::Exists, msgnoMax, stream->uid_last);
 }
 
 /* static */
 void
 MailFolderCC::mm_expunged(MAILSTREAM *stream, unsigned long msgno)
 {
+   if ( ImapIdleManager::OnChange(stream) )
+      return;
+
    MailFolderCC *mf = LookupObject(stream);
    CHECK_RET(mf, _T("mm_expunged for non existent folder"));
 
-   mf->HandleMailExpunge(msgno);
+   // the message is gone for good, don't keep its header in the cache: we can
+   // still access its UID as the element is only freed after mm_expunged(),
+   // so this can't be deferred
+   if ( mf->m_overviewCache || mf->m_ftIndex )
+   {
+      MESSAGECACHE *elt = mail_elt(stream, msgno);
+      if ( elt && elt->private.uid )
+      {
+         if ( mf->m_overviewCache )
+            mf->m_overviewCache->Forget(elt->private.uid);
+         if ( mf->m_ftIndex )
+            mf->m_ftIndex->Forget(elt->private.uid);
+      }
+   }
+
+   mf->QueueListingChange(ListingChange::Expunged, msgno);
 }
 
 /// this message matches a search
@@ -5192,11 +6586,14 @@ MailFolderCC::mm_login(NETMBX * /* mb */,
 void
 MailFolderCC::mm_flags(MAILSTREAM *stream, unsigned long msgno)
 {
+   if ( ImapIdleManager::OnChange(stream) )
+      return;
+
    MailFolderCC *mf = LookupObject(stream);
    CHECK_RET(mf, _T("mm_flags for non existent folder"));
 
    // message flags really changed, cclient checks for it
-   mf->HandleMsgFlags(msgno);
+   mf->QueueListingChange(ListingChange::Flags, msgno);
 }
 
 /** alert that c-client will run critical code
@@ -5317,6 +6714,8 @@ MailFolderCC::ListFolders(ASMailFolder *asmf,
                           UserData ud,
                           Ticket ticket)
 {
+   StreamLocker lockStream(this);
+
    if ( !CheckConnection() )
    {
       wxLogError(_("Cannot list subfolders of folder '%s'."), GetName());
@@ -5392,7 +6791,9 @@ MailFolderCC::ListFolders(ASMailFolder *asmf,
 // gettting the folder delimiter separator
 // ----------------------------------------------------------------------------
 
-static char gs_delimiter = '\0';
+static wxTLS_TYPE(char) tls_delimiter;
+
+#define gs_delimiter wxTLS_VALUE(tls_delimiter)
 
 static void GetDelimiterMMList(MAILSTREAM * /* stream */,
                                char delim,
@@ -5405,6 +6806,8 @@ static void GetDelimiterMMList(MAILSTREAM * /* stream */,
 
 char MailFolderCC::GetFolderDelimiter() const
 {
+   StreamLocker lockStream(this);
+
    // may be we already have it cached?
    if ( m_chDelimiter == ILLEGAL_DELIMITER )
    {
@@ -5547,11 +6950,18 @@ MailFolderCC::ClearFolder(const MFolder *mfolder)
 
       // try to reuse an existing connection, if any
       server = ServerInfoEntryCC::Get(mfolder);
-      stream = server ? server->GetStream() : NIL;
 
       // open the folder: although we don't need to do it to get its status, we
       // have to do it anyhow below, so better do it right now
-      stream = MailOpen(stream, mboxpath);
+      if ( server )
+      {
+         stream = server->GetStream(mboxpath);
+         stream = server->OpenStream(stream, mboxpath);
+      }
+      else
+      {
+         stream = MailOpen(NIL, mboxpath);
+      }
 
       if ( !stream )
       {
@@ -5682,9 +7092,16 @@ MailFolderCC::HasInferiors(const String& imapSpec,
    gs_HasInferiorsFlag = -1;
 
    ServerInfoEntryCC *server = ServerInfoEntryCC::Get(mfolder);
-   MAILSTREAM *stream = server ? server->GetStream() : NIL;
-
-   stream = MailOpen(stream, imapSpec, OP_HALFOPEN);
+   MAILSTREAM *stream;
+   if ( server )
+   {
+      stream = server->GetStream();
+      stream = server->OpenStream(stream, imapSpec, OP_HALFOPEN);
+   }
+   else
+   {
+      stream = MailOpen(NIL, imapSpec, OP_HALFOPEN);
+   }
 
    if ( stream != NIL )
    {
@@ -5712,6 +7129,10 @@ MailFolderCC::HasInferiors(const String& imapSpec,
 void MailFolderCC::StartReading(unsigned long total)
 {
 #ifdef USE_READ_PROGRESS
+   // we can't show the progress dialog from a worker thread
+   if ( !wxThread::IsMain() )
+      return;
+
    ASSERT_MSG( !gs_readProgressInfo, _T("can't start another read operation") );
 
    // don't show the progress dialogs for the local folders - in practice, it
@@ -5738,7 +7159,7 @@ void MailFolderCC::StartReading(unsigned long total)
 void MailFolderCC::EndReading()
 {
 #ifdef USE_READ_PROGRESS
-   if ( gs_readProgressInfo )
+   if ( gs_readProgressInfo && wxThread::IsMain() )
    {
       delete gs_readProgressInfo;
       gs_readProgressInfo = NULL;
@@ -5906,6 +7327,10 @@ mm_status(MAILSTREAM *stream, char *mailbox, MAILSTATUS *status)
 void
 mm_log(char *str, long errflg)
 {
+   // we can be called while waiting for the network, so get the lock back
+   // before doing anything else, even logging the trace message
+   CClientLockReacquirer reacquire;
+
    TRACE_CALLBACK_NOSTREAM_2(mm_log, "%s (%s)", str, GetErrorLevel(errflg));
 
    if ( mm_disable_callbacks || mm_ignore_errors )
@@ -5914,7 +7339,10 @@ mm_log(char *str, long errflg)
    String msg = wxString::From8BitData(str);
 
    // TODO: what's going on here?
-   if(errflg >= 4) // fatal imap error, reopen-mailbox
+   //
+   // NB: don't do it from the worker threads as pinging the other folders
+   //     would lock their streams while we hold ours
+   if ( errflg >= 4 && wxThread::IsMain() ) // fatal imap error, reopen-mailbox
    {
       if ( !MailFolderCC::PingAllOpened() )
          msg << _("\nAttempt to re-open all folders failed.");
@@ -5926,6 +7354,9 @@ mm_log(char *str, long errflg)
 void
 mm_dlog(char *str)
 {
+   // see mm_log()
+   CClientLockReacquirer reacquire;
+
    TRACE_CALLBACK_NOSTREAM_1(mm_dlog, "%s", str);
 
    // always show debug logs, even if other callbacks are disabled - this
@@ -5986,36 +7417,59 @@ mm_fatal(char *str)
 // more control over cclient operation
 // ----------------------------------------------------------------------------
 
-#ifdef USE_BLOCK_NOTIFY
-
 void *mahogany_block_notify(int reason, void *data)
 {
-   #define LOG_BLOCK_REASON(what) \
-      if ( reason == BLOCK_##what ) \
-         printf("%s: mm_blocknotify(%s, %p)\n", \
-                wxDateTime::Now().FormatTime().c_str(), #what, data); \
-      else \
-
-   LOG_BLOCK_REASON(NONE)
-   LOG_BLOCK_REASON(SENSITIVE)
-   LOG_BLOCK_REASON(NONSENSITIVE)
-   LOG_BLOCK_REASON(DNSLOOKUP)
-   LOG_BLOCK_REASON(TCPOPEN)
-   LOG_BLOCK_REASON(TCPREAD)
-   LOG_BLOCK_REASON(TCPWRITE)
-   LOG_BLOCK_REASON(TCPCLOSE)
-   LOG_BLOCK_REASON(FILELOCK)
-   printf("mm_blocknotify(UNKNOWN, %p)\n", data);
+   // release c-client lock while we're waiting so that the other threads
+   // could use it
+   CClientLock * const lock = CClientLock::Get();
+   if ( lock )
+      lock->OnBlock(reason);
 
-   return NULL;
+   return gs_ccBlockNotifyDefault ? (*gs_ccBlockNotifyDefault)(reason, data)
+                                  : NULL;
 }
 
-#endif // USE_BLOCK_NOTIFY
+long mahogany_append_next(MAILSTREAM * /* stream */, void *data,
+                          char **flags, char **date, STRING **message)
+{
+   AppendMessagesData * const ad = static_cast<AppendMessagesData *>(data);
+
+   if ( ad->next == ad->msgs.size() )
+   {
+      // no more messages
+      *message = NIL;
+      return T;
+   }
+
+   const MailFolder::RawMessage& msg = ad->msgs[ad->next++];
+
+   *date = NIL;
+   MESSAGECACHE mc;
+   if ( !msg.date.empty() &&
+         mail_parse_date(&mc, UCHAR_CAST(msg.date.char_str())) )
+   {
+      mail_date(ad->date, &mc);
+      *date = ad->date;
+   }
+
+   ad->flags = GetImapFlags(msg.status).To8BitData();
+   *flags = ad->flags.data();
+
+   INIT(&ad->str, mail_string,
+        const_cast<char *>(msg.text.data()), msg.text.length());
+   *message = &ad->str;
+
+   return T;
+}
 
 #ifdef USE_READ_PROGRESS
 
 void mahogany_read_progress(GETS_DATA * /* md */, unsigned long count)
 {
+   // the progress dialog is only shown for the main thread operations
+   if ( !wxThread::IsMain() )
+      return;
+
    // forbid any other calls to c-client while we're inside it
    MAppCriticalSection cs;
 
@@ -6054,16 +7508,29 @@ static inline bool Folder2NETMBX(const MFolder *folder, NETMBX *netmbx)
 }
 
 ServerInfoEntryCC::ServerInfoEntryCC(const MFolder *folder)
-                 : ServerInfoEntry(folder)
+                 : ServerInfoEntry(folder),
+                   m_condInUse(m_mutexInUse)
 {
    Folder2NETMBX(folder, &m_netmbx);
+
+   m_poolHits =
+   m_poolMisses = 0;
+
+   m_nReused =
+   m_nConnected = 0;
+   m_timeReused =
+   m_timeConnected = 0;
 }
 
 ServerInfoEntryCC::~ServerInfoEntryCC()
 {
    wxLogTrace(TRACE_SERVER_CACHE,
-              _T("Deleting server entry for %s(%s)."),
-              m_netmbx.host, m_netmbx.user);
+              _T("Deleting server entry for %s(%s): connection pool had ")
+              _T("%lu hits and %lu misses, average open time %ldms for ")
+              _T("reused and %ldms for new connections."),
+              m_netmbx.host, m_netmbx.user,
+              m_poolHits, m_poolMisses,
+              GetReuseLatency(), GetConnectLatency());
 
    // close all connections we may still have
    for ( StreamList::iterator i = m_connections.begin();
@@ -6119,6 +7586,7 @@ bool ServerInfoEntryCC::CanBeUsedFor(const MFolder *folder) const
           strcmp(m_netmbx.service, ms_lastParsed.netmbx.service) == 0 &&
           (!m_netmbx.port || (m_netmbx.port == ms_lastParsed.netmbx.port)) &&
           (m_netmbx.anoflag == ms_lastParsed.netmbx.anoflag) &&
+          (m_netmbx.sslflag == ms_lastParsed.netmbx.sslflag) &&
           (!m_netmbx.user[0] ||
             (strcmp(m_netmbx.user, ms_lastParsed.netmbx.user) == 0));
 }
@@ -6127,31 +7595,208 @@ bool ServerInfoEntryCC::CanBeUsedFor(const MFolder *folder) const
 // ServerInfoEntryCC connection caching
 // ----------------------------------------------------------------------------
 
-MAILSTREAM *ServerInfoEntryCC::GetStream()
+MAILSTREAM *ServerInfoEntryCC::GetStream(const String& spec, long options)
 {
    if ( m_connections.empty() )
-      return NULL;
+   {
+      m_poolMisses++;
 
-   MAILSTREAM *stream = *m_connections.begin();
-   m_connections.pop_front();
-   m_timeouts.pop_front();
+      return NULL;
+   }
 
-   return stream;
-}
+   m_poolHits++;
 
-void ServerInfoEntryCC::KeepStream(MAILSTREAM *stream, const MFolder *folder)
-{
-   m_connections.push_back(stream);
+   // find the best connection to reuse: we prefer the oldest ones among the
+   // equally good ones as they're going to time out sooner
+   const bool halfopen = (options & OP_HALFOPEN) != 0;
+   const String path = GetPathFromImapSpec(spec);
 
-   Profile_obj profile(folder->GetProfile());
-   time_t t = time(NULL);
-   time_t delay = READ_CONFIG(profile, MP_CONN_CLOSE_DELAY);
+   StreamList::iterator best = m_connections.begin();
+   TimeList::iterator bestTimeout = m_timeouts.begin();
+   int bestScore = -1;
 
-   wxLogTrace(TRACE_SERVER_CACHE,
-              _T("Keeping connection to %s alive for %d seconds."),
-              stream->mailbox, (int)delay);
+   StreamList::iterator i = m_connections.begin();
+   TimeList::iterator j = m_timeouts.begin();
+   for ( ; i != m_connections.end(); ++i, ++j )
+   {
+      MAILSTREAM * const stream = *i;
 
-   m_timeouts.push_back(t + delay);
+      int score = 0;
+      if ( (stream->halfopen != 0) == halfopen )
+      {
+         // this saves an UNSELECT or SELECT command or, for the servers not
+         // supporting UNSELECT, even the entire reconnection
+         score += 2;
+
+         if ( !halfopen && !path.empty() && stream->mailbox &&
+                  GetPathFromImapSpec(wxString::FromAscii(stream->mailbox))
+                     == path )
+         {
+            // reselecting the same mailbox is cheaper for the server
+            score++;
+         }
+      }
+
+      if ( score > bestScore )
+      {
+         bestScore = score;
+         best = i;
+         bestTimeout = j;
+      }
+   }
+
+   MAILSTREAM * const stream = *best;
+   m_connections.erase(best);
+   m_timeouts.erase(bestTimeout);
+
+   wxLogTrace(TRACE_SERVER_CACHE,
+              _T("Reusing connection to %s (%lu hits, %lu misses)."),
+              stream->mailbox, m_poolHits, m_poolMisses);
+
+   return stream;
+}
+
+void ServerInfoEntryCC::WaitForConnection()
+{
+   const long poolSize = READ_APPCONFIG(MP_CONN_POOL_SIZE);
+   if ( poolSize <= 0 )
+      return;
+
+   // close the unused connections instead of exceeding the limit
+   while ( !m_connections.empty() &&
+            m_streamsInUse.size() + m_connections.size() >= (size_t)poolSize )
+   {
+      CCCallbackDisabler cc;
+
+      mail_close(*m_connections.begin());
+
+      m_connections.pop_front();
+      m_timeouts.pop_front();
+   }
+
+   // the main thread doesn't wait as it would block the GUI
+   if ( wxThread::IsMain() )
+      return;
+
+   // and the workers don't wait forever neither, in case the connections are
+   // held by the other threads waiting for something else in turn
+   static const long CONN_WAIT_TIMEOUT = 30000;
+
+   wxStopWatch sw;
+   while ( m_streamsInUse.size() >= (size_t)poolSize )
+   {
+      if ( sw.Time() > CONN_WAIT_TIMEOUT )
+      {
+         wxLogTrace(TRACE_SERVER_CACHE,
+                    _T("Exceeding the limit of %ld connections to %s."),
+                    poolSize, m_netmbx.host);
+         break;
+      }
+
+      wxLogTrace(TRACE_SERVER_CACHE,
+                 _T("Waiting for one of %ld connections to %s."),
+                 poolSize, m_netmbx.host);
+
+      // lock the mutex before letting the other threads use c-client to
+      // give the streams back, so that we can't miss their signal
+      m_mutexInUse.Lock();
+      MailFolderCC::UnlockCClient();
+
+      m_condInUse.WaitTimeout(CONN_WAIT_TIMEOUT);
+
+      m_mutexInUse.Unlock();
+      MailFolderCC::LockCClient();
+   }
+}
+
+void ServerInfoEntryCC::ReleaseStream(MAILSTREAM *stream)
+{
+   if ( !m_streamsInUse.erase(stream) )
+      return;
+
+   wxMutexLocker lock(m_mutexInUse);
+   m_condInUse.Broadcast();
+}
+
+MAILSTREAM *
+ServerInfoEntryCC::OpenStream(MAILSTREAM *stream,
+                              const String& spec,
+                              long options)
+{
+   if ( !stream )
+      WaitForConnection();
+
+   wxStopWatch sw;
+
+   const bool reused = stream != NULL;
+   stream = MailOpen(stream, spec, options);
+   if ( stream )
+      m_streamsInUse.insert(stream);
+
+   const long elapsed = sw.Time();
+   if ( reused )
+   {
+      m_nReused++;
+      m_timeReused += elapsed;
+   }
+   else
+   {
+      m_nConnected++;
+      m_timeConnected += elapsed;
+   }
+
+   wxLogTrace(TRACE_SERVER_CACHE,
+              _T("Opening %s on a %s connection took %ldms (average %ldms)."),
+              spec.c_str(), reused ? _T("reused") : _T("new"), elapsed,
+              reused ? GetReuseLatency() : GetConnectLatency());
+
+   return stream;
+}
+
+void ServerInfoEntryCC::KeepStream(MAILSTREAM *stream, const MFolder *folder)
+{
+   ReleaseStream(stream);
+
+   Profile_obj profile(folder->GetProfile());
+
+   // don't keep more than the configured number of connections, close the
+   // oldest ones if we already have too many
+   const long poolSize = READ_CONFIG(profile, MP_CONN_POOL_SIZE);
+   while ( !m_connections.empty() && (long)m_connections.size() >= poolSize )
+   {
+      MAILSTREAM *streamOld = *m_connections.begin();
+
+      wxLogTrace(TRACE_SERVER_CACHE,
+                 _T("Too many connections to %s, closing the oldest one."),
+                 streamOld->mailbox);
+
+      CCCallbackDisabler cc;
+
+      mail_close(streamOld);
+
+      m_connections.pop_front();
+      m_timeouts.pop_front();
+   }
+
+   if ( poolSize <= 0 )
+   {
+      CCCallbackDisabler cc;
+
+      mail_close(stream);
+
+      return;
+   }
+
+   m_connections.push_back(stream);
+
+   time_t t = time(NULL);
+   time_t delay = READ_CONFIG(profile, MP_CONN_CLOSE_DELAY);
+
+   wxLogTrace(TRACE_SERVER_CACHE,
+              _T("Keeping connection to %s alive for %d seconds."),
+              stream->mailbox, (int)delay);
+
+   m_timeouts.push_back(t + delay);
 
    if ( !ms_connCloseTimer )
    {
@@ -6238,3 +7883,1029 @@ void ServerInfoEntryCC::CheckTimeoutAll()
    }
 }
 
+// ----------------------------------------------------------------------------
+// ServerInfoEntryCC statistics
+// ----------------------------------------------------------------------------
+
+bool ServerInfoEntryCC::GetPoolStats(PoolStats& stats) const
+{
+   stats.connInUse = m_streamsInUse.size();
+   stats.connPooled = m_connections.size();
+   stats.hits = m_poolHits;
+   stats.misses = m_poolMisses;
+   stats.latencyReuse = GetReuseLatency();
+   stats.latencyConnect = GetConnectLatency();
+
+   return true;
+}
+
+String ServerInfoEntryCC::GetName() const
+{
+   String name;
+   name << m_netmbx.service << _T("://");
+   if ( *m_netmbx.user )
+      name << m_netmbx.user << _T('@');
+   name << m_netmbx.host;
+
+   return name;
+}
+
+// ============================================================================
+// multi-threading support implementation
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// CClientLock
+// ----------------------------------------------------------------------------
+
+CClientLock *CClientLock::ms_lock = NULL;
+size_t CClientLock::ms_nActivations = 0;
+
+CClientLock::CClientLock()
+           : m_cond(m_mutex),
+             m_timer(this)
+{
+   m_held =
+   m_mainWaiting =
+   m_requestPending = false;
+
+   m_nWaiting =
+   m_nGranted = 0;
+
+   Bind(wxEVT_THREAD, &CClientLock::OnRequest, this);
+   Bind(wxEVT_TIMER, &CClientLock::OnTimer, this);
+}
+
+/* static */
+void CClientLock::Activate()
+{
+   ASSERT_MSG( wxThread::IsMain(), _T("must be called from the main thread") );
+
+   if ( ms_nActivations++ )
+      return;
+
+   wxLogTrace(TRACE_CCLIENT_LOCK, _T("Enabling c-client use by worker threads"));
+
+   ms_lock = new CClientLock;
+   ms_lock->Acquire();
+}
+
+/* static */
+void CClientLock::Deactivate()
+{
+   ASSERT_MSG( wxThread::IsMain(), _T("must be called from the main thread") );
+
+   CHECK_RET( ms_nActivations, _T("c-client lock is not activated") );
+
+   if ( --ms_nActivations )
+      return;
+
+   wxLogTrace(TRACE_CCLIENT_LOCK, _T("Disabling c-client use by worker threads"));
+
+   Destroy();
+}
+
+/* static */
+void CClientLock::Destroy()
+{
+   ms_nActivations = 0;
+
+   if ( !ms_lock )
+      return;
+
+   ms_lock->Release();
+
+   delete ms_lock;
+   ms_lock = NULL;
+}
+
+void CClientLock::Acquire()
+{
+   ASSERT_MSG( !wxTLS_VALUE(tls_cclientLocked),
+               _T("c-client lock is not recursive") );
+
+   wxMutexLocker lock(m_mutex);
+
+   if ( wxThread::IsMain() )
+   {
+      m_mainWaiting = true;
+      while ( m_held )
+         m_cond.Wait();
+      m_mainWaiting = false;
+   }
+   else // worker thread
+   {
+      if ( m_held || m_mainWaiting )
+      {
+         // the main thread must give us the lock from its event loop
+         if ( !m_requestPending )
+         {
+            m_requestPending = true;
+            wxQueueEvent(this, new wxThreadEvent);
+         }
+
+         m_nWaiting++;
+         while ( m_held || m_mainWaiting )
+            m_cond.Wait();
+         m_nWaiting--;
+      }
+
+      // notify LetWorkersRun() about it
+      m_nGranted++;
+      m_cond.Broadcast();
+   }
+
+   m_held = true;
+   wxTLS_VALUE(tls_cclientLocked) = true;
+}
+
+void CClientLock::Release()
+{
+   ASSERT_MSG( wxTLS_VALUE(tls_cclientLocked),
+               _T("releasing c-client lock we don't have") );
+
+   wxTLS_VALUE(tls_cclientLocked) = false;
+
+   wxMutexLocker lock(m_mutex);
+   m_held = false;
+   m_cond.Broadcast();
+}
+
+void CClientLock::OnBlock(int reason)
+{
+   switch ( reason )
+   {
+      case BLOCK_TCPREAD:
+      case BLOCK_TCPWRITE:
+      case BLOCK_FILELOCK:
+         // notice that we don't release the lock during DNS lookups nor while
+         // opening the connections as c-client uses static variables then
+         if ( wxTLS_VALUE(tls_cclientLocked) &&
+               !wxTLS_VALUE(tls_nCClientKeepers) )
+         {
+            Release();
+            wxTLS_VALUE(tls_cclientBlocked) = true;
+         }
+         break;
+
+      case BLOCK_NONE:
+         if ( wxTLS_VALUE(tls_cclientBlocked) )
+         {
+            wxTLS_VALUE(tls_cclientBlocked) = false;
+            Acquire();
+         }
+         break;
+   }
+}
+
+void CClientLock::LetWorkersRun()
+{
+   wxTLS_VALUE(tls_cclientLocked) = false;
+
+   {
+      wxMutexLocker lock(m_mutex);
+
+      // wait until all the threads waiting for the lock now get it: we could
+      // reacquire it immediately otherwise
+      const size_t nGranted = m_nGranted + m_nWaiting;
+
+      wxLogTrace(TRACE_CCLIENT_LOCK, _T("Letting %lu worker threads run"),
+                 (unsigned long)m_nWaiting);
+
+      m_held = false;
+      m_cond.Broadcast();
+
+      while ( m_nGranted < nGranted )
+         m_cond.Wait();
+   }
+
+   Acquire();
+}
+
+void CClientLock::ProcessRequests()
+{
+   {
+      wxMutexLocker lock(m_mutex);
+      m_requestPending = false;
+
+      if ( !m_nWaiting )
+         return;
+   }
+
+   // we can't let anybody else use c-client if we're in the middle of some
+   // folder operation (we may be called from a nested event loop then) or if
+   // the background processing is disabled, retry later in this case
+   if ( !wxTLS_VALUE(tls_cclientLocked) ||
+         wxTLS_VALUE(tls_nStreamLocks) ||
+            !mApplication->AllowBgProcessing() )
+   {
+      if ( !m_timer.IsRunning() )
+         m_timer.StartOnce(CCLIENT_LOCK_RETRY_DELAY);
+
+      return;
+   }
+
+   LetWorkersRun();
+}
+
+void CClientLock::OnRequest(wxThreadEvent& WXUNUSED(event))
+{
+   ProcessRequests();
+}
+
+void CClientLock::OnTimer(wxTimerEvent& WXUNUSED(event))
+{
+   ProcessRequests();
+}
+
+// ----------------------------------------------------------------------------
+// MailFolderCC::StreamLocker
+// ----------------------------------------------------------------------------
+
+// the mutex protecting m_streamOwner and m_nStreamLocks of all folders and the
+// condition signaled when any stream is unlocked
+static wxMutex gs_mutexStreams;
+static wxCondition gs_condStreams(gs_mutexStreams);
+
+/* static */
+void MailFolderCC::StreamLocker::Link(MailFolderCC *mf)
+{
+   // keep the list sorted, usually the folder just goes to its head
+   std::less<const MailFolderCC *> before;
+
+   MailFolderCC *mfPrev = NULL,
+                *mfNext = wxTLS_VALUE(tls_streamLast);
+   while ( mfNext && before(mf, mfNext) )
+   {
+      mfPrev = mfNext;
+      mfNext = mfNext->m_streamPrev;
+   }
+
+   mf->m_streamPrev = mfNext;
+   if ( mfPrev )
+      mfPrev->m_streamPrev = mf;
+   else
+      wxTLS_VALUE(tls_streamLast) = mf;
+}
+
+/* static */
+void MailFolderCC::StreamLocker::Unlink(MailFolderCC *mf)
+{
+   MailFolderCC *mfPrev = NULL,
+                *mfCur = wxTLS_VALUE(tls_streamLast);
+   while ( mfCur && mfCur != mf )
+   {
+      mfPrev = mfCur;
+      mfCur = mfCur->m_streamPrev;
+   }
+
+   CHECK_RET( mfCur, _T("unlocking folder stream not held by this thread") );
+
+   if ( mfPrev )
+      mfPrev->m_streamPrev = mf->m_streamPrev;
+   else
+      wxTLS_VALUE(tls_streamLast) = mf->m_streamPrev;
+
+   mf->m_streamPrev = NULL;
+}
+
+/* static */
+void MailFolderCC::StreamLocker::Lock(const MailFolderCC *mfConst)
+{
+   MailFolderCC * const mf = const_cast<MailFolderCC *>(mfConst);
+
+   const wxThreadIdType self = wxThread::GetCurrentId();
+
+   CClientLock *lock = NULL;
+
+   {
+      wxMutexLocker locker(gs_mutexStreams);
+
+      if ( mf->m_nStreamLocks && mf->m_streamOwner == self )
+      {
+         // recursive lock, nothing else to do
+         mf->m_nStreamLocks++;
+         wxTLS_VALUE(tls_nStreamLocks)++;
+
+         return;
+      }
+
+      if ( mf->m_nStreamLocks )
+      {
+         wxLogTrace(TRACE_CCLIENT_LOCK, _T("Waiting for folder '%s'"),
+                    mf->GetName().c_str());
+
+         // the thread using the stream needs c-client lock to finish with it
+         if ( wxTLS_VALUE(tls_cclientLocked) )
+         {
+            lock = CClientLock::Get();
+            lock->Release();
+         }
+
+         // a thread may only wait for a stream if it doesn't hold any of the
+         // streams coming after it in the order of the folders addresses: as
+         // all threads follow this rule, two of them can never wait for each
+         // other, so give back the streams we hold after this one while we
+         // wait for it and take them again, in order, once we have it
+         std::less<const MailFolderCC *> before;
+
+         std::vector<MailFolderCC *> released;
+         std::vector<size_t> counts;
+         for ( MailFolderCC *mfHeld = wxTLS_VALUE(tls_streamLast);
+               mfHeld && before(mf, mfHeld);
+               mfHeld = wxTLS_VALUE(tls_streamLast) )
+         {
+            released.push_back(mfHeld);
+            counts.push_back(mfHeld->m_nStreamLocks);
+
+            Unlink(mfHeld);
+            mfHeld->m_nStreamLocks = 0;
+         }
+
+         if ( !released.empty() )
+         {
+            wxLogTrace(TRACE_CCLIENT_LOCK,
+                       _T("Releasing %lu streams while waiting for '%s'"),
+                       (unsigned long)released.size(), mf->GetName().c_str());
+
+            gs_condStreams.Broadcast();
+         }
+
+         while ( mf->m_nStreamLocks )
+            gs_condStreams.Wait();
+
+         mf->m_streamOwner = self;
+         mf->m_nStreamLocks = 1;
+         Link(mf);
+
+         // the released streams were collected in the reverse order
+         for ( size_t n = released.size(); n > 0; n-- )
+         {
+            MailFolderCC * const mfHeld = released[n - 1];
+            while ( mfHeld->m_nStreamLocks )
+               gs_condStreams.Wait();
+
+            mfHeld->m_streamOwner = self;
+            mfHeld->m_nStreamLocks = counts[n - 1];
+            Link(mfHeld);
+         }
+      }
+      else // the stream is free, take it immediately whatever the order
+      {
+         mf->m_streamOwner = self;
+         mf->m_nStreamLocks = 1;
+         Link(mf);
+      }
+   }
+
+   // don't wait for c-client lock while holding gs_mutexStreams
+   if ( lock )
+      lock->Acquire();
+
+   wxTLS_VALUE(tls_nStreamLocks)++;
+}
+
+/* static */
+void MailFolderCC::StreamLocker::Unlock(const MailFolderCC *mfConst)
+{
+   MailFolderCC * const mf = const_cast<MailFolderCC *>(mfConst);
+
+   wxTLS_VALUE(tls_nStreamLocks)--;
+
+   wxMutexLocker locker(gs_mutexStreams);
+
+   if ( !--mf->m_nStreamLocks )
+   {
+      Unlink(mf);
+
+      gs_condStreams.Broadcast();
+   }
+}
+
+// ----------------------------------------------------------------------------
+// MailFolderCC multi-threading functions
+// ----------------------------------------------------------------------------
+
+/* static */
+void MailFolderCC::EnableWorkerThreads()
+{
+   CClientLock::Activate();
+}
+
+/* static */
+void MailFolderCC::DisableWorkerThreads()
+{
+   CClientLock::Deactivate();
+}
+
+/* static */
+bool MailFolderCC::IsUsingStream()
+{
+   return wxTLS_VALUE(tls_nStreamLocks) != 0;
+}
+
+/* static */
+void MailFolderCC::LockCClient()
+{
+   CClientLock * const lock = CClientLock::Get();
+   CHECK_RET( lock, _T("EnableWorkerThreads() must be called first") );
+
+   lock->Acquire();
+}
+
+/* static */
+void MailFolderCC::UnlockCClient()
+{
+   CClientLock * const lock = CClientLock::Get();
+   CHECK_RET( lock, _T("EnableWorkerThreads() must be called first") );
+
+   lock->Release();
+}
+
+// ============================================================================
+// IMAP IDLE support implementation
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// ImapIdleThread
+// ----------------------------------------------------------------------------
+
+void *ImapIdleThread::Entry()
+{
+   time_t timeStarted = time(NULL);
+
+   while ( !TestDestroy() )
+   {
+      int id;
+      if ( WaitForInput(IMAP_IDLE_WAKEUP_INTERVAL) == 0 )
+      {
+         if ( time(NULL) - timeStarted < IMAP_IDLE_RESTART_INTERVAL )
+            continue;
+
+         id = ImapIdle_Restart;
+      }
+      else // either input or error, let the main thread find out which
+      {
+         id = ImapIdle_Input;
+      }
+
+      if ( !Notify(id) )
+         break;
+
+      if ( id == ImapIdle_Restart )
+         timeStarted = time(NULL);
+   }
+
+   return NULL;
+}
+
+int ImapIdleThread::WaitForInput(long timeout)
+{
+   fd_set fds;
+   FD_ZERO(&fds);
+   FD_SET(m_sock, &fds);
+
+   timeval tv;
+   tv.tv_sec = timeout / 1000;
+   tv.tv_usec = (timeout % 1000)*1000;
+
+   const int rc = select(m_sock + 1, &fds, NULL, NULL, &tv);
+   if ( rc == -1 && errno == EINTR )
+      return 0;
+
+   return rc > 0 ? 1 : rc;
+}
+
+bool ImapIdleThread::Notify(int id)
+{
+   wxThreadEvent event;
+   event.SetId(id);
+   event.SetString(m_name);
+
+   wxQueueEvent(m_handler, event.Clone());
+
+   // the main thread is going to read from the socket, so don't wait for the
+   // input again until it's done with it
+   while ( m_semResume.WaitTimeout(IMAP_IDLE_WAKEUP_INTERVAL) != wxSEMA_NO_ERROR )
+   {
+      if ( TestDestroy() )
+         return false;
+   }
+
+   return !TestDestroy();
+}
+
+// ----------------------------------------------------------------------------
+// ImapIdleConnector
+// ----------------------------------------------------------------------------
+
+ImapIdleConnector::ImapIdleConnector(wxEvtHandler *handler,
+                                     const MFolder *folder,
+                                     const String& login,
+                                     const String& password)
+                 : wxThread(wxTHREAD_JOINABLE),
+                   m_handler(handler),
+                   m_spec(MailFolder::GetImapSpec(folder, login)),
+                   m_login(login),
+                   m_password(password)
+{
+   m_folder = const_cast<MFolder *>(folder);
+   m_folder->IncRef();
+
+   m_stream = NULL;
+   m_unsupported =
+   m_cancelled = false;
+}
+
+ImapIdleConnector::~ImapIdleConnector()
+{
+   if ( m_stream )
+   {
+      CCCallbackDisabler noCallbacks;
+
+      mail_close(m_stream);
+   }
+
+   m_folder->DecRef();
+}
+
+void *ImapIdleConnector::Entry()
+{
+   MailFolderCC::LockCClient();
+
+   m_stream = ImapIdleManager::OpenIdleStream(m_spec, m_login, m_password,
+                                              &m_unsupported);
+
+   MailFolderCC::UnlockCClient();
+
+   wxThreadEvent event;
+   event.SetId(ImapIdle_Connected);
+   event.SetString(m_folder->GetFullName());
+
+   wxQueueEvent(m_handler, event.Clone());
+
+   return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// ImapIdleConnection
+// ----------------------------------------------------------------------------
+
+ImapIdleConnection::ImapIdleConnection(const MFolder *folder,
+                                       MAILSTREAM *stream)
+                  : m_stream(stream)
+{
+   m_folder = const_cast<MFolder *>(folder);
+   m_folder->IncRef();
+
+   m_thread = NULL;
+   m_changed = false;
+}
+
+ImapIdleConnection::~ImapIdleConnection()
+{
+   if ( m_thread )
+   {
+      // wake up the thread if it's waiting for us and wait until it exits
+      m_semResume.Post();
+      m_thread->Delete();
+      delete m_thread;
+   }
+
+   wxLogTrace(TRACE_IMAP_IDLE, _T("Closing IDLE connection for '%s'"),
+              m_folder->GetFullName().c_str());
+
+   {
+      CCCallbackDisabler noCallbacks;
+
+      // this also terminates IDLE
+      mail_close(m_stream);
+   }
+
+   m_folder->DecRef();
+}
+
+bool ImapIdleConnection::Start(wxEvtHandler *handler)
+{
+   long pending;
+   const int sock = imap_idle_socket(m_stream, &pending);
+   if ( sock == -1 )
+   {
+      // the network driver doesn't give us its socket
+      return false;
+   }
+
+   m_thread = new ImapIdleThread(handler, m_folder->GetFullName(), sock,
+                                 m_semResume);
+   if ( m_thread->Run() != wxTHREAD_NO_ERROR )
+   {
+      delete m_thread;
+      m_thread = NULL;
+
+      return false;
+   }
+
+   return true;
+}
+
+bool ImapIdleConnection::ReadInput(bool wait)
+{
+   for ( ;; )
+   {
+      long pending;
+      if ( imap_idle_socket(m_stream, &pending) == -1 )
+         return false;
+
+      if ( !wait && !pending )
+         return true;
+
+      if ( !imap_idle_read(m_stream) )
+         return false;
+
+      wait = false;
+   }
+}
+
+bool ImapIdleConnection::Restart()
+{
+   wxLogTrace(TRACE_IMAP_IDLE, _T("Reissuing IDLE for '%s'"),
+              m_folder->GetFullName().c_str());
+
+   return imap_idle_done(m_stream) && imap_idle(m_stream) && ReadInput(false);
+}
+
+// ----------------------------------------------------------------------------
+// ImapIdleManager
+// ----------------------------------------------------------------------------
+
+ImapIdleManager *ImapIdleManager::ms_manager = NULL;
+
+/* static */
+ImapIdleManager *ImapIdleManager::Get(bool create)
+{
+   if ( !ms_manager && create )
+      ms_manager = new ImapIdleManager;
+
+   return ms_manager;
+}
+
+/* static */
+void ImapIdleManager::Delete()
+{
+   delete ms_manager;
+   ms_manager = NULL;
+}
+
+ImapIdleManager::ImapIdleManager()
+{
+   Bind(wxEVT_THREAD, &ImapIdleManager::OnThreadEvent, this);
+}
+
+ImapIdleManager::~ImapIdleManager()
+{
+   if ( !m_connectors.empty() )
+   {
+      // the threads need c-client lock to finish opening the connections
+      MailFolderCC::UnlockCClient();
+
+      Connectors::iterator i;
+      for ( i = m_connectors.begin(); i != m_connectors.end(); ++i )
+         i->second->Wait();
+
+      MailFolderCC::LockCClient();
+
+      for ( i = m_connectors.begin(); i != m_connectors.end(); ++i )
+      {
+         delete i->second;
+
+         MailFolderCC::DisableWorkerThreads();
+      }
+   }
+
+   for ( Connections::iterator i = m_connections.begin();
+         i != m_connections.end();
+         ++i )
+   {
+      delete i->second;
+   }
+}
+
+/* static */
+bool ImapIdleManager::OnChange(const MAILSTREAM *stream)
+{
+   if ( !ms_manager )
+      return false;
+
+   const Connections& conns = ms_manager->m_connections;
+   for ( Connections::const_iterator i = conns.begin(); i != conns.end(); ++i )
+   {
+      if ( i->second->GetStream() == stream )
+      {
+         i->second->OnChange();
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void ImapIdleManager::Connect(const MFolder *folder)
+{
+   const String name = folder->GetFullName();
+
+   // we can't ask the user for the password from here, so just don't do
+   // anything if we don't have it yet: as we're only called after the folder
+   // had been successfully checked, we normally do have it
+   String login = folder->GetLogin(),
+          password = folder->GetPassword();
+   if ( folder->NeedsLogin() && (login.empty() || password.empty()) )
+   {
+      ServerInfoEntry *server = ServerInfoEntry::Get(folder);
+      if ( !server || !server->GetAuthInfo(login, password) )
+      {
+         wxLogTrace(TRACE_IMAP_IDLE, _T("No password for '%s' yet"),
+                    name.c_str());
+
+         return;
+      }
+   }
+
+   // the thread can't use c-client without this
+   MailFolderCC::EnableWorkerThreads();
+
+   ImapIdleConnector * const
+      connector = new ImapIdleConnector(this, folder, login, password);
+   if ( connector->Create() != wxTHREAD_NO_ERROR ||
+         connector->Run() != wxTHREAD_NO_ERROR )
+   {
+      wxLogDebug(_T("Failed to start IDLE connection thread for '%s'."),
+                 name.c_str());
+
+      delete connector;
+
+      MailFolderCC::DisableWorkerThreads();
+
+      m_retryAfter[name] = time(NULL) + IMAP_IDLE_RETRY_DELAY;
+
+      return;
+   }
+
+   wxLogTrace(TRACE_IMAP_IDLE, _T("Opening IDLE connection for '%s'"),
+              name.c_str());
+
+   m_connectors[name] = connector;
+}
+
+/* static */
+MAILSTREAM *ImapIdleManager::OpenIdleStream(const String& spec,
+                                            const String& login,
+                                            const String& password,
+                                            bool *unsupported)
+{
+   MailFolderCC::SetLoginData(login, password);
+
+   MAILSTREAM *stream;
+   {
+      // we're not interested in mm_exists() for the initial messages
+      CCCallbackDisabler noCallbacks;
+
+      stream = MailOpen(NULL, spec, OP_READONLY);
+   }
+
+   if ( !stream )
+      return NULL;
+
+   if ( !LEVELIDLE(stream) )
+      *unsupported = true;
+   else if ( imap_idle(stream) )
+      return stream;
+
+   CCCallbackDisabler noCallbacks;
+
+   mail_close(stream);
+
+   return NULL;
+}
+
+void ImapIdleManager::OnConnected(const String& name)
+{
+   Connectors::iterator i = m_connectors.find(name);
+   CHECK_RET( i != m_connectors.end(), _T("unknown IMAP IDLE connector") );
+
+   ImapIdleConnector * const connector = i->second;
+   m_connectors.erase(i);
+
+   // the thread is terminating now, so this doesn't block
+   connector->Wait();
+
+   MAILSTREAM * const stream = connector->DetachStream();
+   if ( connector->IsCancelled() )
+   {
+      // the folder was unwatched in the meanwhile
+      if ( stream )
+      {
+         CCCallbackDisabler noCallbacks;
+
+         mail_close(stream);
+      }
+   }
+   else if ( stream )
+   {
+      // from now on the connection object owns the stream
+      ImapIdleConnection *conn = new ImapIdleConnection(connector->GetFolder(),
+                                                        stream);
+      if ( !conn->ReadInput(false) )
+      {
+         m_retryAfter[name] = time(NULL) + IMAP_IDLE_RETRY_DELAY;
+      }
+      else if ( !conn->Start(this) )
+      {
+         // this is not going to work any better the next time
+         m_unsupported.insert(name);
+      }
+      else // everything is fine
+      {
+         m_connections[name] = conn;
+         conn = NULL;
+
+         wxLogTrace(TRACE_IMAP_IDLE, _T("Watching '%s' using IDLE"),
+                    name.c_str());
+      }
+
+      delete conn;
+   }
+   else if ( connector->IsUnsupported() )
+   {
+      wxLogTrace(TRACE_IMAP_IDLE, _T("Server of '%s' doesn't support IDLE"),
+                 name.c_str());
+
+      m_unsupported.insert(name);
+   }
+   else // failed to connect or IDLE failed
+   {
+      m_retryAfter[name] = time(NULL) + IMAP_IDLE_RETRY_DELAY;
+   }
+
+   delete connector;
+
+   MailFolderCC::DisableWorkerThreads();
+}
+
+bool ImapIdleManager::Watch(const MFolder *folder)
+{
+   CHECK( folder, false, _T("NULL folder in ImapIdleManager::Watch") );
+
+   if ( folder->GetType() != MF_IMAP )
+      return false;
+
+   const String name = folder->GetFullName();
+   if ( IsWatched(name) )
+      return true;
+
+   // the folder is polled until the connection is opened
+   Connectors::iterator j = m_connectors.find(name);
+   if ( j != m_connectors.end() )
+   {
+      j->second->Cancel(false);
+
+      return false;
+   }
+
+   if ( m_unsupported.find(name) != m_unsupported.end() )
+      return false;
+
+   std::map<String, time_t>::iterator i = m_retryAfter.find(name);
+   if ( i != m_retryAfter.end() )
+   {
+      if ( time(NULL) < i->second )
+         return false;
+
+      m_retryAfter.erase(i);
+   }
+
+   Connect(folder);
+
+   return false;
+}
+
+void ImapIdleManager::Unwatch(const String& name)
+{
+   Connections::iterator i = m_connections.find(name);
+   if ( i != m_connections.end() )
+   {
+      delete i->second;
+      m_connections.erase(i);
+   }
+
+   // we can't stop the thread opening the connection, but we can close it as
+   // soon as it's opened
+   Connectors::iterator j = m_connectors.find(name);
+   if ( j != m_connectors.end() )
+      j->second->Cancel();
+
+   // forget about any errors too, the folder could be changed before it is
+   // watched again
+   m_unsupported.erase(name);
+   m_retryAfter.erase(name);
+}
+
+void ImapIdleManager::OnThreadEvent(wxThreadEvent& event)
+{
+   const String name = event.GetString();
+   if ( event.GetId() == ImapIdle_Connected )
+   {
+      OnConnected(name);
+      return;
+   }
+
+   Connections::iterator i = m_connections.find(name);
+   if ( i == m_connections.end() )
+   {
+      // the folder was unwatched after this event had been posted
+      return;
+   }
+
+   ImapIdleConnection * const conn = i->second;
+
+   bool ok;
+   switch ( event.GetId() )
+   {
+      case ImapIdle_Input:
+         ok = conn->ReadInput(true);
+         break;
+
+      case ImapIdle_Restart:
+         // also check the folder from time to time even if the server hadn't
+         // notified us about anything, this keeps the main connection to it
+         // alive too
+         conn->OnChange();
+         ok = conn->Restart();
+         break;
+
+      default:
+         FAIL_MSG( _T("unexpected IMAP IDLE event") );
+         ok = true;
+   }
+
+   // keep the folder alive as we may delete the connection below
+   MFolder_obj folder(conn->GetFolder());
+   folder->IncRef();
+
+   const bool changed = conn->GetAndResetChanged();
+
+   if ( ok )
+   {
+      conn->Resume();
+   }
+   else // connection lost
+   {
+      wxLogTrace(TRACE_IMAP_IDLE,
+                 _T("IDLE connection for '%s' lost, polling it instead"),
+                 name.c_str());
+
+      delete conn;
+      m_connections.erase(i);
+
+      // the folder will be polled meanwhile and we'll try to watch it again
+      // after the next check
+      m_retryAfter[name] = time(NULL) + IMAP_IDLE_RETRY_DELAY;
+   }
+
+   if ( changed || !ok )
+   {
+      wxLogTrace(TRACE_IMAP_IDLE, _T("Checking '%s' after IDLE notification"),
+                 name.c_str());
+
+      // this handles the changes in the usual way: by pinging the folder if
+      // it's opened and so getting the same EXISTS and EXPUNGE responses on
+      // its own connection or by checking its status otherwise
+      MailFolder::CheckFolder(folder);
+   }
+}
+
+// ----------------------------------------------------------------------------
+// MailFolder IMAP IDLE methods
+// ----------------------------------------------------------------------------
+
+/* static */
+bool MailFolder::WatchFolder(const MFolder *folder)
+{
+   return ImapIdleManager::Get()->Watch(folder);
+}
+
+/* static */
+void MailFolder::UnwatchFolder(const String& name)
+{
+   ImapIdleManager * const manager = ImapIdleManager::Get(false);
+   if ( manager )
+      manager->Unwatch(name);
+}
+
+/* static */
+bool MailFolder::IsWatched(const String& name)
+{
+   ImapIdleManager * const manager = ImapIdleManager::Get(false);
+
+   return manager && manager->IsWatched(name);
+}
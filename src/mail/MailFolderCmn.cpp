@@ -64,13 +64,24 @@
 #include "Composer.h"
 
 #include "MailFolderCmn.h"
+#include "MailFolderCC.h"          // for LockCClient()
 #include "MFPrivate.h"
 #include "mail/FolderPool.h"
+#include "mail/MsgSort.h"
+#include "mail/FullTextIndex.h"
+#include "mail/ThreadCache.h"
+#include "ASMailFolder.h"
 #include "gui/wxMDialogs.h"
 #include "wx/persctrl.h"
 
 #include <wx/datetime.h>
 #include <wx/file.h>
+#include <wx/stopwatch.h>
+#include <wx/tls.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 // ----------------------------------------------------------------------------
 // options we use here
@@ -79,6 +90,7 @@
 extern const MOption MP_FOLDERPROGRESS_THRESHOLD;
 extern const MOption MP_FOLDER_CLOSE_DELAY;
 extern const MOption MP_MOVE_NEWMAIL;
+extern const MOption MP_MSGS_SORT_PARALLEL_THRESHOLD;
 extern const MOption MP_NEWMAILCOMMAND;
 extern const MOption MP_NEWMAIL_FOLDER;
 extern const MOption MP_NEWMAIL_PLAY_SOUND;
@@ -108,6 +120,34 @@ extern const MOption MP_USE_TRASH_FOLDER;
 // trace mask for keep alive timer
 #define TRACE_MF_KEEPALIVE "mfkeepalive"
 
+// trace mask for copying messages between folders
+#define TRACE_MF_COPY _T("mfcopy")
+
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the number of messages whose data is prefetched at once when copying them
+static const size_t COPY_FETCH_BATCH = 50;
+
+// the maximal total size of the messages retrieved but not copied yet
+static const size_t COPY_WINDOW_SIZE = 8*1024*1024;
+
+// the maximal number and total size of messages appended at once: the entire
+// command fails if any message can't be appended, so don't make it too big
+static const size_t COPY_APPEND_BATCH = 50;
+static const size_t COPY_APPEND_SIZE = 2*1024*1024;
+
+// ----------------------------------------------------------------------------
+// globals
+// ----------------------------------------------------------------------------
+
+typedef std::vector<MailFolderCmn *> MailFolderCmnArray;
+
+/// the folders whose listings were created by the current thread, see
+/// MailFolderCmn::GetThreadHeaders()
+static wxTLS_TYPE(MailFolderCmnArray *) tls_foldersThreadHeaders;
+
 // ----------------------------------------------------------------------------
 // private functions
 // ----------------------------------------------------------------------------
@@ -294,6 +334,84 @@ protected:
    DECLARE_NO_COPY_CLASS(MailFolderKeepAliveTimer)
 };
 
+// ----------------------------------------------------------------------------
+// MessageFetcher: retrieves the messages to be copied to another folder
+// ----------------------------------------------------------------------------
+
+/*
+   Copying the messages to a folder on another server is done by a pipeline:
+   this thread retrieves the messages from the source folder while the thread
+   which called SaveMessages() appends the already retrieved ones to the
+   destination folder, several at once. As c-client lets the other threads
+   run while waiting for the network, the downloads and uploads overlap. The
+   number of messages retrieved in advance is limited by their total size.
+
+   If the thread can't be started, the messages are simply retrieved by
+   batches in the thread calling Get().
+ */
+class MessageFetcher : public wxThread
+{
+public:
+   MessageFetcher(MailFolder *mf, const UIdArray& uids);
+
+   // start the thread, return false if the messages will be retrieved
+   // synchronously instead
+   bool Start();
+
+   // get the messages to append to the destination folder, waiting until
+   // some of them are available, return false if there are no more
+   bool Get(MailFolder::RawMessages& msgs);
+
+   // stop retrieving the messages and wait until the thread terminates
+   void Finish();
+
+   // the number of messages which couldn't be retrieved
+   size_t GetFailedCount() const { return m_nFailed; }
+
+protected:
+   virtual void *Entry();
+
+private:
+   // retrieve the next batch of messages, return false if there are no more
+   bool FetchBatch();
+
+   // add a retrieved message to the window, waiting until there is enough
+   // space in it, return false if we should stop
+   bool Put(const MailFolder::RawMessage& msg);
+
+
+   // the folder to retrieve the messages from and their UIDs
+   MailFolder * const m_mf;
+   const UIdArray& m_uids;
+
+   // the index of the next message to retrieve in m_uids
+   size_t m_next;
+
+   // the number of messages we failed to retrieve
+   size_t m_nFailed;
+
+   // do we use a separate thread?
+   bool m_threaded;
+
+   // did we enable the use of c-client by the worker threads?
+   bool m_enabledWorkers;
+
+   // the mutex protecting the fields below and the condition signaled when
+   // any of them changes
+   wxMutex m_mutex;
+   wxCondition m_cond;
+
+   // the messages retrieved but not taken by Get() yet and their total size
+   std::deque<MailFolder::RawMessage> m_window;
+   size_t m_sizeWindow;
+
+   // true if all messages have been retrieved or we were stopped
+   bool m_done,
+        m_stop;
+
+   DECLARE_NO_COPY_CLASS(MessageFetcher)
+};
+
 // ----------------------------------------------------------------------------
 // module global variables
 // ----------------------------------------------------------------------------
@@ -329,10 +447,20 @@ void MailFolderKeepAliveTimer::Notify(void)
          // don't show any dialogs when doing background checks
          NonInteractiveLock noInter(m_mf, false /* !interactive */);
 
-         wxLogTrace(TRACE_MF_KEEPALIVE,
-                    "Pinging \"%s\" to keep it alive", m_mf->GetName());
+         // the watched folders are checked when they change and also
+         // periodically, so they don't need to be pinged here
+         if ( MailFolder::IsWatched(m_mf->GetName()) )
+         {
+            wxLogTrace(TRACE_MF_KEEPALIVE,
+                       "Not pinging watched \"%s\"", m_mf->GetName());
+         }
+         else
+         {
+            wxLogTrace(TRACE_MF_KEEPALIVE,
+                       "Pinging \"%s\" to keep it alive", m_mf->GetName());
 
-         m_mf->Ping();
+            m_mf->Ping();
+         }
       }
    }
 
@@ -671,6 +799,9 @@ MailFolderCmn::~MailFolderCmn()
 
    ASSERT_MSG( !m_headers, _T("folder destroyed without being closed?") );
 
+   // each thread listing keeps the folder alive
+   ASSERT_MSG( m_threadHeaders.empty(), _T("folder still used by a thread?") );
+
    // this must have been cleared by SendMsgStatusChangeEvent() call earlier
    if ( m_statusChangeData )
    {
@@ -698,6 +829,9 @@ MailFolderCmn::~MailFolderCmn()
 
 HeaderInfoList *MailFolderCmn::GetHeaders(void) const
 {
+   if ( !wxThread::IsMain() )
+      return GetThreadHeaders();
+
    if ( !m_headers )
    {
       MailFolderCmn *self = wxConstCast(this, MailFolderCmn);
@@ -712,6 +846,83 @@ HeaderInfoList *MailFolderCmn::GetHeaders(void) const
    return m_headers;
 }
 
+HeaderInfoList *MailFolderCmn::FindThreadHeaders() const
+{
+   wxCriticalSectionLocker lock(m_csThreadHeaders);
+
+   ThreadHeaders::const_iterator i =
+      m_threadHeaders.find(wxThread::GetCurrentId());
+
+   return i == m_threadHeaders.end() ? NULL : i->second;
+}
+
+HeaderInfoList *MailFolderCmn::GetThreadHeaders() const
+{
+   HeaderInfoList *headers = FindThreadHeaders();
+   if ( !headers )
+   {
+      MailFolderCmn *self = wxConstCast(this, MailFolderCmn);
+
+      // this listing is only used for finding the messages by their UIDs or
+      // msgnos, so it's neither sorted nor threaded
+      headers = HeaderInfoList::Create(self);
+      CHECK( headers, NULL, _T("failed to create the thread listing") );
+
+      {
+         wxCriticalSectionLocker lock(m_csThreadHeaders);
+
+         m_threadHeaders[wxThread::GetCurrentId()] = headers;
+      }
+
+      self->IncRef();
+
+      MailFolderCmnArray *& folders = wxTLS_VALUE(tls_foldersThreadHeaders);
+      if ( !folders )
+         folders = new MailFolderCmnArray;
+
+      folders->push_back(self);
+   }
+
+   headers->IncRef();
+
+   return headers;
+}
+
+/* static */
+void MailFolderCmn::ReleaseThreadHeaders()
+{
+   MailFolderCmnArray * const folders = wxTLS_VALUE(tls_foldersThreadHeaders);
+   if ( !folders )
+      return;
+
+   wxTLS_VALUE(tls_foldersThreadHeaders) = NULL;
+
+   const wxThreadIdType id = wxThread::GetCurrentId();
+
+   const size_t count = folders->size();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      MailFolderCmn * const mf = (*folders)[n];
+
+      HeaderInfoList *headers;
+      {
+         wxCriticalSectionLocker lock(mf->m_csThreadHeaders);
+
+         ThreadHeaders::iterator i = mf->m_threadHeaders.find(id);
+         CHECK_RET( i != mf->m_threadHeaders.end(),
+                    _T("thread listing disappeared?") );
+
+         headers = i->second;
+         mf->m_threadHeaders.erase(i);
+      }
+
+      headers->DecRef();
+      mf->DecRef();
+   }
+
+   delete folders;
+}
+
 void MailFolderCmn::CacheLastMessages(MsgnoType count)
 {
    if ( count > 1 )
@@ -730,6 +941,363 @@ void MailFolderCmn::CacheLastMessages(MsgnoType count)
 // MailFolderCmn message saving
 // ----------------------------------------------------------------------------
 
+// ----------------------------------------------------------------------------
+// MessageFetcher
+// ----------------------------------------------------------------------------
+
+MessageFetcher::MessageFetcher(MailFolder *mf, const UIdArray& uids)
+              : wxThread(wxTHREAD_JOINABLE),
+                m_mf(mf),
+                m_uids(uids),
+                m_cond(m_mutex)
+{
+   m_next =
+   m_nFailed =
+   m_sizeWindow = 0;
+
+   m_threaded =
+   m_enabledWorkers =
+   m_done =
+   m_stop = false;
+}
+
+bool MessageFetcher::Start()
+{
+   // we'd deadlock if the thread needed the stream we're using
+   if ( MailFolderCC::IsUsingStream() )
+      return false;
+
+   // the thread uses c-client together with the current one, so c-client
+   // lock must be used: it is already the case if we're a worker thread,
+   // otherwise only use it during the copy as it slows down everything else
+   if ( wxThread::IsMain() )
+   {
+      MailFolderCC::EnableWorkerThreads();
+      m_enabledWorkers = true;
+   }
+
+   m_threaded = Create() == wxTHREAD_NO_ERROR && Run() == wxTHREAD_NO_ERROR;
+   if ( !m_threaded )
+   {
+      wxLogTrace(TRACE_MF_COPY,
+                 _T("Failed to start fetcher thread, copying synchronously."));
+
+      if ( m_enabledWorkers )
+      {
+         MailFolderCC::DisableWorkerThreads();
+         m_enabledWorkers = false;
+      }
+   }
+
+   return m_threaded;
+}
+
+void *MessageFetcher::Entry()
+{
+   MailFolderCC::LockCClient();
+
+   while ( FetchBatch() )
+      ;
+
+   MailFolderCmn::ReleaseThreadHeaders();
+
+   MailFolderCC::UnlockCClient();
+
+   return NULL;
+}
+
+bool MessageFetcher::FetchBatch()
+{
+   const size_t count = m_uids.GetCount();
+   const size_t end = wxMin(m_next + COPY_FETCH_BATCH, count);
+
+   if ( m_next < end )
+   {
+      // get the overview data of all messages of this batch in one go
+      UIdArray uids;
+      for ( size_t n = m_next; n < end; n++ )
+         uids.Add(m_uids[n]);
+
+      m_mf->PrefetchMessages(uids, MailFolder::Prefetch_Overview,
+                             wxArrayString());
+
+      for ( ; m_next < end; m_next++ )
+      {
+         Message_obj msg(m_mf->GetMessage(m_uids[m_next]));
+
+         MailFolder::RawMessage raw;
+         if ( !msg || !msg->WriteToBuffer(raw.text) )
+         {
+            wxLogError(_("Failed to retrieve the message text."));
+
+            m_nFailed++;
+            continue;
+         }
+
+         raw.uid = m_uids[m_next];
+         raw.status = msg->GetStatus();
+         msg->GetHeaderLine(_T("Date"), raw.date);
+
+         if ( !Put(raw) )
+            return false;
+      }
+
+      if ( m_next < count )
+         return true;
+   }
+
+   wxMutexLocker lock(m_mutex);
+   m_done = true;
+   m_cond.Broadcast();
+
+   return false;
+}
+
+bool MessageFetcher::Put(const MailFolder::RawMessage& msg)
+{
+   const size_t len = msg.text.length();
+
+   for ( ;; )
+   {
+      {
+         wxMutexLocker lock(m_mutex);
+
+         if ( m_stop )
+            return false;
+
+         // the window is not limited when we're not using a separate thread
+         // as Get() only calls FetchBatch() when it is empty anyhow
+         if ( !m_threaded ||
+               m_window.empty() ||
+                  m_sizeWindow + len <= COPY_WINDOW_SIZE )
+         {
+            m_window.push_back(msg);
+            m_sizeWindow += len;
+            m_cond.Broadcast();
+
+            return true;
+         }
+      }
+
+      // the window is full, let the other thread use c-client to empty it
+      // (notice that we must not wait for c-client lock with m_mutex locked)
+      MailFolderCC::UnlockCClient();
+
+      {
+         wxMutexLocker lock(m_mutex);
+
+         while ( !m_stop &&
+                  !m_window.empty() &&
+                     m_sizeWindow + len > COPY_WINDOW_SIZE )
+         {
+            m_cond.Wait();
+         }
+      }
+
+      MailFolderCC::LockCClient();
+   }
+}
+
+bool MessageFetcher::Get(MailFolder::RawMessages& msgs)
+{
+   msgs.clear();
+
+   if ( m_threaded )
+   {
+      bool mustWait;
+      {
+         wxMutexLocker lock(m_mutex);
+         mustWait = m_window.empty() && !m_done;
+      }
+
+      if ( mustWait )
+      {
+         // the fetcher thread needs c-client to retrieve the messages
+         MailFolderCC::UnlockCClient();
+
+         {
+            wxMutexLocker lock(m_mutex);
+            while ( m_window.empty() && !m_done )
+               m_cond.Wait();
+         }
+
+         MailFolderCC::LockCClient();
+      }
+   }
+   else if ( m_window.empty() )
+   {
+      FetchBatch();
+   }
+
+   wxMutexLocker lock(m_mutex);
+
+   size_t size = 0;
+   while ( !m_window.empty() && msgs.size() < COPY_APPEND_BATCH )
+   {
+      const MailFolder::RawMessage& msg = m_window.front();
+      const size_t len = msg.text.length();
+      if ( !msgs.empty() && size + len > COPY_APPEND_SIZE )
+         break;
+
+      msgs.push_back(msg);
+      size += len;
+
+      m_sizeWindow -= len;
+      m_window.pop_front();
+   }
+
+   m_cond.Broadcast();
+
+   return !msgs.empty();
+}
+
+void MessageFetcher::Finish()
+{
+   if ( !m_threaded )
+      return;
+
+   {
+      wxMutexLocker lock(m_mutex);
+      m_stop = true;
+      m_cond.Broadcast();
+   }
+
+   // the thread may need c-client lock to terminate
+   MailFolderCC::UnlockCClient();
+   Wait();
+   MailFolderCC::LockCClient();
+
+   if ( m_enabledWorkers )
+   {
+      MailFolderCC::DisableWorkerThreads();
+      m_enabledWorkers = false;
+   }
+}
+
+// copy the messages to a folder which can store their texts, uidLast is set
+// to the UID of the last message copied after all those preceding it in uids
+static bool
+CopyMessages(MailFolder *mfSrc,
+             const UIdArray& uids,
+             MailFolder *mfDst,
+             MProgressDialog *pd,
+             UIdType *uidLast)
+{
+   const unsigned long count = uids.GetCount();
+   const bool isMain = wxThread::IsMain();
+
+   MessageFetcher fetcher(mfSrc, uids);
+   const bool threaded = fetcher.Start();
+
+   wxStopWatch sw;
+
+   bool rc = true;
+   unsigned long done = 0,
+                 bytes = 0;
+
+   // the number of the leading uids all copied: the messages come in their
+   // order but those which couldn't be retrieved are skipped
+   size_t countInOrder = 0;
+   bool inOrder = true;
+
+   MailFolder::RawMessages msgs;
+   while ( fetcher.Get(msgs) )
+   {
+      if ( mfDst->AppendMessages(msgs) )
+      {
+         done += msgs.size();
+         for ( size_t n = 0; n < msgs.size(); n++ )
+         {
+            bytes += msgs[n].text.length();
+
+            if ( inOrder )
+            {
+               if ( countInOrder < count && uids[countInOrder] == msgs[n].uid )
+                  countInOrder++;
+               else
+                  inOrder = false;
+            }
+         }
+      }
+      else // failed to append the whole batch
+      {
+         // MULTIAPPEND fails entirely if any message is rejected, so retry
+         // them one by one to copy all the others
+         rc = false;
+
+         size_t nFailed = 0;
+         for ( size_t n = 0; n < msgs.size(); n++ )
+         {
+            if ( !mfDst->AppendMessages(MailFolder::RawMessages(1, msgs[n])) )
+            {
+               nFailed++;
+               inOrder = false;
+               continue;
+            }
+
+            done++;
+            bytes += msgs[n].text.length();
+
+            if ( inOrder )
+            {
+               if ( countInOrder < count && uids[countInOrder] == msgs[n].uid )
+                  countInOrder++;
+               else
+                  inOrder = false;
+            }
+         }
+
+         wxLogTrace(TRACE_MF_COPY,
+                    _T("Failed to append %lu of %lu messages to '%s'"),
+                    (unsigned long)nFailed, (unsigned long)msgs.size(),
+                    mfDst->GetName().c_str());
+
+         // if none could be appended, the folder is probably unusable
+         if ( nFailed == msgs.size() )
+            break;
+      }
+
+      // show the progress together with the current throughput
+      const long elapsed = sw.Time();
+
+      String text;
+      text.Printf(_("Copied %lu of %lu messages (%luKb, %lu messages/s)"),
+                  done, count, bytes / 1024,
+                  elapsed ? (1000*done) / elapsed : done);
+
+      bool cont;
+      if ( pd )
+         cont = pd->Update(2*done, text);
+      else if ( !isMain )
+         cont = ASMailFolder::UpdateProgress(done, count, text);
+      else
+         cont = true;
+
+      if ( !cont )
+      {
+         // cancelled
+         rc = false;
+         break;
+      }
+   }
+
+   fetcher.Finish();
+
+   if ( fetcher.GetFailedCount() )
+      rc = false;
+
+   if ( uidLast )
+      *uidLast = countInOrder ? uids[countInOrder - 1] : UID_ILLEGAL;
+
+   wxLogTrace(TRACE_MF_COPY,
+              _T("Copied %lu messages (%lu bytes) from '%s' to '%s' in %ldms ")
+              _T("(%s fetcher thread)"),
+              done, bytes, mfSrc->GetName().c_str(), mfDst->GetName().c_str(),
+              sw.Time(), threaded ? _T("with") : _T("without"));
+
+   return rc;
+}
+
 // TODO: the functions below should share at least some common code instead of
 //       duplicating it! (VZ)
 
@@ -779,7 +1347,10 @@ MailFolderCmn::SaveMessagesToFile(const UIdArray *selections,
    scoped_ptr<MProgressDialog> pd;
    long threshold = GetProgressThreshold(GetProfile());
 
-   if ( threshold > 0 && n > threshold )
+   // no progress dialog in the background threads, ASMailFolder shows the
+   // progress in the status bar for them instead
+   const bool isMain = wxThread::IsMain();
+   if ( isMain && threshold > 0 && n > threshold )
    {
       wxString msg;
       msg.Printf(_("Saving %d messages to the file '%s'..."),
@@ -799,6 +1370,9 @@ MailFolderCmn::SaveMessagesToFile(const UIdArray *selections,
          if ( pd && !pd->Update( 2*i + 1 ) )
             break;
 
+         if ( !isMain && !ASMailFolder::UpdateProgress(i, n) )
+            break;
+
          if ( !msg->WriteToString(tmpstr) )
          {
             wxLogError(_("Failed to get the text of the message to save."));
@@ -819,8 +1393,12 @@ MailFolderCmn::SaveMessagesToFile(const UIdArray *selections,
 
 bool
 MailFolderCmn::SaveMessages(const UIdArray *selections,
-                            MFolder *folder)
+                            MFolder *folder,
+                            UIdType *uidLast)
 {
+   if ( uidLast )
+      *uidLast = UID_ILLEGAL;
+
    CHECK( folder, false, _T("SaveMessages() needs a valid folder pointer") );
 
    if ( !CanCreateMessagesInFolder(folder->GetType()) )
@@ -836,7 +1414,8 @@ MailFolderCmn::SaveMessages(const UIdArray *selections,
    int n = selections->Count();
    CHECK( n, true, _T("SaveMessages(): nothing to save") );
 
-   MailFolder_obj mf(MailFolder::OpenFolder(folder, Normal, m_frame));
+   MailFolder_obj mf(MailFolder::OpenFolder(folder, Normal,
+                                            GetInteractiveFrame()));
    if ( !mf )
    {
       String msg;
@@ -846,7 +1425,11 @@ MailFolderCmn::SaveMessages(const UIdArray *selections,
       return false;
    }
 
-   if ( mf->IsLocked() )
+   // when we're running in a background thread, the main one may be using
+   // the target folder right now, but this is fine as AppendMessage() will
+   // just wait until it is done with it
+   const bool isMain = wxThread::IsMain();
+   if ( isMain && mf->IsLocked() )
    {
       FAIL_MSG( _T("Can't SaveMessages() to locked folder") );
       return false;
@@ -855,7 +1438,7 @@ MailFolderCmn::SaveMessages(const UIdArray *selections,
    scoped_ptr<MProgressDialog> pd;
    long threshold = GetProgressThreshold(mf->GetProfile());
 
-   if ( threshold > 0 && n > threshold )
+   if ( isMain && threshold > 0 && n > threshold )
    {
       // open a progress window:
       wxString msg;
@@ -873,6 +1456,13 @@ MailFolderCmn::SaveMessages(const UIdArray *selections,
    // minimize the number of updates by only doing it once
    SuspendFolderUpdates suspend(mf);
 
+   // retrieving the messages and appending them one by one is very slow for
+   // the remote folders, so copy them in batches if possible: only the
+   // virtual folders which just reference the other folders messages don't
+   // support this
+   if ( mf->GetType() != MF_VIRTUAL )
+      return CopyMessages(this, *selections, mf, pd.get(), uidLast);
+
    bool rc = true;
    for ( int i = 0; i < n; i++ )
    {
@@ -882,6 +1472,9 @@ MailFolderCmn::SaveMessages(const UIdArray *selections,
          return false;
       }
 
+      if ( !isMain && !ASMailFolder::UpdateProgress(i, n) )
+         return false;
+
       Message *msg = GetMessage((*selections)[i]);
       if ( msg )
       {
@@ -972,11 +1565,106 @@ MailFolderCmn::ForwardMessages(const UIdArray *selections,
 // MailFolderCmn searching
 // ----------------------------------------------------------------------------
 
+namespace
+{
+
+// the search in the message text using the full text index
+class IndexedSearch
+{
+public:
+   IndexedSearch(FullTextIndex *index, const SearchCriterium *crit, int fields)
+      : m_index(index),
+        m_fields(fields),
+        m_isCC(crit->m_What == SearchCriterium::SC_CC),
+        m_key(crit->m_Key.Lower())
+   {
+      m_result = m_index->Find(crit->m_Key, fields, m_uids);
+
+      // the index contains all header words, not just those of CC, so the
+      // header matches must always be checked for this criterium
+      if ( m_isCC && m_result == FullTextIndex::Find_Exact )
+         m_result = FullTextIndex::Find_Candidates;
+   }
+
+   // return true if the message contains the search string, this adds the
+   // message to the index if it's not there yet
+   bool Matches(MailFolder *mf, UIdType uid)
+   {
+      if ( m_result != FullTextIndex::Find_Unusable && m_index->IsIndexed(uid) )
+      {
+         const bool isCandidate =
+            std::binary_search(m_uids.begin(), m_uids.end(), uid);
+
+         // we don't need to look at the message at all in these cases
+         if ( !isCandidate || m_result == FullTextIndex::Find_Exact )
+            return isCandidate;
+      }
+
+      Message_obj msg(mf->GetMessage(uid));
+      if ( !msg )
+      {
+         FAIL_MSG( _T("SearchMessages: can't get message") );
+
+         return false;
+      }
+
+      // we have the message anyhow, so index it for the next searches
+      m_index->AddMessage(uid, *msg);
+
+      String text;
+      if ( m_isCC )
+         msg->GetDecodedHeaderLine(_T("CC"), text);
+      else
+         text = FullTextIndex::GetMessageText(*msg, m_fields);
+
+      return text.Lower().find(m_key) != String::npos;
+   }
+
+private:
+   FullTextIndex * const m_index;
+   const int m_fields;
+   const bool m_isCC;
+   const String m_key;
+
+   FullTextIndex::FindResult m_result;
+   std::vector<UIdType> m_uids;
+};
+
+} // anonymous namespace
+
 UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
 {
    HeaderInfoList_obj hil(GetHeaders());
    CHECK( hil, NULL, _T("no listing in SearchMessages") );
 
+   // use the full text index for the criteria needing the message text if we
+   // have it
+   int fields;
+   switch ( crit->m_What )
+   {
+      case SearchCriterium::SC_FULL:
+         fields = FullTextIndex::Field_All;
+         break;
+
+      case SearchCriterium::SC_BODY:
+         fields = FullTextIndex::Field_Body;
+         break;
+
+      case SearchCriterium::SC_HEADER:
+      case SearchCriterium::SC_CC:
+         fields = FullTextIndex::Field_Header;
+         break;
+
+      default:
+         fields = 0;
+   }
+
+   FullTextIndex * const index = fields ? GetFullTextIndex() : NULL;
+   scoped_ptr<IndexedSearch> indexedSearch;
+   wxStopWatch stopwatch;
+   if ( index )
+      indexedSearch.reset(new IndexedSearch(index, crit, fields));
+
    // the search results
    UIdArray *results = new UIdArray;
 
@@ -988,7 +1676,8 @@ UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
    MsgnoType nMessages = GetMessageCount();
 
    // show the progress dialog if the search is going to take a long time
-   if ( nMessages > (unsigned long)READ_CONFIG(GetProfile(),
+   const bool isMain = wxThread::IsMain();
+   if ( isMain && nMessages > (unsigned long)READ_CONFIG(GetProfile(),
                                                MP_FOLDERPROGRESS_THRESHOLD) )
    {
       String msg;
@@ -997,6 +1686,9 @@ UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
       progDlg = new MProgressDialog(GetName(), msg, nMessages);
    }
 
+   // the total size of the message texts we had to retrieve
+   unsigned long bytesScanned = 0;
+
    // check all messages
    bool cont = true;
    String what;
@@ -1023,6 +1715,10 @@ UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
       {
          what = hi->GetTo();
       }
+      else if ( indexedSearch.get() )
+      {
+         what.clear();
+      }
       else
       {
          Message_obj msg(GetMessage(hi->GetUId()));
@@ -1053,9 +1749,13 @@ UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
             default:
                FAIL_MSG(_T("Unknown search criterium!"));
          }
+
+         bytesScanned += what.length();
       }
 
-      bool found = wxStrstr(what, crit->m_Key) != NULL;
+      bool found = indexedSearch.get()
+                     ? indexedSearch->Matches(this, hi->GetUId())
+                     : wxStrstr(what, crit->m_Key) != NULL;
       if ( found != crit->m_Invert )
       {
          // really found, remember its UID or msgno depending on the flags
@@ -1083,10 +1783,29 @@ UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
             cont = progDlg->Update(idx);
          }
       }
+      else if ( !isMain )
+      {
+         cont = ASMailFolder::UpdateProgress(idx, nMessages);
+      }
    }
 
    delete progDlg;
 
+   if ( index )
+   {
+      wxLogTrace(TRACE_FTINDEX,
+                 _T("Searched %lu messages in \"%s\" using index (%lu ")
+                 _T("indexed) in %ldms"),
+                 (unsigned long)nMessages, GetName().c_str(),
+                 (unsigned long)index->GetCount(), stopwatch.Time());
+   }
+
+   wxLogTrace(TRACE_SEARCH,
+              _T("Local search in \"%s\": %lu of %lu messages matched in ")
+              _T("%ldms, %lu bytes of message text scanned"),
+              GetName().c_str(), (unsigned long)results->GetCount(),
+              (unsigned long)nMessages, stopwatch.Time(), bytesScanned);
+
    return results;
 }
 
@@ -1094,201 +1813,6 @@ UIdArray *MailFolderCmn::SearchMessages(const SearchCriterium *crit, int flags)
 // MailFolderCmn sorting
 // ----------------------------------------------------------------------------
 
-// we can only sort one listing at a time currently as we use global data to
-// pass information to the C callback used by qsort() - if this proves to be a
-// significant limitation, we should reimplement sorting ourselves
-static struct SortData
-{
-   // the struct must be locked while in use
-   MMutex mutex;
-
-   // the listing which we're sorting
-   HeaderInfoList *hil;
-
-   // the parameters for sorting
-   SortParams sortParams;
-} gs_SortData;
-
-// return negative number if a < b, 0 if a == b and positive number if a > b
-#define CmpNumeric(a, b) ((a)-(b))
-
-static int ComputeStatusScore(int status)
-{
-   /*
-      The idea is to make the messages appear in the order of new, important,
-      recent or unread, other, answered so the scores are assigned in a way to
-      make new appear in front of the important, but the important before the
-      ones which are just recent or unread (remember that new == recent &&
-      unread)
-   */
-   enum
-   {
-      SCORE_RECENT = 2,
-      SCORE_UNREAD = 3,
-      SCORE_IMPORTANT = 4,
-      SCORE_ANSWERED = -1
-   };
-
-   int score = 0;
-
-   if ( status & MailFolder::MSG_STAT_RECENT )
-      score += SCORE_RECENT;
-
-   if ( !(status & MailFolder::MSG_STAT_SEEN) )
-      score += SCORE_UNREAD;
-
-   if ( status & MailFolder::MSG_STAT_FLAGGED )
-      score += SCORE_IMPORTANT;
-
-   if ( status & MailFolder::MSG_STAT_ANSWERED )
-      score += SCORE_ANSWERED;
-
-   return score;
-}
-
-static int CompareStatus(int stat1, int stat2)
-{
-   // deleted messages are considered to be less important than undeleted ones
-   if ( stat1 & MailFolder::MSG_STAT_DELETED )
-   {
-      if ( ! (stat2 & MailFolder::MSG_STAT_DELETED ) )
-         return -1;
-   }
-   else if ( stat2 & MailFolder::MSG_STAT_DELETED )
-   {
-      return 1;
-   }
-
-   // now, messages are either both deleted or neither one is -- compare
-   // according to the other status bits
-   return CmpNumeric(ComputeStatusScore(stat1), ComputeStatusScore(stat2));
-}
-
-extern "C"
-{
-   static int SortComparisonFunction(const void *p1, const void *p2)
-   {
-      // check that the caller didn't forget to acquire the global data lock
-      ASSERT_MSG( gs_SortData.mutex.IsLocked(), _T("using unlocked gs_SortData") );
-
-      // convert msgnos to indices
-      MsgnoType n1 = *(MsgnoType *)p1 - 1,
-                n2 = *(MsgnoType *)p2 - 1;
-
-      HeaderInfo *hi1 = gs_SortData.hil->GetItemByIndex(n1),
-                 *hi2 = gs_SortData.hil->GetItemByIndex(n2);
-
-      int result = 0;
-
-      // if one header is invalid (presumable because it wasn't retrieved from
-      // server at all because the user aborted it), assume it is always less
-      // than the other
-      if ( !hi1->IsValid() )
-      {
-         // even if the second one is invalid, we may still return 1, it's not
-         // like it changes anything
-         result = -1;
-      }
-      else if ( !hi2->IsValid() )
-      {
-         // as hi1 is valid, it is greater
-         result = 1;
-      }
-
-      // copy it as we're going to modify it while processing
-      long sortOrder = gs_SortData.sortParams.sortOrder;
-      while ( !result && sortOrder != 0 )
-      {
-         long criterium = GetSortCrit(sortOrder);
-         sortOrder = GetSortNextCriterium(sortOrder);
-
-         // we rely on MessageSortOrder values being what they are: as _REV
-         // version immediately follows the normal order constant, we should
-         // reverse the comparison result for odd values of MSO_XXX
-         int reverse = criterium % 2;
-         switch ( criterium - reverse )
-         {
-            case MSO_NONE:
-               break;
-
-            case MSO_DATE:
-               result = CmpNumeric(hi1->GetDate(), hi2->GetDate());
-               break;
-
-            case MSO_SUBJECT:
-               {
-                  String
-                     subj1 = Address::NormalizeSubject(hi1->GetSubject()),
-                     subj2 = Address::NormalizeSubject(hi2->GetSubject());
-
-                  result = wxStricmp(subj1, subj2);
-               }
-               break;
-
-            case MSO_SENDER:
-               {
-                  // use "To" if needed
-                  String value1, value2;
-                  (void)HeaderInfo::GetFromOrTo
-                                    (
-                                       hi1,
-                                       gs_SortData.sortParams.detectOwnAddresses,
-                                       gs_SortData.sortParams.ownAddresses,
-                                       &value1
-                                    );
-
-                  (void)HeaderInfo::GetFromOrTo
-                                    (
-                                       hi2,
-                                       gs_SortData.sortParams.detectOwnAddresses,
-                                       gs_SortData.sortParams.ownAddresses,
-                                       &value2
-                                    );
-
-                  result = wxStricmp(value1, value2);
-               }
-               break;
-
-            case MSO_STATUS:
-               result = CompareStatus(hi1->GetStatus(), hi2->GetStatus());
-               break;
-
-            case MSO_SIZE:
-               result = CmpNumeric(hi1->GetSize(), hi2->GetSize());
-               break;
-
-            case MSO_SCORE:
-               // we don't store score any more in HeaderInfo
-#ifdef USE_HEADER_SCORE
-               result = CmpNumeric(hi1->GetScore(), hi2->GetScore());
-#else
-               FAIL_MSG(_T("unimplemented"));
-#endif // USE_HEADER_SCORE
-               break;
-
-            default:
-               FAIL_MSG(_T("unknown sorting criterium"));
-         }
-
-         if ( reverse )
-         {
-            if ( criterium == MSO_NONE )
-            {
-               // special case: result is 0 for MSO_NONE but -1 (reversed order)
-               // for MSO_NONE_REV
-               result = -1;
-            }
-            else // for all other cases just revert the result value
-            {
-               result = -result;
-            }
-         }
-      }
-
-      return result;
-   }
-}
-
 bool
 MailFolderCmn::SortMessages(MsgnoType *msgnos, const SortParams& sortParams)
 {
@@ -1308,22 +1832,25 @@ MailFolderCmn::SortMessages(MsgnoType *msgnos, const SortParams& sortParams)
    // we need all headers, prefetch them
    hil->CacheMsgnos(1, count);
 
-   MLocker lock(gs_SortData.mutex);
-   gs_SortData.sortParams = sortParams;
-   gs_SortData.hil = hil.operator->();
+   // use parallel sort for big folders unless disabled
+   long thresholdParallel = READ_CONFIG(GetProfile(),
+                                        MP_MSGS_SORT_PARALLEL_THRESHOLD);
+   if ( thresholdParallel < 0 )
+      thresholdParallel = 0;
 
-   // start with unsorted listing
-   for ( MsgnoType n = 0; n < count; n++ )
-   {
-      // +1 because we want the msgnos, not indices
-      msgnos[n] = n + 1;
-   }
+   wxStopWatch sw;
+
+   MessageSorter sorter(hil.operator->(), sortParams);
 
-   // now sort it
-   qsort(msgnos, count, sizeof(MsgnoType), SortComparisonFunction);
+   const long timeKeys = sw.Time();
 
-   // don't leave dangling pointers around
-   gs_SortData.hil = NULL;
+   sorter.Sort(msgnos, thresholdParallel);
+
+   wxLogTrace(TRACE_SORT,
+              _T("Sorted %lu messages of '%s': %ldms to extract keys, ")
+              _T("%ldms to sort"),
+              (unsigned long)count, GetName().c_str(),
+              timeKeys, sw.Time() - timeKeys);
 
    return true;
 }
@@ -1351,8 +1878,39 @@ bool MailFolderCmn::ThreadMessages(const ThreadParams& thrParams,
    // we need all headers, prefetch them
    hil->CacheMsgnos(1, count);
 
-   // do thread!
-   JWZThreadMessages(thrParams, hil.operator->(), thrData);
+   // reuse the threads computed previously for the same messages if we can
+   ThreadCache * const thrCache = GetThreadCache();
+   MsgnoType countCached = thrCache
+                              ? thrCache->Restore(thrParams, hil.operator->(), thrData)
+                              : 0;
+
+   if ( countCached )
+   {
+      // index the restored tree even if it's complete as otherwise the
+      // messages arriving later couldn't be added to it without rethreading
+      // everything
+      JWZIndexThreadTree(thrParams, hil.operator->(), thrData);
+
+      // only the new messages need to be threaded, try to just add them to
+      // the existing tree
+      if ( countCached < count &&
+            !JWZThreadNewMessages(hil.operator->(), thrData,
+                                  countCached + 1, count) )
+      {
+         thrData->killTree();
+         countCached = 0;
+      }
+   }
+
+   if ( !countCached )
+   {
+      // do thread!
+      JWZThreadMessages(thrParams, hil.operator->(), thrData);
+   }
+
+   // remember the tree if it changed
+   if ( thrCache && countCached != count )
+      thrCache->Store(thrParams, hil.operator->(), thrData);
 
    return true;
 }
@@ -2452,8 +3010,11 @@ wxFrame *MailFolderCmn::SetInteractiveFrame(wxFrame *frame)
 
 wxFrame *MailFolderCmn::GetInteractiveFrame() const
 {
-   // no interactivity at all in away mode
-   return mApplication->IsInAwayMode() ? NULL : m_frame;
+   // no interactivity at all in away mode nor in the background threads
+   if ( mApplication->IsInAwayMode() || !wxThread::IsMain() )
+      return NULL;
+
+   return m_frame;
 }
 
 // ----------------------------------------------------------------------------
@@ -63,6 +63,21 @@ size_t Message::ExtractAddressesFromHeader(wxArrayString& addresses) const
 
 // TODO: write a function to extract addresses from the body as well
 
+// ============================================================================
+// implementation of Message methods for working with the message contents
+// ============================================================================
+
+bool Message::WriteToBuffer(wxCharBuffer& buf) const
+{
+   String str;
+   if ( !WriteToString(str) )
+      return false;
+
+   buf = str.To8BitData();
+
+   return true;
+}
+
 // ============================================================================
 // implementation of Message methods for working with headers
 // ============================================================================
@@ -88,6 +88,7 @@ void MessageCC::Init()
 {
    m_mimePartTop = NULL;
    m_mailFullText = NULL;
+   m_MailTextLen = 0;
    m_Body = NULL;
    m_Envelope = NULL;
    m_msgText = NULL;
@@ -243,6 +244,8 @@ String MessageCC::GetHeader(void) const
 
    if ( m_folder )
    {
+      MailFolderCC::StreamLocker lockStream(m_folder);
+
       CHECK_DEAD_RC(str);
 
       if ( m_folder->Lock() )
@@ -290,6 +293,8 @@ MessageCC::GetHeaderLines(const char **headersOrig,
    CHECK( m_folder, values,
           _T("GetHeaderLines() can't be called for this message") );
 
+   MailFolderCC::StreamLocker lockStream(m_folder);
+
    CHECK_DEAD_RC(values);
 
    if ( !m_folder->Lock() )
@@ -438,13 +443,23 @@ AddressList *MessageCC::GetAddressList(MessageAddressType type) const
 
 String
 MessageCC::FetchText(void) const
+{
+   unsigned long len;
+
+   return wxString::From8BitData(GetRawText(&len));
+}
+
+const char *
+MessageCC::GetRawText(unsigned long *len) const
 {
    char *text;
    if ( m_folder )
    {
       if ( !m_mailFullText )
       {
-         CHECK_DEAD_RC(wxEmptyString);
+         MailFolderCC::StreamLocker lockStream(m_folder);
+
+         CHECK_DEAD_RC(NULL);
 
          if ( m_folder->Lock() )
          {
@@ -486,13 +501,15 @@ MessageCC::FetchText(void) const
       //else: already have it, reuse as msg text doesn't change
 
       text = m_mailFullText;
+      *len = m_MailTextLen;
    }
    else // from a text
    {
       text = m_msgText;
+      *len = text ? strlen(text) : 0;
    }
 
-   return wxString::From8BitData(text);
+   return text;
 }
 
 // ----------------------------------------------------------------------------
@@ -620,6 +637,8 @@ MessageCC::DoGetPartAny(const MimePart& mimepart,
 
    CheckMIME();
 
+   MailFolderCC::StreamLocker lockStream(m_folder);
+
    MAILSTREAM *stream = m_folder->Stream();
    if ( !stream )
    {
@@ -691,6 +710,8 @@ MessageCC::GetEnvelope()
    // Forget what we know and re-fetch the body, it is cached anyway.
    m_Envelope = NULL;
 
+   MailFolderCC::StreamLocker lockStream(m_folder);
+
    // reopen the folder if needed
    CHECK_DEAD();
 
@@ -719,6 +740,8 @@ MessageCC::GetBody(void)
    // Forget what we know and re-fetch the body, it is cached anyway.
    m_Body = NULL;
 
+   MailFolderCC::StreamLocker lockStream(m_folder);
+
    // reopen the folder if needed
    CHECK_DEAD();
 
@@ -743,7 +766,12 @@ MessageCC::GetCacheElement() const
 {
    MESSAGECACHE *mc = NULL;
 
-   if ( m_folder && m_folder->Lock() )
+   if ( !m_folder )
+      return NULL;
+
+   MailFolderCC::StreamLocker lockStream(m_folder);
+
+   if ( m_folder->Lock() )
    {
       MAILSTREAM *stream = m_folder->Stream();
 
@@ -832,6 +860,8 @@ MessageCC::WriteToString(String &str, bool headerFlag) const
       {
          ((MessageCC *)this)->CheckBody(); // const_cast<>
 
+         MailFolderCC::StreamLocker lockStream(m_folder);
+
          CHECK_DEAD_RC(false);
 
          if ( m_folder->Lock())
@@ -860,6 +890,48 @@ MessageCC::WriteToString(String &str, bool headerFlag) const
    return true;
 }
 
+bool
+MessageCC::WriteToBuffer(wxCharBuffer& buf) const
+{
+   // folder-less message doesn't have headers, see WriteToString()
+   if ( !m_folder )
+      return Message::WriteToBuffer(buf);
+
+   CheckBody();
+
+   MailFolderCC::StreamLocker lockStream(m_folder);
+
+   CHECK_DEAD_RC(false);
+
+   // get the text first as fetching it could invalidate the header pointer
+   unsigned long lenText;
+   const char * const text = GetRawText(&lenText);
+   if ( !text )
+      return false;
+
+   if ( !m_folder->Lock() )
+   {
+      ERRORMESSAGE((_("Cannot get lock for obtaining message text.")));
+      return false;
+   }
+
+   unsigned long lenHeader;
+   const char * const header = mail_fetchheader_full(m_folder->Stream(),
+                                                     m_uid, NIL,
+                                                     &lenHeader, FT_UID);
+
+   // copy both parts directly into the buffer which adds the trailing NUL
+   wxCharBuffer bufMsg(lenHeader + lenText);
+   memcpy(bufMsg.data(), header, lenHeader);
+   memcpy(bufMsg.data() + lenHeader, text, lenText);
+
+   m_folder->UnLock();
+
+   buf = bufMsg;
+
+   return true;
+}
+
 // ============================================================================
 // functions from Mcclient.h
 // ============================================================================
@@ -0,0 +1,886 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/MsgSort.cpp: MessageSorter class implementation
+// Purpose:     local sorting of the message headers using precomputed keys
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+// ============================================================================
+// declarations
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// headers
+// ----------------------------------------------------------------------------
+
+#include  "Mpch.h"
+
+#ifndef  USE_PCH
+#  include "Mcommon.h"
+#endif // USE_PCH
+
+#include "HeaderInfo.h"
+#include "Address.h"
+
+#include "mail/MsgSort.h"
+
+#include <wx/thread.h>
+
+#include <algorithm>
+
+// ----------------------------------------------------------------------------
+// private functions
+// ----------------------------------------------------------------------------
+
+// return negative number if a < b, 0 if a == b and positive number if a > b
+template <typename T>
+static inline int CmpNumeric(T a, T b)
+{
+   return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/*
+   Compute the value which can be directly compared to sort the messages by
+   status: the idea is to make the messages appear in the order of new,
+   important, recent or unread, other, answered so the scores are assigned in a
+   way to make new appear in front of the important, but the important before
+   the ones which are just recent or unread (remember that new == recent &&
+   unread).
+
+   Deleted messages are considered to be less important than all undeleted
+   ones, whatever their other flags are.
+ */
+static int ComputeStatusScore(int status)
+{
+   enum
+   {
+      SCORE_RECENT = 2,
+      SCORE_UNREAD = 3,
+      SCORE_IMPORTANT = 4,
+      SCORE_ANSWERED = -1,
+
+      // must be greater than the maximal difference between the other scores
+      SCORE_UNDELETED = 16
+   };
+
+   int score = 0;
+
+   if ( !(status & MailFolder::MSG_STAT_DELETED) )
+      score += SCORE_UNDELETED;
+
+   if ( status & MailFolder::MSG_STAT_RECENT )
+      score += SCORE_RECENT;
+
+   if ( !(status & MailFolder::MSG_STAT_SEEN) )
+      score += SCORE_UNREAD;
+
+   if ( status & MailFolder::MSG_STAT_FLAGGED )
+      score += SCORE_IMPORTANT;
+
+   if ( status & MailFolder::MSG_STAT_ANSWERED )
+      score += SCORE_ANSWERED;
+
+   return score;
+}
+
+// ============================================================================
+// MessageSorter implementation
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// MessageSorter::MsgnoLess
+// ----------------------------------------------------------------------------
+
+class MessageSorter::MsgnoLess
+{
+public:
+   MsgnoLess(const MessageSorter& sorter) : m_sorter(sorter) { }
+
+   bool operator()(MsgnoType msgno1, MsgnoType msgno2) const
+   {
+      // convert msgnos to indices
+      return m_sorter.Compare(msgno1 - 1, msgno2 - 1) < 0;
+   }
+
+private:
+   const MessageSorter& m_sorter;
+};
+
+// ----------------------------------------------------------------------------
+// MessageSorter::SortTask and SortThread
+// ----------------------------------------------------------------------------
+
+// one unit of work of the parallel sort: either sorts [first, last) range in
+// place (if out is NULL) or merges [first, middle) and [middle, last) already
+// sorted ranges into out
+struct MessageSorter::SortTask
+{
+   SortTask(MsgnoType *first_, MsgnoType *last_)
+   {
+      first = first_;
+      middle = NULL;
+      last = last_;
+      out = NULL;
+   }
+
+   SortTask(MsgnoType *first_, MsgnoType *middle_, MsgnoType *last_,
+            MsgnoType *out_)
+   {
+      first = first_;
+      middle = middle_;
+      last = last_;
+      out = out_;
+   }
+
+   void Do(const MessageSorter& sorter) const
+   {
+      if ( out )
+      {
+         // std::merge() is stable: the elements from the first range precede
+         // the equal elements from the second one
+         std::merge(first, middle, middle, last, out, MsgnoLess(sorter));
+      }
+      else
+      {
+         std::stable_sort(first, last, MsgnoLess(sorter));
+      }
+   }
+
+   MsgnoType *first,
+             *middle,
+             *last,
+             *out;
+};
+
+// the thread executing a single SortTask
+class MessageSorter::SortThread : public wxThread
+{
+public:
+   SortThread(const MessageSorter& sorter, const SortTask& task)
+      : wxThread(wxTHREAD_JOINABLE),
+        m_sorter(sorter),
+        m_task(task)
+   {
+   }
+
+protected:
+   virtual void *Entry()
+   {
+      m_task.Do(m_sorter);
+
+      return NULL;
+   }
+
+private:
+   const MessageSorter& m_sorter;
+   const SortTask m_task;
+
+   DECLARE_NO_COPY_CLASS(SortThread)
+};
+
+// ----------------------------------------------------------------------------
+// keys extraction
+// ----------------------------------------------------------------------------
+
+MessageSorter::MessageSorter(HeaderInfoList *hil,
+                             const SortParams& sortParams,
+                             KeysMode mode)
+             : m_hil(hil),
+               m_count(hil->Count()),
+               m_detectOwnAddresses(sortParams.detectOwnAddresses),
+               m_ownAddresses(sortParams.ownAddresses)
+{
+   m_needDate =
+   m_needSize =
+   m_needStatus =
+   m_needSubject =
+   m_needSender = false;
+
+   for ( long sortOrder = sortParams.sortOrder;
+         sortOrder;
+         sortOrder = GetSortNextCriterium(sortOrder) )
+   {
+      const MessageSortOrder crit = GetSortCrit(sortOrder);
+      switch ( GetSortCritDirect(sortOrder) )
+      {
+         case MSO_NONE:
+            // MSO_NONE is the same as the default msgno order preserved by
+            // the stable sort, so it's only useful when reversed
+            if ( crit == MSO_NONE )
+               continue;
+            break;
+
+         case MSO_DATE:
+            m_needDate = true;
+            break;
+
+         case MSO_SUBJECT:
+            m_needSubject = true;
+            break;
+
+         case MSO_SENDER:
+            m_needSender = true;
+            break;
+
+         case MSO_STATUS:
+            m_needStatus = true;
+            break;
+
+         case MSO_SIZE:
+            m_needSize = true;
+            break;
+
+         case MSO_SCORE:
+            // we don't store score any more in HeaderInfo
+            FAIL_MSG(_T("unimplemented"));
+            continue;
+
+         default:
+            FAIL_MSG(_T("unknown sorting criterium"));
+            continue;
+      }
+
+      m_criteria.push_back(crit);
+
+      // there is no point in continuing after MSO_NONE_REV as no two messages
+      // compare equal using it
+      if ( crit == MSO_NONE_REV )
+         break;
+   }
+
+   m_valid.resize(m_count);
+   if ( m_needDate )
+      m_dates.resize(m_count);
+   if ( m_needSize )
+      m_sizes.resize(m_count);
+   if ( m_needStatus )
+      m_statusScores.resize(m_count);
+   if ( m_needSubject )
+      m_subjects.resize(m_count);
+   if ( m_needSender )
+      m_senders.resize(m_count);
+
+   if ( mode == Keys_OnDemand )
+   {
+      m_extracted.resize(m_count);
+   }
+   else // extract all keys right now
+   {
+      for ( MsgnoType n = 0; n < m_count; n++ )
+      {
+         ExtractKeys(n);
+      }
+   }
+}
+
+void MessageSorter::ExtractKeys(MsgnoType n)
+{
+   const HeaderInfo * const hi = m_hil->GetItemByIndex(n);
+
+   // if the header is invalid (presumably because it wasn't retrieved from
+   // server at all because the user aborted it), don't bother with its keys
+   // as it's always less than all the valid ones
+   m_valid[n] = hi && hi->IsValid();
+   if ( !m_valid[n] )
+      return;
+
+   if ( m_needDate )
+      m_dates[n] = hi->GetDate();
+
+   if ( m_needSize )
+      m_sizes[n] = hi->GetSize();
+
+   if ( m_needStatus )
+      m_statusScores[n] = ComputeStatusScore(hi->GetStatus());
+
+   if ( m_needSubject )
+      m_subjects[n] = Address::NormalizeSubject(hi->GetSubject()).Lower();
+
+   if ( m_needSender )
+   {
+      // use "To" if needed
+      String value;
+      (void)HeaderInfo::GetFromOrTo
+                        (
+                           hi,
+                           m_detectOwnAddresses,
+                           m_ownAddresses,
+                           &value
+                        );
+
+      m_senders[n] = value.Lower();
+   }
+}
+
+void MessageSorter::EnsureKeys(MsgnoType n)
+{
+   // m_extracted is empty if all keys had been extracted in the ctor
+   if ( !m_extracted.empty() && !m_extracted[n] )
+   {
+      ExtractKeys(n);
+
+      m_extracted[n] = true;
+   }
+}
+
+// ----------------------------------------------------------------------------
+// sorting
+// ----------------------------------------------------------------------------
+
+int MessageSorter::Compare(MsgnoType idx1, MsgnoType idx2) const
+{
+   // invalid headers are always less than the valid ones and equal between
+   // themselves
+   if ( !m_valid[idx1] || !m_valid[idx2] )
+      return m_valid[idx1] - m_valid[idx2];
+
+   const size_t count = m_criteria.size();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      // we rely on MessageSortOrder values being what they are: as _REV
+      // version immediately follows the normal order constant, we should
+      // reverse the comparison result for odd values of MSO_XXX
+      const MessageSortOrder crit = m_criteria[n];
+
+      int result;
+      switch ( GetSortCritDirect(crit) )
+      {
+         case MSO_NONE:
+            result = CmpNumeric(idx1, idx2);
+            break;
+
+         case MSO_DATE:
+            result = CmpNumeric(m_dates[idx1], m_dates[idx2]);
+            break;
+
+         case MSO_SUBJECT:
+            result = m_subjects[idx1].compare(m_subjects[idx2]);
+            break;
+
+         case MSO_SENDER:
+            result = m_senders[idx1].compare(m_senders[idx2]);
+            break;
+
+         case MSO_STATUS:
+            result = CmpNumeric(m_statusScores[idx1], m_statusScores[idx2]);
+            break;
+
+         case MSO_SIZE:
+            result = CmpNumeric(m_sizes[idx1], m_sizes[idx2]);
+            break;
+
+         default:
+            FAIL_MSG(_T("unexpected sorting criterium"));
+            result = 0;
+      }
+
+      if ( result )
+         return IsSortCritReversed(crit) ? -result : result;
+   }
+
+   return 0;
+}
+
+void MessageSorter::Sort(MsgnoType *msgnos, MsgnoType thresholdParallel) const
+{
+   CHECK_RET( m_extracted.empty(), _T("can't sort with keys extracted on demand") );
+
+   // start with unsorted listing
+   for ( MsgnoType n = 0; n < m_count; n++ )
+   {
+      // +1 because we want the msgnos, not indices
+      msgnos[n] = n + 1;
+   }
+
+   if ( thresholdParallel && m_count >= thresholdParallel )
+   {
+      const int nCPUs = wxThread::GetCPUCount();
+      if ( nCPUs > 1 )
+      {
+         ParallelSort(msgnos, nCPUs);
+
+         return;
+      }
+   }
+
+   // sort it using stable sort as the messages which are equal according to
+   // the sort criteria should remain in their original order
+   std::stable_sort(msgnos, msgnos + m_count, MsgnoLess(*this));
+}
+
+MsgnoType *
+MessageSorter::UpperBound(MsgnoType *first, MsgnoType *last, MsgnoType msgno)
+{
+   const MsgnoType idx = msgno - 1;
+   EnsureKeys(idx);
+
+   // this is the usual binary search except that we extract the keys of the
+   // messages we compare with on the fly
+   size_t count = last - first;
+   while ( count > 0 )
+   {
+      const size_t step = count / 2;
+      MsgnoType * const middle = first + step;
+
+      EnsureKeys(*middle - 1);
+      if ( Compare(idx, *middle - 1) < 0 )
+      {
+         count = step;
+      }
+      else
+      {
+         first = middle + 1;
+         count -= step + 1;
+      }
+   }
+
+   return first;
+}
+
+void
+MessageSorter::InsertNew(MsgnoType *msgnos,
+                         MsgnoType countOld,
+                         MsgnoType countNew)
+{
+   CHECK_RET( countOld <= countNew && countNew <= m_count,
+              _T("invalid parameters in MessageSorter::InsertNew") );
+
+   const MsgnoType countAdded = countNew - countOld;
+   if ( !countAdded )
+      return;
+
+   // first sort the new messages themselves
+   std::vector<MsgnoType> added(countAdded);
+   MsgnoType n;
+   for ( n = 0; n < countAdded; n++ )
+   {
+      added[n] = countOld + n + 1;
+
+      EnsureKeys(countOld + n);
+   }
+
+   std::stable_sort(added.begin(), added.end(), MsgnoLess(*this));
+
+   // then find where each of them must be inserted: as they're sorted, we
+   // can start searching from the position of the previous one
+   std::vector<MsgnoType *> positions(countAdded);
+   MsgnoType *pos = msgnos;
+   for ( n = 0; n < countAdded; n++ )
+   {
+      pos = UpperBound(pos, msgnos + countOld, added[n]);
+      positions[n] = pos;
+   }
+
+   // and finally shift the existing elements to their final places, starting
+   // from the end so that each one is moved only once
+   MsgnoType *end = msgnos + countOld;
+   for ( n = countAdded; n > 0; n-- )
+   {
+      MsgnoType * const insertAt = positions[n - 1];
+
+      // there are n new elements still to be inserted before the elements in
+      // [insertAt, end) range, so they must be shifted by n positions
+      std::copy_backward(insertAt, end, end + n);
+      insertAt[n - 1] = added[n - 1];
+
+      end = insertAt;
+   }
+}
+
+void MessageSorter::RunTasks(const std::vector<SortTask>& tasks) const
+{
+   const size_t count = tasks.size();
+   if ( !count )
+      return;
+
+   // launch all tasks but the first one in their own threads
+   std::vector<SortThread *> threads;
+   threads.reserve(count - 1);
+
+   size_t n;
+   for ( n = 1; n < count; n++ )
+   {
+      SortThread *thread = new SortThread(*this, tasks[n]);
+      if ( thread->Run() == wxTHREAD_NO_ERROR )
+      {
+         threads.push_back(thread);
+      }
+      else // failed to launch the thread, just do it ourselves
+      {
+         delete thread;
+
+         tasks[n].Do(*this);
+      }
+   }
+
+   // do the first one in this thread while the others are running
+   tasks[0].Do(*this);
+
+   // and wait until all the others terminate
+   for ( n = 0; n < threads.size(); n++ )
+   {
+      threads[n]->Wait();
+
+      delete threads[n];
+   }
+}
+
+/*
+   The parallel sort splits the array in nThreads chunks of (almost) equal
+   size, sorts each of them in its own thread using std::stable_sort() and then
+   merges the pairs of the adjacent chunks, again in parallel, until only one
+   chunk remains. As both the chunk sort and the merge are stable and the
+   chunks are always merged in their original order, the result is exactly
+   the same as if we sorted the entire array with std::stable_sort().
+ */
+void MessageSorter::ParallelSort(MsgnoType *msgnos, unsigned nThreads) const
+{
+   wxLogTrace(TRACE_SORT, _T("Sorting %lu messages using %u threads"),
+              (unsigned long)m_count, nThreads);
+
+   // the boundaries of the sorted chunks: chunk n is [bounds[n], bounds[n+1])
+   std::vector<MsgnoType> bounds;
+   bounds.reserve(nThreads + 1);
+
+   std::vector<SortTask> tasks;
+   tasks.reserve(nThreads);
+
+   size_t n;
+   for ( n = 0; n <= nThreads; n++ )
+   {
+      bounds.push_back((MsgnoType)(((wxULongLong_t)m_count * n) / nThreads));
+      if ( n > 0 )
+         tasks.push_back(SortTask(msgnos + bounds[n - 1], msgnos + bounds[n]));
+   }
+
+   RunTasks(tasks);
+
+   // now merge the chunks pairwise going back and forth between the original
+   // array and the buffer
+   std::vector<MsgnoType> buffer(m_count);
+   MsgnoType *src = msgnos,
+             *dst = &buffer[0];
+
+   while ( bounds.size() > 2 )
+   {
+      tasks.clear();
+
+      std::vector<MsgnoType> boundsNew;
+      boundsNew.push_back(0);
+
+      const size_t nChunks = bounds.size() - 1;
+      for ( n = 0; n + 1 < nChunks; n += 2 )
+      {
+         tasks.push_back(SortTask(src + bounds[n],
+                                  src + bounds[n + 1],
+                                  src + bounds[n + 2],
+                                  dst + bounds[n]));
+         boundsNew.push_back(bounds[n + 2]);
+      }
+
+      if ( n < nChunks )
+      {
+         // odd number of chunks, just copy the last one
+         std::copy(src + bounds[n], src + bounds[n + 1], dst + bounds[n]);
+         boundsNew.push_back(bounds[n + 1]);
+      }
+
+      RunTasks(tasks);
+
+      bounds.swap(boundsNew);
+      std::swap(src, dst);
+   }
+
+   if ( src != msgnos )
+   {
+      std::copy(src, src + m_count, msgnos);
+   }
+}
+
+#ifdef TEST_MSGSORT
+
+// ----------------------------------------------------------------------------
+// sorting benchmark
+// ----------------------------------------------------------------------------
+
+// define this to build a program comparing MessageSorter with the qsort()
+// based sort used before it, which normalized the subjects and senders during
+// each comparison, on synthetic listings of 10k, 100k and 1M messages and
+// checking that they give the same order (it must be linked with the rest of
+// the program objects)
+
+#include <wx/init.h>
+#include <wx/stopwatch.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// the listing of synthetic headers, only the functions used by MessageSorter
+// do anything
+class MessageSorterTest : public HeaderInfoList
+{
+public:
+   MessageSorterTest(size_t count);
+
+   virtual MsgnoType Count() const { return m_headers.size(); }
+   virtual HeaderInfo *GetItemByIndex(MsgnoType n) const
+      { return const_cast<HeaderInfo *>(&m_headers[n]); }
+
+   virtual MsgnoType GetIdxFromUId(UIdType uid) const { return uid - 1; }
+   virtual MsgnoType GetIdxFromPos(MsgnoType pos) const { return pos; }
+   virtual MsgnoType GetPosFromIdx(MsgnoType n) const { return n; }
+   virtual MsgnoType GetOldPosFromIdx(MsgnoType n) const { return n; }
+   virtual size_t GetIndentation(MsgnoType) const { return 0; }
+   virtual void OnRemove(MsgnoType) { }
+   virtual void OnAdd(MsgnoType) { }
+   virtual void OnClose() { }
+   virtual MsgnoType FindHeaderByFlag(MailFolder::MessageStatus, bool, long)
+      { return INDEX_ILLEGAL; }
+   virtual MsgnoType FindHeaderByFlagWrap(MailFolder::MessageStatus,
+                                          bool, long)
+      { return INDEX_ILLEGAL; }
+   virtual MsgnoArray *GetAllHeadersByFlag(MailFolder::MessageStatus, bool)
+      { return NULL; }
+   virtual bool SetSortOrder(const SortParams&) { return false; }
+   virtual bool SetThreadParameters(const ThreadParams&) { return false; }
+   virtual LastMod GetLastMod() const { return 1; }
+   virtual bool HasChanged(const LastMod) const { return false; }
+   virtual void CachePositions(const Sequence&) { }
+   virtual void CacheMsgnos(MsgnoType, MsgnoType) { }
+   virtual bool IsInCache(MsgnoType) const { return true; }
+   virtual bool ReallyGet(MsgnoType) { return true; }
+
+private:
+   std::vector<HeaderInfo> m_headers;
+};
+
+MessageSorterTest::MessageSorterTest(size_t count)
+                 : m_headers(count)
+{
+   // use a fixed pseudo random sequence to have the same data for all runs
+   unsigned long seed = 1;
+
+   // there are many replies in the same threads, from the same people, as
+   // in the real mailing lists
+   const unsigned long countThreads = count / 10 + 1,
+                       countSenders = count / 100 + 1;
+
+   for ( size_t n = 0; n < count; n++ )
+   {
+      seed = seed * 1103515245 + 12345;
+      const unsigned long r = (seed >> 8) & 0xffffff;
+
+      HeaderInfo& hi = m_headers[n];
+      hi.m_UId = n + 1;
+      hi.m_Subject = String::Format(_T("%s[list] Thread number %lu"),
+                                    r % 3 ? _T("Re: ") : _T(""),
+                                    r % countThreads);
+      hi.m_From = String::Format(_T("Sender %lu <sender%lu@example.com>"),
+                                 r % countSenders, r % countSenders);
+      hi.m_Date = 1000000000 + r * 7;
+      hi.m_Size = 1000 + r % 100000;
+
+      int status = 0;
+      if ( r & 1 )
+         status |= MailFolder::MSG_STAT_SEEN;
+      if ( r & 2 )
+         status |= MailFolder::MSG_STAT_ANSWERED;
+      if ( !(r & 0x1c) )
+         status |= MailFolder::MSG_STAT_FLAGGED;
+      hi.m_Status = status;
+   }
+}
+
+// the data used by LegacyCompare(), as by the old sort code
+static const HeaderInfoList *gs_legacyHil = NULL;
+static const SortParams *gs_legacyParams = NULL;
+
+extern "C"
+{
+   // the comparison function used by the old sort code, for the criteria
+   // used by this test only
+   static int LegacyCompare(const void *p1, const void *p2)
+   {
+      const MsgnoType n1 = *(const MsgnoType *)p1 - 1,
+                      n2 = *(const MsgnoType *)p2 - 1;
+
+      const HeaderInfo *hi1 = gs_legacyHil->GetItemByIndex(n1),
+                       *hi2 = gs_legacyHil->GetItemByIndex(n2);
+
+      int result = 0;
+      long sortOrder = gs_legacyParams->sortOrder;
+      while ( !result && sortOrder != 0 )
+      {
+         const long criterium = GetSortCrit(sortOrder);
+         sortOrder = GetSortNextCriterium(sortOrder);
+
+         const int reverse = criterium % 2;
+         switch ( criterium - reverse )
+         {
+            case MSO_DATE:
+               result = CmpNumeric(hi1->GetDate(), hi2->GetDate());
+               break;
+
+            case MSO_SUBJECT:
+               result = wxStricmp(Address::NormalizeSubject(hi1->GetSubject()),
+                                  Address::NormalizeSubject(hi2->GetSubject()));
+               break;
+
+            case MSO_SENDER:
+               {
+                  String value1, value2;
+                  (void)HeaderInfo::GetFromOrTo
+                                    (
+                                       hi1,
+                                       gs_legacyParams->detectOwnAddresses,
+                                       gs_legacyParams->ownAddresses,
+                                       &value1
+                                    );
+                  (void)HeaderInfo::GetFromOrTo
+                                    (
+                                       hi2,
+                                       gs_legacyParams->detectOwnAddresses,
+                                       gs_legacyParams->ownAddresses,
+                                       &value2
+                                    );
+
+                  result = wxStricmp(value1, value2);
+               }
+               break;
+
+            case MSO_SIZE:
+               result = CmpNumeric(hi1->GetSize(), hi2->GetSize());
+               break;
+         }
+
+         if ( reverse )
+            result = -result;
+      }
+
+      return result;
+   }
+}
+
+// check that the msgnos are sorted according to the given sorter, the ties
+// must be in msgno order only if stable is true
+static bool CheckSorted(const MessageSorter& sorter,
+                        const std::vector<MsgnoType>& msgnos,
+                        bool stable)
+{
+   for ( size_t n = 1; n < msgnos.size(); n++ )
+   {
+      const int rc = sorter.Compare(msgnos[n - 1] - 1, msgnos[n] - 1);
+      if ( rc > 0 || (stable && rc == 0 && msgnos[n - 1] > msgnos[n]) )
+      {
+         printf("ERROR: messages %lu and %lu at %lu are out of order\n",
+                (unsigned long)msgnos[n - 1], (unsigned long)msgnos[n],
+                (unsigned long)n);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static bool
+TestSort(MessageSorterTest *hil, const char *desc, long sortOrder)
+{
+   SortParams sortParams;
+   sortParams.sortOrder = sortOrder;
+
+   const MsgnoType count = hil->Count();
+   printf("%lu messages by %s: ", (unsigned long)count, desc);
+   fflush(stdout);
+
+   wxStopWatch sw;
+   MessageSorter sorter(hil, sortParams);
+   const long timeKeys = sw.Time();
+
+   std::vector<MsgnoType> msgnos(count);
+
+   sw.Start();
+   sorter.Sort(&msgnos[0]);
+   const long timeSort = sw.Time();
+
+   bool ok = CheckSorted(sorter, msgnos, true);
+
+   // the parallel sort must give exactly the same result
+   std::vector<MsgnoType> msgnosPar(count);
+
+   sw.Start();
+   sorter.Sort(&msgnosPar[0], 1);
+   const long timeSortPar = sw.Time();
+
+   if ( msgnosPar != msgnos )
+   {
+      printf("ERROR: parallel sort result differs ");
+      ok = false;
+   }
+
+   // and the old one the same order, except for the ties as qsort() is not
+   // stable
+   std::vector<MsgnoType> msgnosOld(count);
+   for ( MsgnoType n = 0; n < count; n++ )
+      msgnosOld[n] = n + 1;
+
+   gs_legacyHil = hil;
+   gs_legacyParams = &sortParams;
+
+   sw.Start();
+   qsort(&msgnosOld[0], count, sizeof(MsgnoType), LegacyCompare);
+   const long timeOld = sw.Time();
+
+   if ( !CheckSorted(sorter, msgnosOld, false) )
+      ok = false;
+
+   const long timeNew = timeKeys + timeSort;
+   printf("%s\n"
+          "\tkeys %ldms + sort %ldms = %ldms (parallel sort %ldms), "
+          "old sort %ldms (%.1f times slower)\n",
+          ok ? "ok" : "ERROR",
+          timeKeys, timeSort, timeNew, timeSortPar,
+          timeOld, timeNew ? (double)timeOld / timeNew : 0.);
+
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   unsigned long countMax = 1000000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &countMax) != 1 || countMax < 2) )
+   {
+      fprintf(stderr, "Usage: %s [maximal number of messages]\n", argv[0]);
+      return 2;
+   }
+
+   printf("Using up to %d CPUs for the parallel sort.\n",
+          wxThread::GetCPUCount());
+
+   bool ok = true;
+   for ( unsigned long count = 10000; count <= countMax; count *= 10 )
+   {
+      MessageSorterTest *hil = new MessageSorterTest(count);
+
+      if ( !TestSort(hil, "subject and date", MSO_SUBJECT | (MSO_DATE << 4)) )
+         ok = false;
+      if ( !TestSort(hil, "sender and date", MSO_SENDER | (MSO_DATE << 4)) )
+         ok = false;
+      if ( !TestSort(hil, "size", MSO_SIZE_REV) )
+         ok = false;
+
+      hil->DecRef();
+   }
+
+   return ok ? 0 : 1;
+}
+
+#endif // TEST_MSGSORT
@@ -0,0 +1,836 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/OverviewCache.cpp: OverviewCache class implementation
+// Purpose:     persistent on disk storage of the folder headers
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+// ============================================================================
+// declarations
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// headers
+// ----------------------------------------------------------------------------
+
+#include  "Mpch.h"
+
+#ifndef  USE_PCH
+#  include "Mcommon.h"
+
+#  include <wx/log.h>           // for wxLogNull
+#endif // USE_PCH
+
+#include <wx/file.h>
+#include <wx/stopwatch.h>
+
+#include "mail/OverviewCache.h"
+
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the signature at the start of the file
+static const char OVERVIEW_CACHE_MAGIC[8] = { 'M', 'O', 'V', 'C', 'A', 'C', 'H', 'E' };
+
+// the current version of the file format: increment it if FileHeader or
+// FileRecord change, the old files will be simply discarded then
+static const wxUint32 OVERVIEW_CACHE_VERSION = 1;
+
+// the indices of the strings in FileRecord::strings
+enum
+{
+   Str_Subject,
+   Str_From,
+   Str_To,
+   Str_NewsGroups,
+   Str_References,
+   Str_InReplyTo,
+   Str_Id,
+   Str_Max
+};
+
+// ----------------------------------------------------------------------------
+// file format
+// ----------------------------------------------------------------------------
+
+struct OverviewCache::FileHeader
+{
+   char magic[8];
+   wxUint32 version;
+   wxUint32 uidValidity;
+   wxUint32 countRecords;
+   wxUint32 sizeStrings;
+};
+
+// the records are stored sorted by UID immediately after the header and are
+// followed by the string pool with all strings encoded in UTF-8 and NUL
+// terminated
+struct OverviewCache::FileRecord
+{
+   wxUint32 uid;
+   wxUint32 size;
+   wxUint32 lines;
+   wxInt32 encoding;
+   wxInt64 date;
+
+   // offsets of the strings in the string pool
+   wxUint32 strings[Str_Max];
+
+   // explicit padding to keep the size a multiple of 8
+   wxUint32 padding;
+};
+
+// ============================================================================
+// OverviewCache implementation
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// ctor/dtor
+// ----------------------------------------------------------------------------
+
+OverviewCache::OverviewCache(const String& folderName, UIdType uidValidity)
+             : m_folderName(folderName),
+               m_filename(GetCacheFileName(folderName)),
+               m_uidValidity(uidValidity)
+{
+   Init();
+}
+
+OverviewCache::OverviewCache(const String& folderName,
+                             UIdType uidValidity,
+                             const String& filename)
+             : m_folderName(folderName),
+               m_filename(filename),
+               m_uidValidity(uidValidity)
+{
+   Init();
+}
+
+void OverviewCache::Init()
+{
+   m_records = NULL;
+   m_countRecords = 0;
+   m_strings = NULL;
+   m_sizeStrings = 0;
+}
+
+OverviewCache::~OverviewCache()
+{
+   Unmap();
+}
+
+void OverviewCache::Unmap()
+{
+   m_data.Free();
+
+   m_records = NULL;
+   m_countRecords = 0;
+   m_strings = NULL;
+   m_sizeStrings = 0;
+}
+
+/* static */
+String OverviewCache::GetCacheFileName(const String& folderName)
+{
+   return CacheFile::GetFolderCacheFileName(_T("headers"), folderName);
+}
+
+/* static */
+void OverviewCache::Remove(const String& folderName)
+{
+   const String filename = GetCacheFileName(folderName);
+   if ( wxFileExists(filename) )
+   {
+      if ( !wxRemoveFile(filename) )
+      {
+         wxLogDebug(_T("Failed to remove the overview cache file \"%s\""),
+                    filename.c_str());
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+// loading
+// ----------------------------------------------------------------------------
+
+bool OverviewCache::Load()
+{
+   Unmap();
+
+   m_newEntries.clear();
+   m_forgotten.clear();
+
+   if ( !wxFileExists(m_filename) )
+   {
+      // no cache yet, not an error
+      return true;
+   }
+
+   wxStopWatch sw;
+
+   if ( !m_data.Load(m_filename) )
+   {
+      // an empty file can't be loaded but it is just an empty cache, only a
+      // file which couldn't be read at all is an error
+      wxFile file(m_filename);
+      return file.IsOpened() && file.Length() == 0;
+   }
+
+   const char * const data = m_data.GetData();
+   const size_t sizeData = m_data.GetSize();
+
+   // check that the file is valid and is still usable
+   bool ok = sizeData >= sizeof(FileHeader);
+
+   const FileHeader *hdr = reinterpret_cast<const FileHeader *>(data);
+   if ( ok )
+   {
+      ok = memcmp(hdr->magic, OVERVIEW_CACHE_MAGIC, sizeof(hdr->magic)) == 0 &&
+               hdr->version == OVERVIEW_CACHE_VERSION;
+   }
+
+   if ( ok )
+   {
+      ok = sizeData == sizeof(FileHeader) +
+                       hdr->countRecords*sizeof(FileRecord) +
+                       hdr->sizeStrings;
+   }
+
+   if ( ok )
+   {
+      m_strings = data + sizeData - hdr->sizeStrings;
+      m_sizeStrings = hdr->sizeStrings;
+
+      // the pool always ends with the terminating NUL of its last string
+      ok = m_sizeStrings > 0 && m_strings[m_sizeStrings - 1] == '\0';
+   }
+
+   if ( !ok )
+   {
+      wxLogTrace(TRACE_OVERVIEW_CACHE,
+                 _T("Discarding invalid overview cache file \"%s\""),
+                 m_filename.c_str());
+
+      Unmap();
+
+      return true;
+   }
+
+   if ( hdr->uidValidity != m_uidValidity )
+   {
+      wxLogTrace(TRACE_OVERVIEW_CACHE,
+                 _T("UIDVALIDITY of '%s' changed, discarding its cache"),
+                 m_folderName.c_str());
+
+      Unmap();
+
+      // it's useless now
+      Remove(m_folderName);
+
+      return true;
+   }
+
+   m_records = reinterpret_cast<const FileRecord *>(data + sizeof(FileHeader));
+   m_countRecords = hdr->countRecords;
+
+   wxLogTrace(TRACE_OVERVIEW_CACHE,
+              _T("Loaded %lu cached headers for '%s' in %ldms"),
+              (unsigned long)m_countRecords, m_folderName.c_str(), sw.Time());
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+// accessing the data
+// ----------------------------------------------------------------------------
+
+const OverviewCache::FileRecord *OverviewCache::FindRecord(UIdType uid) const
+{
+   size_t lo = 0,
+          hi = m_countRecords;
+   while ( lo < hi )
+   {
+      const size_t mid = lo + (hi - lo) / 2;
+      const FileRecord& rec = m_records[mid];
+      if ( rec.uid == uid )
+         return &rec;
+
+      if ( rec.uid < uid )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return NULL;
+}
+
+String OverviewCache::GetPoolString(size_t offset) const
+{
+   CHECK( offset < m_sizeStrings, String(), _T("corrupted overview cache") );
+
+   return String::FromUTF8(m_strings + offset);
+}
+
+void OverviewCache::FillFromRecord(const FileRecord& rec, HeaderInfo& hi) const
+{
+   hi.m_Subject = GetPoolString(rec.strings[Str_Subject]);
+   hi.m_From = GetPoolString(rec.strings[Str_From]);
+   hi.m_To = GetPoolString(rec.strings[Str_To]);
+   hi.m_NewsGroups = GetPoolString(rec.strings[Str_NewsGroups]);
+   hi.m_References = GetPoolString(rec.strings[Str_References]);
+   hi.m_InReplyTo = GetPoolString(rec.strings[Str_InReplyTo]);
+   hi.m_Id = GetPoolString(rec.strings[Str_Id]);
+
+   hi.m_Size = rec.size;
+   hi.m_Lines = rec.lines;
+   hi.m_Date = (time_t)rec.date;
+   hi.m_Encoding = (wxFontEncoding)rec.encoding;
+}
+
+bool OverviewCache::Lookup(UIdType uid, HeaderInfo& hi) const
+{
+   if ( m_forgotten.find(uid) != m_forgotten.end() )
+      return false;
+
+   NewEntries::const_iterator i = m_newEntries.find(uid);
+   if ( i != m_newEntries.end() )
+   {
+      const HeaderInfo& hiCached = i->second;
+
+      // don't overwrite the status and UID of the entry
+      const int status = hi.m_Status;
+      const UIdType uidOld = hi.m_UId;
+
+      hi = hiCached;
+
+      hi.m_Status = status;
+      hi.m_UId = uidOld;
+
+      return true;
+   }
+
+   const FileRecord *rec = FindRecord(uid);
+   if ( !rec )
+      return false;
+
+   FillFromRecord(*rec, hi);
+
+   return true;
+}
+
+void OverviewCache::Store(const HeaderInfo& hi)
+{
+   const UIdType uid = hi.GetUId();
+   CHECK_RET( uid != UID_ILLEGAL, _T("can't cache header without UID") );
+
+   m_forgotten.erase(uid);
+
+   if ( !FindRecord(uid) )
+      m_newEntries[uid] = hi;
+}
+
+void OverviewCache::Forget(UIdType uid)
+{
+   m_newEntries.erase(uid);
+
+   if ( FindRecord(uid) )
+      m_forgotten.insert(uid);
+}
+
+size_t OverviewCache::GetCount() const
+{
+   return m_countRecords - m_forgotten.size() + m_newEntries.size();
+}
+
+// ----------------------------------------------------------------------------
+// saving
+// ----------------------------------------------------------------------------
+
+namespace
+{
+
+// helper class used to build the string pool
+class StringPoolBuilder
+{
+public:
+   StringPoolBuilder()
+   {
+      // put an empty string at offset 0 as we have a lot of those
+      m_pool.push_back('\0');
+   }
+
+   wxUint32 Add(const String& s)
+   {
+      if ( s.empty() )
+         return 0;
+
+      const wxUint32 offset = m_pool.size();
+
+      const wxCharBuffer buf(s.utf8_str());
+      const char *p = buf.data();
+      m_pool.insert(m_pool.end(), p, p + strlen(p) + 1);
+
+      return offset;
+   }
+
+   wxUint32 AddExisting(const char *s)
+   {
+      if ( !*s )
+         return 0;
+
+      const wxUint32 offset = m_pool.size();
+      m_pool.insert(m_pool.end(), s, s + strlen(s) + 1);
+
+      return offset;
+   }
+
+   const std::vector<char>& GetPool() const { return m_pool; }
+
+private:
+   std::vector<char> m_pool;
+};
+
+} // anonymous namespace
+
+bool OverviewCache::Save()
+{
+   if ( m_newEntries.empty() && m_forgotten.empty() )
+   {
+      // nothing changed
+      return true;
+   }
+
+   wxStopWatch sw;
+
+   if ( !CacheFile::CreateDirFor(m_filename) )
+      return false;
+
+   // merge the existing records with the new ones preserving the UID order
+   std::vector<FileRecord> records;
+   records.reserve(m_countRecords + m_newEntries.size());
+
+   StringPoolBuilder pool;
+
+   size_t nOld = 0;
+   NewEntries::const_iterator i = m_newEntries.begin();
+   for ( ;; )
+   {
+      const bool hasOld = nOld < m_countRecords,
+                 hasNew = i != m_newEntries.end();
+      if ( !hasOld && !hasNew )
+         break;
+
+      FileRecord rec;
+      memset(&rec, 0, sizeof(rec));
+
+      if ( hasOld && (!hasNew || m_records[nOld].uid < i->first) )
+      {
+         const FileRecord& recOld = m_records[nOld++];
+         if ( m_forgotten.find(recOld.uid) != m_forgotten.end() )
+            continue;
+
+         rec = recOld;
+         for ( size_t n = 0; n < Str_Max; n++ )
+         {
+            const size_t offset = recOld.strings[n];
+            rec.strings[n] = offset < m_sizeStrings
+                              ? pool.AddExisting(m_strings + offset)
+                              : 0;
+         }
+      }
+      else // take the new one
+      {
+         const HeaderInfo& hi = i++->second;
+
+         rec.uid = hi.m_UId;
+         rec.size = hi.m_Size;
+         rec.lines = hi.m_Lines;
+         rec.encoding = hi.m_Encoding;
+         rec.date = hi.m_Date;
+
+         rec.strings[Str_Subject] = pool.Add(hi.m_Subject);
+         rec.strings[Str_From] = pool.Add(hi.m_From);
+         rec.strings[Str_To] = pool.Add(hi.m_To);
+         rec.strings[Str_NewsGroups] = pool.Add(hi.m_NewsGroups);
+         rec.strings[Str_References] = pool.Add(hi.m_References);
+         rec.strings[Str_InReplyTo] = pool.Add(hi.m_InReplyTo);
+         rec.strings[Str_Id] = pool.Add(hi.m_Id);
+      }
+
+      records.push_back(rec);
+   }
+
+   FileHeader hdr;
+   memcpy(hdr.magic, OVERVIEW_CACHE_MAGIC, sizeof(hdr.magic));
+   hdr.version = OVERVIEW_CACHE_VERSION;
+   hdr.uidValidity = m_uidValidity;
+   hdr.countRecords = records.size();
+   hdr.sizeStrings = pool.GetPool().size();
+
+   wxTempFile file;
+   bool ok = file.Open(m_filename) &&
+               file.Write(&hdr, sizeof(hdr));
+   if ( ok && !records.empty() )
+   {
+      ok = file.Write(&records[0], records.size()*sizeof(FileRecord));
+   }
+
+   if ( ok )
+   {
+      ok = file.Write(&pool.GetPool()[0], pool.GetPool().size());
+   }
+
+   // notice that we must not release the old data before the new file is
+   // successfully committed as we'd lose all the existing entries otherwise
+   if ( ok )
+   {
+      ok = file.Commit();
+   }
+
+   if ( !ok )
+   {
+      wxLogDebug(_T("Failed to write the overview cache file \"%s\""),
+                 m_filename.c_str());
+
+      return false;
+   }
+
+   wxLogTrace(TRACE_OVERVIEW_CACHE,
+              _T("Saved %lu headers for '%s' in %ldms"),
+              (unsigned long)records.size(), m_folderName.c_str(), sw.Time());
+
+   // reload the file to be able to continue using it
+   return Load();
+}
+
+
+#ifdef TEST_OVERVIEW_CACHE
+
+// ----------------------------------------------------------------------------
+// overview cache benchmark
+// ----------------------------------------------------------------------------
+
+// define this to build a program comparing the time needed to get the headers
+// of the given number of messages (200000 by default) by parsing them, as is
+// done when there is no cache, with the time needed to load them from the
+// cache, as well as the time needed to reopen the folder when only a few new
+// messages must be parsed, and checking that the cache returns the same
+// headers (it must be linked with the rest of the program objects)
+//
+// notice that only the local parsing of the headers is measured, retrieving
+// them from a remote server takes much longer
+
+#include <wx/init.h>
+#include <wx/filename.h>
+
+#include "HeaderInfo.h"
+#include "Address.h"
+#include "AddressCC.h"
+#include "Mcclient.h"
+#include "mail/MimeDecode.h"
+
+#include <stdio.h>
+
+class OverviewCacheTest
+{
+public:
+   OverviewCacheTest(const String& filename);
+
+   // parse the headers of the given number of messages
+   bool TestParse(size_t count);
+
+   // store all the headers in the cache and save it
+   bool TestSave();
+
+   // load the cache and find all messages in it
+   bool TestLoad();
+
+   // add new messages to the folder and reopen it, parsing only them
+   bool TestDelta(size_t countNew);
+
+private:
+   // generate the header of the message with the given UID
+   static std::string GetRawHeader(UIdType uid);
+
+   // fill the header info from the header of the message with the given UID
+   // as MailFolderCC::OverviewHeaderEntry() does
+   static bool ParseHeader(UIdType uid, HeaderInfo& hi);
+
+   // check that the header info has the expected contents
+   static bool IsSame(const HeaderInfo& hi1, const HeaderInfo& hi2);
+
+   const String m_filename;
+
+   // the headers of all messages, the message with UID n is at n - 1
+   std::vector<HeaderInfo> m_headers;
+
+   DECLARE_NO_COPY_CLASS(OverviewCacheTest)
+};
+
+OverviewCacheTest::OverviewCacheTest(const String& filename)
+                 : m_filename(filename)
+{
+}
+
+/* static */
+std::string OverviewCacheTest::GetRawHeader(UIdType uid)
+{
+   // there are many replies in the same threads, from the same people, as
+   // in the real mailing lists, and some subjects are encoded
+   const unsigned long n = uid,
+                       thread = n / 10,
+                       sender = n % 997;
+
+   char buf[1024];
+   sprintf(buf,
+           "Date: Sat, 17 Oct 2026 %02lu:%02lu:%02lu +0200\r\n"
+           "From: Sender %lu <sender%lu@example.com>\r\n"
+           "To: list@example.org, Someone Else <else@example.net>\r\n"
+           "Subject: %s%s %lu\r\n"
+           "Message-Id: <%lu@example.com>\r\n"
+           "In-Reply-To: <%lu@example.com>\r\n"
+           "References: <%lu@example.com> <%lu@example.com>\r\n"
+           "\r\n",
+           (n / 3600) % 24, (n / 60) % 60, n % 60,
+           sender, sender,
+           n % 10 ? "Re: " : "",
+           thread % 5 ? "Thread number" : "=?iso-8859-1?Q?Caf=E9_number?=",
+           thread,
+           n,
+           n - 1,
+           thread * 10, n - 1);
+
+   return buf;
+}
+
+/* static */
+bool OverviewCacheTest::ParseHeader(UIdType uid, HeaderInfo& hi)
+{
+   const std::string header = GetRawHeader(uid);
+
+   ENVELOPE *env = NULL;
+   BODY *body = NULL;
+   if ( !CclientParseMessage(header.c_str(), &env, &body) || !env )
+      return false;
+
+   hi.m_UId = uid;
+   hi.m_Status = 0;
+
+   MESSAGECACHE selt;
+   mail_parse_date(&selt, env->date);
+   hi.m_Date = (time_t) mail_longdate(&selt);
+
+   AddressList *addrList = AddressListCC::Create(env->from);
+   const String from = addrList->GetAddresses();
+   addrList->DecRef();
+
+   addrList = AddressListCC::Create(env->to);
+   const String to = addrList->GetAddresses();
+   addrList->DecRef();
+
+   // use the first encoding found in the headers for the entire message
+   wxFontEncoding encodingMsg = wxFONTENCODING_SYSTEM,
+                  encoding = wxFONTENCODING_SYSTEM;
+
+   hi.m_To = MIME::DecodeHeader(to, &encoding);
+   if ( encodingMsg == wxFONTENCODING_SYSTEM )
+      encodingMsg = encoding;
+
+   hi.m_From = MIME::DecodeHeader(from, &encoding);
+   if ( encodingMsg == wxFONTENCODING_SYSTEM )
+      encodingMsg = encoding;
+
+   hi.m_Subject = MIME::DecodeHeader(wxString::From8BitData(env->subject),
+                                     &encoding);
+   if ( encodingMsg == wxFONTENCODING_SYSTEM )
+      encodingMsg = encoding;
+
+   hi.m_Size = header.length();
+   hi.m_Lines = 0;
+   hi.m_Id = env->message_id;
+   hi.m_References = env->references;
+   hi.m_InReplyTo = env->in_reply_to;
+   hi.m_Encoding = encodingMsg;
+
+   mail_free_envelope(&env);
+   mail_free_body(&body);
+
+   return true;
+}
+
+/* static */
+bool OverviewCacheTest::IsSame(const HeaderInfo& hi1, const HeaderInfo& hi2)
+{
+   return hi1.m_UId == hi2.m_UId &&
+          hi1.m_Subject == hi2.m_Subject &&
+          hi1.m_From == hi2.m_From &&
+          hi1.m_To == hi2.m_To &&
+          hi1.m_NewsGroups == hi2.m_NewsGroups &&
+          hi1.m_References == hi2.m_References &&
+          hi1.m_InReplyTo == hi2.m_InReplyTo &&
+          hi1.m_Id == hi2.m_Id &&
+          hi1.m_Date == hi2.m_Date &&
+          hi1.m_Size == hi2.m_Size &&
+          hi1.m_Lines == hi2.m_Lines &&
+          hi1.m_Encoding == hi2.m_Encoding;
+}
+
+bool OverviewCacheTest::TestParse(size_t count)
+{
+   printf("Parsing %lu headers: ", (unsigned long)count);
+   fflush(stdout);
+
+   m_headers.clear();
+   m_headers.resize(count);
+
+   wxStopWatch sw;
+
+   bool ok = true;
+   for ( size_t n = 0; ok && n < count; n++ )
+   {
+      ok = ParseHeader(n + 1, m_headers[n]);
+   }
+
+   printf("%s (%ldms)\n", ok ? "ok" : "ERROR", sw.Time());
+
+   return ok;
+}
+
+bool OverviewCacheTest::TestSave()
+{
+   printf("Saving %lu headers: ", (unsigned long)m_headers.size());
+   fflush(stdout);
+
+   wxStopWatch sw;
+
+   OverviewCache cache(_T("test"), 1, m_filename);
+   bool ok = cache.Load();
+
+   for ( size_t n = 0; ok && n < m_headers.size(); n++ )
+   {
+      cache.Store(m_headers[n]);
+   }
+
+   ok = ok && cache.Save() && cache.GetCount() == m_headers.size();
+
+   printf("%s (%ldms)\n", ok ? "ok" : "ERROR", sw.Time());
+
+   return ok;
+}
+
+bool OverviewCacheTest::TestLoad()
+{
+   printf("Loading %lu headers: ", (unsigned long)m_headers.size());
+   fflush(stdout);
+
+   wxStopWatch sw;
+
+   OverviewCache cache(_T("test"), 1, m_filename);
+   bool ok = cache.Load() && cache.GetCount() == m_headers.size();
+
+   const long timeLoad = sw.Time();
+
+   sw.Start();
+   for ( size_t n = 0; ok && n < m_headers.size(); n++ )
+   {
+      // Lookup() doesn't fill the UID and the status
+      HeaderInfo hi;
+      hi.m_UId = n + 1;
+      hi.m_Status = 0;
+
+      ok = cache.Lookup(n + 1, hi) && IsSame(hi, m_headers[n]);
+   }
+
+   const long timeLookup = sw.Time();
+
+   printf("%s\n\tload %ldms, look up all %ldms\n",
+          ok ? "ok" : "ERROR", timeLoad, timeLookup);
+
+   return ok;
+}
+
+bool OverviewCacheTest::TestDelta(size_t countNew)
+{
+   const size_t countOld = m_headers.size(),
+                count = countOld + countNew;
+
+   printf("Reopening with %lu new headers: ", (unsigned long)countNew);
+   fflush(stdout);
+
+   m_headers.resize(count);
+
+   wxStopWatch sw;
+
+   // this is what GetHeaderInfo() does when the cache is used
+   OverviewCache cache(_T("test"), 1, m_filename);
+   bool ok = cache.Load();
+
+   size_t countParsed = 0;
+   for ( size_t n = 0; ok && n < count; n++ )
+   {
+      HeaderInfo& hi = m_headers[n];
+      hi.m_UId = n + 1;
+      hi.m_Status = 0;
+
+      if ( cache.Lookup(n + 1, hi) )
+         continue;
+
+      ok = ParseHeader(n + 1, hi);
+      cache.Store(hi);
+      countParsed++;
+   }
+
+   ok = ok && countParsed == countNew && cache.Save();
+
+   printf("%s (%ldms)\n", ok ? "ok" : "ERROR", sw.Time());
+
+   // check that the new headers were saved too
+   return ok && TestLoad();
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   unsigned long count = 200000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &count) != 1 || count < 100) )
+   {
+      fprintf(stderr, "Usage: %s [number of messages]\n", argv[0]);
+      return 2;
+   }
+
+   // notice that the empty file is just an empty cache
+   const String filename = wxFileName::CreateTempFileName(_T("headers"));
+   if ( filename.empty() )
+   {
+      fprintf(stderr, "Failed to create the temporary file.\n");
+      return 2;
+   }
+
+   bool ok;
+
+   {
+      OverviewCacheTest test(filename);
+
+      ok = test.TestParse(count) &&
+            test.TestSave() &&
+             test.TestLoad() &&
+              test.TestDelta(count / 100);
+   }
+
+   wxRemoveFile(filename);
+
+   return ok ? 0 : 1;
+}
+
+#endif // TEST_OVERVIEW_CACHE
@@ -26,10 +26,13 @@
    #include "pointers.h"           // for RefCounter
    #include "strutil.h"            // for strutil_restore_array
    #include "Profile.h"            // for Profile_obj
+   #include "Mdefaults.h"
    #include <wx/frame.h>
 #endif // USE_PCH
 
 #include <wx/imaglist.h>
+#include <wx/stopwatch.h>
+#include <wx/thread.h>
 #include <wx/persist/bookctrl.h>
 
 #include "MAtExit.h"
@@ -41,6 +44,14 @@
 
 #include "SpamFilter.h"
 
+#include <deque>
+
+// ----------------------------------------------------------------------------
+// options we use here
+// ----------------------------------------------------------------------------
+
+extern const MOption MP_SPAM_PARALLEL_THRESHOLD;
+
 // ----------------------------------------------------------------------------
 // constants
 // ----------------------------------------------------------------------------
@@ -48,6 +59,14 @@
 // separator used between filters in is_spam() arguments
 static const wxChar FILTERS_SEPARATOR = _T(';');
 
+// ----------------------------------------------------------------------------
+// global variables
+// ----------------------------------------------------------------------------
+
+// protects SpamFilter::ms_batchLevel and m_inBatch of all filters as the
+// spam checks may be done by several threads at once
+static wxCriticalSection gs_csBatch;
+
 // ----------------------------------------------------------------------------
 // local functions
 // ----------------------------------------------------------------------------
@@ -248,6 +267,446 @@ static wxArrayString SplitParams(const String& paramsAll)
    return strutil_restore_array(paramsAllReal, FILTERS_SEPARATOR);
 }
 
+// ----------------------------------------------------------------------------
+// SpamFilterChain: the filters used for checking the messages
+// ----------------------------------------------------------------------------
+
+class SpamFilterChain
+{
+public:
+   // parse the parameters of CheckIfSpam() and find the filters to use for
+   // checking the messages using the given profile
+   SpamFilterChain(const Profile *profile, const String& paramsAll);
+
+   // get the profile this chain was created for
+   const Profile *GetProfile() const { return m_profile; }
+
+   // get the number of filters in the chain
+   size_t GetCount() const { return m_filters.size(); }
+
+   // get the index of the first filter from which all the remaining ones can
+   // check the raw message text, GetCount() if the last one can't do it
+   size_t GetRawStart() const { return m_rawStart; }
+
+   // check the message with the filters in [start, end) range, return the
+   // same values as SpamFilter::DoCheckIfSpam()
+   int Check(const Message& msg, size_t start, size_t end, String *result) const;
+
+   // check the raw message text with the filters starting from the given one
+   // which must be at least GetRawStart() without learning from it, may be
+   // called from any thread and appends the data for learning to learn
+   int CheckRaw(const char *text,
+                size_t start,
+                String *result,
+                SpamLearnData::Items& learn) const;
+
+private:
+   // return true if the value returned by the given filter means that the
+   // message is or is not a spam for sure and update the result then
+   static bool IsFinal(int rc, const SpamFilter *filter, String *result);
+
+   const Profile * const m_profile;
+
+   // the filters to use and their parameters
+   std::vector<SpamFilter *> m_filters;
+   wxArrayString m_params;
+
+   // the index of the first filter of the tail supporting CanCheckRaw()
+   size_t m_rawStart;
+
+   DECLARE_NO_COPY_CLASS(SpamFilterChain)
+};
+
+SpamFilterChain::SpamFilterChain(const Profile *profile,
+                                 const String& paramsAll)
+               : m_profile(profile)
+{
+   // break down the parameters (if we have any) into names and values
+   wxSortedArrayString names;
+   wxArrayString values;
+   if ( !paramsAll.empty() )
+   {
+      wxArrayString params(SplitParams(paramsAll));
+      const size_t count = params.GetCount();
+      for ( size_t n = 0; n < count; n++ )
+      {
+         const wxString& param = params[n];
+         int pos = param.Find(_T('='));
+
+         wxString name,
+                  val;
+         if ( pos != wxNOT_FOUND )
+         {
+            name = wxString(param, pos);
+            val = param.c_str() + pos + 1;
+         }
+         else // no value, use default options
+         {
+            name = param;
+         }
+
+
+         // insert the value in the same position in values array as name is
+         // going to have in the names one (as it's sorted we don't know where
+         // will it be)
+         values.Insert(val, names.Add(name));
+      }
+   }
+
+
+   // now find all filters to use in their usual order
+   for ( SpamFilter *p = SpamFilter::ms_first; p; p = p->m_next )
+   {
+      String param;
+      if ( !paramsAll.empty() )
+      {
+         int n = names.Index(p->GetName());
+         if ( n == wxNOT_FOUND )
+         {
+            // skip filters not appearing in paramsAll
+            continue;
+         }
+
+         param = values[(size_t)n];
+      }
+      else // use only configured filters
+      {
+         if ( !IsSpamFilterEnabled(profile, p->GetName()) )
+            continue;
+      }
+
+      m_filters.push_back(p);
+      m_params.Add(param);
+
+      // only prepare the filters which are really used for the batch
+      wxCriticalSectionLocker lock(gs_csBatch);
+      if ( SpamFilter::ms_batchLevel && !p->m_inBatch )
+      {
+         p->DoBeginBatch();
+         p->m_inBatch = true;
+      }
+   }
+
+   // the filters which can check the raw text can only be used in the worker
+   // threads if all the filters after them can do it too
+   m_rawStart = m_filters.size();
+   while ( m_rawStart > 0 && m_filters[m_rawStart - 1]->CanCheckRaw() )
+      m_rawStart--;
+}
+
+/* static */
+bool
+SpamFilterChain::IsFinal(int rc, const SpamFilter *filter, String *result)
+{
+   // DoCheckIfSpam() may return -1 in addition to true or false which is
+   // treated as "definitively false", i.e. not only this spam filter didn't
+   // recognize this message as spam but it shouldn't be even checked with
+   // the others (this is mainly used for whitelisting support)
+   switch ( rc )
+   {
+      case true:
+         if ( result )
+         {
+            *result = String::Format("recognized as spam by %s filter: %s",
+                                     filter->GetName(), result->c_str());
+         }
+         return true;
+
+      case -1:
+         if ( result )
+         {
+            *result = String::Format("recognized as non-spam by %s filter: %s",
+                                     filter->GetName(), result->c_str());
+         }
+         return true;
+
+      default:
+         FAIL_MSG( "unexpected DoCheckIfSpam() return value" );
+         // fall through
+
+      case false:
+         // continue with the other filters checks
+         break;
+   }
+
+   return false;
+}
+
+int
+SpamFilterChain::Check(const Message& msg,
+                       size_t start,
+                       size_t end,
+                       String *result) const
+{
+   for ( size_t n = start; n < end; n++ )
+   {
+      SpamFilter * const p = m_filters[n];
+      const int rc = p->DoCheckIfSpam(m_profile, msg, m_params[n], result);
+      if ( IsFinal(rc, p, result) )
+         return rc;
+   }
+
+   return false;
+}
+
+int
+SpamFilterChain::CheckRaw(const char *text,
+                          size_t start,
+                          String *result,
+                          SpamLearnData::Items& learn) const
+{
+   ASSERT_MSG( start >= m_rawStart, "filter can't check raw text" );
+
+   const size_t count = m_filters.size();
+   for ( size_t n = start; n < count; n++ )
+   {
+      SpamFilter * const p = m_filters[n];
+
+      SpamFilter::LearnData *data = NULL;
+      const int rc = p->DoCheckRawIfSpam(text, m_params[n], result, &data);
+      if ( data )
+      {
+         SpamLearnData::Item item;
+         item.filter = p;
+         item.data = data;
+         learn.push_back(item);
+      }
+
+      if ( IsFinal(rc, p, result) )
+         return rc;
+   }
+
+   return false;
+}
+
+// ----------------------------------------------------------------------------
+// SpamCheckPipeline: checks the raw messages texts in the worker threads
+// ----------------------------------------------------------------------------
+
+class SpamCheckPipeline
+{
+public:
+   // start the given number of worker threads (possibly 0) storing the
+   // results in the provided arrays which must be big enough for all
+   // messages which are going to be queued and the data for learning from
+   // them in learn, starting at the given index
+   SpamCheckPipeline(unsigned nThreads,
+                     std::vector<int>& verdicts,
+                     std::vector<String>& results,
+                     SpamLearnData& learn,
+                     size_t learnFirst);
+
+   // calls Finish()
+   ~SpamCheckPipeline() { Finish(); }
+
+   // check the message with the given index with the chain filters starting
+   // from the given one in a worker thread, takes ownership of the text
+   //
+   // this blocks if too many messages are already waiting to be checked
+   void Queue(size_t idx,
+              wxCharBuffer& text,
+              const SpamFilterChain *chain,
+              size_t start);
+
+   // wait until all queued messages are checked and stop the worker threads
+   void Finish();
+
+   // get the number of worker threads actually running
+   size_t GetThreadCount() const { return m_threads.size(); }
+
+private:
+   // the message waiting to be checked
+   struct Job
+   {
+      size_t idx;
+      char *text;
+      const SpamFilterChain *chain;
+      size_t start;
+   };
+
+   class Worker;
+
+   // get the next job to do, blocks until there is one and returns false if
+   // there are no more and the worker should terminate
+   bool GetJob(Job& job);
+
+   // check the message and free its text, called from the worker threads
+   void DoJob(const Job& job);
+
+
+   // the jobs waiting for the workers, protected by m_mutex
+   std::deque<Job> m_jobs;
+
+   // the maximal number of elements in m_jobs
+   size_t m_maxJobs;
+
+   // set by Finish() when there will be no more jobs
+   bool m_finished;
+
+   wxMutex m_mutex;
+
+   // signalled when a job is added to m_jobs or m_finished is set
+   wxCondition m_condJobs;
+
+   // signalled when a job is removed from m_jobs
+   wxCondition m_condSpace;
+
+   // the worker threads
+   std::vector<Worker *> m_threads;
+
+   // the output arrays, each element is only modified by the worker which
+   // checks the corresponding message
+   std::vector<int>& m_verdicts;
+   std::vector<String>& m_results;
+   SpamLearnData& m_learn;
+   const size_t m_learnFirst;
+
+   DECLARE_NO_COPY_CLASS(SpamCheckPipeline)
+};
+
+class SpamCheckPipeline::Worker : public wxThread
+{
+public:
+   Worker(SpamCheckPipeline& pipeline)
+      : wxThread(wxTHREAD_JOINABLE),
+        m_pipeline(pipeline)
+   {
+   }
+
+protected:
+   virtual void *Entry()
+   {
+      Job job;
+      while ( m_pipeline.GetJob(job) )
+         m_pipeline.DoJob(job);
+
+      return NULL;
+   }
+
+private:
+   SpamCheckPipeline& m_pipeline;
+
+   DECLARE_NO_COPY_CLASS(Worker)
+};
+
+SpamCheckPipeline::SpamCheckPipeline(unsigned nThreads,
+                                     std::vector<int>& verdicts,
+                                     std::vector<String>& results,
+                                     SpamLearnData& learn,
+                                     size_t learnFirst)
+                 : m_condJobs(m_mutex),
+                   m_condSpace(m_mutex),
+                   m_verdicts(verdicts),
+                   m_results(results),
+                   m_learn(learn),
+                   m_learnFirst(learnFirst)
+{
+   // don't retrieve too many messages in advance, the workers can't be very
+   // far behind the main thread anyhow
+   m_maxJobs = 4*nThreads;
+   m_finished = false;
+
+   m_threads.reserve(nThreads);
+   for ( unsigned n = 0; n < nThreads; n++ )
+   {
+      Worker *thread = new Worker(*this);
+      if ( thread->Run() != wxTHREAD_NO_ERROR )
+      {
+         delete thread;
+         break;
+      }
+
+      m_threads.push_back(thread);
+   }
+}
+
+void
+SpamCheckPipeline::Queue(size_t idx,
+                         wxCharBuffer& text,
+                         const SpamFilterChain *chain,
+                         size_t start)
+{
+   Job job;
+   job.idx = idx;
+   job.text = text.release();
+   job.chain = chain;
+   job.start = start;
+
+   // if we couldn't launch any threads, just do it ourselves
+   if ( m_threads.empty() )
+   {
+      DoJob(job);
+      return;
+   }
+
+   wxMutexLocker lock(m_mutex);
+
+   while ( m_jobs.size() >= m_maxJobs )
+      m_condSpace.Wait();
+
+   m_jobs.push_back(job);
+
+   m_condJobs.Signal();
+}
+
+bool SpamCheckPipeline::GetJob(Job& job)
+{
+   wxMutexLocker lock(m_mutex);
+
+   while ( m_jobs.empty() )
+   {
+      if ( m_finished )
+         return false;
+
+      m_condJobs.Wait();
+   }
+
+   job = m_jobs.front();
+   m_jobs.pop_front();
+
+   m_condSpace.Signal();
+
+   return true;
+}
+
+void SpamCheckPipeline::DoJob(const Job& job)
+{
+   wxStopWatch timer;
+
+   String result;
+   const int rc = job.chain->CheckRaw(job.text, job.start, &result,
+                                      m_learn.Get(m_learnFirst + job.idx));
+
+   free(job.text);
+
+   wxLogTrace(TRACE_SPAM, "Message %lu classified as %s in %ldms",
+              (unsigned long)job.idx + 1,
+              rc == true ? "spam" : "ham", timer.Time());
+
+   m_verdicts[job.idx] = rc;
+   m_results[job.idx] = result;
+}
+
+void SpamCheckPipeline::Finish()
+{
+   {
+      wxMutexLocker lock(m_mutex);
+
+      m_finished = true;
+
+      m_condJobs.Broadcast();
+   }
+
+   for ( size_t n = 0; n < m_threads.size(); n++ )
+   {
+      m_threads[n]->Wait();
+
+      delete m_threads[n];
+   }
+
+   m_threads.clear();
+}
+
 // ----------------------------------------------------------------------------
 // local globals
 // ----------------------------------------------------------------------------
@@ -261,6 +720,7 @@ static MRunFunctionAtExit gs_runFilterCleanup(SpamFilter::UnloadAll);
 
 SpamFilter *SpamFilter::ms_first = NULL;
 bool SpamFilter::ms_loaded = false;
+size_t SpamFilter::ms_batchLevel = 0;
 
 // ----------------------------------------------------------------------------
 // helpers
@@ -356,95 +816,201 @@ SpamFilter::CheckIfSpam(const Message& msg,
 
    LoadAll();
 
-   // break down the parameters (if we have any) into names and values
-   wxSortedArrayString names;
-   wxArrayString values;
-   if ( !paramsAll.empty() )
-   {
-      wxArrayString params(SplitParams(paramsAll));
-      const size_t count = params.GetCount();
-      for ( size_t n = 0; n < count; n++ )
-      {
-         const wxString& param = params[n];
-         int pos = param.Find(_T('='));
+   // try all filters in turn until one of them gives a definitive answer
+   const SpamFilterChain chain(profile, paramsAll);
 
-         wxString name,
-                  val;
-         if ( pos != wxNOT_FOUND )
-         {
-            name = wxString(param, pos);
-            val = param.c_str() + pos + 1;
-         }
-         else // no value, use default options
-         {
-            name = param;
-         }
+   return chain.Check(msg, 0, chain.GetCount(), result) == true;
+}
+
+/* static */
+size_t
+SpamFilter::CheckIfSpam(const std::vector<const Message *>& msgs,
+                        const String& param,
+                        std::vector<bool>& isSpam,
+                        wxArrayString *results,
+                        SpamLearnData *learn)
+{
+   const size_t count = msgs.size();
 
+   isSpam.clear();
+   if ( results )
+      results->clear();
 
-         // insert the value in the same position in values array as name is
-         // going to have in the names one (as it's sorted we don't know where
-         // will it be)
-         values.Insert(val, names.Add(name));
+   if ( !count )
+      return 0;
+
+   LoadAll();
+
+   SpamFilterBatch batch;
+
+   // use the worker threads only if we have enough messages to make it
+   // worthwhile
+   //
+   // the raw checks don't modify the filters data, so they can be done by
+   // several workers at once and in any order, use one of them per CPU
+   unsigned nThreads = 0;
+   Profile * const profileFirst = GetProfile(*msgs[0]);
+   if ( profileFirst )
+   {
+      const long
+         threshold = READ_CONFIG(profileFirst, MP_SPAM_PARALLEL_THRESHOLD);
+      const int countCPUs = wxThread::GetCPUCount();
+      if ( threshold > 0 && count >= (size_t)threshold && countCPUs > 1 )
+      {
+         nThreads = countCPUs;
       }
    }
 
+   std::vector<int> verdicts(count, false);
+   std::vector<String> explanations(count);
 
-   // now try all filters in turn until one of them returns true
-   for ( SpamFilter *p = ms_first; p; p = p->m_next )
+   // if we must learn from all messages ourselves, still do it only after
+   // checking all of them
+   SpamLearnData learnAll;
+   if ( !learn )
+      learn = &learnAll;
+
+   const size_t learnFirst = learn->Add(count);
+
+   wxStopWatch timerAll;
+
+   // the chains used for the messages: normally there is only one of them as
+   // all messages use the same profile but we can't be sure about it
+   std::vector<SpamFilterChain *> chains;
+
+   size_t countThreads;
    {
-      const String name(p->GetName());
+      SpamCheckPipeline
+         pipeline(nThreads, verdicts, explanations, *learn, learnFirst);
+      countThreads = pipeline.GetThreadCount();
 
-      String param;
-      if ( !paramsAll.empty() )
+      wxStopWatch timer;
+      for ( size_t n = 0; n < count; n++ )
       {
-         int n = names.Index(name);
-         if ( n == wxNOT_FOUND )
-         {
-            // skip filters not appearing in paramsAll
+         const Message& msg = *msgs[n];
+         Profile * const profile = GetProfile(msg);
+         if ( !profile )
             continue;
-         }
 
-         param = values[(size_t)n];
-      }
-      else // use only configured filters
-      {
-         if ( !IsSpamFilterEnabled(profile, p->GetName()) )
-            continue;
-      }
+         timer.Start();
 
-      // DoCheckIfSpam() may return -1 in addition to true or false which is
-      // treated as "definitively false", i.e. not only this spam filter didn't
-      // recognize this message as spam but it shouldn't be even checked with
-      // the others (this is mainly used for whitelisting support)
-      switch ( p->DoCheckIfSpam(profile, msg, param, result) )
-      {
-         case true:
-            if ( result )
+         const SpamFilterChain *chain = NULL;
+         for ( size_t i = 0; i < chains.size(); i++ )
+         {
+            if ( chains[i]->GetProfile() == profile )
             {
-               *result = String::Format("recognized as spam by %s filter: %s",
-                                        name.c_str(), result->c_str());
+               chain = chains[i];
+               break;
             }
-            return true;
+         }
+
+         if ( !chain )
+         {
+            SpamFilterChain * const chainNew = new SpamFilterChain(profile, param);
+            chains.push_back(chainNew);
+            chain = chainNew;
+         }
 
-         case -1:
-            if ( result )
+         // check the message with the filters which must be used from this
+         // thread first and leave the others to the workers (or check the
+         // raw text here too if there are no workers)
+         const size_t countFilters = chain->GetCount(),
+                      start = chain->GetRawStart();
+
+         String result;
+         int rc = chain->Check(msg, 0, start, &result);
+         if ( rc == false && start < countFilters )
+         {
+            wxCharBuffer text;
+            if ( msg.WriteToBuffer(text) )
             {
-               *result = String::Format("recognized as non-spam by %s filter: %s",
-                                        name.c_str(), result->c_str());
+               pipeline.Queue(n, text, chain, start);
+               continue;
             }
-            return false;
 
-         default:
-            FAIL_MSG( "unexpected DoCheckIfSpam() return value" );
-            // fall through
+            // still try to check it in the usual way if the filters may learn
+            // from it immediately
+            if ( learn == &learnAll )
+               rc = chain->Check(msg, start, countFilters, &result);
+         }
 
-         case false:
-            // continue with the other filters checks
-            break;
+         verdicts[n] = rc;
+         explanations[n] = result;
+
+         wxLogTrace(TRACE_SPAM, "Message %lu/%lu classified as %s in %ldms",
+                    (unsigned long)n + 1, (unsigned long)count,
+                    rc == true ? "spam" : "ham", timer.Time());
       }
+
+      pipeline.Finish();
    }
 
-   return false;
+   if ( learn == &learnAll )
+   {
+      wxStopWatch timerLearn;
+
+      for ( size_t n = 0; n < count; n++ )
+         learnAll.Learn(learnFirst + n);
+
+      wxLogTrace(TRACE_SPAM, "Learnt from %lu messages in %ldms",
+                 (unsigned long)count, timerLearn.Time());
+   }
+
+   for ( size_t n = 0; n < chains.size(); n++ )
+      delete chains[n];
+
+   size_t countSpam = 0;
+   isSpam.reserve(count);
+   if ( results )
+      results->reserve(count);
+   for ( size_t n = 0; n < count; n++ )
+   {
+      const bool spam = verdicts[n] == true;
+      isSpam.push_back(spam);
+      if ( results )
+         results->push_back(spam ? explanations[n] : String());
+
+      if ( spam )
+         countSpam++;
+   }
+
+   const long elapsed = timerAll.Time();
+   wxLogTrace(TRACE_SPAM,
+              "Classified %lu messages (%lu spam) using %lu threads in %ldms "
+              "(%.1f messages/s)",
+              (unsigned long)count, (unsigned long)countSpam,
+              (unsigned long)countThreads, elapsed,
+              elapsed ? (1000.*count)/elapsed : 0.);
+
+   return countSpam;
+}
+
+/* static */
+void SpamFilter::BeginBatch()
+{
+   wxCriticalSectionLocker lock(gs_csBatch);
+
+   ms_batchLevel++;
+}
+
+/* static */
+void SpamFilter::EndBatch()
+{
+   wxCriticalSectionLocker lock(gs_csBatch);
+
+   CHECK_RET( ms_batchLevel, "EndBatch() without matching BeginBatch()" );
+
+   if ( --ms_batchLevel )
+      return;
+
+   for ( SpamFilter *p = ms_first; p; p = p->m_next )
+   {
+      if ( p->m_inBatch )
+      {
+         p->DoEndBatch();
+         p->m_inBatch = false;
+      }
+   }
 }
 
 // ----------------------------------------------------------------------------
@@ -680,7 +1246,68 @@ SpamFilter::CreateOptionPage(MBookCtrl * /* notebook */,
    return NULL;
 }
 
+int
+SpamFilter::DoCheckRawIfSpam(const char * /* text */,
+                             const String& /* param */,
+                             String * /* result */,
+                             LearnData ** /* learn */)
+{
+   FAIL_MSG( "DoCheckRawIfSpam() must be overridden if CanCheckRaw() is" );
+
+   return false;
+}
+
+void SpamFilter::DoLearnRaw(const LearnData& /* learn */)
+{
+   FAIL_MSG( "DoLearnRaw() must be overridden if DoCheckRawIfSpam() "
+             "returns the data for learning" );
+}
+
 SpamFilter::~SpamFilter()
 {
 }
 
+
+// ============================================================================
+// SpamLearnData implementation
+// ============================================================================
+
+SpamLearnData::~SpamLearnData()
+{
+   const size_t count = m_messages.size();
+   for ( size_t n = 0; n < count; n++ )
+      Free(n);
+}
+
+size_t SpamLearnData::Add(size_t n)
+{
+   const size_t first = m_messages.size();
+   m_messages.resize(first + n);
+
+   return first;
+}
+
+void SpamLearnData::Free(size_t n)
+{
+   Items& items = m_messages[n];
+
+   const size_t count = items.size();
+   for ( size_t i = 0; i < count; i++ )
+      delete items[i].data;
+
+   items.clear();
+}
+
+void SpamLearnData::Learn(size_t n)
+{
+   CHECK_RET( n < m_messages.size(), "invalid message index" );
+
+   const Items& items = m_messages[n];
+
+   const size_t count = items.size();
+   for ( size_t i = 0; i < count; i++ )
+      items[i].filter->DoLearnRaw(*items[i].data);
+
+   // we must not learn from the same message twice
+   Free(n);
+}
@@ -0,0 +1,398 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   mail/ThreadCache.cpp: ThreadCache class implementation
+// Purpose:     persistent on disk storage of the folder threads
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+// ============================================================================
+// declarations
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// headers
+// ----------------------------------------------------------------------------
+
+#include  "Mpch.h"
+
+#ifndef  USE_PCH
+#  include "Mcommon.h"
+
+#  include "Threading.h"
+
+#  include "Mcclient.h"         // for THREADNODE
+#endif // USE_PCH
+
+#include <wx/file.h>
+#include <wx/stopwatch.h>
+
+#include "CacheFile.h"
+#include "HeaderInfo.h"
+
+#include "mail/ThreadCache.h"
+
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the signature at the start of the file
+static const char THREAD_CACHE_MAGIC[8] = { 'M', 'T', 'H', 'R', 'E', 'A', 'D', 'S' };
+
+// the current version of the file format
+static const wxUint32 THREAD_CACHE_VERSION = 1;
+
+// ----------------------------------------------------------------------------
+// file format
+// ----------------------------------------------------------------------------
+
+// the file starts with this header followed by countUIds UIDs of the messages
+// in msgno order and then by countNodes Node structs describing the tree in
+// pre-order
+struct ThreadCache::FileHeader
+{
+   char magic[8];
+   wxUint32 version;
+   wxUint32 uidValidity;
+   wxUint32 hashParams;
+   wxUint32 countUIds;
+   wxUint32 countNodes;
+};
+
+// ----------------------------------------------------------------------------
+// private functions
+// ----------------------------------------------------------------------------
+
+// return the hash of all parameters affecting the threads built by
+// JWZThreadMessages()
+static wxUint32 HashThreadParams(const ThreadParams& thrParams)
+{
+   String s;
+   s << thrParams.simplifyingRegex << _T('\n')
+     << thrParams.replacementString << _T('\n')
+     << (thrParams.gatherSubjects ? _T('1') : _T('0'))
+     << (thrParams.breakThread ? _T('1') : _T('0'));
+
+   return static_cast<wxUint32>(wxStringHash()(s));
+}
+
+// ============================================================================
+// ThreadCache implementation
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// ctor and helpers
+// ----------------------------------------------------------------------------
+
+ThreadCache::ThreadCache(const String& folderName, UIdType uidValidity)
+           : m_folderName(folderName),
+             m_filename(GetCacheFileName(folderName)),
+             m_uidValidity(uidValidity)
+{
+   m_hashParams = 0;
+   m_modified = false;
+}
+
+void ThreadCache::Clear()
+{
+   m_hashParams = 0;
+   m_uids.clear();
+   m_nodes.clear();
+}
+
+/* static */
+String ThreadCache::GetCacheFileName(const String& folderName)
+{
+   return CacheFile::GetFolderCacheFileName(_T("threads"), folderName);
+}
+
+/* static */
+void ThreadCache::Remove(const String& folderName)
+{
+   const String filename = GetCacheFileName(folderName);
+   if ( wxFileExists(filename) )
+   {
+      if ( !wxRemoveFile(filename) )
+      {
+         wxLogDebug(_T("Failed to remove the thread cache file \"%s\""),
+                    filename.c_str());
+      }
+   }
+}
+
+// ----------------------------------------------------------------------------
+// loading and saving
+// ----------------------------------------------------------------------------
+
+bool ThreadCache::Load()
+{
+   Clear();
+   m_modified = false;
+
+   if ( !wxFileExists(m_filename) )
+   {
+      // no cache yet, not an error
+      return true;
+   }
+
+   wxStopWatch sw;
+
+   CacheFileData data;
+   if ( !data.Load(m_filename) )
+      return false;
+
+   FileHeader hdr;
+   bool ok = data.GetSize() >= sizeof(hdr);
+   if ( ok )
+   {
+      memcpy(&hdr, data.GetData(), sizeof(hdr));
+
+      ok = memcmp(hdr.magic, THREAD_CACHE_MAGIC, sizeof(hdr.magic)) == 0 &&
+               hdr.version == THREAD_CACHE_VERSION;
+   }
+
+   if ( ok && hdr.uidValidity != m_uidValidity )
+   {
+      wxLogTrace(TRACE_THREAD_CACHE,
+                 _T("UIDVALIDITY of '%s' changed, discarding its threads"),
+                 m_folderName.c_str());
+
+      data.Free();
+
+      // it's useless now
+      Remove(m_folderName);
+
+      return true;
+   }
+
+   if ( ok )
+   {
+      ok = data.GetSize() == sizeof(hdr) +
+                             hdr.countUIds*sizeof(wxUint32) +
+                             hdr.countNodes*sizeof(Node);
+   }
+
+   if ( ok )
+   {
+      const char *p = data.GetData() + sizeof(hdr);
+
+      m_uids.resize(hdr.countUIds);
+      if ( hdr.countUIds )
+      {
+         const size_t size = hdr.countUIds*sizeof(wxUint32);
+         memcpy(&m_uids[0], p, size);
+         p += size;
+      }
+
+      m_nodes.resize(hdr.countNodes);
+      if ( hdr.countNodes )
+         memcpy(&m_nodes[0], p, hdr.countNodes*sizeof(Node));
+   }
+
+   if ( !ok )
+   {
+      wxLogTrace(TRACE_THREAD_CACHE,
+                 _T("Discarding invalid thread cache file \"%s\""),
+                 m_filename.c_str());
+
+      Clear();
+
+      return true;
+   }
+
+   m_hashParams = hdr.hashParams;
+
+   wxLogTrace(TRACE_THREAD_CACHE,
+              _T("Loaded threads of %lu messages for '%s' in %ldms"),
+              (unsigned long)m_uids.size(), m_folderName.c_str(), sw.Time());
+
+   return true;
+}
+
+bool ThreadCache::Save()
+{
+   if ( !m_modified )
+   {
+      // nothing changed
+      return true;
+   }
+
+   if ( !CacheFile::CreateDirFor(m_filename) )
+      return false;
+
+   FileHeader hdr;
+   memcpy(hdr.magic, THREAD_CACHE_MAGIC, sizeof(hdr.magic));
+   hdr.version = THREAD_CACHE_VERSION;
+   hdr.uidValidity = m_uidValidity;
+   hdr.hashParams = m_hashParams;
+   hdr.countUIds = m_uids.size();
+   hdr.countNodes = m_nodes.size();
+
+   wxTempFile file;
+   bool ok = file.Open(m_filename) &&
+               file.Write(&hdr, sizeof(hdr));
+   if ( ok && !m_uids.empty() )
+   {
+      ok = file.Write(&m_uids[0], m_uids.size()*sizeof(wxUint32));
+   }
+
+   if ( ok && !m_nodes.empty() )
+   {
+      ok = file.Write(&m_nodes[0], m_nodes.size()*sizeof(Node));
+   }
+
+   if ( !ok || !file.Commit() )
+   {
+      wxLogDebug(_T("Failed to write the thread cache file \"%s\""),
+                 m_filename.c_str());
+
+      return false;
+   }
+
+   m_modified = false;
+
+   wxLogTrace(TRACE_THREAD_CACHE,
+              _T("Saved threads of %lu messages for '%s'"),
+              (unsigned long)m_uids.size(), m_folderName.c_str());
+
+   return true;
+}
+
+// ----------------------------------------------------------------------------
+// using the cached tree
+// ----------------------------------------------------------------------------
+
+MsgnoType ThreadCache::Restore(const ThreadParams& thrParams,
+                               const HeaderInfoList *hil,
+                               ThreadData *thrData) const
+{
+   CHECK( hil && thrData, 0, _T("NULL pointer in ThreadCache::Restore") );
+   CHECK( !thrData->m_root, 0, _T("will leak THREADNODE tree!") );
+
+   if ( m_nodes.empty() || m_hashParams != HashThreadParams(thrParams) )
+      return 0;
+
+   // the messages in the cached tree must still be the first ones in the
+   // folder, in the same order
+   const MsgnoType count = m_uids.size();
+   if ( count > hil->Count() )
+      return 0;
+
+   for ( MsgnoType n = 0; n < count; n++ )
+   {
+      const HeaderInfo * const hi = hil->GetItemByIndex(n);
+      if ( !hi || hi->GetUId() != m_uids[n] )
+      {
+         wxLogTrace(TRACE_THREAD_CACHE,
+                    _T("Messages of '%s' changed, cached threads unusable"),
+                    m_folderName.c_str());
+
+         return 0;
+      }
+   }
+
+   // rebuild the tree: the last nodes seen at each level of the current
+   // branch are kept in this array, so the previous sibling of a node at the
+   // given depth is the node at the same index (if any) and its parent is
+   // the node just before it
+   std::vector<THREADNODE *> last;
+   THREADNODE *root = NULL;
+   for ( size_t n = 0; n < m_nodes.size(); n++ )
+   {
+      const Node& node = m_nodes[n];
+      if ( node.depth > last.size() || node.num > count )
+      {
+         wxLogTrace(TRACE_THREAD_CACHE,
+                    _T("Corrupted thread cache for '%s'"),
+                    m_folderName.c_str());
+
+         if ( root )
+            mail_free_threadnode(&root);
+
+         return 0;
+      }
+
+      THREADNODE *thr = mail_newthreadnode(NULL);
+      thr->num = node.num;
+
+      if ( node.depth < last.size() )
+      {
+         last[node.depth]->branch = thr;
+         last.resize(node.depth);
+      }
+      else if ( node.depth )
+      {
+         last[node.depth - 1]->next = thr;
+      }
+      else // the very first node
+      {
+         root = thr;
+      }
+
+      last.push_back(thr);
+   }
+
+   thrData->m_root = root;
+
+   wxLogTrace(TRACE_THREAD_CACHE,
+              _T("Restored threads of %lu messages of '%s'"),
+              (unsigned long)count, m_folderName.c_str());
+
+   return count;
+}
+
+void ThreadCache::Store(const ThreadParams& thrParams,
+                        const HeaderInfoList *hil,
+                        const ThreadData *thrData)
+{
+   CHECK_RET( hil && thrData, _T("NULL pointer in ThreadCache::Store") );
+
+   Clear();
+   m_modified = true;
+
+   if ( !thrData->m_root )
+      return;
+
+   const MsgnoType count = hil->Count();
+   m_uids.reserve(count);
+   for ( MsgnoType n = 0; n < count; n++ )
+   {
+      const HeaderInfo * const hi = hil->GetItemByIndex(n);
+      if ( !hi )
+      {
+         // we can't store the tree without knowing all UIDs
+         Clear();
+         return;
+      }
+
+      m_uids.push_back(hi->GetUId());
+   }
+
+   // walk the tree in pre-order without recursing as it may be very deep
+   m_nodes.reserve(count);
+   std::vector< std::pair<THREADNODE *, wxUint32> > stack;
+   stack.push_back(std::make_pair(thrData->m_root, (wxUint32)0));
+   while ( !stack.empty() )
+   {
+      THREADNODE * const thr = stack.back().first;
+      const wxUint32 depth = stack.back().second;
+      stack.pop_back();
+
+      Node node;
+      node.num = thr->num;
+      node.depth = depth;
+      m_nodes.push_back(node);
+
+      // the children must come before the next siblings, so push them last
+      if ( thr->branch )
+         stack.push_back(std::make_pair(thr->branch, depth));
+      if ( thr->next )
+         stack.push_back(std::make_pair(thr->next, depth + 1));
+   }
+
+   m_hashParams = HashThreadParams(thrParams);
+}
@@ -40,6 +40,13 @@
 #include "strlist.h"
 #include "HeaderInfo.h"
 
+#include <wx/hashmap.h>
+#include <wx/stopwatch.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
 #if wxUSE_REGEX
   #if defined(JWZ_USE_REGEX)
     #include <wx/regex.h>       // for wxRegEx
@@ -327,6 +334,9 @@ int main(int argc, char **argv)
     case, some HeaderInfo. The result of the JWZ algorithm will be to
     compute the index that the message will have in the display, and
     its indentation.
+
+    The Threadable objects are stored by value in contiguous arrays and
+    are owned by these arrays, not by the tree built from them.
     */
 class Threadable {
 private:
@@ -350,25 +360,22 @@ private:
    String      m_subject;
    String      m_refs;
 #endif
-   String     *m_id;
-   String     *m_simplifiedSubject;
+   String      m_id;
+   String      m_simplifiedSubject;
+   bool        m_hasSimplifiedSubject;
    bool        m_isReply;
 public:
    Threadable(HeaderInfo *hi, size_t index = 0, bool dummy = false);
-   ~Threadable();
-
-   void destroy();
 
-   Threadable *makeDummy() {
-      return new Threadable(m_hi, m_indexInHilp, true);
-   }
    int isDummy() const { return m_dummy; }
-   size_t getIndex() { return m_indexInHilp; }
-   size_t getThreadedIndex() { return m_threadedIndex; }
-   size_t getIndent() { return m_indent; }
+   size_t getIndex() const { return m_indexInHilp; }
+   size_t getThreadedIndex() const { return m_threadedIndex; }
+   size_t getIndent() const { return m_indent; }
    void setThreadedIndex(size_t i) { m_threadedIndex = i; }
    void setIndent(size_t i) { m_indent = i; }
 
+   HeaderInfo *getHeaderInfo() const { return m_hi; }
+
    Threadable *getNext() const { return m_next; }
    Threadable *getChild() const { return m_child; }
    void setNext(Threadable* x) { m_next = x; }
@@ -377,6 +384,14 @@ public:
    String messageThreadID() const;
    StringList messageThreadReferences() const;
 
+   /// Set the result of getSimplifiedSubject() computed elsewhere
+   void setSimplifiedSubject(const String& subject, bool isReply)
+   {
+      m_simplifiedSubject = subject;
+      m_isReply = isReply;
+      m_hasSimplifiedSubject = true;
+   }
+
 #if defined(JWZ_USE_REGEX)
    String getSimplifiedSubject(wxRegEx *replyRemover,
                                const String &replacementString) const;
@@ -397,8 +412,7 @@ Threadable::Threadable(HeaderInfo *hi, size_t index, bool dummy)
    , m_dummy(dummy)
    , m_next(0)
    , m_child(0)
-   , m_id(0)
-   , m_simplifiedSubject(0)
+   , m_hasSimplifiedSubject(false)
    , m_isReply(false)
 {
 #if defined(DEBUG)
@@ -407,38 +421,12 @@ Threadable::Threadable(HeaderInfo *hi, size_t index, bool dummy)
 #endif
 }
 
-inline
-Threadable::~Threadable()
-{
-   delete m_simplifiedSubject;
-   delete m_id;
-}
-
-
-void Threadable::destroy() {
-   static int depth = 0;
-   CHECK_RET(depth < MAX_THREAD_DEPTH, _T("Deep recursion in Threadable::destroy()"));
-   if (m_child != 0)
-   {
-      depth++;
-      m_child->destroy();
-      depth--;
-      CHECK_RET(depth >= 0, _T("Negative recursion depth in Threadable::destroy()"));
-   }
-   delete m_child;
-   m_child = 0;
-   if (m_next != 0)
-      m_next->destroy();
-   delete m_next;
-   m_next = 0;
-}
 
 String Threadable::messageThreadID() const
 {
    Threadable *that = (Threadable *)this;    // Remove constness
-   if (that->m_id != 0)
-      return *that->m_id;
-   that->m_id = new String;
+   if (!that->m_id.empty())
+      return that->m_id;
 
    // Scan the provided id to remove the garbage
    const wxChar *s = m_hi->GetId().c_str();
@@ -472,7 +460,7 @@ String Threadable::messageThreadID() const
          if (current == '>')
          {
             // We found a reference
-            *that->m_id = m_hi->GetId().Mid(start, i+1-start);
+            that->m_id = m_hi->GetId().Mid(start, i+1-start);
             i = nbChar; // exit the while loop
          }
          break;
@@ -480,11 +468,11 @@ String Threadable::messageThreadID() const
       i++;
    }
 
-   if (that->m_id->empty()) {
-      *that->m_id = String::Format(_T("<emptyId:%p>"), this);
+   if (that->m_id.empty()) {
+      that->m_id = String::Format(_T("<emptyId:%p>"), this);
    }
 
-   return *that->m_id;
+   return that->m_id;
 }
 
 
@@ -622,32 +610,32 @@ String Threadable::getSimplifiedSubject(bool removeListPrefix) const
    // be computed again
    //
    Threadable *that = (Threadable *)this;    // Remove constness
-   if (that->m_simplifiedSubject != 0)
-      return *that->m_simplifiedSubject;
-   that->m_simplifiedSubject = new String;
+   if (that->m_hasSimplifiedSubject)
+      return that->m_simplifiedSubject;
+   that->m_hasSimplifiedSubject = true;
 #if defined(JWZ_USE_REGEX)
-   *(that->m_simplifiedSubject) = m_hi->GetSubject();
+   that->m_simplifiedSubject = m_hi->GetSubject();
    if (!replyRemover)
    {
       that->m_isReply = false;
-      return *that->m_simplifiedSubject;
+      return that->m_simplifiedSubject;
    }
-   size_t len = that->m_simplifiedSubject->Len();
-   if (replyRemover->Replace(that->m_simplifiedSubject, replacementString, 1))
+   size_t len = that->m_simplifiedSubject.Len();
+   if (replyRemover->Replace(&that->m_simplifiedSubject, replacementString, 1))
       // XNOFIXME: we should have a much more complicated test, because
       // this one gives false positives whenever a space or a list prefix
       // is removed (e.g. the replaceement string is empty)
-      that->m_isReply = (that->m_simplifiedSubject->Len() != len);
+      that->m_isReply = (that->m_simplifiedSubject.Len() != len);
    else
       that->m_isReply = 0;
 #else
-   *that->m_simplifiedSubject =
+   that->m_simplifiedSubject =
       strutil_removeAllReplyPrefixes(m_hi->GetSubject(),
                                      that->m_isReply);
    if (removeListPrefix)
-      *that->m_simplifiedSubject = RemoveListPrefix(*that->m_simplifiedSubject);
+      that->m_simplifiedSubject = RemoveListPrefix(that->m_simplifiedSubject);
 #endif
-   return *that->m_simplifiedSubject;
+   return that->m_simplifiedSubject;
 }
 
 
@@ -658,15 +646,14 @@ bool Threadable::subjectIsReply(wxRegEx *replyRemover,
 bool Threadable::subjectIsReply(bool removeListPrefix) const
 #endif
 {
-   Threadable *that = (Threadable *)this;    // Remove constness
-   if (that->m_simplifiedSubject == 0) {
+   if (!m_hasSimplifiedSubject) {
 #if defined(JWZ_USE_REGEX)
       getSimplifiedSubject(replyRemover, replacementString);
 #else
       getSimplifiedSubject(removeListPrefix);
 #endif
    }
-   return that->m_isReply;
+   return m_isReply;
 }
 
 
@@ -675,13 +662,6 @@ bool Threadable::subjectIsReply(bool removeListPrefix) const
 // ThreadContainer
 // --------------------------------------------------------------------
 
-#if defined(DEBUG)
-// Count of the number of instances alive
-// Should be 0 at the end of the threading
-static int NumberOfThreadContainers = 0;
-#endif
-
-
 //
 // XNOFIXME: the ThreadContainer objects have the same structure than
 // the Threadable objects. They should be merged.
@@ -696,7 +676,6 @@ private:
 
 public:
    ThreadContainer(Threadable *th = 0);
-   ~ThreadContainer();
 
    Threadable *getThreadable() const { return m_threadable; }
    ThreadContainer *getParent() const { return m_parent; }
@@ -724,21 +703,15 @@ public:
    void addAsChild(ThreadContainer *c);
 
    /** Returns true if target is a children (maybe deep in the
-       tree) of the caller. If withNext == true, also scans the
-       nexts of the caller (which is usefull during the recursive
-       search, but not to be used externally)
+       tree) of the caller.
        */
-   bool findChild(ThreadContainer *target, bool withNexts = false) const;
+   bool findChild(const ThreadContainer *target) const;
 
    /** Computes and saves (in the Threadable they store) the indentation
-       and the numbering of the messages
+       and the numbering of the messages of the tree starting at the
+       calling object and all its nexts.
        */
    void flush(size_t &threadedIndex, size_t indent, bool indentIfDummyNode);
-
-   /** Recursively destroys the tree of ThreadContainer starting at the
-       the calling object.
-       */
-   void destroy();
 };
 
 
@@ -749,18 +722,6 @@ ThreadContainer::ThreadContainer(Threadable *th)
    , m_child(0)
    , m_next(0)
 {
-#if defined(DEBUG)
-   NumberOfThreadContainers++;
-#endif
-}
-
-
-inline
-ThreadContainer::~ThreadContainer()
-{
-#if defined(DEBUG)
-   NumberOfThreadContainers--;
-#endif
 }
 
 
@@ -772,27 +733,13 @@ size_t ThreadContainer::getIndex() const
 #if defined(JWZ_NO_SORT)
    return 0;
 #else
-   const size_t foolish = 1000000000;
-   static int depth = 0;
-   CHECK(depth < MAX_THREAD_DEPTH, foolish,
-      _T("Deep recursion in ThreadContainer::getIndex()"));
-   Threadable *th = getThreadable();
-   if (th != 0)
-      return th->getIndex();
-   else
-   {
-      if (getChild() != 0)
-      {
-         depth++;
-         size_t index = getChild()->getIndex();
-         depth--;
-         CHECK(depth >= 0, foolish,
-            _T("Negative recursion depth in ThreadContainer::getIndex()"));
-         return index;
-      }
-      else
-         return foolish;
-   }
+   // The containers without message take the index of their first child
+   // having one
+   const ThreadContainer *c = this;
+   while (c != 0 && c->getThreadable() == 0)
+      c = c->getChild();
+
+   return c != 0 ? c->getThreadable()->getIndex() : 1000000000;
 #endif
 }
 
@@ -837,83 +784,171 @@ void ThreadContainer::addAsChild(ThreadContainer *c)
 }
 
 
-bool ThreadContainer::findChild(ThreadContainer *target, bool withNexts) const
+bool ThreadContainer::findChild(const ThreadContainer *target) const
 {
-   static int depth = 0;
-   CHECK(depth < MAX_THREAD_DEPTH, true, _T("Deep recursion in ThreadContainer::findChild()"));
-   if (m_child == target)
-      return true;
-   if (withNexts && m_next == target)
-      return true;
-   if (m_child != 0)
-   {
-      depth++;
-      bool found = m_child->findChild(target, true);
-      depth--;
-      CHECK(depth >= 0, true, _T("Negative recursion depth in ThreadContainer::findChild()"));
-      if (found)
-         return true;
-   }
-   if (withNexts && m_next != 0)
+   // All the links set up by the threader keep the parent pointers in sync
+   // with the children lists, so walk up from the target instead of
+   // exploring all our descendants: this only costs the depth of the tree
+   // and not its size, which matters a lot for the very wide threads
+   size_t depth = 0;
+   for (const ThreadContainer *c = target ? target->getParent() : 0;
+        c != 0;
+        c = c->getParent())
    {
-      bool found = m_next->findChild(target, true);
-      if (found)
+      if (c == this)
          return true;
+
+      CHECK(++depth < MAX_THREAD_DEPTH, true,
+            _T("Loop in the parents in ThreadContainer::findChild()"));
    }
+
    return false;
 }
 
 
 void ThreadContainer::flush(size_t &threadedIndex, size_t indent, bool indentIfDummyNode)
 {
-   static int depth = 0;
-   CHECK_RET(depth < MAX_THREAD_DEPTH, _T("Deep recursion in ThreadContainer::flush()"));
-   CHECK_RET(m_threadable != 0, _T("No threadable in ThreadContainer::flush()"));
-   m_threadable->setChild(m_child == 0 ? 0 : m_child->getThreadable());
-   if (!m_threadable->isDummy())
-   {
-      m_threadable->setThreadedIndex(threadedIndex++);
-      m_threadable->setIndent(indent);
-   }
-   if (m_child != 0)
+   // Use an explicit stack instead of recursing for each child and each
+   // next as the threads can be both very deep and very wide: it contains
+   // the next containers to process with their indentation
+   std::vector< std::pair<ThreadContainer *, size_t> > stack;
+   stack.push_back(std::make_pair(this, indent));
+   while (!stack.empty())
    {
-      depth++;
-      if (indentIfDummyNode)
-         m_child->flush(threadedIndex, indent+1, indentIfDummyNode);
-      else
-         m_child->flush(threadedIndex,
-                        indent+(m_threadable->isDummy() ? 0 : 1),
-                        indentIfDummyNode);
-      depth--;
-      CHECK_RET(depth >= 0, _T("Negative recursion depth in ThreadContainer::flush()"));
+      ThreadContainer * const c = stack.back().first;
+      indent = stack.back().second;
+      stack.pop_back();
+
+      Threadable * const th = c->m_threadable;
+      CHECK_RET(th != 0, _T("No threadable in ThreadContainer::flush()"));
+      th->setChild(c->m_child == 0 ? 0 : c->m_child->getThreadable());
+      th->setNext(c->m_next == 0 ? 0 : c->m_next->getThreadable());
+      if (!th->isDummy())
+      {
+         th->setThreadedIndex(threadedIndex++);
+         th->setIndent(indent);
+      }
+
+      // the children must be numbered before the next ones, so push them
+      // last
+      if (c->m_next != 0)
+         stack.push_back(std::make_pair(c->m_next, indent));
+      if (c->m_child != 0)
+      {
+         size_t indentChild = indent;
+         if (indentIfDummyNode || !th->isDummy())
+            indentChild++;
+         stack.push_back(std::make_pair(c->m_child, indentChild));
+      }
    }
-   if (m_threadable != 0)
-      m_threadable->setNext(m_next == 0 ? 0 : m_next->getThreadable());
-   if (m_next != 0)
-      m_next->flush(threadedIndex, indent, indentIfDummyNode);
 }
 
 
-void ThreadContainer::destroy()
+// --------------------------------------------------------------------
+// ThreadContainerTable: maps strings to ThreadContainers
+// --------------------------------------------------------------------
+
+/**
+   A hash table using open addressing with linear probing.
+
+   All the entries are stored in a single array, so that there is no
+   allocation for each entry (but for the copy of its key) and the lookups
+   don't have to follow the pointers.
+ */
+class ThreadContainerTable
 {
-   static int depth = 0;
-   CHECK_RET(depth < MAX_THREAD_DEPTH, _T("Deep recursion in ThreadContainer::destroy()"));
-   if (m_child != 0)
+public:
+   /// Creates a table big enough for the given number of entries
+   ThreadContainerTable(size_t count)
    {
-      depth++;
-      m_child->destroy();
-      depth--;
-      CHECK_RET(depth >= 0, _T("Negative recursion depth in ThreadContainer::destroy()"));
+      size_t size = 16;
+      while (size < 2*count)
+         size *= 2;
+      m_slots.resize(size);
+      m_count = 0;
    }
-   delete m_child;
-   m_child = 0;
-   if (m_next != 0)
-      m_next->destroy();
-   delete m_next;
-   m_next = 0;
-}
 
+   /// Returns the container with this key or NULL
+   ThreadContainer *lookUp(const String& key) const
+   {
+      const Slot& slot = m_slots[findSlot(key, wxStringHash()(key))];
+      return slot.container;
+   }
+
+   /// Adds the entry, replacing the existing one with the same key
+   void add(const String& key, ThreadContainer *container)
+   {
+      if (2*(m_count + 1) > m_slots.size())
+         grow();
+
+      const unsigned long hash = wxStringHash()(key);
+      Slot& slot = m_slots[findSlot(key, hash)];
+      if (!slot.container)
+      {
+         slot.key = key;
+         slot.hash = hash;
+         m_count++;
+      }
+      slot.container = container;
+   }
 
+   /// Returns the number of entries in the table
+   size_t getCount() const { return m_count; }
+
+   /// Returns the number of slots, use getContainer() to iterate over them
+   size_t getSize() const { return m_slots.size(); }
+
+   /// Returns the container in this slot (may be NULL)
+   ThreadContainer *getContainer(size_t n) const
+      { return m_slots[n].container; }
+
+private:
+   struct Slot
+   {
+      Slot() { hash = 0; container = 0; }
+
+      String key;
+      unsigned long hash;
+      ThreadContainer *container;
+   };
+
+   // Returns the slot containing the key or the empty one where it should
+   // be inserted
+   size_t findSlot(const String& key, unsigned long hash) const
+   {
+      const size_t mask = m_slots.size() - 1;
+      size_t n = hash & mask;
+      while (m_slots[n].container &&
+             (m_slots[n].hash != hash || m_slots[n].key != key))
+      {
+         n = (n + 1) & mask;
+      }
+
+      return n;
+   }
+
+   // Doubles the size of the table
+   void grow()
+   {
+      std::vector<Slot> slots(m_slots.size() * 2);
+      m_slots.swap(slots);
+
+      const size_t mask = m_slots.size() - 1;
+      for (size_t i = 0; i < slots.size(); i++)
+      {
+         if (!slots[i].container)
+            continue;
+
+         size_t n = slots[i].hash & mask;
+         while (m_slots[n].container)
+            n = (n + 1) & mask;
+         m_slots[n] = slots[i];
+      }
+   }
+
+   std::vector<Slot> m_slots;
+   size_t m_count;
+};
 
 
 // --------------------------------------------------------------------
@@ -923,9 +958,15 @@ void ThreadContainer::destroy()
 class Threader {
 private:
    ThreadContainer *m_root;
-   HASHTAB         *m_idTable;
+   ThreadContainerTable *m_idTable;
    int              m_bogusIdCount;
 
+   // All the containers and dummy messages created during the run: they're
+   // allocated in blocks and all freed together when the Threader is
+   // destroyed (std::deque never moves its existing elements)
+   std::deque<ThreadContainer> m_containers;
+   std::deque<Threadable> m_dummies;
+
    // Options
    bool m_gatherSubjects;
    bool m_breakThreadsOnSubjectChange;
@@ -946,13 +987,16 @@ public:
 
    ~Threader();
 
-   /** Does all the job. Input is a list of messages, output
+   /** Does all the job. Input is the array of messages, output
        is the root of the first thread, with all the roots
        of the other threads as next. Moreover, all the
        Threadable objects will be filled with their threadedIndex
        (the position where they should be displayed, starting
        from 0) and their indentation.
 
+       The returned tree may contain dummy messages which remain
+       valid as long as this Threader object exists.
+
        If shouldGatherSubjects is true, all messages that
        have the same non-empty subject will be considered
        to be part of the same thread.
@@ -960,7 +1004,7 @@ public:
        If indentIfDummyNode is true, messages under a dummy
        node will be indented.
        */
-   Threadable *thread(Threadable *threadableRoot);
+   Threadable *thread(std::vector<Threadable>& threadables);
 
    void setGatherSubjects(bool x) { m_gatherSubjects = x; }
    void setBreakThreadsOnSubjectChange(bool x) { m_breakThreadsOnSubjectChange = x; }
@@ -975,19 +1019,17 @@ public:
 #endif
 
 private:
+   ThreadContainer *newContainer(Threadable *th = 0);
+   Threadable *makeDummy(const Threadable *th);
+   void simplifySubjects(std::vector<Threadable>& threadables);
    void buildContainer(Threadable *threadable);
    void findRootSet();
    void pruneEmptyContainers(ThreadContainer *parent,
                              bool fromBreakThreads);
-   size_t collectSubjects(HASHTAB*, ThreadContainer *, bool recursive);
+   size_t collectSubjects(ThreadContainerTable&);
    void gatherSubjects();
-   void breakThreads(ThreadContainer*);
-
-   // An API on top of the hash-table
-   HASHTAB *create(size_t) const;
-   ThreadContainer* lookUp(HASHTAB*, const String&) const;
-   void add(HASHTAB*, const String&, ThreadContainer*) const;
-   void destroy(HASHTAB **) const;
+   void breakThreads();
+   bool breakThread(ThreadContainer*);
 };
 
 
@@ -1052,110 +1094,81 @@ void Threader::setSimplifyingRegex(const String &x)
 #endif
 
 
-//
-// Returns true if the arguement seems to be a prime number
-//
-static bool SeemsPrime(size_t n)
-{
-   if (n % 2 == 0)
-      return false;
-   if (n % 3 == 0)
-      return false;
-   if (n % 5 == 0)
-      return false;
-   if (n % 7 == 0)
-      return false;
-   if (n % 11 == 0)
-      return false;
-   if (n % 13 == 0)
-      return false;
-   if (n % 17 == 0)
-      return false;
-   if (n % 19 == 0)
-      return false;
-   return true;
-}
-
-//
-// Find a (seemingly) prime number greater than n
-//
-static size_t FindPrime(size_t n)
+inline
+ThreadContainer *Threader::newContainer(Threadable *th)
 {
-   if (n % 2 == 0)
-      n++;
-   while (!SeemsPrime(n))
-      n += 2;
-   return n;
+   m_containers.push_back(ThreadContainer(th));
+   return &m_containers.back();
 }
 
 
-HASHTAB *Threader::create(size_t size) const
+inline
+Threadable *Threader::makeDummy(const Threadable *th)
 {
-   // Find a correct size for an hash-table
-   size_t aPrime = FindPrime(size);
-   // Create it
-   return hash_create(aPrime);
+   m_dummies.push_back(Threadable(th->getHeaderInfo(), th->getIndex(), true));
+   return &m_dummies.back();
 }
 
 
-void Threader::add(HASHTAB *hTable, const String &str, ThreadContainer *container) const
+// The result of the subject simplification for one raw subject
+struct SimplifiedSubject
 {
-   hash_add(hTable, strdup(str.utf8_str()), container, 0);
-}
+   String subject;
+   bool isReply;
+};
 
+WX_DECLARE_STRING_HASH_MAP(SimplifiedSubject, SimplifiedSubjectMap);
 
-ThreadContainer *Threader::lookUp(HASHTAB *hTable, const String &s) const
+// Compute the simplified subjects of all messages before threading them:
+// the messages of the same thread usually have the same subject, so do it
+// only once for each different subject instead of once per message
+void Threader::simplifySubjects(std::vector<Threadable>& threadables)
 {
-   void** data = hash_lookup(hTable,
-                              const_cast<char *>((const char *)s.utf8_str()));
-   if (data != 0)
-      return (ThreadContainer*)data[0];
-   else
-      return 0;
-}
+   SimplifiedSubjectMap subjects;
 
+   const size_t count = threadables.size();
+   for (size_t n = 0; n < count; n++)
+   {
+      Threadable& th = threadables[n];
+      const String& subject = th.getHeaderInfo()->GetSubject();
 
-void Threader::destroy(HASHTAB ** hTable) const
-{
-   // Delete all the strings that have been used as key
-   HASHENT *ent;
-   size_t i;
-   for (i = 0; i < (*hTable)->size; i++)
-      for (ent = (*hTable)->table[i]; ent != 0; ent = ent->next)
-         free(ent->name);
-   // and destroy the hash-table
-   hash_destroy(hTable);
-}
+      SimplifiedSubjectMap::iterator i = subjects.find(subject);
+      if (i != subjects.end())
+      {
+         th.setSimplifiedSubject(i->second.subject, i->second.isReply);
+         continue;
+      }
 
+      SimplifiedSubject& simplified = subjects[subject];
+#if defined(JWZ_USE_REGEX)
+      simplified.subject = th.getSimplifiedSubject(m_replyRemover,
+                                                   m_replacementString);
+      simplified.isReply = th.subjectIsReply(m_replyRemover,
+                                             m_replacementString);
+#else
+      simplified.subject = th.getSimplifiedSubject(m_removeListPrefixGathering);
+      simplified.isReply = th.subjectIsReply(m_removeListPrefixGathering);
+#endif
+   }
+}
 
 
-Threadable *Threader::thread(Threadable *threadableRoot)
+Threadable *Threader::thread(std::vector<Threadable>& threadables)
 {
-   if (threadableRoot == 0)
+   const size_t thCount = threadables.size();
+   if (thCount == 0)
       return 0;
 
-#if defined(DEBUG)
-   // In case we leaked in a previous run of the algo, reset the count
-   NumberOfThreadContainers = 0;
-#endif
-
-   // Count the number of messages to thread, and verify
-   // the input list
-   Threadable *th = threadableRoot;
-   size_t thCount = 0;
-   for (; th != 0; th = th->getNext())
-   {
-      VERIFY(th->getChild() == 0, _T("Bad input list in Threader::thread()"));
-      thCount++;
-   }
+   simplifySubjects(threadables);
 
    // Make an hash-table big enough to hold all the instances of
    // ThreadContainer that will be created during the run.
    // Note that some dummy containers will be created also, so
    // don't be shy...
-   m_idTable = create(thCount*2);
+   ThreadContainerTable idTable(thCount*2);
+   m_idTable = &idTable;
 
-   // Scan the list, and build the corresponding ThreadContainers
+   // Scan the array, and build the corresponding ThreadContainers
    // This step will:
    //  - Build a ThreadContainer for the Threadable given as argument
    //  - Scan the references of the message, and build on the fly some
@@ -1163,8 +1176,13 @@ Threadable *Threader::thread(Threadable *threadableRoot)
    //    already been processed
    //  - Store all those containers in the hash-table, indexed by their Message-Id
    //  - Build their parent/child relations
-   for (th = threadableRoot; th != 0; th = th->getNext())
+   //
+   // Notice that the messages are processed from the last one to the first
+   // one: this determines which of the messages with the same id or with
+   // contradicting references wins and we keep the historic order.
+   for (size_t n = thCount; n-- > 0; )
    {
+      Threadable *th = &threadables[n];
       VERIFY(th->getIndex() < thCount, _T("Too big in Threader::thread()"));
       // As things are now, dummy messages won't get past the algorithm
       // and won't be displayed. Thus we should not get them back when
@@ -1182,7 +1200,7 @@ Threadable *Threader::thread(Threadable *threadableRoot)
    ASSERT(m_root->getNext() == 0); // root node has a next ?!
 
    // We are finished with this hash-table
-   destroy(&m_idTable);
+   m_idTable = 0;
 
    // Remove all the useless containers (e.g. those that are not
    // in the root-set, have no message, but have a child)
@@ -1194,11 +1212,11 @@ Threadable *Threader::thread(Threadable *threadableRoot)
    ThreadContainer *thr;
    for (thr = m_root->getChild(); thr != 0; thr = thr->getNext())
       if (thr->getThreadable() == 0)
-         thr->setThreadable(thr->getChild()->getThreadable()->makeDummy());
+         thr->setThreadable(makeDummy(thr->getChild()->getThreadable()));
 
    wxLogTrace(TRACE_JWZ, _T("Entering BreakThreads"));
    if (m_breakThreadsOnSubjectChange)
-      breakThreads(m_root);
+      breakThreads();
    wxLogTrace(TRACE_JWZ, _T("Leaving BreakThreads"));
 
    // If asked to, gather all the messages that have the same
@@ -1223,13 +1241,9 @@ Threadable *Threader::thread(Threadable *threadableRoot)
    if (m_root->getChild() != 0)
       m_root->getChild()->flush(threadedIndex, 0, m_indentIfDummyNode);
 
-   // Destroy the ThreadContainer structure.
-   m_root->destroy();
-   delete m_root;
-
-#if defined(DEBUG)
-   ASSERT(NumberOfThreadContainers == 0); // Some ThreadContainers leak
-#endif
+   // The ThreadContainer structure is not needed any more
+   m_root = 0;
+   m_containers.clear();
 
    return result;
 }
@@ -1244,7 +1258,7 @@ void Threader::buildContainer(Threadable *th)
    // has been built.
    String id = th->messageThreadID();
    ASSERT(!id.empty());
-   ThreadContainer *container = lookUp(m_idTable, id);
+   ThreadContainer *container = m_idTable->lookUp(id);
 
    if (container != 0)
    {
@@ -1265,8 +1279,8 @@ void Threader::buildContainer(Threadable *th)
    {
       // Create a container and store it (with id as key)
       // in the hash-table
-      container = new ThreadContainer(th);
-      add(m_idTable, id, container);
+      container = newContainer(th);
+      m_idTable->add(id, container);
    }
 
    // Let's have a look to the references of this message.
@@ -1282,12 +1296,12 @@ void Threader::buildContainer(Threadable *th)
    for ( StringList::iterator i = refs.begin(); i != refs.end(); i++)
    {
       String ref = *i;
-      ThreadContainer *refCont = lookUp(m_idTable, ref);
+      ThreadContainer *refCont = m_idTable->lookUp(ref);
       if (refCont == 0)
       {
          // No container with this id. Create one.
-         refCont = new ThreadContainer();
-         add(m_idTable, ref, refCont);
+         refCont = newContainer();
+         m_idTable->add(ref, refCont);
       }
 
       // If one container was found during last iteration, it must
@@ -1368,107 +1382,111 @@ void Threader::buildContainer(Threadable *th)
 }
 
 
+// Compare the containers by their index, used to sort the root set
+static bool CompareContainerIndices(const ThreadContainer *c1,
+                                    const ThreadContainer *c2)
+{
+   return c1->getIndex() < c2->getIndex();
+}
+
+
 void Threader::findRootSet()
 {
    wxLogTrace(TRACE_JWZ, _T("Entering Threader::findRootSet()"));
-   m_root = new ThreadContainer();
-   HASHENT *ent;
-   size_t i;
-   for (i = 0; i < m_idTable->size; i++)
-      for (ent = m_idTable->table[i]; ent != 0; ent = ent->next) {
-         ThreadContainer *container = (ThreadContainer*)ent->data[0];
-         if (container->getParent() == 0)
-         {
-            // This one will be in the root set
-            ASSERT(container->getNext() == 0);
-#if defined(JWZ_NO_SORT)
-            mProot->addAsChild(container);
-#else
-            // Find the correct position to insert it, so that the
-            // order given to us is respected
-            ThreadContainer *c = m_root->getChild();
-            if (c == 0)
-            {
-               // This is the first one found
-               container->setNext(m_root->getChild());
-               m_root->setChild(container);
-            } else {
-               size_t index = container->getIndex();
-               ThreadContainer *prev = 0;
-               while ((c != 0) &&
-                  (c->getIndex() < index))
-               {
-                  prev = c;
-                  c = c->getNext();
-               }
-               ASSERT(container->getNext() == 0);
-               container->setNext(c);
-               if (prev == 0)
-               {
-                  ASSERT(m_root->getChild() == c);
-                  m_root->setChild(container);
-               } else
-               {
-                  ASSERT(prev->getNext() == c);
-                  prev->setNext(container);
-               }
-            }
-#endif
-         }
+   m_root = newContainer();
+
+   std::vector<ThreadContainer *> roots;
+   const size_t size = m_idTable->getSize();
+   for (size_t i = 0; i < size; i++) {
+      ThreadContainer *container = m_idTable->getContainer(i);
+      if (container != 0 && container->getParent() == 0)
+      {
+         // This one will be in the root set
+         ASSERT(container->getNext() == 0);
+         roots.push_back(container);
       }
+   }
+
+#if !defined(JWZ_NO_SORT)
+   // Respect the order given to us: sort all the roots at once instead of
+   // inserting each of them at its position in the list
+   std::stable_sort(roots.begin(), roots.end(), CompareContainerIndices);
+#endif
+
+   // Link them together in this order
+   for (size_t n = roots.size(); n-- > 0; )
+   {
+      roots[n]->setNext(m_root->getChild());
+      m_root->setChild(roots[n]);
+   }
 }
 
 
 void Threader::pruneEmptyContainers(ThreadContainer *parent,
                                     bool fromBreakThreads)
 {
-   ThreadContainer *c, *prev, *next;
-   for (prev = 0, c = parent->getChild(), next = c->getNext();
-        c != 0;
-        prev = c, c = next, next = (c == 0 ? 0 : c->getNext()))
+   // The children of each container must be pruned before the container
+   // itself, so collect all the containers having children breadth first and
+   // process them in the reverse order instead of recursing. When called from
+   // breakThreads(), only the immediate children of the parent are pruned.
+   std::vector<ThreadContainer *> parents;
+   parents.push_back(parent);
+   if (!fromBreakThreads)
    {
-      if (c->getChild() != 0 && !fromBreakThreads) {   
-         pruneEmptyContainers(c, false);
-      }
-      if ((c->getThreadable() == 0 ||
-           c->getThreadable()->isDummy()) &&
-          (c->getChild() == 0))
-      {
-         if (prev == 0)
-            parent->setChild(c->getNext());
-         else
-            prev->setNext(c->getNext());
-         if (fromBreakThreads)
-            delete c->getThreadable();
-         delete c;
-         c = prev;
-
-      } else if ((c->getThreadable() == 0 ||
-                  c->getThreadable()->isDummy()) &&
-                 (c->getChild() != 0) &&
-                 ((c->getParent() != 0) ||
-                  (c->getChild()->getNext() == 0)))
+      for (size_t n = 0; n < parents.size(); n++)
       {
-         ThreadContainer *kids = c->getChild();
-         if (prev == 0)
-            parent->setChild(kids);
-         else
-            prev->setNext(kids);
+         for (ThreadContainer *c = parents[n]->getChild(); c != 0; c = c->getNext())
+         {
+            if (c->getChild() != 0)
+               parents.push_back(c);
+         }
+      }
+   }
 
-         ThreadContainer *tail;
-         for (tail = kids; tail->getNext() != 0; tail = tail->getNext())
-            tail->setParent(c->getParent());
+   for (size_t n = parents.size(); n-- > 0; )
+   {
+      parent = parents[n];
+      if (parent->getChild() == 0)
+         continue;
 
-         tail->setParent(c->getParent());
-         tail->setNext(c->getNext());
+      ThreadContainer *c, *prev, *next;
+      for (prev = 0, c = parent->getChild(), next = c->getNext();
+           c != 0;
+           prev = c, c = next, next = (c == 0 ? 0 : c->getNext()))
+      {
+         if ((c->getThreadable() == 0 ||
+              c->getThreadable()->isDummy()) &&
+             (c->getChild() == 0))
+         {
+            if (prev == 0)
+               parent->setChild(c->getNext());
+            else
+               prev->setNext(c->getNext());
+            c = prev;
+
+         } else if ((c->getThreadable() == 0 ||
+                     c->getThreadable()->isDummy()) &&
+                    (c->getChild() != 0) &&
+                    ((c->getParent() != 0) ||
+                     (c->getChild()->getNext() == 0)))
+         {
+            ThreadContainer *kids = c->getChild();
+            if (prev == 0)
+               parent->setChild(kids);
+            else
+               prev->setNext(kids);
+
+            ThreadContainer *tail;
+            for (tail = kids; tail->getNext() != 0; tail = tail->getNext())
+               tail->setParent(c->getParent());
 
-         next = kids;
+            tail->setParent(c->getParent());
+            tail->setNext(c->getNext());
 
-         if (fromBreakThreads)
-            delete c->getThreadable();
+            next = kids;
 
-         delete c;
-         c = prev;
+            c = prev;
+         }
       }
    }
 }
@@ -1490,18 +1508,15 @@ void Threader::gatherSubjects()
    // Make the hash-table large enough. Let's consider
    // that there are not too many (not more than one per
    // thread) subject changes.
-   HASHTAB *subjectTable = create(count*2);
+   ThreadContainerTable subjectTable(count*2);
 
    wxLogTrace(TRACE_JWZ, _T("Entering collectSubjects"));
    // Collect the subjects in all the tree
-   count = collectSubjects(subjectTable, m_root, true);
+   count = collectSubjects(subjectTable);
    wxLogTrace(TRACE_JWZ, _T("Leaving collectSubjects"));
 
    if (count == 0)            // If the table is empty, we're done.
-   {
-      destroy(&subjectTable);
       return;
-   }
 
    // The sujectTable is now populated with one entry for each subject.
    // Now iterate over the root set, and gather together the difference.
@@ -1529,7 +1544,7 @@ void Threader::gatherSubjects()
       if (subject.empty())
          continue;
 
-      ThreadContainer *old = lookUp(subjectTable, subject);
+      ThreadContainer *old = subjectTable.lookUp(subject);
       if (old == c)    // oops, that's us
          continue;
 
@@ -1590,7 +1605,6 @@ void Threader::gatherSubjects()
             old->addAsChild(kid);
             kid = next;
          }
-         delete c;
       }
       else if (old->getThreadable() == 0 ||               // old is empty, or
                (c->getThreadable() != 0 &&
@@ -1626,7 +1640,7 @@ void Threader::gatherSubjects()
             // so that the hash-table still points to the one that is at depth 0
             // instead of depth 1.
 
-            ThreadContainer *newC = new ThreadContainer(old->getThreadable());
+            ThreadContainer *newC = newContainer(old->getThreadable());
             newC->setChild(old->getChild());
             ThreadContainer *tail = newC->getChild();
             for (; tail != 0; tail = tail->getNext())
@@ -1655,7 +1669,7 @@ void Threader::gatherSubjects()
 
             // Now that we know who is the child of the new node, we can build
             // its dummy threadable
-            old->setThreadable(c->getThreadable()->makeDummy());
+            old->setThreadable(makeDummy(c->getThreadable()));
          }
          else
             old->getParent()->addAsChild(c);
@@ -1665,21 +1679,29 @@ void Threader::gatherSubjects()
       c = prev;
    }
 
-   destroy(&subjectTable);
    wxLogTrace(TRACE_JWZ, _T("Leaving GatherSubjects"));
 }
 
 
-size_t Threader::collectSubjects(HASHTAB *subjectTable,
-                                 ThreadContainer *parent,
-                                 bool recursive)
+size_t Threader::collectSubjects(ThreadContainerTable& subjectTable)
 {
-   static int depth = 0;
-   ASSERT_MSG(depth < MAX_THREAD_DEPTH, _T("Deep recursion in Threader::collectSubjects()"));
    size_t count = 0;
-   ThreadContainer *c;
-   for (c = parent->getChild(); c != 0; c = c->getNext())
+
+   // Visit all the tree in pre-order, just as the recursive traversal would
+   // do, but using an explicit stack of the next containers to visit
+   std::vector<ThreadContainer *> stack;
+   if (m_root->getChild() != 0)
+      stack.push_back(m_root->getChild());
+   while (!stack.empty())
    {
+      ThreadContainer *c = stack.back();
+      stack.pop_back();
+
+      if (c->getNext() != 0)
+         stack.push_back(c->getNext());
+      if (c->getChild() != 0)
+         stack.push_back(c->getChild());
+
       Threadable *cTh = c->getThreadable();
       Threadable *th = cTh;
 
@@ -1702,7 +1724,7 @@ size_t Threader::collectSubjects(HASHTAB *subjectTable,
       if (subject.empty())
          continue;
 
-      ThreadContainer *old = lookUp(subjectTable, subject);
+      ThreadContainer *old = subjectTable.lookUp(subject);
 
       // Add this container to the table if:
       //  - There is no container in the table with this subject, or
@@ -1729,21 +1751,9 @@ size_t Threader::collectSubjects(HASHTAB *subjectTable,
 #endif
          ))
       {
-         // The hash-table we use does not offer to replace (nor remove)
-         // an entry. But adding a new entry with the same key will 'hide'
-         // the old one. This is just not as efficient if there are collisions
-         // but we do not care for now.
-         add(subjectTable, subject, c);
+         subjectTable.add(subject, c);
          count++;
       }
-
-      if (recursive)
-      {
-         depth++;
-         count += collectSubjects(subjectTable, c, true);
-         depth--;
-         VERIFY(depth >= 0, _T("Negative recursion depth in Threader::collectSubjects()"));
-      }
    }
 
    // Return number of subjects found
@@ -1751,21 +1761,43 @@ size_t Threader::collectSubjects(HASHTAB *subjectTable,
 }
 
 
-void Threader::breakThreads(ThreadContainer* c)
+void Threader::breakThreads()
 {
-   static int depth = 0;
-   CHECK_RET(depth < MAX_THREAD_DEPTH, _T("Deep recursion in Threader::breakThreads()"));
+   // Visit all the containers in pre-order without recursing: the stack
+   // contains the next sibling to visit at each level of the tree. Notice
+   // that it must be remembered before processing the container as the
+   // latter may be moved elsewhere by breakThread().
+   std::vector<ThreadContainer *> stack;
+   stack.push_back(m_root->getChild());
+   while (!stack.empty())
+   {
+      ThreadContainer *c = stack.back();
+      if (c == NULL)
+      {
+         stack.pop_back();
+         continue;
+      }
+
+      stack.back() = c->getNext();
+
+      if (breakThread(c))
+         stack.push_back(c->getChild());
+   }
+}
 
+
+bool Threader::breakThread(ThreadContainer* c)
+{
    // Dummies should have been built
-   CHECK_RET((c == m_root) || (c->getThreadable() != NULL),
-             _T("No threadable in Threader::breakThreads()"));
+   CHECK(c->getThreadable() != NULL, false,
+         _T("No threadable in Threader::breakThreads()"));
 
    // If there is no parent, there is no thread to break.
    if (c->getParent() != NULL)
    {
       // Dummies should have been built
-      CHECK_RET(c->getParent()->getThreadable() != NULL,
-                _T("No parent's threadable in Threader::breakThreads()"));
+      CHECK(c->getParent()->getThreadable() != NULL, false,
+            _T("No parent's threadable in Threader::breakThreads()"));
 
       ThreadContainer *parent = c->getParent();
 
@@ -1785,8 +1817,8 @@ void Threader::breakThreads(ThreadContainer* c)
          else
          {
             ThreadContainer *prev = parent->getChild();
-            CHECK_RET(parent->findChild(c),
-                      _T("Not child of its parent in Threader::breakThreads()"));
+            CHECK(parent->findChild(c), false,
+                  _T("Not child of its parent in Threader::breakThreads()"));
             while (prev->getNext() != c)
                prev = prev->getNext();
             prev->setNext(c->getNext());
@@ -1806,107 +1838,369 @@ void Threader::breakThreads(ThreadContainer* c)
       }
    }
 
-   ThreadContainer *kid = c->getChild();
-   while (kid != NULL)
-   {
-      // We save the next to check, as kid may disappear of this thread
-      ThreadContainer *next = kid->getNext();
-
-      depth++;
-      breakThreads(kid);
-      depth--;
-      VERIFY(depth >= 0, _T("Negative recursion depth in Threader::breakThreads()"));
-
-      kid = next;
-   }
+   return true;
 }
 
-// Build the input struture for the threader: a list
+// Build the input struture for the threader: an array
 // of all the messages to thread.
-static Threadable *BuildThreadableList(const HeaderInfoList *hilp)
+static void BuildThreadables(const HeaderInfoList *hilp,
+                             std::vector<Threadable>& threadables)
 {
-   wxLogTrace(TRACE_JWZ, _T("Entering BuildThreadableList"));
-   Threadable *root = 0;
+   wxLogTrace(TRACE_JWZ, _T("Entering BuildThreadables"));
    size_t count = hilp->Count();
+   threadables.reserve(count);
    for (size_t i = 0; i < count; ++i) {
       HeaderInfo *hi = hilp->GetItemByIndex(i);
-      Threadable *item = new Threadable(hi, i);
-      item->setNext(root);
-      root = item;
+      threadables.push_back(Threadable(hi, i));
    }
-   wxLogTrace(TRACE_JWZ, _T("Leaving BuildThreadableList"));
-   return root;
+   wxLogTrace(TRACE_JWZ, _T("Leaving BuildThreadables"));
 }
 
 
-// Scan the Threadable tree and fill the arrays needed to
-// correctly display the threads
 //
-static size_t FlushThreadable(Threadable *t,
-                            MsgnoType *indices,
-                            size_t *indents,
-                            MsgnoType *children
-#if defined(DEBUG)
-                            , bool seen[]
-#endif
-                            )
+// Copy the tree structure to a THREADNODE structure
+//
+static THREADNODE *MapToThreadNode(Threadable* root)
 {
-  size_t number = 0;    // For this one
-   if (!t->isDummy())
+   THREADNODE *result = NULL;
+
+   // the siblings are handled in a loop and the children use an explicit
+   // stack containing the first child and the location where its node must
+   // be stored, so that neither wide nor deep trees can overflow the stack
+   std::vector< std::pair<Threadable *, THREADNODE **> > stack;
+   stack.push_back(std::make_pair(root, &result));
+   while ( !stack.empty() )
    {
-      size_t threadedIndex = t->getThreadedIndex();
-      size_t index = t->getIndex();
-      indices[threadedIndex] = index;
-      indents[index] = t->getIndent();
-#if defined(DEBUG)
-      seen[index] = true;
-#endif
+      Threadable *th = stack.back().first;
+      THREADNODE **where = stack.back().second;
+      stack.pop_back();
+
+      for ( ; th; th = th->getNext() )
+      {
+         // we must allocate THREADNODEs with fs_get() as they're freed by
+         // cclient
+         THREADNODE *thrNode = mail_newthreadnode(NULL);
+
+         // +1 for getting a msgno
+         thrNode->num = th->isDummy() ? 0 : th->getIndex()+1;
+
+         *where = thrNode;
+         where = &thrNode->branch;
+
+         if ( th->getChild() )
+            stack.push_back(std::make_pair(th->getChild(), &thrNode->next));
+      }
    }
 
-   if (t->getChild()) {
-      number +=
-#if defined(DEBUG)
-         FlushThreadable(t->getChild(), indices, indents, children, seen);
-#else
-         FlushThreadable(t->getChild(), indices, indents, children);
-#endif
+   return result;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// JWZThreadIndex: data needed to add new messages to an existing tree
+// ----------------------------------------------------------------------------
+
+// the information about a message already in the tree
+struct JWZNodeInfo
+{
+   JWZNodeInfo() { node = parent = NULL; }
+   JWZNodeInfo(THREADNODE *node_, THREADNODE *parent_)
+   {
+      node = node_;
+      parent = parent_;
+   }
+
+   // the node of this message
+   THREADNODE *node;
+
+   // the node of its parent (may be a dummy one) or NULL if it's a root
+   THREADNODE *parent;
+};
+
+WX_DECLARE_STRING_HASH_MAP(JWZNodeInfo, JWZIdMap);
+WX_DECLARE_STRING_HASH_MAP(bool, JWZStringSet);
+
+/**
+   JWZThreadIndex remembers the ids, references and subjects of all messages
+   in the tree built by JWZThreadMessages() which allows to quickly check
+   whether a new message may be simply attached to the existing tree or if it
+   would change the threads of the other messages.
+ */
+class JWZThreadIndex
+{
+public:
+   JWZThreadIndex(const ThreadParams& thrParams);
+   ~JWZThreadIndex();
+
+   // add all messages of the (sub)tree to the index, the Threadable and
+   // THREADNODE trees must have the same structure
+   void AddTree(Threadable *th, THREADNODE *node, THREADNODE *parent);
+
+   // add all messages of the existing tree to the index
+   void AddNodes(const HeaderInfoList *hil, THREADNODE *root);
+
+   // add a new message to the tree and to the index if possible
+   bool AddNewMessage(const HeaderInfoList *hil,
+                      MsgnoType msgno,
+                      THREADNODE **root);
+
+private:
+   // remember this message in the index
+   void AddMessage(Threadable& th, THREADNODE *node, THREADNODE *parent);
+
+   // get the simplified subject as used by the subject gathering
+   String GetSubject(Threadable& th) const;
+
+   // does this message subject start with "Re:"?
+   bool IsReply(Threadable& th) const;
+
+   // is this id or reference known, i.e. used by any message in the tree?
+   bool IsKnown(const String& id) const
+   {
+      return m_ids.find(id) != m_ids.end() ||
+               m_references.find(id) != m_references.end();
    }
-   if (!t->isDummy())
+
+   // is this message a root (possibly under a dummy node) of the tree?
+   static bool IsRoot(const JWZNodeInfo& info)
    {
-      children[t->getIndex()] = number;
-      number++;  // Count oneself
+      return !info.parent || !info.parent->num;
    }
-   if (t->getNext()) {
-     number +=
-#if defined(DEBUG)
-         FlushThreadable(t->getNext(), indices, indents, children, seen);
+
+   // the threading options
+   bool m_gatherSubjects,
+        m_breakThreadsOnSubjectChange;
+#if defined(JWZ_USE_REGEX)
+   wxRegEx *m_replyRemover;
+   String m_replacementString;
+#endif
+
+   // the ids of all messages in the tree
+   JWZIdMap m_ids;
+
+   // all the ids referenced by the messages in the tree
+   JWZStringSet m_references;
+
+   // all the non empty simplified subjects of the messages in the tree
+   JWZStringSet m_subjects;
+
+   DECLARE_NO_COPY_CLASS(JWZThreadIndex)
+};
+
+JWZThreadIndex::JWZThreadIndex(const ThreadParams& thrParams)
+   : m_gatherSubjects(thrParams.gatherSubjects)
+   , m_breakThreadsOnSubjectChange(thrParams.breakThread)
+#if defined(JWZ_USE_REGEX)
+   , m_replyRemover(new wxRegEx(thrParams.simplifyingRegex))
+   , m_replacementString(thrParams.replacementString)
+#endif
+{
+}
+
+JWZThreadIndex::~JWZThreadIndex()
+{
+#if defined(JWZ_USE_REGEX)
+   delete m_replyRemover;
+#endif
+}
+
+String JWZThreadIndex::GetSubject(Threadable& th) const
+{
+#if defined(JWZ_USE_REGEX)
+   return th.getSimplifiedSubject(m_replyRemover, m_replacementString);
 #else
-         FlushThreadable(t->getNext(), indices, indents, children);
+   return th.getSimplifiedSubject(true /* remove list prefix */);
 #endif
+}
+
+bool JWZThreadIndex::IsReply(Threadable& th) const
+{
+#if defined(JWZ_USE_REGEX)
+   return th.subjectIsReply(m_replyRemover, m_replacementString);
+#else
+   return th.subjectIsReply(true /* remove list prefix */);
+#endif
+}
+
+void JWZThreadIndex::AddMessage(Threadable& th,
+                                THREADNODE *node,
+                                THREADNODE *parent)
+{
+   // in case of duplicate ids keep the first message, just as the threader
+   // itself does
+   const String id = th.messageThreadID();
+   if ( m_ids.find(id) == m_ids.end() )
+      m_ids[id] = JWZNodeInfo(node, parent);
+
+   const StringList refs = th.messageThreadReferences();
+   for ( StringList::const_iterator i = refs.begin(); i != refs.end(); ++i )
+      m_references[String(*i)] = true;
+
+   const String subject = GetSubject(th);
+   if ( !subject.empty() )
+      m_subjects[subject] = true;
+}
+
+void JWZThreadIndex::AddTree(Threadable *th,
+                             THREADNODE *node,
+                             THREADNODE *parent)
+{
+   // don't recurse for the children as the threads may be very deep, use
+   // an explicit stack of the first children of each level instead
+   struct Level
+   {
+      Threadable *th;
+      THREADNODE *node,
+                 *parent;
+   };
+
+   std::vector<Level> stack;
+   Level level = { th, node, parent };
+   stack.push_back(level);
+   while ( !stack.empty() )
+   {
+      level = stack.back();
+      stack.pop_back();
+
+      for ( th = level.th, node = level.node;
+            th && node;
+            th = th->getNext(), node = node->branch )
+      {
+         if ( !th->isDummy() )
+            AddMessage(*th, node, level.parent);
+
+         if ( th->getChild() )
+         {
+            Level child = { th->getChild(), node->next, node };
+            stack.push_back(child);
+         }
+      }
    }
-   return number;
 }
 
+void JWZThreadIndex::AddNodes(const HeaderInfoList *hil, THREADNODE *root)
+{
+   // as in AddTree(), use an explicit stack of the first nodes of each level
+   std::vector< std::pair<THREADNODE *, THREADNODE *> > stack;
+   stack.push_back(std::make_pair(root, (THREADNODE *)NULL));
+   while ( !stack.empty() )
+   {
+      THREADNODE * const parent = stack.back().second;
+      THREADNODE *node = stack.back().first;
+      stack.pop_back();
 
-//
-// Copy the tree structure to a THREADNODE structure
-//
-static THREADNODE *MapToThreadNode(Threadable* root)
+      for ( ; node; node = node->branch )
+      {
+         if ( node->num )
+         {
+            Threadable th(hil->GetItemByIndex(node->num - 1), node->num - 1);
+            AddMessage(th, node, parent);
+         }
+
+         if ( node->next )
+            stack.push_back(std::make_pair(node->next, node));
+      }
+   }
+}
+
+/*
+   A new message can be added to the existing tree without changing the
+   position of any other message if:
+
+   1. Its id is not used nor referenced by any existing message (otherwise
+      either it is a duplicate or it would become the parent of the messages
+      referencing it).
+
+   2. None of its references which doesn't correspond to an existing message
+      is referenced by an existing one (otherwise it would share a dummy
+      parent with it).
+
+   3. None of the existing messages it references and which are currently
+      roots would get a new parent from the references preceding it.
+
+   4. If the subjects are gathered, no other message has the same subject
+      unless this one is a reply to an existing message (otherwise it could
+      be merged with another thread or become its new root).
+
+   The new message then becomes the last child of the closest existing message
+   among its references (the children order doesn't matter as ReOrderTree()
+   is applied to the tree later anyhow) or a new root if there is none or if
+   the thread is broken because of the subject change.
+ */
+bool JWZThreadIndex::AddNewMessage(const HeaderInfoList *hil,
+                                   MsgnoType msgno,
+                                   THREADNODE **root)
 {
-   if ( !root )
-      return NULL;
+   Threadable th(hil->GetItemByIndex(msgno - 1), msgno - 1);
+
+   const String id = th.messageThreadID();
+   if ( IsKnown(id) )
+      return false;
 
-   // we must allocate THREADNODEs with fs_get() as they're freed by cclient
-   THREADNODE *thrNode = mail_newthreadnode(NULL);
+   THREADNODE *parent = NULL;
+   bool knownBefore = false;
 
-   // +1 for getting a msgno
-   thrNode->num = root->isDummy() ? 0 : root->getIndex()+1;
-   thrNode->next = MapToThreadNode(root->getChild());
-   thrNode->branch = MapToThreadNode(root->getNext());
+   const StringList refs = th.messageThreadReferences();
+   for ( StringList::const_iterator i = refs.begin(); i != refs.end(); ++i )
+   {
+      const String ref = *i;
+      if ( ref == id )
+         return false;
 
-   return thrNode;
+      JWZIdMap::const_iterator it = m_ids.find(ref);
+      if ( it != m_ids.end() )
+      {
+         if ( knownBefore && IsRoot(it->second) )
+            return false;
+
+         parent = it->second.node;
+         knownBefore = true;
+      }
+      else if ( m_references.find(ref) != m_references.end() )
+      {
+         return false;
+      }
+      //else: unknown id, its empty container would be pruned by the threader
+   }
+
+   const String subject = GetSubject(th);
+
+   if ( parent && m_breakThreadsOnSubjectChange )
+   {
+      Threadable thParent(hil->GetItemByIndex(parent->num - 1),
+                          parent->num - 1);
+      if ( GetSubject(thParent) != subject )
+         parent = NULL;
+   }
+
+   if ( m_gatherSubjects &&
+         !subject.empty() &&
+            m_subjects.find(subject) != m_subjects.end() )
+   {
+      if ( !parent || !IsReply(th) )
+         return false;
+   }
+
+   // all checks passed, insert the new node in the tree
+   THREADNODE *node = mail_newthreadnode(NULL);
+   node->num = msgno;
+
+   THREADNODE **pp = parent ? &parent->next : root;
+   while ( *pp )
+      pp = &(*pp)->branch;
+   *pp = node;
+
+   AddMessage(th, node, parent);
+
+   return true;
 }
 
+void ThreadData::killIndex()
+{
+   delete m_jwzIndex;
+   m_jwzIndex = NULL;
+}
 
 
 // ----------------------------------------------------------------------------
@@ -1918,26 +2212,245 @@ extern void JWZThreadMessages(const ThreadParams& thrParams,
                               ThreadData *thrData)
 {
    wxLogTrace(TRACE_JWZ, _T("Entering JWZThreadMessages"));
-   Threadable *threadableRoot = BuildThreadableList(hilp);
+   wxStopWatch timeThreading;
+
+   std::vector<Threadable> threadables;
+   BuildThreadables(hilp, threadables);
 
    Threader *threader = new Threader(thrParams);
 
    // Do the work
-   threadableRoot = threader->thread(threadableRoot);
+   Threadable *threadableRoot = threader->thread(threadables);
 
    if ( threadableRoot )
    {
       // Map to needed output format
       thrData->m_root = MapToThreadNode(threadableRoot);
 
-      // Clean up
-      threadableRoot->destroy();
-      delete threadableRoot;
+      // and remember the ids and subjects of all messages to be able to add
+      // the new ones to this tree later without rethreading everything
+      thrData->killIndex();
+      thrData->m_jwzIndex = new JWZThreadIndex(thrParams);
+      thrData->m_jwzIndex->AddTree(threadableRoot, thrData->m_root, NULL);
    }
 
+   // this also frees the dummy messages which may be in the tree
    delete threader;
+
+   wxLogTrace(TRACE_JWZ, _T("Threaded %lu messages in %ldms"),
+              (unsigned long)threadables.size(), timeThreading.Time());
    wxLogTrace(TRACE_JWZ, _T("Leaving JWZThreadMessages"));
 }
 
+extern void JWZIndexThreadTree(const ThreadParams& thrParams,
+                               const HeaderInfoList *hilp,
+                               ThreadData *thrData)
+{
+   CHECK_RET( thrData && thrData->m_root,
+              _T("no tree in JWZIndexThreadTree") );
+
+   thrData->killIndex();
+   thrData->m_jwzIndex = new JWZThreadIndex(thrParams);
+   thrData->m_jwzIndex->AddNodes(hilp, thrData->m_root);
+}
+
+extern bool JWZThreadNewMessages(const HeaderInfoList *hilp,
+                                 ThreadData *thrData,
+                                 MsgnoType msgnoFirst,
+                                 MsgnoType msgnoLast)
+{
+   CHECK( thrData, false, _T("no thread data in JWZThreadNewMessages") );
+
+   // we can only update the tree built by JWZThreadMessages() itself
+   JWZThreadIndex * const index = thrData->m_jwzIndex;
+   if ( !index || !thrData->m_root )
+      return false;
+
+   for ( MsgnoType msgno = msgnoFirst; msgno <= msgnoLast; msgno++ )
+   {
+      if ( !index->AddNewMessage(hilp, msgno, &thrData->m_root) )
+      {
+         wxLogTrace(TRACE_JWZ,
+                    _T("New message %lu requires rethreading all messages"),
+                    (unsigned long)msgno);
+
+         return false;
+      }
+   }
+
+   return true;
+}
+
+#ifdef TEST_THREADING
+
+// ----------------------------------------------------------------------------
+// threading test
+// ----------------------------------------------------------------------------
+
+// define this to build a program checking the threading of the synthetic very
+// deep and very wide threads and measuring the time it takes (it must be
+// linked with the rest of the program objects)
+
+#include <wx/init.h>
+
+#include <stdio.h>
+
+// creates the messages to be threaded
+class JWZThreadingTest
+{
+public:
+   JWZThreadingTest(size_t count) : m_headers(count) { }
+
+   // the id of the message n
+   static String MakeId(size_t n)
+   {
+      return String::Format(_T("<%lu@test>"), (unsigned long)n);
+   }
+
+   void SetMessage(size_t n, const String& subject, const String& refs)
+   {
+      HeaderInfo& hi = m_headers[n];
+      hi.m_Id = MakeId(n);
+      hi.m_Subject = subject;
+      hi.m_References = refs;
+   }
+
+   // thread all the messages and return the time taken in ms
+   long Thread(const ThreadParams& thrParams)
+   {
+      m_threadables.clear();
+      m_threadables.reserve(m_headers.size());
+      for (size_t n = 0; n < m_headers.size(); n++)
+         m_threadables.push_back(Threadable(&m_headers[n], n));
+
+      wxStopWatch timeThreading;
+      Threader threader(thrParams);
+      m_root = threader.thread(m_threadables);
+      return timeThreading.Time();
+   }
+
+   const Threadable *GetRoot() const { return m_root; }
+   const Threadable& Get(size_t n) const { return m_threadables[n]; }
+
+   // check that the message n is at the expected position in the tree
+   bool Check(size_t n, size_t indent) const
+   {
+      const Threadable& th = m_threadables[n];
+      if (th.getThreadedIndex() == n && th.getIndent() == indent)
+         return true;
+
+      printf("ERROR: message %lu is at %lu with indent %lu instead of %lu\n",
+             (unsigned long)n,
+             (unsigned long)th.getThreadedIndex(),
+             (unsigned long)th.getIndent(),
+             (unsigned long)indent);
+
+      return false;
+   }
+
+private:
+   std::vector<HeaderInfo> m_headers;
+   std::vector<Threadable> m_threadables;
+   const Threadable *m_root;
+};
+
+// each message is a reply to the previous one
+static bool TestDeepThread(const ThreadParams& thrParams, size_t count)
+{
+   JWZThreadingTest test(count);
+   for (size_t n = 0; n < count; n++)
+   {
+      // only put the last few ancestors in References, like the real
+      // mailers which truncate it
+      String refs;
+      for (size_t m = n > 5 ? n - 5 : 0; m < n; m++)
+         refs += JWZThreadingTest::MakeId(m);
+
+      test.SetMessage(n, n ? _T("Re: deep") : _T("deep"), refs);
+   }
+
+   printf("Deep thread of %lu messages: ", (unsigned long)count);
+   fflush(stdout);
+   long ms = test.Thread(thrParams);
+
+   bool ok = test.GetRoot() == &test.Get(0);
+   for (size_t n = 0; ok && n < count; n++)
+   {
+      ok = test.Check(n, n) &&
+           test.Get(n).getNext() == 0 &&
+           test.Get(n).getChild() == (n + 1 < count ? &test.Get(n + 1) : 0);
+   }
+
+   printf("%s (%ldms)\n", ok ? "ok" : "ERROR", ms);
+
+   return ok;
+}
+
+// all messages are replies to the first one
+static bool TestWideThread(const ThreadParams& thrParams, size_t count)
+{
+   JWZThreadingTest test(count);
+   for (size_t n = 0; n < count; n++)
+   {
+      test.SetMessage(n, n ? _T("Re: wide") : _T("wide"),
+                      n ? JWZThreadingTest::MakeId(0) : String());
+   }
+
+   printf("Wide thread of %lu messages: ", (unsigned long)count);
+   fflush(stdout);
+   long ms = test.Thread(thrParams);
+
+   bool ok = test.GetRoot() == &test.Get(0) &&
+             test.Check(0, 0) &&
+             test.Get(0).getNext() == 0;
+
+   size_t n = 1;
+   for (const Threadable *th = test.Get(0).getChild();
+        ok && th;
+        th = th->getNext(), n++)
+   {
+      ok = th == &test.Get(n) && test.Check(n, 1) && th->getChild() == 0;
+   }
+
+   if (ok && n != count)
+   {
+      printf("ERROR: %lu replies instead of %lu ",
+             (unsigned long)(n - 1), (unsigned long)(count - 1));
+      ok = false;
+   }
+
+   printf("%s (%ldms)\n", ok ? "ok" : "ERROR", ms);
+
+   return ok;
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   // the deep thread must remain under MAX_THREAD_DEPTH
+   unsigned long count = 50000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &count) != 1 || count < 2 ||
+                     count >= MAX_THREAD_DEPTH) )
+   {
+      fprintf(stderr, "Usage: %s [number of messages]\n", argv[0]);
+      return 2;
+   }
+
+   ThreadParams thrParams;
+   thrParams.gatherSubjects =
+   thrParams.breakThread = true;
+
+   bool ok = TestDeepThread(thrParams, count);
+   if ( !TestWideThread(thrParams, count) )
+      ok = false;
+
+   return ok ? 0 : 1;
+}
+
+#endif // TEST_THREADING
+
 #endif // TEST_SUBJECT_NORMALIZE/!TEST_SUBJECT_NORMALIZE
 
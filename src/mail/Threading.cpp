@@ -107,6 +107,7 @@ ThreadData::ThreadData(MsgnoType count)
    m_children = new MsgnoType[count];
    m_indents = new size_t[count];
    m_root = 0;
+   m_jwzIndex = NULL;
 }
 
 void ThreadData::killTree()
@@ -116,6 +117,9 @@ void ThreadData::killTree()
       mail_free_threadnode(&m_root);
       m_root = NULL;
    }
+
+   // the index refers to the nodes of the tree, so it can't be used any more
+   killIndex();
 }
 
 ThreadData::~ThreadData()
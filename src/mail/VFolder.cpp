@@ -293,26 +293,46 @@ MailFolderVirt::Msg *MailFolderVirt::GetMsgFromMsgno(MsgnoType msgno) const
    return m_messages[msgno - 1];
 }
 
-MailFolderVirt::Msg *MailFolderVirt::GetMsgFromUID(UIdType uid) const
-{
-   MsgCookie cookie;
-   for ( Msg *msg = GetFirstMsg(cookie); msg; msg = GetNextMsg(cookie) )
+size_t MailFolderVirt::GetIndexFromUID(UIdType uid) const
+{
+   // as the messages are only ever appended to m_messages with increasing
+   // UIDs (see AddMsg()) and removed from it, the array is always sorted by
+   // UID and we can use binary search instead of checking all messages
+   size_t lo = 0,
+          hi = m_messages.GetCount();
+   while ( lo < hi )
    {
-      if ( msg->uidVirt == uid )
-      {
-         return msg;
-      }
+      const size_t mid = lo + (hi - lo) / 2;
+      if ( m_messages[mid]->uidVirt < uid )
+         lo = mid + 1;
+      else
+         hi = mid;
    }
 
-   FAIL_MSG( _T("no message with such UID in the virtual folder") );
+   if ( lo == m_messages.GetCount() || m_messages[lo]->uidVirt != uid )
+      return (size_t)-1;
 
-   return NULL;
+   return lo;
+}
+
+MailFolderVirt::Msg *MailFolderVirt::GetMsgFromUID(UIdType uid) const
+{
+   const size_t n = GetIndexFromUID(uid);
+
+   CHECK( n != (size_t)-1, NULL,
+          _T("no message with such UID in the virtual folder") );
+
+   return m_messages[n];
 }
 
 void MailFolderVirt::AddMsg(MailFolderVirt::Msg *msg)
 {
    CHECK_RET( msg, _T("NULL Msg in MailFolderVirt?") );
 
+   ASSERT_MSG( m_messages.IsEmpty() ||
+                  m_messages.Last()->uidVirt < msg->uidVirt,
+               _T("messages must be added in increasing UID order") );
+
    m_underlyingMFs.insert(msg->mf);
 
    m_messages.Add(msg);
@@ -536,17 +556,9 @@ bool MailFolderVirt::DoCountMessages(MailFolderStatus *status) const
 
 MsgnoType MailFolderVirt::GetMsgnoFromUID(UIdType uid) const
 {
-   MsgnoType n = 1;
-   MsgCookie cookie;
-   for ( Msg *msg = GetFirstMsg(cookie); msg; msg = GetNextMsg(cookie), n++ )
-   {
-      if ( msg->uidVirt == uid )
-      {
-         return n;
-      }
-   }
+   const size_t n = GetIndexFromUID(uid);
 
-   return MSGNO_ILLEGAL;
+   return n == (size_t)-1 ? MSGNO_ILLEGAL : n + 1;
 }
 
 // ----------------------------------------------------------------------------
@@ -672,6 +684,12 @@ bool MailFolderVirt::AppendMessage(const Message& msg)
    // use the new UID for the new message
    AddMsg(new Msg(mf, uidPhys, ++m_uidLast, hi->GetStatus()));
 
+   // let the listing know about the new message if it had been already
+   // created, the caller is responsible for calling RequestUpdate() to show
+   // it in the GUI
+   if ( m_headers )
+      m_headers->OnAdd(GetMsgCount());
+
    return true;
 }
 
@@ -682,6 +700,13 @@ bool MailFolderVirt::AppendMessage(const String& /* msg */)
    return false;
 }
 
+bool MailFolderVirt::AppendMessages(const RawMessages& /* msgs */)
+{
+   FAIL_MSG( _T("AppendMessages() can't be used with virtual folder") );
+
+   return false;
+}
+
 void MailFolderVirt::ExpungeMessages()
 {
    MsgCookie cookie;
@@ -41,10 +41,17 @@
 #include "mail/MimeDecode.h"
 #include "UIdArray.h"
 #include "Message.h"
+#include "ASMailFolder.h"            // for UpdateProgress()
 
 #include "gui/wxMDialogs.h"             // for MProgressDialog
 
 #include <wx/regex.h>   // wxRegEx::Flags
+#include <wx/hashmap.h>
+#include <wx/stopwatch.h>
+#include <wx/thread.h>
+
+#include <map>
+#include <vector>
 
 #ifdef USE_PYTHON
 #    include "MPython.h"      // Python fix for PyObject / presult
@@ -69,6 +76,14 @@ static String gs_spamTest;                // MT-FIXME
 // constants
 // ----------------------------------------------------------------------------
 
+// the trace mask for filter compilation and execution
+#define TRACE_FILTERS _T("filters")
+
+// the minimal and maximal number of messages checked for spam at once by
+// FilterRuleImpl::GetSpamVerdict()
+static const size_t SPAM_CHECK_CHUNK_MIN = 8;
+static const size_t SPAM_CHECK_CHUNK_MAX = 128;
+
 // all recipient headers, more can be added (but always NULL terminate!)
 static const char *headersRecipients[] =
 {
@@ -98,6 +113,7 @@ class SyntaxNode;
 class Token;
 class Value;
 class FilterRuleApply;
+class FilterProgram;
 
 /// Type for functions to be called.
 typedef Value (* FunctionPointer)(ArgList *args, FilterRuleImpl *p);
@@ -188,6 +204,35 @@ private:
    String    m_string;
 };
 
+/** The message data used by a filter program.
+
+    This is computed once for the entire program when it is parsed and used
+    to retrieve the data for many messages at once before evaluating it.
+*/
+struct FilterDataNeeds
+{
+   FilterDataNeeds() { what = 0; }
+
+   /// add a header to the list of the headers we need
+   void AddHeader(const String& name)
+   {
+      what |= MailFolder::Prefetch_HeaderLines;
+
+      // header names are case-insensitive
+      if ( headers.Index(name, false /* no case */) == wxNOT_FOUND )
+         headers.Add(name);
+   }
+
+   /// combination of MailFolder::PrefetchData bits
+   int what;
+
+   /// the names of the headers needed for MailFolder::Prefetch_HeaderLines
+   wxArrayString headers;
+
+   /// the constant parameters of isspam() calls in the program
+   wxArrayString spamParams;
+};
+
 /** Parsed representation of a filtering rule to be applied to a
     message.
 */
@@ -263,6 +308,30 @@ public:
    /// check if a function is already defined
    const FunctionDefinition *FindFunction(const String &name);
 
+   /// replace the expression with its value if it is constant
+   const SyntaxNode *Fold(const SyntaxNode *sn);
+
+   /**@name regular expressions with constant patterns */
+   //@{
+
+   /// compile the regex only once instead of doing it for each message
+   void PrecompileRegEx(const SyntaxNode *pattern, int flags);
+
+   /// get the precompiled regex (may be NULL if it is invalid) if we have it
+   bool GetPrecompiledRegEx(const SyntaxNode *pattern,
+                            strutil_RegEx **re) const;
+
+   //@}
+
+   /**@name spam checks done for all messages at once */
+   //@{
+
+   /// get the result of isspam(param) for the current message, checking it
+   /// together with the next messages if it hadn't been done yet
+   bool GetSpamVerdict(const String& param, bool *isSpam, String *result);
+
+   //@}
+
    /**@name for runtime information */
    //@{
 
@@ -317,11 +386,21 @@ private:
    Token token;              // current token
    size_t m_Position;        // seek offset of current token
    size_t m_Peek;            // seek offset of next token
-   const SyntaxNode *m_Program; // compiled filter program
+   const SyntaxNode *m_Program; // parsed filter program
+   FilterProgram *m_Code;       // and its compiled form, never NULL
+
+   // the regexes precompiled by PrecompileRegEx()
+   class FilterRegExCache *m_regexCache;
+
+   // the number of constant expressions replaced by their values in Fold()
+   size_t m_countFolded;
 
    // the UID of the message we're currently filtering
    UIdType m_MessageUId;
 
+   // and its index in the array of all messages being filtered
+   size_t m_MessageIndex;
+
    // the message itself
    Message *m_MailMessage;
 
@@ -334,11 +413,37 @@ private:
    // the folder the message was copied or moved to or empty
    String m_copiedTo;
 
-   // the optimization hints - set in FindFunction(), used in Apply()
-   bool m_hasToFunc,
-        m_hasRcptFunc,
-        m_hasHdrLineFunc,
-        m_hasHeaderFunc;
+   // the message data used by the program, computed in the ctor
+   FilterDataNeeds m_needs;
+
+   // the results of isspam() calls for the messages being filtered: they
+   // are computed for several messages at once, but only when isspam() is
+   // really called for the first of them
+   struct SpamVerdicts
+   {
+      // -1 if the message hadn't been checked yet, the result otherwise
+      std::vector<int> isSpam;
+      wxArrayString results;
+
+      // the data for letting the spam filters learn from the checked
+      // messages when their results are used and its index for each message
+      SpamLearnData *learn;
+      std::vector<size_t> learnIndex;
+
+      // the messages checked the last time and how many of them were used
+      size_t chunk,
+             used;
+   };
+
+   // check the messages starting from the current one with isspam(param)
+   void CheckSpamChunk(const String& param, SpamVerdicts& verdicts);
+
+   // the results for all needs.spamParams, only valid inside
+   // FilterRuleApply::LoopEvaluate()
+   std::map<String, SpamVerdicts> m_spamVerdicts;
+
+   // the messages being filtered, also only valid inside LoopEvaluate()
+   const UIdArray *m_spamMsgs;
 
    friend class FilterRuleApply;
 
@@ -450,6 +555,10 @@ private:
    MOBJECT_NAME(Value)
 };
 
+// the map from the destination folder name to the index of the corresponding
+// FilterRuleApply::CopyGroup
+WX_DECLARE_STRING_HASH_MAP(size_t, FilterDestinationIndex);
+
 // an object of this class is created to apply the given rule to the specified
 // messages, it is a sort of "filter runner"
 class FilterRuleApply
@@ -461,6 +570,17 @@ public:
    int Run();
 
 private:
+   // all messages copied to the same folder, see LoopCopy()
+   struct CopyGroup
+   {
+      // the destination folder
+      String destination;
+
+      // the messages to copy and their indices in m_msgs
+      UIdArray uids;
+      wxArrayLong indices;
+   };
+
    bool LoopEvaluate();
    bool LoopCopy();
    bool DeleteAll();
@@ -473,10 +593,12 @@ private:
    String CreditsForStatusBar();
    String ResultsMessage();
    bool UpdateProgressDialog();
+   void Prefetch();
+   void CheckSpam();
    void HeaderCacheHints();
    bool Evaluate();
    bool ProgressCopy();
-   bool CopyToOneFolder();
+   bool CopyToOneFolder(const CopyGroup& group);
    void CollectForDelete();
    void ProgressDelete();
    void IndicateDeleted();
@@ -507,6 +629,110 @@ private:
    Value m_retval;
 };
 
+// ----------------------------------------------------------------------------
+// FilterProgram: the compiled filter program
+// ----------------------------------------------------------------------------
+
+/// Types of the functions implementing the operators
+typedef Value (*UnaryOpFunc)(const Value& value);
+typedef Value (*BinaryOpFunc)(const Value& left, const Value& right);
+
+/**
+   FilterProgram is the syntax tree lowered to a flat array of instructions.
+
+   The control flow of the program (sequences of statements, if/else, the ?:
+   operator and short-circuiting && and ||) and the operators are executed
+   by a simple stack machine instead of walking the tree recursively. The
+   function calls still use the syntax tree for their arguments because the
+   built-in functions decide themselves which arguments to evaluate.
+ */
+class FilterProgram
+{
+public:
+   /// the instruction codes
+   enum OpCode
+   {
+      Op_Push,          // push the constant value
+      Op_Eval,          // push the value of the syntax node
+      Op_Unary,         // replace the top value with unary(top)
+      Op_Binary,        // replace two top values with binary(left, right)
+      Op_Pop,           // discard the top value
+      Op_PopOrHalt,     // stop if the top value aborts, otherwise discard it
+      Op_Jump,          // jump unconditionally
+      Op_JumpIfFalse,   // jump if the top value is false, keep it
+      Op_JumpIfTrue,    // jump if the top value is true, keep it
+      Op_PopJumpIfFalse // discard the top value and jump if it was false
+   };
+
+   FilterProgram() { }
+
+   /// get the number of instructions
+   size_t GetCount() const { return m_code.size(); }
+
+   /**@name Functions used by SyntaxNode::Compile() */
+   //@{
+
+   /// add an instruction without parameters
+   void Emit(OpCode op) { m_code.push_back(Instr(op)); }
+
+   /// add Op_Push instruction
+   void EmitPush(const Value& value)
+      { Emit(Op_Push); m_code.back().value = value; }
+
+   /// add Op_Eval instruction
+   void EmitEval(const SyntaxNode *node)
+      { Emit(Op_Eval); m_code.back().node = node; }
+
+   /// add Op_Unary instruction
+   void EmitUnary(UnaryOpFunc unary)
+      { Emit(Op_Unary); m_code.back().unary = unary; }
+
+   /// add Op_Binary instruction
+   void EmitBinary(BinaryOpFunc binary)
+      { Emit(Op_Binary); m_code.back().binary = binary; }
+
+   /// add a jump instruction, return its index to pass to SetJumpTarget()
+   size_t EmitJump(OpCode op) { Emit(op); return m_code.size() - 1; }
+
+   /// make the jump go to the next instruction to be emitted
+   void SetJumpTarget(size_t jump) { m_code[jump].target = m_code.size(); }
+
+   //@}
+
+   /// run the program and return its result
+   Value Run() const;
+
+private:
+   struct Instr
+   {
+      Instr(OpCode op_) : op(op_)
+      {
+         node = NULL;
+         unary = NULL;
+         binary = NULL;
+         target = 0;
+      }
+
+      OpCode op;
+
+      // the parameters, only the one corresponding to op is used
+      Value value;
+      const SyntaxNode *node;
+      UnaryOpFunc unary;
+      BinaryOpFunc binary;
+      size_t target;
+   };
+
+   std::vector<Instr> m_code;
+
+   DECLARE_NO_COPY_CLASS(FilterProgram)
+};
+
+// the map used by FilterRuleImpl::PrecompileRegEx()
+WX_DECLARE_HASH_MAP(const SyntaxNode *, strutil_RegEx *,
+                    wxPointerHash, wxPointerEqual,
+                    FilterRegExCache);
+
 // ----------------------------------------------------------------------------
 // ABC for syntax tree nodes.
 // ----------------------------------------------------------------------------
@@ -520,6 +746,15 @@ public:
    virtual const Value Evaluate(void) const = 0;
    virtual String ToString(void) const
       { return Evaluate().ToString(); }
+
+   /// can the value of this node be computed without any message?
+   virtual bool IsConstant(void) const { return false; }
+
+   /// append the instructions evaluating this node to the program
+   virtual void Compile(FilterProgram& pgm) const { pgm.EmitEval(this); }
+
+   /// add the message data needed to evaluate this node to needs
+   virtual void GetNeeds(FilterDataNeeds& WXUNUSED(needs)) const { }
 #ifdef DEBUG
    virtual String Debug(void) const = 0;
 #endif
@@ -550,6 +785,19 @@ public:
          // tail recursion, so no add'l stack frame
          return m_Next->Evaluate();
       }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         MOcheck();
+
+         m_Rule->Compile(pgm);
+         pgm.Emit(FilterProgram::Op_PopOrHalt);
+         m_Next->Compile(pgm);
+      }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      {
+         m_Rule->GetNeeds(needs);
+         m_Next->GetNeeds(needs);
+      }
 
 protected:
    const SyntaxNode *m_Rule,
@@ -602,6 +850,8 @@ class Number : public SyntaxNode
 public:
    Number(long v) { m_value = v; }
    virtual const Value Evaluate() const { MOcheck(); return m_value; }
+   virtual bool IsConstant() const { return true; }
+   virtual void Compile(FilterProgram& pgm) const { pgm.EmitPush(m_value); }
 #ifdef DEBUG
    virtual String Debug(void) const
       { MOcheck(); String s; s.Printf(_T("%ld"), m_value); return s; }
@@ -617,6 +867,8 @@ public:
    StringConstant(String v) : m_String(v) {}
    virtual const Value Evaluate() const
       { MOcheck(); return m_String; }
+   virtual bool IsConstant() const { return true; }
+   virtual void Compile(FilterProgram& pgm) const { pgm.EmitPush(m_String); }
 
 #ifdef DEBUG
    virtual String Debug(void) const
@@ -633,6 +885,11 @@ private:
    DECLARE_NO_COPY_CLASS(StringConstant)
 };
 
+static Value LogicalNot(const Value& v)
+{
+   return ! (v.MakeNumber() ? v.GetNumber() : (long)v.GetString().Length());
+}
+
 class Negation : public SyntaxNode
 {
 public:
@@ -641,10 +898,16 @@ public:
    virtual const Value Evaluate() const
       {
          MOcheck();
-         Value v = m_Sn->Evaluate();
-         return ! (v.MakeNumber() ?
-            v.GetNumber() : (long)v.GetString().Length());
+         return LogicalNot(m_Sn->Evaluate());
       }
+   virtual bool IsConstant() const { return m_Sn->IsConstant(); }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         m_Sn->Compile(pgm);
+         pgm.EmitUnary(LogicalNot);
+      }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      { m_Sn->GetNeeds(needs); }
 #ifdef DEBUG
    virtual String Debug(void) const
       {
@@ -659,6 +922,11 @@ private:
    MOBJECT_NAME(Negation)
 };
 
+static Value ArithmeticNegate(const Value& v)
+{
+   return -(v.MakeNumber() ? v.GetNumber() : (long)v.GetString().Length());
+}
+
 class Negative : public SyntaxNode
 {
 public:
@@ -667,10 +935,16 @@ public:
    virtual const Value Evaluate() const
       {
          MOcheck();
-         Value v = m_Sn->Evaluate();
-         return -(v.MakeNumber() ?
-            v.GetNumber() : (long)v.GetString().Length());
+         return ArithmeticNegate(m_Sn->Evaluate());
+      }
+   virtual bool IsConstant() const { return m_Sn->IsConstant(); }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         m_Sn->Compile(pgm);
+         pgm.EmitUnary(ArithmeticNegate);
       }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      { m_Sn->GetNeeds(needs); }
 #ifdef DEBUG
    virtual String Debug(void) const
       {
@@ -758,6 +1032,64 @@ private:
    MOBJECT_NAME(ArgList)
 };
 
+// add the message data used by the builtin function with the given name
+static void
+GetFunctionNeeds(const String& name, const ArgList *args, FilterDataNeeds& needs)
+{
+   if ( name == _T("subject") || name == _T("from") ||
+        name == _T("date") || name == _T("size") ||
+        name == _T("hasflag") || name == _T("isfromme") )
+   {
+      needs.what |= MailFolder::Prefetch_Overview;
+   }
+   else if ( name == _T("to") )
+   {
+      needs.AddHeader(_T("To"));
+   }
+   else if ( name == _T("recipients") || name == _T("istome") )
+   {
+      for ( const char **h = headersRecipients; *h; h++ )
+         needs.AddHeader(wxString::FromAscii(*h));
+
+      if ( name == _T("istome") )
+         needs.AddHeader(_T("List-Post"));
+   }
+   else if ( name == _T("headerline") )
+   {
+      // we can only know which header is used if it's a constant
+      if ( args->Count() == 1 && args->GetArg(0)->IsConstant() )
+         needs.AddHeader(args->GetArg(0)->Evaluate().ToString());
+      else
+         needs.what |= MailFolder::Prefetch_Header;
+   }
+   else if ( name == _T("header") )
+   {
+      needs.what |= MailFolder::Prefetch_Header;
+   }
+   else if ( name == _T("body") || name == _T("text") )
+   {
+      needs.what |= MailFolder::Prefetch_Text;
+   }
+   else if ( name == _T("isspam") || name == _T("python") ||
+             name == _T("print") )
+   {
+      // we can check all messages for spam at once if we know the parameter
+      if ( name == _T("isspam") &&
+               args->Count() == 1 && args->GetArg(0)->IsConstant() )
+      {
+         const String param(args->GetArg(0)->Evaluate().GetString());
+         if ( needs.spamParams.Index(param) == wxNOT_FOUND )
+            needs.spamParams.Add(param);
+      }
+
+      // we don't know what these functions use, so suppose they need all
+      needs.what |= MailFolder::Prefetch_Overview |
+                    MailFolder::Prefetch_Header |
+                    MailFolder::Prefetch_Text;
+   }
+   //else: the other functions don't use the message data at all
+}
+
 class FunctionCall : public SyntaxNode
 {
 public:
@@ -777,6 +1109,33 @@ public:
          MOcheck();
          return (*m_fd->GetFPtr())(m_args, m_Parser);
       }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         MOcheck();
+
+         // the regex functions are called for each message, so don't compile
+         // the same constant pattern again and again
+         const String name(m_fd->GetName());
+         if ( (name == _T("matchregex") || name == _T("matchregexi")) &&
+                  m_args->Count() == 2 && m_args->GetArg(1)->IsConstant() )
+         {
+            m_Parser->PrecompileRegEx(m_args->GetArg(1),
+                                      name == _T("matchregexi") ? wxRE_ICASE
+                                                                : 0);
+         }
+
+         pgm.EmitEval(this);
+      }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      {
+         MOcheck();
+
+         const size_t count = m_args->Count();
+         for ( size_t n = 0; n < count; n++ )
+            m_args->GetArg(n)->GetNeeds(needs);
+
+         GetFunctionNeeds(m_fd->GetName(), m_args, needs);
+      }
 #ifdef DEBUG
    virtual String Debug(void) const
       {
@@ -816,6 +1175,28 @@ public:
               ? m_Left->Evaluate()
               : m_Right->Evaluate();
       }
+   virtual bool IsConstant(void) const
+      {
+         return m_Cond->IsConstant() &&
+                  m_Left->IsConstant() && m_Right->IsConstant();
+      }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         m_Cond->Compile(pgm);
+         const size_t jumpRight =
+            pgm.EmitJump(FilterProgram::Op_PopJumpIfFalse);
+         m_Left->Compile(pgm);
+         const size_t jumpEnd = pgm.EmitJump(FilterProgram::Op_Jump);
+         pgm.SetJumpTarget(jumpRight);
+         m_Right->Compile(pgm);
+         pgm.SetJumpTarget(jumpEnd);
+      }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      {
+         m_Cond->GetNeeds(needs);
+         m_Left->GetNeeds(needs);
+         m_Right->GetNeeds(needs);
+      }
 #ifdef DEBUG
    virtual String Debug(void) const
       {
@@ -851,6 +1232,13 @@ public:
          delete m_Left;
          delete m_Right;
       }
+   virtual bool IsConstant(void) const
+      { return m_Left->IsConstant() && m_Right->IsConstant(); }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      {
+         m_Left->GetNeeds(needs);
+         m_Right->GetNeeds(needs);
+      }
 #ifdef DEBUG
    virtual const wxChar *OperName(void) const = 0;
    String Debug(void) const
@@ -888,25 +1276,22 @@ static inline Value operator oper(const Value &left, const Value &right) \
    return Value(); \
 }
 
-#ifdef DEBUG
-#define IMPLEMENT_OP(name, oper, string) \
-IMPLEMENT_VALUE_OP(oper, string); \
-class Operator##name : Expression \
-{ \
-public: \
-   Operator##name(const SyntaxNode *l, const SyntaxNode *r) \
-      : Expression(l, r) {} \
-   static const SyntaxNode *Create(const SyntaxNode *l, const SyntaxNode *r) \
-      { return new Operator##name(l, r); } \
-   virtual const Value Evaluate(void) const \
-      { return m_Left->Evaluate() oper m_Right->Evaluate(); } \
-   virtual const wxChar *OperName(void) const { return _T(#oper); } \
-}
+/* The foldable parameter of IMPLEMENT_OP() is the condition which must be
+   satisfied, in addition to both operands being constant, for the
+   expression to be evaluated during parsing: this allows to avoid dividing
+   by 0 before the filter is even executed. */
 
+#ifdef DEBUG
+#define IMPLEMENT_OP_DEBUG(oper) \
+   virtual const wxChar *OperName(void) const { return _T(#oper); }
 #else        // not DEBUGing
+#define IMPLEMENT_OP_DEBUG(oper)
+#endif
 
-#define IMPLEMENT_OP(name, oper, string) \
+#define IMPLEMENT_OP(name, oper, string, foldable) \
 IMPLEMENT_VALUE_OP(oper, string) \
+static Value Apply##name(const Value& left, const Value& right) \
+   { return left oper right; } \
 class Operator##name : Expression \
 { \
 public: \
@@ -916,24 +1301,43 @@ public: \
       { return new Operator##name(l, r); } \
    virtual const Value Evaluate(void) const \
       { return m_Left->Evaluate() oper m_Right->Evaluate(); } \
+   virtual bool IsConstant(void) const \
+      { return Expression::IsConstant() && (foldable); } \
+   virtual void Compile(FilterProgram& pgm) const \
+      { \
+         m_Left->Compile(pgm); \
+         m_Right->Compile(pgm); \
+         pgm.EmitBinary(Apply##name); \
+      } \
+   IMPLEMENT_OP_DEBUG(oper) \
+}
+
+// used as foldable parameter of IMPLEMENT_OP() for division operators
+static inline bool IsNonZero(const SyntaxNode *sn)
+{
+   return sn->Evaluate().ToNumber() != 0;
 }
-#endif
 
-IMPLEMENT_OP(Plus,+,GetString());
-IMPLEMENT_OP(Minus,-,GetString().Length());
-IMPLEMENT_OP(Times,*,GetString().Length());
-IMPLEMENT_OP(Divide,/,GetString().Length());
-IMPLEMENT_OP(Mod,%,GetString().Length());
+IMPLEMENT_OP(Plus,+,GetString(),true);
+IMPLEMENT_OP(Minus,-,GetString().Length(),true);
+IMPLEMENT_OP(Times,*,GetString().Length(),true);
+IMPLEMENT_OP(Divide,/,GetString().Length(),IsNonZero(m_Right));
+IMPLEMENT_OP(Mod,%,GetString().Length(),IsNonZero(m_Right));
 
-IMPLEMENT_OP(Less, <, GetString());
-IMPLEMENT_OP(Leq, <=, GetString());
-IMPLEMENT_OP(Greater, >, GetString());
-IMPLEMENT_OP(Geq, >=, GetString());
-IMPLEMENT_OP(Equal, ==, GetString());
-IMPLEMENT_OP(Neq, !=, GetString());
+IMPLEMENT_OP(Less, <, GetString(), true);
+IMPLEMENT_OP(Leq, <=, GetString(), true);
+IMPLEMENT_OP(Greater, >, GetString(), true);
+IMPLEMENT_OP(Geq, >=, GetString(), true);
+IMPLEMENT_OP(Equal, ==, GetString(), true);
+IMPLEMENT_OP(Neq, !=, GetString(), true);
 
 // special logic for AND
 IMPLEMENT_VALUE_OP(&&, GetString().Length());
+static Value ApplyAnd(const Value& left, const Value& right)
+{
+   return left && right;
+}
+
 class OperatorAnd : Expression
 {
 public:
@@ -948,6 +1352,14 @@ public:
 
          return lv;
       }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         m_Left->Compile(pgm);
+         const size_t jumpEnd = pgm.EmitJump(FilterProgram::Op_JumpIfFalse);
+         m_Right->Compile(pgm);
+         pgm.EmitBinary(ApplyAnd);
+         pgm.SetJumpTarget(jumpEnd);
+      }
 #ifdef DEBUG
    virtual const wxChar *OperName(void) const { return _T("&&"); }
 #endif
@@ -955,6 +1367,11 @@ public:
 
 // special logic for OR
 IMPLEMENT_VALUE_OP(||, GetString().Length());
+static Value ApplyOr(const Value& left, const Value& right)
+{
+   return left || right;
+}
+
 class OperatorOr : Expression
 {
 public:
@@ -969,6 +1386,14 @@ public:
 
          return lv;
       }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         m_Left->Compile(pgm);
+         const size_t jumpEnd = pgm.EmitJump(FilterProgram::Op_JumpIfTrue);
+         m_Right->Compile(pgm);
+         pgm.EmitBinary(ApplyOr);
+         pgm.SetJumpTarget(jumpEnd);
+      }
 #ifdef DEBUG
    virtual const wxChar *OperName(void) const { return _T("||"); }
 #endif
@@ -1006,6 +1431,36 @@ public:
 
          return rc;
       }
+   virtual void Compile(FilterProgram& pgm) const
+      {
+         MOcheck();
+
+         // as in Evaluate(), the value of the condition is the result if it
+         // is false and there is no else branch
+         m_Condition->Compile(pgm);
+         const size_t jumpElse = pgm.EmitJump(FilterProgram::Op_JumpIfFalse);
+         pgm.Emit(FilterProgram::Op_Pop);
+         m_IfBlock->Compile(pgm);
+         if ( m_ElseBlock )
+         {
+            const size_t jumpEnd = pgm.EmitJump(FilterProgram::Op_Jump);
+            pgm.SetJumpTarget(jumpElse);
+            pgm.Emit(FilterProgram::Op_Pop);
+            m_ElseBlock->Compile(pgm);
+            pgm.SetJumpTarget(jumpEnd);
+         }
+         else
+         {
+            pgm.SetJumpTarget(jumpElse);
+         }
+      }
+   virtual void GetNeeds(FilterDataNeeds& needs) const
+      {
+         m_Condition->GetNeeds(needs);
+         m_IfBlock->GetNeeds(needs);
+         if ( m_ElseBlock )
+            m_ElseBlock->GetNeeds(needs);
+      }
 #ifdef DEBUG
    virtual String Debug(void) const
       {
@@ -1029,6 +1484,82 @@ private:
    MOBJECT_NAME(IfElse)
 };
 
+// ----------------------------------------------------------------------------
+// FilterProgram implementation
+// ----------------------------------------------------------------------------
+
+Value FilterProgram::Run() const
+{
+   std::vector<Value> stack;
+   stack.reserve(16);
+
+   const size_t count = m_code.size();
+   for ( size_t pc = 0; pc < count; )
+   {
+      const Instr& instr = m_code[pc++];
+      switch ( instr.op )
+      {
+         case Op_Push:
+            stack.push_back(instr.value);
+            break;
+
+         case Op_Eval:
+            stack.push_back(instr.node->Evaluate());
+            break;
+
+         case Op_Unary:
+            stack.back() = (*instr.unary)(stack.back());
+            break;
+
+         case Op_Binary:
+            {
+               const Value right = stack.back();
+               stack.pop_back();
+               stack.back() = (*instr.binary)(stack.back(), right);
+            }
+            break;
+
+         case Op_PopOrHalt:
+            // don't execute the rest of the program if it was aborted, e.g.
+            // because the message was deleted
+            if ( stack.back().ShouldAbort() )
+               return stack.back();
+            // fall through
+
+         case Op_Pop:
+            stack.pop_back();
+            break;
+
+         case Op_Jump:
+            pc = instr.target;
+            break;
+
+         case Op_JumpIfFalse:
+            if ( !stack.back().ToNumber() )
+               pc = instr.target;
+            break;
+
+         case Op_JumpIfTrue:
+            if ( stack.back().ToNumber() )
+               pc = instr.target;
+            break;
+
+         case Op_PopJumpIfFalse:
+            {
+               const bool cond = stack.back().ToNumber() != 0;
+               stack.pop_back();
+               if ( !cond )
+                  pc = instr.target;
+            }
+            break;
+      }
+   }
+
+   CHECK( stack.size() == 1, Value(), _T("corrupted filter program stack") );
+
+   return stack.back();
+}
+
 static const FunctionList *BuiltinFunctions(void);
 
 const FunctionDefinition *
@@ -1039,25 +1570,157 @@ FilterRuleImpl::FindFunction(const String &name)
    for (FunctionList::iterator i = list->begin(); i != list->end(); ++i)
    {
       if ( name == i->GetName() )
-      {
-         // remember if we have some particular functions - we use it to
-         // optimize filter execution in Apply()
-         if ( name == _T("to") )
-            m_hasToFunc = true;
-         else if ( name == _T("recipients") )
-            m_hasRcptFunc = true;
-         else if ( name == _T("headerline") )
-            m_hasHdrLineFunc = true;
-         else if ( name == _T("header") )
-            m_hasHeaderFunc = true;
-
          return i.operator->();
-      }
    }
 
    return NULL;
 }
 
+const SyntaxNode *
+FilterRuleImpl::Fold(const SyntaxNode *sn)
+{
+   if ( !sn->IsConstant() )
+      return sn;
+
+   const Value v = sn->Evaluate();
+
+   const SyntaxNode *folded;
+   if ( v.IsNumber() )
+      folded = new Number(v.GetNumber());
+   else if ( v.IsString() )
+      folded = new StringConstant(v.GetString());
+   else // type error, leave it to be detected when the filter is executed
+      return sn;
+
+   delete sn;
+
+   m_countFolded++;
+
+   return folded;
+}
+
+void
+FilterRuleImpl::PrecompileRegEx(const SyntaxNode *pattern, int flags)
+{
+   ASSERT_MSG( pattern->IsConstant(), _T("can't precompile variable regex") );
+
+#ifdef TEST
+   // there is no MInterface in the test suite, so we can't compile anything
+   if ( !m_MInterface )
+      return;
+#endif // TEST
+
+   if ( m_regexCache->find(pattern) != m_regexCache->end() )
+      return;
+
+   // notice that we also remember the invalid regexes (as NULL) to avoid
+   // trying (and failing) to compile them again for each message
+   (*m_regexCache)[pattern] = m_MInterface->
+      strutil_compileRegEx(pattern->Evaluate().ToString(), flags);
+}
+
+bool
+FilterRuleImpl::GetPrecompiledRegEx(const SyntaxNode *pattern,
+                                    strutil_RegEx **re) const
+{
+   FilterRegExCache::const_iterator i = m_regexCache->find(pattern);
+   if ( i == m_regexCache->end() )
+      return false;
+
+   *re = i->second;
+
+   return true;
+}
+
+bool
+FilterRuleImpl::GetSpamVerdict(const String& param,
+                               bool *isSpam,
+                               String *result)
+{
+   std::map<String, SpamVerdicts>::iterator i = m_spamVerdicts.find(param);
+   if ( i == m_spamVerdicts.end() )
+      return false;
+
+   SpamVerdicts& verdicts = i->second;
+
+   const size_t idx = m_MessageIndex;
+   if ( idx >= verdicts.isSpam.size() )
+      return false;
+
+   if ( verdicts.isSpam[idx] == -1 )
+      CheckSpamChunk(param, verdicts);
+   else if ( verdicts.used < verdicts.chunk )
+      verdicts.used++;
+
+   // the messages were checked without learning from them as we didn't know
+   // if their results were going to be used, now we do
+   if ( verdicts.learnIndex[idx] < verdicts.learn->GetCount() )
+      verdicts.learn->Learn(verdicts.learnIndex[idx]);
+
+   *isSpam = verdicts.isSpam[idx] == true;
+   *result = verdicts.results[idx];
+
+   return true;
+}
+
+void
+FilterRuleImpl::CheckSpamChunk(const String& param, SpamVerdicts& verdicts)
+{
+   // if all messages checked the last time were really used, check twice as
+   // many of them now, otherwise don't check more than were used as the
+   // others are probably not going to reach isspam() neither
+   size_t chunk;
+   if ( !verdicts.chunk )
+      chunk = SPAM_CHECK_CHUNK_MIN;
+   else if ( verdicts.used == verdicts.chunk )
+      chunk = wxMin(2*verdicts.chunk, SPAM_CHECK_CHUNK_MAX);
+   else
+      chunk = wxMax(verdicts.used, SPAM_CHECK_CHUNK_MIN);
+
+   const size_t count = verdicts.isSpam.size();
+   std::vector<const Message *> msgs;
+   std::vector<size_t> indices;
+   msgs.reserve(chunk);
+   indices.reserve(chunk);
+
+   for ( size_t n = m_MessageIndex; n < count && msgs.size() < chunk; n++ )
+   {
+      if ( verdicts.isSpam[n] != -1 )
+         continue;
+
+      // messages which can't be retrieved are not spam
+      verdicts.isSpam[n] = false;
+
+      Message * const msg = m_MailFolder->GetMessage((*m_spamMsgs)[n]);
+      if ( msg )
+      {
+         indices.push_back(n);
+         msgs.push_back(msg);
+      }
+   }
+
+   std::vector<bool> isSpam;
+   wxArrayString results;
+   const size_t learnFirst = verdicts.learn->GetCount();
+   SpamFilter::CheckIfSpam(msgs, param, isSpam, &results, verdicts.learn);
+
+   for ( size_t n = 0; n < msgs.size(); n++ )
+   {
+      verdicts.isSpam[indices[n]] = isSpam[n];
+      verdicts.results[indices[n]] = results[n];
+      verdicts.learnIndex[indices[n]] = learnFirst + n;
+
+      const_cast<Message *>(msgs[n])->DecRef();
+   }
+
+   // the current message is used, obviously
+   verdicts.chunk = msgs.size();
+   verdicts.used = 1;
+
+   wxLogTrace(TRACE_FILTERS, _T("Checked %lu messages for spam at once"),
+              (unsigned long)msgs.size());
+}
+
 void
 FilterRuleImpl::Error(const String &error)
 {
@@ -1382,6 +2045,28 @@ FilterRuleImpl::ParseIfElse(void)
       }
    }
    // if we reach here, everything was parsed OK:
+
+   // don't keep the branch which can never be executed
+   if ( condition->IsConstant() )
+   {
+      if ( condition->Evaluate().ToNumber() )
+      {
+         delete condition;
+         delete elseBlock;
+         return ifBlock;
+      }
+
+      delete ifBlock;
+      if ( elseBlock )
+      {
+         delete condition;
+         return elseBlock;
+      }
+
+      // the value of the if statement is the value of its condition then
+      return condition;
+   }
+
    return new IfElse(condition, ifBlock, elseBlock);
 }
 
@@ -1503,6 +2188,22 @@ FilterRuleImpl::ParseQueryOp(void)
       delete left; delete sn;
       return NULL;
    }
+
+   // don't keep the branch which can never be evaluated
+   if ( sn->IsConstant() )
+   {
+      const bool cond = sn->Evaluate().ToNumber() != 0;
+      delete sn;
+      if ( cond )
+      {
+         delete right;
+         return left;
+      }
+
+      delete left;
+      return right;
+   }
+
    return new QueryOp(sn, left, right);
 }
 
@@ -1537,7 +2238,7 @@ FilterRuleImpl::Parse##name(void) \
          Error(msg); \
          return NULL; \
       } \
-      expr = (*op)(expr, exp); \
+      expr = Fold((*op)(expr, exp)); \
    } \
    return expr; \
 }
@@ -1675,7 +2376,7 @@ FilterRuleImpl::ParseRelational(void)
       Error(_("Expected expression after relational operator"));
       return NULL;
    }
-   return (*op)(expr, exp);
+   return Fold((*op)(expr, exp));
 }
 
 static inline OpCreate
@@ -1746,7 +2447,7 @@ FilterRuleImpl::ParseUnary(void)
             Error(_("Expected unary after negation operator."));
             return NULL;
          }
-         sn = new Negation(sn);
+         sn = Fold(new Negation(sn));
       }
    }
    else if( token.IsOperator() )
@@ -1769,7 +2470,7 @@ FilterRuleImpl::ParseUnary(void)
             sn = ParseUnary();
             if (sn == NULL)
                return NULL;
-            sn = new Negative(sn);
+            sn = Fold(new Negative(sn));
          }
       }
    }
@@ -1872,17 +2573,21 @@ FilterRuleImpl::ParseFunctionCall(Token id)
 
 static Value func_isspam(ArgList *args, FilterRuleImpl *p)
 {
-   Message_obj msg(p->GetMessage());
-   if ( !msg )
-      return false;
-
-   wxArrayString params;
    if ( args->Count() != 1 )
       return 0;
 
    const wxString param(args->GetArg(0)->Evaluate().GetString());
    gs_spamTest.clear();
 
+   // check several messages at once when filtering many of them
+   bool isSpam;
+   if ( p->GetSpamVerdict(param, &isSpam, &gs_spamTest) )
+      return isSpam;
+
+   Message_obj msg(p->GetMessage());
+   if ( !msg )
+      return false;
+
    return SpamFilter::CheckIfSpam(*msg, param, &gs_spamTest);
 }
 
@@ -1968,16 +2673,23 @@ static Value DoMatchRegEx(ArgList *args, FilterRuleImpl *p, int flags = 0)
    if(args->Count() != 2)
       return 0;
    const Value v1 = args->GetArg(0)->Evaluate();
-   const Value v2 = args->GetArg(1)->Evaluate();
    String haystack = v1.ToString();
-   String needle = v2.ToString();
-   strutil_RegEx * re = p->GetInterface()->
-                           strutil_compileRegEx(needle, flags);
+
+   // use the regex compiled when the filter was compiled if possible
+   strutil_RegEx * re;
+   const bool precompiled = p->GetPrecompiledRegEx(args->GetArg(1), &re);
+   if ( !precompiled )
+   {
+      const Value v2 = args->GetArg(1)->Evaluate();
+      String needle = v2.ToString();
+      re = p->GetInterface()->strutil_compileRegEx(needle, flags);
+   }
    if(! re) return FALSE;
 
    // yes, 0, don't use flags here
    bool rc = p->GetInterface()->strutil_matchRegEx(re, haystack, 0);
-   p->GetInterface()->strutil_freeRegEx(re);
+   if ( !precompiled )
+      p->GetInterface()->strutil_freeRegEx(re);
    return rc;
 }
 
@@ -2614,13 +3326,42 @@ FilterRuleImpl::FilterRuleImpl(const char* filterrule,
    m_FilterModule->IncRef();
 #endif
 
-   m_hasToFunc =
-   m_hasRcptFunc =
-   m_hasHdrLineFunc =
-   m_hasHeaderFunc = false;
+   m_regexCache = new FilterRegExCache;
+   m_countFolded = 0;
 
    m_Program = Parse(filterrule);
+
+   m_Code = new FilterProgram;
+   if ( m_Program )
+   {
+      m_Program->Compile(*m_Code);
+
+      wxLogTrace(TRACE_FILTERS,
+                 _T("Compiled filter program: %lu instructions, ")
+                 _T("%lu constants folded, %lu regexes precompiled"),
+                 (unsigned long)m_Code->GetCount(),
+                 (unsigned long)m_countFolded,
+                 (unsigned long)m_regexCache->size());
+
+      // find out which message data we need to run the program, this allows
+      // to avoid retrieving the parts of the messages not used by it
+      m_Program->GetNeeds(m_needs);
+
+      wxLogTrace(TRACE_FILTERS,
+                 _T("Filter program uses: %s%s%s%s(%s)"),
+                 m_needs.what & MailFolder::Prefetch_Overview ? _T("overview ")
+                                                              : _T(""),
+                 m_needs.what & MailFolder::Prefetch_HeaderLines ? _T("lines ")
+                                                                 : _T(""),
+                 m_needs.what & MailFolder::Prefetch_Header ? _T("header ")
+                                                            : _T(""),
+                 m_needs.what & MailFolder::Prefetch_Text ? _T("text ")
+                                                          : _T(""),
+                 strutil_flatten_array(m_needs.headers, ',').c_str());
+   }
    m_MessageUId = UID_ILLEGAL;
+   m_MessageIndex = 0;
+   m_spamMsgs = NULL;
    m_MailMessage = NULL;
    m_MailFolder = NULL;
 }
@@ -2628,6 +3369,17 @@ FilterRuleImpl::FilterRuleImpl(const char* filterrule,
 FilterRuleImpl::~FilterRuleImpl()
 {
    SafeDecRef(m_MailFolder);
+
+   for ( FilterRegExCache::iterator i = m_regexCache->begin();
+         i != m_regexCache->end();
+         ++i )
+   {
+      if ( i->second )
+         m_MInterface->strutil_freeRegEx(i->second);
+   }
+   delete m_regexCache;
+
+   delete m_Code;
    delete m_Program;
 #ifndef TEST
    m_FilterModule->DecRef();
@@ -2711,6 +3463,17 @@ FilterRuleApply::LoopEvaluate()
 {
    bool allOk = true;
 
+   wxStopWatch timer;
+
+   // retrieve the data used by the filters for all messages at once instead
+   // of doing it for each message individually
+   Prefetch();
+
+   // and let the spam filters used by the rules reuse their resources too
+   SpamFilterBatch spamBatch;
+
+   CheckSpam();
+
    // first decide what should we do with the messages: fill the arrays with
    // the operations to perform and the destination folder if the operation
    // involves copying the message
@@ -2743,31 +3506,87 @@ FilterRuleApply::LoopEvaluate()
       m_parent->m_MailMessage->DecRef();
    }
 
+   wxLogTrace(TRACE_FILTERS, _T("Evaluated filters for %lu messages in %ldms"),
+              (unsigned long)m_idx, timer.Time());
+
+   // forget the data for learning from the messages whose spam check results
+   // were not used
+   for ( std::map<String, FilterRuleImpl::SpamVerdicts>::iterator
+            i = m_parent->m_spamVerdicts.begin();
+         i != m_parent->m_spamVerdicts.end();
+         ++i )
+   {
+      delete i->second.learn;
+   }
+
+   m_parent->m_spamVerdicts.clear();
+   m_parent->m_spamMsgs = NULL;
+
    return allOk;
 }
 
 bool
 FilterRuleApply::LoopCopy()
 {
+   wxStopWatch timer;
+
+   // group the messages by their destination folder in a single pass, so that
+   // all messages going to the same folder are copied at once
+   std::vector<CopyGroup> groups;
+   FilterDestinationIndex groupIndex;
+
+   const size_t count = m_msgs.GetCount();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      if ( !(m_allOperations[n] & FilterRuleImpl::Copy) )
+         continue;
+
+      const String& destination = m_destinations[n];
+
+      size_t g;
+      FilterDestinationIndex::const_iterator i = groupIndex.find(destination);
+      if ( i == groupIndex.end() )
+      {
+         g = groups.size();
+         groupIndex[destination] = g;
+
+         groups.push_back(CopyGroup());
+         groups.back().destination = destination;
+      }
+      else // we already copy something to this folder
+      {
+         g = i->second;
+      }
+
+      groups[g].uids.Add(m_msgs[n]);
+      groups[g].indices.Add(n);
+   }
+
    bool allOk = true;
 
-   for ( m_idx = 0; m_idx < m_msgs.GetCount(); m_idx++ )
+   const size_t countGroups = groups.size();
+   for ( size_t g = 0; g < countGroups; g++ )
    {
-      if ( m_allOperations[m_idx] & FilterRuleImpl::Copy )
+      const CopyGroup& group = groups[g];
+
+      m_idx = group.indices[0];
+      if ( !ProgressCopy() )
       {
-         if ( !ProgressCopy() )
-         {
-            // cancelled by user
-            break;
-         }
+         // cancelled by user, m_idx is left less than count to indicate it
+         return allOk;
+      }
 
-         if ( !CopyToOneFolder() )
-         {
-            allOk = false;
-         }
+      if ( !CopyToOneFolder(group) )
+      {
+         allOk = false;
       }
    }
 
+   m_idx = count;
+
+   wxLogTrace(TRACE_FILTERS, _T("Copied messages to %lu folders in %ldms"),
+              (unsigned long)countGroups, timer.Time());
+
    return allOk;
 }
 
@@ -2828,6 +3647,7 @@ bool
 FilterRuleApply::GetMessage()
 {
    m_parent->m_MessageUId = m_msgs[m_idx];
+   m_parent->m_MessageIndex = m_idx;
 
    if ( m_parent->m_MessageUId == UID_ILLEGAL )
    {
@@ -2853,32 +3673,65 @@ FilterRuleApply::GetMessage()
 }
 
 void
-FilterRuleApply::HeaderCacheHints()
+FilterRuleApply::Prefetch()
 {
-   // do some heuristic optimizations: if our program contains requests
-   // for the entire message header, get it first because like this it
-   // will be cached and all other requests will use it - otherwise we'd
-   // have to make several trips to server to get a few separate fields
-   // first and only then retrieve the header
-   //
-   // in the same way, retrieve all the recipients if we need them anyhow
-   // before retrieving "To" &c
-   if ( m_parent->m_hasHeaderFunc )
+   const FilterDataNeeds& needs = m_parent->m_needs;
+   if ( !needs.what )
    {
-      if ( m_parent->m_hasToFunc || m_parent->m_hasRcptFunc
-         || m_parent->m_hasHdrLineFunc )
-      {
-         // pre-retrieve the whole header
-         (void)m_parent->m_MailMessage->GetHeader();
-      }
+      // the program doesn't use the messages at all
+      return;
    }
-   else if ( m_parent->m_hasRcptFunc )
+
+   wxStopWatch timer;
+
+   m_parent->m_MailFolder->PrefetchMessages(m_msgs, needs.what, needs.headers);
+
+   wxLogTrace(TRACE_FILTERS, _T("Prefetched data of %lu messages in %ldms"),
+              (unsigned long)m_msgs.GetCount(), timer.Time());
+}
+
+void
+FilterRuleApply::CheckSpam()
+{
+   const wxArrayString& params = m_parent->m_needs.spamParams;
+   if ( params.empty() )
+      return;
+
+   // the messages are checked when isspam() is called for them, see
+   // FilterRuleImpl::GetSpamVerdict(), here we just prepare for it
+   const size_t count = m_msgs.GetCount();
+   const size_t countParams = params.GetCount();
+   for ( size_t n = 0; n < countParams; n++ )
    {
-      if ( m_parent->m_hasToFunc )
-      {
-         // pre-fetch the recipient headers which include "To"
-         (void)m_parent->m_MailMessage->GetHeaderLines(headersRecipients);
-      }
+      FilterRuleImpl::SpamVerdicts&
+         verdicts = m_parent->m_spamVerdicts[params[n]];
+
+      verdicts.isSpam.assign(count, -1);
+      verdicts.results.clear();
+      verdicts.results.Add(wxEmptyString, count);
+      verdicts.learn = new SpamLearnData;
+      verdicts.learnIndex.assign(count, (size_t)-1);
+      verdicts.chunk =
+      verdicts.used = 0;
+   }
+
+   m_parent->m_spamMsgs = &m_msgs;
+}
+
+void
+FilterRuleApply::HeaderCacheHints()
+{
+   // if our program needs both the entire message header and some separate
+   // header lines, get the header first because like this it will be cached
+   // and all other requests will use it - otherwise we'd have to make several
+   // trips to server to get a few separate fields first and only then
+   // retrieve the header (the separate header lines themselves were already
+   // retrieved for all messages at once by Prefetch())
+   const int what = m_parent->m_needs.what;
+   if ( (what & MailFolder::Prefetch_Header) &&
+            (what & MailFolder::Prefetch_HeaderLines) )
+   {
+      (void)m_parent->m_MailMessage->GetHeader();
    }
 }
 
@@ -2888,7 +3741,7 @@ FilterRuleApply::Evaluate()
    // reset the result flags
    m_parent->m_operation = FilterRuleImpl::None;
 
-   m_retval = m_parent->m_Program->Evaluate();
+   m_retval = m_parent->m_Code->Run();
 
    // remember the result
    m_allOperations[m_idx] = m_parent->m_operation;
@@ -3080,11 +3933,16 @@ FilterRuleApply::UpdateProgressDialog()
       //     interpreted as a format string
       wxLogGeneric(M_LOG_WINONLY, _T("%s"), textLog.c_str());
    }
-   else // no progress dialog
+   else if ( wxThread::IsMain() ) // no progress dialog
    {
       // see comment above
       wxLogStatus(_T("%s"), textLog.c_str());
    }
+   else // running in a background thread
+   {
+      if ( !ASMailFolder::UpdateProgress(m_idx, m_msgs.GetCount(), textLog) )
+         return false;
+   }
 
    // We don't need this anymore
    m_parent->m_copiedTo.clear();
@@ -3110,43 +3968,28 @@ FilterRuleApply::ProgressCopy()
          return false;
       }
    }
+   else if ( !wxThread::IsMain() )
+   {
+      if ( !ASMailFolder::UpdateProgress(m_idx, m_destinations.GetCount()) )
+         return false;
+   }
 
    return true;
 }
 
 bool
-FilterRuleApply::CopyToOneFolder()
+FilterRuleApply::CopyToOneFolder(const CopyGroup& group)
 {
-   // copy all messages we are copying to this destination at once
-   UIdArray uidsToCopy;
-   wxArrayLong indexesToCopy;
+   bool copyOk = m_parent->m_MailFolder->SaveMessages(&group.uids,
+                                                      group.destination);
 
-   uidsToCopy.Add(m_msgs[m_idx]);
-   indexesToCopy.Add(m_idx);
-
-   for ( size_t n = m_idx + 1; n < m_msgs.GetCount(); n++ )
-   {
-      if ( (m_allOperations[n] & FilterRuleImpl::Copy)
-         && m_destinations[n] == m_destinations[m_idx] )
-      {
-         uidsToCopy.Add(m_msgs[n]);
-         indexesToCopy.Add(n);
-      }
-   }
-
-   bool copyOk = m_parent->m_MailFolder->SaveMessages(
-      &uidsToCopy, m_destinations[m_idx]);
-
-   for ( size_t copiedIndex = 0; copiedIndex < indexesToCopy.GetCount();
-      ++copiedIndex )
+   if ( !copyOk )
    {
-      // don't try to copy it when we reach it
-      m_allOperations[indexesToCopy[copiedIndex]] &= ~FilterRuleImpl::Copy;
-
-      if ( !copyOk )
+      // don't delete the messages we failed to move
+      const size_t count = group.indices.GetCount();
+      for ( size_t n = 0; n < count; n++ )
       {
-         m_allOperations[indexesToCopy[copiedIndex]]
-            &= ~FilterRuleImpl::Delete;
+         m_allOperations[group.indices[n]] &= ~FilterRuleImpl::Delete;
       }
    }
 
@@ -3368,6 +4211,86 @@ TestPgm(int arg, const char *s)
    return 0;
 }
 
+int        // test whether the expression is (not) folded into a constant
+TestFold(bool folded, int arg, const char *s)
+{
+   MyParser p(s);
+   const SyntaxNode *exp = p.ParseExpression();
+   if (exp == NULL)
+   {
+      Rejected(p);
+      return 1;
+   }
+   FilterProgram code;
+   exp->Compile(code);
+   delete exp;
+   const size_t count = code.GetCount();
+   if (!folded)
+   {
+      if (count != 1)
+         return 0;
+      printf("`%s' was folded\n", s);
+      return 1;
+   }
+   if (count != 1)
+   {
+      printf("`%s' was not folded (%lu instructions)\n",
+             s, (unsigned long)count);
+      return 1;
+   }
+   const Value v = code.Run();
+   if (v.ToNumber() != arg)
+   {
+      printf("`%s' was folded to %ld instead of %d\n", s, v.ToNumber(), arg);
+      return 1;
+   }
+   return 0;
+}
+
+int        // test the number of instructions in the compiled program
+TestCode(int arg, const char *s)
+{
+   MyParser p(s);
+   const SyntaxNode *pgm = p.ParseProgram();
+   if (pgm == NULL)
+   {
+      Rejected(p);
+      return 1;
+   }
+   FilterProgram code;
+   pgm->Compile(code);
+   delete pgm;
+   if (code.GetCount() != (size_t)arg)
+   {
+      printf("`%s' was compiled into %lu instructions instead of %d\n",
+             s, (unsigned long)code.GetCount(), arg);
+      return 1;
+   }
+   return 0;
+}
+
+int        // test the result of running the compiled program
+TestRun(int arg, const char *s)
+{
+   MyParser p(s);
+   const SyntaxNode *pgm = p.ParseProgram();
+   if (pgm == NULL)
+   {
+      Rejected(p);
+      return 1;
+   }
+   FilterProgram code;
+   pgm->Compile(code);
+   const Value v = code.Run();
+   delete pgm;
+   if (v.ToNumber() != arg)
+   {
+      printf("`%s' ran as %ld instead of %d\n", s, v.ToNumber(), arg);
+      return 1;
+   }
+   return 0;
+}
+
 int
 main(void)
 {
@@ -3416,6 +4339,28 @@ main(void)
             printf("Unknown option `%s' to pgm command\n",
                opt.c_str());
       }
+      else if (cmd == "fold")
+      {
+         long val;
+         if (opt == "no")
+            errs += TestFold(false, 0, exp);
+         else if (opt.ToLong(&val))
+            errs += TestFold(true, val, exp);
+         else
+            printf("Unknown option `%s' to fold command\n",
+               opt.c_str());
+      }
+      else if (cmd == "code" || cmd == "run")
+      {
+         long val;
+         if (!opt.ToLong(&val))
+            printf("Unknown option `%s' to %s command\n",
+               opt.c_str(), cmd.c_str());
+         else if (cmd == "code")
+            errs += TestCode(val, exp);
+         else
+            errs += TestRun(val, exp);
+      }
       else
          printf("Unknown command `%s'\n", cmd.c_str());
    }
@@ -22,6 +22,9 @@
 
 #ifndef USE_PCH
    #include "Mcommon.h"
+   #include "Mdefaults.h"
+   #include "MApplication.h"
+   #include "Profile.h"
    #include "gui/wxIconManager.h"
 
    #include <wx/app.h>        // for wxPostEvent()
@@ -48,12 +51,18 @@
 #include "HeaderInfo.h"
 
 #include "ASMailFolder.h"               // for ATT_NOINFERIORS
+#include "MailFolderCC.h"               // for LockCClient()
 
 #include "gui/wxDialogLayout.h"
 #include "gui/wxMainFrame.h"
 #include "gui/wxBrowseButton.h"
 
 #include <wx/wizard.h>
+#include <wx/thread.h>
+#include <wx/stopwatch.h>
+
+#include <vector>
+#include <algorithm>
 
 // if we're still using old headers
 #ifndef wxRB_SINGLE
@@ -68,6 +77,26 @@
 // folder which has both subfolders and messages
 #define MESSAGES_SUFFIX ".messages"
 
+// the maximal number of messages and their total size (in bytes) copied at
+// once: the progress and the checkpoint are updated after each batch
+#define MIGRATE_BATCH_COUNT 500
+#define MIGRATE_BATCH_SIZE  (32*1024*1024)
+
+// how often (in ms) is the progress updated while the folders are copied
+#define MIGRATE_UPDATE_INTERVAL 200
+
+// the profile group where the checkpoints of the folders are stored
+#define MIGRATE_CHECKPOINTS _T("Checkpoints")
+
+// trace mask for the migration progress
+#define TRACE_MIGRATE _T("migrate")
+
+// ----------------------------------------------------------------------------
+// options we use here
+// ----------------------------------------------------------------------------
+
+extern const MOption MP_CONN_POOL_SIZE;
+
 // ----------------------------------------------------------------------------
 // MigrateImapServer: IMAP server parameters
 // ----------------------------------------------------------------------------
@@ -173,6 +202,43 @@ struct MigrateData
    void FixFolderFlags();
 };
 
+// ----------------------------------------------------------------------------
+// MigrateJob: a folder to be copied by one of MigrateWorker threads
+// ----------------------------------------------------------------------------
+
+struct MigrateJob
+{
+   // the name of the source folder (relative to source.root)
+   String name;
+
+   // the flags of the source folder (ASMailFolder::ATT_XXX)
+   int flags;
+
+   // the folders to copy from and to (we hold a reference to both of them)
+   MFolder *folderSrc,
+           *folderDst;
+
+   // the key of the checkpoint of this folder in the module profile
+   String keyCheckpoint;
+
+   // the checkpoint: UID validity of the source folder and UID of the last
+   // message copied from it or UID_ILLEGAL if none was copied yet
+   UIdType uidValidity,
+           uidLast;
+
+   // true if the checkpoint changed since it was last saved
+   bool isDirty;
+
+   // true while the folder is being copied
+   bool isActive;
+};
+
+typedef std::vector<MigrateJob> MigrateJobs;
+
+// the UID and the size of a message to copy
+typedef std::pair<UIdType, unsigned long> MigrateMessage;
+typedef std::vector<MigrateMessage> MigrateMessages;
+
 // ----------------------------------------------------------------------------
 // MigrateModule: implementation of MModule by this plugin
 // ----------------------------------------------------------------------------
@@ -530,6 +596,11 @@ class MigrateWizardProgressPage : public MigrateWizardPage
 {
 public:
    MigrateWizardProgressPage(MigrateWizard *parent);
+   virtual ~MigrateWizardProgressPage();
+
+   // copy the folders until there are no more of them, called by the worker
+   // threads
+   void CopyFolders();
 
 protected:
    // enable/disable all wizard buttons
@@ -546,19 +617,19 @@ protected:
    void OnShow(wxShowEvent& event);
 
 private:
-   // update the messages progress meter
-   bool UpdateMessageProgress();
-
-   // update the folder progress meter (also updates the messages one)
+   // update the folder progress meter while preparing the folders to copy
    bool UpdateFolderProgress();
 
+   // update both progress meters while the folders are being copied
+   bool UpdateCopyProgress();
+
    // update the status shown in m_labelStatus
    bool UpdateStatus(const String& msg);
 
 
    // returns the folder to copy from
-   MailFolder *OpenSource(const MigrateImapServer& imapData,
-                          const String& name);
+   MFolder *GetSrcFolder(const MigrateImapServer& imapData,
+                         const String& name);
 
    // return the MFolder to copy to
    MFolder *GetDstFolder(const String& name, int flags);
@@ -572,15 +643,33 @@ private:
    // get the dst folder name corresponding to the given source folder
    String GetDstNameForSource(const String& name);
 
-   // do copy all messages
-   bool CopyMessages(MailFolder *mfSrc, MFolder *folderDst);
+   // get the key of the checkpoint for the given folder
+   String GetCheckpointKey(const MigrateJob& job);
+
+   // read the checkpoint of the folder from the profile
+   void LoadCheckpoint(MigrateJob& job);
 
-   // process the source folder with this name
-   bool ProcessOneFolder(const String& name, int flags);
+   // write the changed checkpoints to the profile
+   void SaveCheckpoints();
+
+   // forget all checkpoints after successfully finishing the migration
+   void ClearCheckpoints();
+
+   // do copy all messages not copied yet
+   bool CopyMessages(MailFolder *mfSrc, MigrateJob& job);
+
+   // process the source folder of this job, called by the worker threads
+   bool ProcessOneFolder(MigrateJob& job);
+
+   // prepare the job for the source folder with this name
+   bool AddFolder(const String& name, int flags);
 
    // create the target folder corresponding to the non-selectable source one
    bool CreateDstDirectory(const String& name);
 
+   // copy the folders of all jobs using the worker threads
+   bool RunJobs();
+
    // process all folders
    bool ProcessAllFolders();
 
@@ -589,13 +678,30 @@ private:
 
 
    // data
-   int m_nFolder,                   // current folder or -1 if none yet
-       m_nMessage,                  // current message in current folder
-       m_countMessages;             // total number of messages or -1
+   int m_nFolder;                   // current folder or -1 if none yet
+
+   bool m_continue;                 // set to false if we're cancelled
+
+   MigrateJobs m_jobs;              // the folders to copy
+
+   wxStopWatch m_stopwatch;         // the time spent copying the folders
+
+   // the data below is shared with the worker threads and protected by
+   // m_mutex, m_cond is signaled when a worker thread terminates
+   wxMutex m_mutex;
+   wxCondition m_cond;
+
+   size_t m_nextJob,                // the first job not started yet
+          m_nJobsDone,              // the number of jobs done
+          m_nWorkers;               // the number of running worker threads
+
+   unsigned long m_nMessages,       // the number of messages copied
+                 m_countMessages,   // and to copy in the started jobs
+                 m_kbCopied;        // the size of the messages copied
 
    size_t m_nErrors;                // number of folders we couldn't copy
 
-   bool m_continue;                 // set to false if we're cancelled
+   bool m_cancel;                   // tells the worker threads to stop
 
    // the GUI controls
    wxStaticText *m_labelFolder,     // folder progress label
@@ -611,6 +717,25 @@ private:
    DECLARE_NO_COPY_CLASS(MigrateWizardProgressPage)
 };
 
+// ----------------------------------------------------------------------------
+// MigrateWorker: the thread copying the folders for the progress page
+// ----------------------------------------------------------------------------
+
+class MigrateWorker : public wxThread
+{
+public:
+   MigrateWorker(MigrateWizardProgressPage *page)
+      : wxThread(wxTHREAD_JOINABLE), m_page(page) { }
+
+protected:
+   virtual void *Entry();
+
+private:
+   MigrateWizardProgressPage * const m_page;
+
+   DECLARE_NO_COPY_CLASS(MigrateWorker)
+};
+
 // ============================================================================
 // MigrateModule implementation
 // ============================================================================
@@ -1244,10 +1369,25 @@ MigrateWizardProgressPage::MigrateWizardProgressPage(MigrateWizard *parent)
                            (
                               parent,
                               MigrateWizard::Page_Progress
-                           )
+                           ),
+                           m_cond(m_mutex)
 {
+   m_nFolder = -1;
+
    m_continue = true;
 
+   m_nextJob =
+   m_nJobsDone =
+   m_nWorkers = 0;
+
+   m_nMessages =
+   m_countMessages =
+   m_kbCopied = 0;
+
+   m_nErrors = 0;
+
+   m_cancel = false;
+
    // create the GUI controls
    wxSizer *sizer = new wxBoxSizer(wxVERTICAL);
    sizer->Add
@@ -1257,8 +1397,8 @@ MigrateWizardProgressPage::MigrateWizardProgressPage(MigrateWizard *parent)
                   this,
                   -1,
                   _("You may press \"Abort\" at any moment to\n"
-                    "abort the migration but please be warned that\n"
-                    "it will be impossible to resume it later.")
+                    "abort the migration and resume it later by\n"
+                    "running it again with the same parameters.")
                 ),
             0,
             wxALL,
@@ -1299,23 +1439,13 @@ MigrateWizardProgressPage::MigrateWizardProgressPage(MigrateWizard *parent)
    SetSizer(sizer);
 }
 
-bool MigrateWizardProgressPage::UpdateMessageProgress()
+MigrateWizardProgressPage::~MigrateWizardProgressPage()
 {
-   m_labelMsg->SetLabel
-               (
-                  wxString::Format
-                  (
-                     _("Message: %d/%d"),
-                     m_nMessage + 1,
-                     m_countMessages
-                  )
-               );
-
-   m_gaugeMsg->SetValue(m_nMessage);
-
-   wxYield();
-
-   return m_continue;
+   for ( MigrateJobs::iterator i = m_jobs.begin(); i != m_jobs.end(); ++i )
+   {
+      i->folderSrc->DecRef();
+      i->folderDst->DecRef();
+   }
 }
 
 bool MigrateWizardProgressPage::UpdateFolderProgress()
@@ -1346,6 +1476,74 @@ bool MigrateWizardProgressPage::UpdateFolderProgress()
    return m_continue;
 }
 
+bool MigrateWizardProgressPage::UpdateCopyProgress()
+{
+   size_t nJobsDone;
+   unsigned long nMessages,
+                 countMessages,
+                 kbCopied;
+   String active;
+   {
+      wxMutexLocker lock(m_mutex);
+
+      nJobsDone = m_nJobsDone;
+      nMessages = m_nMessages;
+      countMessages = m_countMessages;
+      kbCopied = m_kbCopied;
+
+      for ( MigrateJobs::const_iterator i = m_jobs.begin();
+            i != m_jobs.end();
+            ++i )
+      {
+         if ( i->isActive )
+         {
+            if ( !active.empty() )
+               active += _T(", ");
+
+            active += i->name;
+         }
+      }
+   }
+
+   // the folders without messages are done before we start copying
+   const size_t nFoldersDone = Data().countFolders - m_jobs.size() + nJobsDone;
+
+   m_labelFolder->SetLabel
+                  (
+                     wxString::Format
+                     (
+                        _("Folders: %lu/%d (%s)"),
+                        (unsigned long)nFoldersDone,
+                        Data().countFolders,
+                        active.c_str()
+                     )
+                  );
+
+   m_gaugeFolder->SetValue(nFoldersDone);
+
+   // don't show the bogus rates during the first second
+   const double secs = wxMax(m_stopwatch.Time(), 1000L) / 1000.;
+
+   m_labelMsg->SetLabel
+               (
+                  wxString::Format
+                  (
+                     _("Messages: %lu/%lu (%lu messages/s, %luKb/s)"),
+                     nMessages,
+                     countMessages,
+                     (unsigned long)(nMessages / secs),
+                     (unsigned long)(kbCopied / secs)
+                  )
+               );
+
+   m_gaugeMsg->SetRange(countMessages);
+   m_gaugeMsg->SetValue(nMessages);
+
+   wxYield();
+
+   return m_continue;
+}
+
 bool MigrateWizardProgressPage::UpdateStatus(const String& msg)
 {
    // we need to relayout because the size of the control changed and it must
@@ -1367,11 +1565,11 @@ void MigrateWizardProgressPage::EnableWizardButtons(bool enable)
                         : MigrateWizard::Btn_All, enable);
 }
 
-MailFolder *
-MigrateWizardProgressPage::OpenSource(const MigrateImapServer& imapData,
-                                      const String& name)
+MFolder *
+MigrateWizardProgressPage::GetSrcFolder(const MigrateImapServer& imapData,
+                                        const String& name)
 {
-   MFolder_obj folderSrc(MFolder::CreateTemp(wxEmptyString, MF_IMAP));
+   MFolder *folderSrc = MFolder::CreateTemp(wxEmptyString, MF_IMAP);
    CHECK( folderSrc, NULL, _T("MFolder::CreateTemp() failed?") );
 
    folderSrc->SetServer(imapData.server);
@@ -1392,7 +1590,7 @@ MigrateWizardProgressPage::OpenSource(const MigrateImapServer& imapData,
    }
 #endif // USE_SSL
 
-   return MailFolder::OpenFolder(folderSrc, MailFolder::ReadOnly);
+   return folderSrc;
 }
 
 MFolderType
@@ -1534,45 +1732,222 @@ MigrateWizardProgressPage::SetAccessParameters(MFolder *folderDst)
    }
 }
 
+String MigrateWizardProgressPage::GetCheckpointKey(const MigrateJob& job)
+{
+   // the checkpoint is only valid for the same source and destination
+   String key;
+   key << Data().source.server << ':' << job.folderSrc->GetPath()
+       << _T(" -> ")
+       << job.folderDst->GetServer() << ':' << job.folderDst->GetPath();
+
+   // the slashes would be interpreted as profile path separators
+   key.Replace(_T("%"), _T("%25"));
+   key.Replace(_T("/"), _T("%2F"));
+   key.Replace(_T("\\"), _T("%5C"));
+
+   return String(MIGRATE_CHECKPOINTS) + _T('/') + key;
+}
+
+void MigrateWizardProgressPage::LoadCheckpoint(MigrateJob& job)
+{
+   job.keyCheckpoint = GetCheckpointKey(job);
+   job.uidValidity =
+   job.uidLast = UID_ILLEGAL;
+   job.isDirty = false;
+
+   Profile_obj profile(Profile::CreateModuleProfile(_T("Migrate")));
+   CHECK_RET( profile, _T("failed to create Migrate module profile") );
+
+   // the checkpoint is stored as "uidvalidity:uid"
+   const String value = profile->readEntry(job.keyCheckpoint, wxEmptyString);
+   if ( value.empty() )
+      return;
+
+   unsigned long uidValidity,
+                 uidLast;
+   if ( !value.BeforeFirst(_T(':')).ToULong(&uidValidity) ||
+         !value.AfterFirst(_T(':')).ToULong(&uidLast) )
+   {
+      wxLogDebug(_T("Invalid checkpoint \"%s\" for folder \"%s\" ignored."),
+                 value.c_str(), job.name.c_str());
+      return;
+   }
+
+   job.uidValidity = uidValidity;
+   job.uidLast = uidLast;
+}
+
+void MigrateWizardProgressPage::SaveCheckpoints()
+{
+   Profile_obj profile(Profile::CreateModuleProfile(_T("Migrate")));
+   CHECK_RET( profile, _T("failed to create Migrate module profile") );
+
+   wxMutexLocker lock(m_mutex);
+
+   for ( MigrateJobs::iterator i = m_jobs.begin(); i != m_jobs.end(); ++i )
+   {
+      if ( !i->isDirty )
+         continue;
+
+      profile->writeEntry(i->keyCheckpoint,
+                          String::Format(_T("%lu:%lu"),
+                                         (unsigned long)i->uidValidity,
+                                         (unsigned long)i->uidLast));
+
+      i->isDirty = false;
+   }
+}
+
+void MigrateWizardProgressPage::ClearCheckpoints()
+{
+   Profile_obj profile(Profile::CreateModuleProfile(_T("Migrate")));
+   CHECK_RET( profile, _T("failed to create Migrate module profile") );
+
+   for ( MigrateJobs::const_iterator i = m_jobs.begin();
+         i != m_jobs.end();
+         ++i )
+   {
+      profile->DeleteEntry(i->keyCheckpoint);
+   }
+}
+
 bool
-MigrateWizardProgressPage::CopyMessages(MailFolder *mfSrc, MFolder *folderDst)
+MigrateWizardProgressPage::CopyMessages(MailFolder *mfSrc, MigrateJob& job)
 {
-   UIdArray uids;
-   uids.Add(UID_ILLEGAL);
+   // the checkpoint can only be used if the UIDs didn't change since then
+   const UIdType uidValidity = mfSrc->GetUIdValidity();
 
+   UIdType uidLast = job.uidLast;
+   if ( uidLast != UID_ILLEGAL )
+   {
+      if ( job.uidValidity != uidValidity )
+      {
+         wxLogWarning(_("The folder \"%s\" was modified after the previous "
+                        "migration attempt, all its messages will be "
+                        "copied again."), job.name.c_str());
+
+         uidLast = UID_ILLEGAL;
+      }
+      else
+      {
+         wxLogTrace(TRACE_MIGRATE, _T("Resuming folder '%s' after UID %lu"),
+                    job.name.c_str(), (unsigned long)uidLast);
+      }
+   }
+
+   // get the messages not copied yet in the UID order: this is the order in
+   // which they're copied, so that the checkpoint is always the last UID
    HeaderInfoList_obj headers(mfSrc->GetHeaders());
+   if ( !headers )
+      return false;
+
+   bool ok = true;
 
-   m_countMessages = headers->Count();
-   m_gaugeMsg->SetRange(m_countMessages);
+   // the checkpoint must remain below the first message we failed to get the
+   // header of, otherwise it would never be copied when resuming: as the UIDs
+   // grow with msgnos, this is the UID of the message preceding it (or the
+   // old checkpoint if it is greater)
+   bool hasLimit = false;
+   UIdType uidLimit = uidLast,
+           uidPrev = UID_ILLEGAL;
 
-   for ( m_nMessage = 0; m_nMessage < m_countMessages; m_nMessage++ )
+   const size_t count = headers->Count();
+
+   MigrateMessages msgs;
+   msgs.reserve(count);
+   for ( size_t n = 0; n < count; n++ )
    {
-      if ( !UpdateMessageProgress() )
+      HeaderInfo *hi = headers->GetItemByIndex(n);
+      if ( !hi )
       {
-         // cancelled
-         return true;
+         wxLogError(_("Failed to retrieve header for message %lu"),
+                    (unsigned long)n);
+
+         if ( !hasLimit )
+         {
+            hasLimit = true;
+            if ( uidPrev != UID_ILLEGAL &&
+                  (uidLimit == UID_ILLEGAL || uidPrev > uidLimit) )
+            {
+               uidLimit = uidPrev;
+            }
+         }
+
+         ok = false;
+         continue;
       }
 
-      HeaderInfo *hi = headers->GetItemByIndex(m_nMessage);
-      if ( !hi )
+      const UIdType uid = hi->GetUId();
+      uidPrev = uid;
+      if ( uidLast == UID_ILLEGAL || uid > uidLast )
+         msgs.push_back(MigrateMessage(uid, hi->GetSize()));
+   }
+
+   std::sort(msgs.begin(), msgs.end());
+
+   {
+      wxMutexLocker lock(m_mutex);
+      m_countMessages += msgs.size();
+   }
+
+   // copy them in batches as big as possible: SaveMessages() retrieves and
+   // appends many messages at once and does it concurrently
+   UIdArray uids;
+   unsigned long sizeBatch = 0;
+   for ( size_t n = 0; n < msgs.size(); n++ )
+   {
+      uids.Add(msgs[n].first);
+      sizeBatch += msgs[n].second;
+
+      if ( n + 1 < msgs.size() &&
+            uids.GetCount() < MIGRATE_BATCH_COUNT &&
+               sizeBatch < MIGRATE_BATCH_SIZE )
       {
-         wxLogError(_("Failed to retrieve header for message %d"),
-                    m_nMessage);
          continue;
       }
 
-      uids[0] = hi->GetUId();
-      if ( !mfSrc->SaveMessages(&uids, folderDst) )
+      // even if only a part of the batch was copied, the checkpoint can
+      // still advance up to the last message copied in order
+      UIdType uidDone;
+      const bool copied = mfSrc->SaveMessages(&uids, job.folderDst, &uidDone);
+
+      wxMutexLocker lock(m_mutex);
+
+      if ( uidDone != UID_ILLEGAL )
       {
-         wxLogError(_("Failed to copy the message %d from folder \"%s\""),
-                    m_nMessage,
-                    Data().folderNames[m_nFolder].c_str());
+         if ( hasLimit && (uidLimit == UID_ILLEGAL || uidDone > uidLimit) )
+            uidDone = uidLimit;
+
+         if ( uidDone != UID_ILLEGAL )
+         {
+            job.uidValidity = uidValidity;
+            job.uidLast = uidDone;
+            job.isDirty = true;
+         }
+      }
+
+      if ( !copied )
+      {
+         wxLogError(_("Failed to copy the messages from folder \"%s\""),
+                    job.name.c_str());
 
          return false;
       }
+
+      m_nMessages += uids.GetCount();
+      m_kbCopied += sizeBatch / 1024;
+
+      if ( m_cancel )
+      {
+         // cancelled, but whatever we copied is not lost
+         break;
+      }
+
+      uids.Empty();
+      sizeBatch = 0;
    }
 
-   return true;
+   return ok;
 }
 
 bool MigrateWizardProgressPage::CreateDstDirectory(const String& name)
@@ -1592,13 +1967,14 @@ bool MigrateWizardProgressPage::CreateDstDirectory(const String& name)
    }
 }
 
-bool MigrateWizardProgressPage::ProcessOneFolder(const String& name, int flags)
+bool MigrateWizardProgressPage::ProcessOneFolder(MigrateJob& job)
 {
    // open the source folder
-   MailFolder_obj mf(OpenSource(Data().source, name));
+   MailFolder_obj mf(MailFolder::OpenFolder(job.folderSrc,
+                                            MailFolder::ReadOnly));
    if ( !mf )
    {
-      wxLogError(_("Failed to open source folder \"%s\""), name.c_str());
+      wxLogError(_("Failed to open source folder \"%s\""), job.name.c_str());
 
       return false;
    }
@@ -1607,24 +1983,197 @@ bool MigrateWizardProgressPage::ProcessOneFolder(const String& name, int flags)
    // subfolders: i.e. we do create empty folders if they contain messages only
    // but we want to avoid creating empty "folder.messages" files if we have a
    // "folder" directory
-   if ( !(flags & ASMailFolder::ATT_NOINFERIORS) && !mf->GetMessageCount() )
+   if ( !(job.flags & ASMailFolder::ATT_NOINFERIORS) && !mf->GetMessageCount() )
    {
       // nothing to do
       return true;
    }
 
    // create the folder to save the messages to
-   MFolder_obj folderDst(GetDstFolder(name, flags));
-   MailFolder_obj mfDst(MailFolder::OpenFolder(folderDst));
+   MailFolder_obj mfDst(MailFolder::OpenFolder(job.folderDst));
    if ( !mfDst )
    {
-      wxLogError(_("Failed to create the target folder \"%s\""), name.c_str());
+      wxLogError(_("Failed to create the target folder \"%s\""),
+                 job.name.c_str());
 
       return false;
    }
 
    // now copy all the messages from src to dst
-   return CopyMessages(mf, folderDst);
+   const bool ok = CopyMessages(mf, job);
+
+   // the listing used for copying keeps the folder alive, free it now
+   MailFolderCmn::ReleaseThreadHeaders();
+
+   return ok;
+}
+
+bool MigrateWizardProgressPage::AddFolder(const String& name, int flags)
+{
+   MigrateJob job;
+   job.name = name;
+   job.flags = flags;
+   job.folderSrc = GetSrcFolder(Data().source, name);
+   job.folderDst = GetDstFolder(name, flags);
+   job.isActive = false;
+
+   if ( !job.folderSrc || !job.folderDst )
+   {
+      SafeDecRef(job.folderSrc);
+      SafeDecRef(job.folderDst);
+
+      return false;
+   }
+
+   LoadCheckpoint(job);
+
+   m_jobs.push_back(job);
+
+   return true;
+}
+
+void MigrateWizardProgressPage::CopyFolders()
+{
+   for ( ;; )
+   {
+      MigrateJob *job;
+      {
+         wxMutexLocker lock(m_mutex);
+
+         if ( m_cancel || m_nextJob == m_jobs.size() )
+            break;
+
+         job = &m_jobs[m_nextJob++];
+         job->isActive = true;
+      }
+
+      const bool ok = ProcessOneFolder(*job);
+      if ( !ok )
+      {
+         wxLogError(_("Failed to copy messages from folder \"%s\""),
+                    job->name.c_str());
+      }
+
+      wxMutexLocker lock(m_mutex);
+
+      job->isActive = false;
+
+      m_nJobsDone++;
+      if ( !ok )
+         m_nErrors++;
+   }
+
+   wxMutexLocker lock(m_mutex);
+
+   m_nWorkers--;
+   m_cond.Broadcast();
+}
+
+bool MigrateWizardProgressPage::RunJobs()
+{
+   if ( m_jobs.empty() )
+      return true;
+
+   // don't use more than MP_CONN_POOL_SIZE connections to any server: each
+   // thread uses one connection to the source server and, when copying to
+   // IMAP, one to the destination one, which is the same server for the
+   // migrations between the accounts on it
+   const MigrateData& data = Data();
+   size_t connPerWorker = 1;
+   if ( data.toIMAP &&
+         data.dstIMAP.server.CmpNoCase(data.source.server) == 0 &&
+            data.dstIMAP.port == data.source.port )
+   {
+      connPerWorker = 2;
+   }
+
+   long connPerServer = READ_APPCONFIG(MP_CONN_POOL_SIZE);
+   size_t countWorkers = connPerServer > 0 ? connPerServer / connPerWorker : 0;
+   if ( countWorkers < 1 )
+      countWorkers = 1;
+   else if ( countWorkers > m_jobs.size() )
+      countWorkers = m_jobs.size();
+
+   // the threads can't use c-client before this is done
+   MailFolderCC::EnableWorkerThreads();
+
+   m_stopwatch.Start();
+
+   std::vector<MigrateWorker *> workers;
+   for ( size_t n = 0; n < countWorkers; n++ )
+   {
+      {
+         wxMutexLocker lock(m_mutex);
+         m_nWorkers++;
+      }
+
+      MigrateWorker *worker = new MigrateWorker(this);
+      if ( worker->Create() != wxTHREAD_NO_ERROR ||
+            worker->Run() != wxTHREAD_NO_ERROR )
+      {
+         delete worker;
+
+         wxMutexLocker lock(m_mutex);
+         m_nWorkers--;
+
+         break;
+      }
+
+      workers.push_back(worker);
+   }
+
+   if ( workers.empty() )
+   {
+      MailFolderCC::DisableWorkerThreads();
+
+      wxLogError(_("Failed to start the migration threads.\n"
+                   "\n"
+                   "Migration aborted"));
+
+      return false;
+   }
+
+   wxLogTrace(TRACE_MIGRATE, _T("Copying %lu folders using %lu threads"),
+              (unsigned long)m_jobs.size(), (unsigned long)workers.size());
+
+   for ( bool done = false; !done; )
+   {
+      // let the threads use c-client while we're waiting
+      MailFolderCC::UnlockCClient();
+
+      {
+         wxMutexLocker lock(m_mutex);
+
+         if ( m_nWorkers )
+            m_cond.WaitTimeout(MIGRATE_UPDATE_INTERVAL);
+
+         done = m_nWorkers == 0;
+      }
+
+      MailFolderCC::LockCClient();
+
+      SaveCheckpoints();
+
+      if ( !UpdateCopyProgress() )
+      {
+         // cancelled, the threads will stop after their current batch
+         wxMutexLocker lock(m_mutex);
+         m_cancel = true;
+      }
+   }
+
+   for ( size_t n = 0; n < workers.size(); n++ )
+   {
+      workers[n]->Wait();
+      delete workers[n];
+   }
+
+   MailFolderCC::DisableWorkerThreads();
+
+   wxLogTrace(TRACE_MIGRATE, _T("Copied %lu messages (%luKb) in %ldms"),
+              m_nMessages, m_kbCopied, m_stopwatch.Time());
+
+   return true;
 }
 
 bool MigrateWizardProgressPage::ProcessAllFolders()
@@ -1646,14 +2195,14 @@ bool MigrateWizardProgressPage::ProcessAllFolders()
       }
    }
 
-   for ( m_nFolder = 0, m_nErrors = 0;
-         m_nFolder < Data().countFolders;
-         m_nFolder++ )
+   // create the directories and the target folders in order as the parent
+   // directories must exist before their children are created
+   for ( m_nFolder = 0; m_nFolder < Data().countFolders; m_nFolder++ )
    {
       if ( !UpdateFolderProgress() )
       {
          // cancelled
-         break;
+         return true;
       }
 
       const String& name = Data().folderNames[m_nFolder];
@@ -1669,9 +2218,9 @@ bool MigrateWizardProgressPage::ProcessAllFolders()
             wxLogWarning(_("Failed to copy the folder \"%s\""), name.c_str());
          }
       }
-      else // a "file"-like folder, copy the messages from it
+      else // a "file"-like folder, copy the messages from it later
       {
-         if ( !ProcessOneFolder(name, Data().folderFlags[m_nFolder]) )
+         if ( !AddFolder(name, Data().folderFlags[m_nFolder]) )
          {
             wxLogError(_("Failed to copy messages from folder \"%s\""),
                        name.c_str());
@@ -1681,7 +2230,8 @@ bool MigrateWizardProgressPage::ProcessAllFolders()
       }
    }
 
-   return true;
+   // and copy the messages of several folders concurrently
+   return RunJobs();
 }
 
 void MigrateWizardProgressPage::DoMigration()
@@ -1705,7 +2255,7 @@ void MigrateWizardProgressPage::DoMigration()
    }
    else if ( m_continue )
    {
-      m_gaugeMsg->SetValue(m_countMessages);
+      m_gaugeMsg->SetValue(m_gaugeMsg->GetRange());
       m_gaugeFolder->SetValue(Data().countFolders);
 
       String msg;
@@ -1717,6 +2267,9 @@ void MigrateWizardProgressPage::DoMigration()
       }
       else
       {
+         // nothing to resume any more
+         ClearCheckpoints();
+
          msg = _("Completed successfully.");
       }
    }
@@ -1754,9 +2307,10 @@ void MigrateWizardProgressPage::OnButtonOk(wxCommandEvent& /* event */)
 
 void MigrateWizardProgressPage::OnButtonCancel(wxCommandEvent& /* event */)
 {
-   if ( wxMessageBox(_("Warning: you won't be able to resume later!"
+   if ( wxMessageBox(_("The messages already copied won't be copied again "
+                       "if you resume the migration later.\n"
                        "\n"
-                       "Are you still sure you want to abort?"),
+                       "Are you sure you want to abort?"),
                      _("Mahogany: Please confirm"),
                      wxYES_NO | wxICON_QUESTION | wxNO_DEFAULT) == wxYES )
    {
@@ -1764,6 +2318,21 @@ void MigrateWizardProgressPage::OnButtonCancel(wxCommandEvent& /* event */)
    }
 }
 
+// ----------------------------------------------------------------------------
+// MigrateWorker
+// ----------------------------------------------------------------------------
+
+void *MigrateWorker::Entry()
+{
+   MailFolderCC::LockCClient();
+
+   m_page->CopyFolders();
+
+   MailFolderCC::UnlockCClient();
+
+   return NULL;
+}
+
 // ----------------------------------------------------------------------------
 // MigrateWizard
 // ----------------------------------------------------------------------------
@@ -36,6 +36,10 @@
 #include "SpamFilter.h"
 #include "gui/SpamOptionsPage.h"
 
+#include "pointers.h"
+
+#include <wx/thread.h>
+
 extern "C"
 {
    #define class klass
@@ -50,6 +54,12 @@ extern "C"
 
 static const char *DSPAM_USER_NAME = "mahogany";
 
+#ifdef TEST_DSPAM_THREADS
+   // the directory used for the database by the test program at the end of
+   // this file which has no application object
+   static String gs_testHome;
+#endif // TEST_DSPAM_THREADS
+
 // base class used by DspamProcess/ClassifyCtx
 class DspamCtx
 {
@@ -61,7 +71,11 @@ public:
               (
                   DSPAM_USER_NAME,  // user name used as base file name
                   NULL,             // no group
+#ifdef TEST_DSPAM_THREADS
+                  gs_testHome,
+#else
                   mApplication->GetLocalDir(),
+#endif
                   mode,
                   flags
               );
@@ -102,6 +116,24 @@ public:
          dspam_destroy(m_ctx);
    }
 
+   // prepare the context to process another message
+   void Reset()
+   {
+      // dspam_process() only parses the message text if the context doesn't
+      // have a message yet, so forget the one processed before
+      if ( m_ctx->message )
+      {
+         _ds_destroy_message(m_ctx->message);
+         m_ctx->message = NULL;
+      }
+
+      // reset the input fields possibly changed for the previous message and
+      // the class name which is only set if it's empty
+      m_ctx->classification = DSR_NONE;
+      m_ctx->source = DSS_NONE;
+      m_ctx->class[0] = '\0';
+   }
+
    operator DSPAM_CTX *() const { return m_ctx; }
    DSPAM_CTX *operator->() const { return m_ctx; }
 
@@ -149,14 +181,118 @@ public:
 class DspamClassifyCtx : public DspamCtx
 {
 public:
-   DspamClassifyCtx()
-      : DspamCtx(DSM_CLASSIFY, 0)
+   DspamClassifyCtx(unsigned flags = 0)
+      : DspamCtx(DSM_CLASSIFY, flags)
    {
    }
 
    DECLARE_NO_COPY_CLASS(DspamClassifyCtx);
 };
 
+// ----------------------------------------------------------------------------
+// DspamStorageLock: protects the hash storage shared by all contexts
+// ----------------------------------------------------------------------------
+
+// the contexts only classifying the messages just read the storage and so can
+// be used by several threads at once, as in dspam daemon, but the contexts
+// modifying it (or creating it) need exclusive access to it
+class DspamStorageLock
+{
+public:
+   DspamStorageLock()
+      : m_cond(m_mutex)
+   {
+      m_readers = 0;
+      m_writer = false;
+   }
+
+   void LockRead()
+   {
+      wxMutexLocker lock(m_mutex);
+
+      while ( m_writer )
+         m_cond.Wait();
+
+      m_readers++;
+   }
+
+   void UnlockRead()
+   {
+      wxMutexLocker lock(m_mutex);
+
+      if ( !--m_readers )
+         m_cond.Broadcast();
+   }
+
+   void LockWrite()
+   {
+      wxMutexLocker lock(m_mutex);
+
+      while ( m_writer || m_readers )
+         m_cond.Wait();
+
+      m_writer = true;
+   }
+
+   void UnlockWrite()
+   {
+      wxMutexLocker lock(m_mutex);
+
+      m_writer = false;
+
+      m_cond.Broadcast();
+   }
+
+private:
+   wxMutex m_mutex;
+
+   // signalled when the last reader or the writer unlocks
+   wxCondition m_cond;
+
+   // the number of threads reading the storage
+   size_t m_readers;
+
+   // true if a thread is modifying it
+   bool m_writer;
+
+   DECLARE_NO_COPY_CLASS(DspamStorageLock);
+};
+
+// helpers for locking DspamStorageLock for the current scope
+class DspamReadLocker
+{
+public:
+   DspamReadLocker(DspamStorageLock& lock)
+      : m_lock(lock)
+   {
+      m_lock.LockRead();
+   }
+
+   ~DspamReadLocker() { m_lock.UnlockRead(); }
+
+private:
+   DspamStorageLock& m_lock;
+
+   DECLARE_NO_COPY_CLASS(DspamReadLocker);
+};
+
+class DspamWriteLocker
+{
+public:
+   DspamWriteLocker(DspamStorageLock& lock)
+      : m_lock(lock)
+   {
+      m_lock.LockWrite();
+   }
+
+   ~DspamWriteLocker() { m_lock.UnlockWrite(); }
+
+private:
+   DspamStorageLock& m_lock;
+
+   DECLARE_NO_COPY_CLASS(DspamWriteLocker);
+};
+
 // ----------------------------------------------------------------------------
 // DspamFilter class
 // ----------------------------------------------------------------------------
@@ -186,13 +322,18 @@ protected:
                              const Message& msg,
                              const String& param,
                              String *result);
+   virtual bool CanCheckRaw() const { return true; }
+   virtual int DoCheckRawIfSpam(const char *text,
+                                const String& param,
+                                String *result,
+                                LearnData **learn);
+   virtual void DoLearnRaw(const LearnData& learn);
+   virtual void DoBeginBatch();
+   virtual void DoEndBatch();
    virtual const char *GetOptionPageIconName() const { return "dspam"; }
    virtual SpamOptionsPage *CreateOptionPage(MBookCtrl *notebook,
                                              Profile *profile) const;
 
-   // get the context creating it on demand
-   DSPAM_CTX *GetCtx() const;
-
 private:
    // helper: used as DoProcess() argument to initialize the context or to get
    // result from it
@@ -231,14 +372,78 @@ private:
       bool m_isSpam;
    };
 
+   // ContextHandler used by DoCheckIfSpam()
+   class CheckContextHandler : public ContextHandler
+   {
+   public:
+      CheckContextHandler(bool *rc, float *probability)
+      {
+         m_rc = rc;
+         m_probability = probability;
+      }
+
+      virtual void OnDone(DSPAM_CTX *ctx)
+      {
+         *m_probability = ctx->confidence;
+         *m_rc = ctx->result == DSR_ISSPAM;
+      }
+
+   private:
+      bool *m_rc;
+      float *m_probability;
+   };
+
+
+   // the data returned by DoCheckRawIfSpam() for learning from the message
+   class SignatureLearnData : public LearnData
+   {
+   public:
+      // takes ownership of the signature
+      SignatureLearnData(bool isSpam, _ds_spam_signature *signature)
+      {
+         m_isSpam = isSpam;
+         m_signature = signature;
+      }
+
+      virtual ~SignatureLearnData()
+      {
+         if ( m_signature )
+         {
+            free(m_signature->data);
+            free(m_signature);
+         }
+      }
+
+      // the result of the message classification
+      bool m_isSpam;
+
+      // the tokens found in the message when classifying it, may be NULL
+      _ds_spam_signature *m_signature;
+
+      DECLARE_NO_COPY_CLASS(SignatureLearnData);
+   };
+
 
    // common part of all DoXXX() functions: processes the message and returns
    // false if we failed, use ContextHandler to customize processing
    bool DoProcess(const Message& msg, ContextHandler& handler);
 
+   // the same as DoProcess() but for the raw message text
+   bool DoProcessText(const char *text, ContextHandler& handler);
+
+   // get the context to use for processing a message: either the batch one
+   // or a new one stored in ctxTmp, may return NULL, m_lockStorage must be
+   // locked for writing
+   DSPAM_CTX *GetProcessCtx(scoped_ptr<DspamProcessCtx>& ctxTmp);
 
+
+   // the context reused for all messages of the current batch, NULL if we're
+   // not inside DoBeginBatch()/DoEndBatch()
    DspamCtx *m_ctx;
 
+   // protects m_ctx and the hash storage used by all contexts
+   DspamStorageLock m_lockStorage;
+
    DECLARE_SPAM_FILTER("dspam", _("DSPAM"), 100);
 };
 
@@ -301,42 +506,75 @@ DspamFilter::~DspamFilter()
    delete m_ctx;
 }
 
-DSPAM_CTX *DspamFilter::GetCtx() const
+void DspamFilter::DoBeginBatch()
 {
-   if ( !m_ctx )
-   {
-      const_cast<DspamFilter *>(this)->m_ctx = new DspamProcessCtx();
-   }
+   DspamWriteLocker lock(m_lockStorage);
+
+   delete m_ctx;
+   m_ctx = new DspamProcessCtx();
 
    if ( !*m_ctx )
    {
       ERRORMESSAGE((_("DSPAM: library initialization failed.")));
 
-      return NULL;
+      // DoProcess() will try to create a new context for every message
+      delete m_ctx;
+      m_ctx = NULL;
    }
+}
 
-   return *m_ctx;
+void DspamFilter::DoEndBatch()
+{
+   DspamWriteLocker lock(m_lockStorage);
+
+   // destroying the context writes the updated totals to the database
+   delete m_ctx;
+   m_ctx = NULL;
 }
 
 bool DspamFilter::DoProcess(const Message& msg, ContextHandler& handler)
 {
-   DspamProcessCtx ctx;
-   if ( !ctx )
-      return false;
-
-   String str;
-   if ( !msg.WriteToString(str) )
+   wxCharBuffer buf;
+   if ( !msg.WriteToBuffer(buf) )
    {
       ERRORMESSAGE((_("Failed to get the message text.")));
 
       return false;
    }
 
+   return DoProcessText(buf, handler);
+}
+
+DSPAM_CTX *DspamFilter::GetProcessCtx(scoped_ptr<DspamProcessCtx>& ctxTmp)
+{
+   // use the batch context if we have it or a temporary one otherwise
+   if ( m_ctx )
+   {
+      m_ctx->Reset();
+      return *m_ctx;
+   }
+
+   ctxTmp.reset(new DspamProcessCtx());
+   return *ctxTmp;
+}
+
+bool DspamFilter::DoProcessText(const char *text, ContextHandler& handler)
+{
+   // processing the message modifies the hash storage, so we can't do it
+   // while the worker threads classify the other messages
+   DspamWriteLocker lock(m_lockStorage);
+
+   scoped_ptr<DspamProcessCtx> ctxTmp;
+   DSPAM_CTX * const ctx = GetProcessCtx(ctxTmp);
+   if ( !ctx )
+      return false;
+
    handler.OnInit(ctx);
 
-   if ( dspam_process(ctx, str.To8BitData()) != 0 )
+   // don't use ERRORMESSAGE() here as we may be not in the main thread
+   if ( dspam_process(ctx, text) != 0 )
    {
-      ERRORMESSAGE((_("DSPAM: processing message failed.")));
+      wxLogError(_("DSPAM: processing message failed."));
 
       return false;
    }
@@ -370,32 +608,20 @@ DspamFilter::DoCheckIfSpam(const Profile * /* profile */,
                            const String& param,
                            String *result)
 {
-   class CheckContextHandler : public ContextHandler
+   wxCharBuffer buf;
+   if ( !msg.WriteToBuffer(buf) )
    {
-   public:
-      CheckContextHandler(bool *rc, float *probability)
-      {
-         m_rc = rc;
-         m_probability = probability;
-      }
-
-      virtual void OnDone(DSPAM_CTX *ctx)
-      {
-         *m_probability = ctx->confidence;
-         *m_rc = ctx->result == DSR_ISSPAM;
-      }
+      ERRORMESSAGE((_("Failed to get the message text.")));
 
-   private:
-      bool *m_rc;
-      float *m_probability;
-   };
+      return false;
+   }
 
    ASSERT_MSG( param.empty(), _T("DspamFilter has no parameters") );
 
    bool rc;
    float probability;
    CheckContextHandler handler(&rc, &probability);
-   if ( !DoProcess(msg, handler) || !rc )
+   if ( !DoProcessText(buf, handler) || !rc )
       return false;
 
    if ( result )
@@ -406,6 +632,100 @@ DspamFilter::DoCheckIfSpam(const Profile * /* profile */,
    return true;
 }
 
+int
+DspamFilter::DoCheckRawIfSpam(const char *text,
+                              const String& param,
+                              String *result,
+                              LearnData **learn)
+{
+   ASSERT_MSG( param.empty(), _T("DspamFilter has no parameters") );
+
+   // creating the context may need to map the storage into memory, so do it
+   // exclusively, but it's cheap compared to the classification itself
+   scoped_ptr<DspamClassifyCtx> ctx;
+   {
+      DspamWriteLocker lock(m_lockStorage);
+
+      // use the same flags as DspamProcessCtx to get the same results and ask
+      // for the signature of the message to learn from it later
+      ctx.reset(new DspamClassifyCtx(DSF_SIGNATURE |
+                                     DSF_NOISE |
+                                     DSF_WHITELIST));
+   }
+
+   if ( !*ctx )
+      return false;
+
+   {
+      DspamReadLocker lock(m_lockStorage);
+
+      if ( dspam_process(*ctx, text) != 0 )
+      {
+         wxLogError(_("DSPAM: processing message failed."));
+
+         return false;
+      }
+   }
+
+   const bool isSpam = (*ctx)->result == DSR_ISSPAM;
+
+   *learn = new SignatureLearnData(isSpam, (*ctx)->signature);
+   (*ctx)->signature = NULL;
+
+   if ( !isSpam )
+      return false;
+
+   if ( result )
+   {
+      result->Printf(_T("probability = %0.3f"), (*ctx)->confidence);
+   }
+
+   return true;
+}
+
+void DspamFilter::DoLearnRaw(const LearnData& learn)
+{
+   const SignatureLearnData&
+      data = static_cast<const SignatureLearnData&>(learn);
+   if ( !data.m_signature )
+      return;
+
+   DspamWriteLocker lock(m_lockStorage);
+
+   scoped_ptr<DspamProcessCtx> ctxTmp;
+   DSPAM_CTX * const ctx = GetProcessCtx(ctxTmp);
+   if ( !ctx )
+      return;
+
+   // train DSPAM on the tokens found when classifying the message: this
+   // updates the storage as processing the message would have done but
+   // without tokenizing it again
+   ctx->classification = data.m_isSpam ? DSR_ISSPAM : DSR_ISINNOCENT;
+   ctx->source = DSS_CORPUS;
+   ctx->signature = data.m_signature;
+   ctx->flags |= DSF_SIGNATURE;
+
+   const int rc = dspam_process(ctx, NULL);
+
+   ctx->flags &= ~DSF_SIGNATURE;
+   ctx->signature = NULL;
+   ctx->_sig_provided = 0;
+
+   if ( rc != 0 )
+   {
+      wxLogError(_("DSPAM: processing message failed."));
+
+      return;
+   }
+
+   // training with a signature counts the message as fed to DSPAM by the
+   // user but this one was only checked, as when processing it normally
+   if ( data.m_isSpam )
+      ctx->totals.spam_corpusfed--;
+   else
+      ctx->totals.innocent_corpusfed--;
+}
+
 // ----------------------------------------------------------------------------
 // DspamFilter other (private) methods
 // ----------------------------------------------------------------------------
@@ -648,4 +968,348 @@ void DspamOptionsPage::OnButton(wxCommandEvent& event)
    }
 }
 
+#ifdef TEST_DSPAM_THREADS
+
+// ----------------------------------------------------------------------------
+// spam check throughput test
+// ----------------------------------------------------------------------------
+
+// define this to build a program training DSPAM on a synthetic corpus in a
+// temporary directory and measuring how fast DoCheckRawIfSpam() classifies it
+// using different numbers of threads (it must be linked with the rest of the
+// program objects)
+
+#include <wx/init.h>
+#include <wx/filename.h>
+
+#include <stdio.h>
+
+#include <string>
+
+// generates the synthetic messages
+class DspamTestCorpus
+{
+public:
+   DspamTestCorpus(size_t count)
+   {
+      m_seed = 1;
+
+      m_texts.reserve(count);
+      m_isSpam.reserve(count);
+      for ( size_t n = 0; n < count; n++ )
+      {
+         // every third message is a spam
+         const bool isSpam = n % 3 == 0;
+         m_texts.push_back(MakeMessage(n, isSpam));
+         m_isSpam.push_back(isSpam);
+      }
+   }
+
+   size_t GetCount() const { return m_texts.size(); }
+   const char *GetText(size_t n) const { return m_texts[n].c_str(); }
+   bool IsSpam(size_t n) const { return m_isSpam[n]; }
+
+private:
+   // simple LCG, we want the same corpus every time
+   unsigned long Random(unsigned long max)
+   {
+      m_seed = m_seed*1103515245 + 12345;
+      return (m_seed / 65536) % max;
+   }
+
+   // the spam and the ham use different but overlapping ranges of words
+   std::string MakeWord(bool isSpam)
+   {
+      char buf[16];
+      sprintf(buf, "w%lu", Random(3000) + (isSpam ? 0 : 2000));
+      return buf;
+   }
+
+   std::string MakeMessage(size_t n, bool isSpam)
+   {
+      char buf[128];
+      sprintf(buf, "From: sender%lu@%s.example.com\n"
+                   "To: user@example.org\n"
+                   "Message-Id: <%lu@test>\n"
+                   "Subject: ",
+              Random(500), isSpam ? "spam" : "ham", (unsigned long)n);
+
+      std::string text(buf);
+      for ( size_t i = 0; i < 5; i++ )
+         text += MakeWord(isSpam) + ' ';
+
+      text += "\n\n";
+
+      const size_t words = 100 + Random(400);
+      for ( size_t i = 0; i < words; i++ )
+      {
+         text += MakeWord(isSpam);
+         text += i % 12 == 11 ? '\n' : ' ';
+      }
+
+      text += '\n';
+
+      return text;
+   }
+
+   unsigned long m_seed;
+
+   std::vector<std::string> m_texts;
+   std::vector<bool> m_isSpam;
+};
+
+// gives access to DspamFilter protected methods
+class DspamFilterTest : public DspamFilter
+{
+public:
+   typedef DspamFilter::LearnData LearnData;
+
+   // train DSPAM on the first count messages of the corpus
+   bool Train(const DspamTestCorpus& corpus, size_t count)
+   {
+      DspamProcessCtx ctx;
+      if ( !ctx )
+         return false;
+
+      for ( size_t n = 0; n < count; n++ )
+      {
+         ctx.Reset();
+         ctx->classification = corpus.IsSpam(n) ? DSR_ISSPAM : DSR_ISINNOCENT;
+         ctx->source = DSS_CORPUS;
+         if ( dspam_process(ctx, corpus.GetText(n)) != 0 )
+            return false;
+      }
+
+      return true;
+   }
+
+   using DspamFilter::DoCheckRawIfSpam;
+   using DspamFilter::DoLearnRaw;
+   using DspamFilter::DoBeginBatch;
+   using DspamFilter::DoEndBatch;
+};
+
+// classifies the messages from a shared queue
+class DspamTestWorker : public wxThread
+{
+public:
+   DspamTestWorker(DspamFilterTest& filter,
+                   const DspamTestCorpus& corpus,
+                   std::vector<int>& verdicts,
+                   std::vector<DspamFilterTest::LearnData *>& learn,
+                   size_t& next,
+                   wxMutex& mutex)
+      : wxThread(wxTHREAD_JOINABLE),
+        m_filter(filter),
+        m_corpus(corpus),
+        m_verdicts(verdicts),
+        m_learn(learn),
+        m_next(next),
+        m_mutex(mutex)
+   {
+   }
+
+protected:
+   virtual void *Entry()
+   {
+      for ( ;; )
+      {
+         size_t n;
+         {
+            wxMutexLocker lock(m_mutex);
+            n = m_next++;
+         }
+
+         if ( n >= m_corpus.GetCount() )
+            break;
+
+         m_verdicts[n] = m_filter.DoCheckRawIfSpam(m_corpus.GetText(n),
+                                                   String(), NULL,
+                                                   &m_learn[n]);
+      }
+
+      return NULL;
+   }
+
+private:
+   DspamFilterTest& m_filter;
+   const DspamTestCorpus& m_corpus;
+   std::vector<int>& m_verdicts;
+   std::vector<DspamFilterTest::LearnData *>& m_learn;
+   size_t& m_next;
+   wxMutex& m_mutex;
+};
+
+// classify all messages using the given number of threads and return the
+// time taken in ms or -1 on error
+static long Classify(DspamFilterTest& filter,
+                     const DspamTestCorpus& corpus,
+                     unsigned nThreads,
+                     std::vector<int>& verdicts,
+                     std::vector<DspamFilterTest::LearnData *>& learn)
+{
+   const size_t count = corpus.GetCount();
+   verdicts.assign(count, -1);
+   learn.assign(count, NULL);
+
+   size_t next = 0;
+   wxMutex mutex;
+
+   wxStopWatch timer;
+
+   std::vector<DspamTestWorker *> threads;
+   for ( unsigned n = 0; n < nThreads; n++ )
+   {
+      DspamTestWorker * const
+         thread = new DspamTestWorker(filter, corpus, verdicts, learn,
+                                      next, mutex);
+      if ( thread->Run() != wxTHREAD_NO_ERROR )
+      {
+         delete thread;
+         break;
+      }
+
+      threads.push_back(thread);
+   }
+
+   for ( size_t n = 0; n < threads.size(); n++ )
+   {
+      threads[n]->Wait();
+      delete threads[n];
+   }
+
+   const long ms = timer.Time();
+
+   return threads.size() == nThreads ? ms : -1;
+}
+
+static void FreeLearnData(std::vector<DspamFilterTest::LearnData *>& learn)
+{
+   for ( size_t n = 0; n < learn.size(); n++ )
+      delete learn[n];
+
+   learn.clear();
+}
+
+int main(int argc, char **argv)
+{
+   wxInitializer init;
+   if ( !init.IsOk() )
+      return 2;
+
+   unsigned long count = 3000;
+   if ( argc > 1 && (sscanf(argv[1], "%lu", &count) != 1 || count < 10) )
+   {
+      fprintf(stderr, "Usage: %s [number of messages]\n", argv[0]);
+      return 2;
+   }
+
+   gs_testHome = wxFileName::CreateTempFileName(_T("dspam"));
+   wxRemoveFile(gs_testHome);
+   if ( !wxMkdir(gs_testHome) )
+      return 2;
+
+   printf("Generating %lu messages: ", count);
+   fflush(stdout);
+   DspamTestCorpus corpus(count);
+   printf("ok\n");
+
+   DspamFilterTest * const filter = new DspamFilterTest;
+
+   // train on a tenth of the messages as the user would have done
+   printf("Training on %lu messages: ", count / 10);
+   fflush(stdout);
+   wxStopWatch timerTrain;
+   if ( !filter->Train(corpus, count / 10) )
+   {
+      printf("ERROR\n");
+      return 1;
+   }
+   printf("ok (%ldms)\n", timerTrain.Time());
+
+   filter->DoBeginBatch();
+
+   bool ok = true;
+
+   std::vector<int> verdicts,
+                    verdictsFirst;
+   std::vector<DspamFilterTest::LearnData *> learn;
+
+   const int countCPUs = wxThread::GetCPUCount();
+   long msFirst = 0;
+   for ( unsigned nThreads = 1; ; nThreads *= 2 )
+   {
+      if ( nThreads > 1 && (int)nThreads > countCPUs )
+         break;
+
+      printf("Classifying with %u threads: ", nThreads);
+      fflush(stdout);
+
+      const long ms = Classify(*filter, corpus, nThreads, verdicts, learn);
+      if ( ms == -1 )
+      {
+         printf("ERROR: failed to start the threads\n");
+         ok = false;
+         break;
+      }
+
+      size_t correct = 0;
+      for ( size_t n = 0; n < count; n++ )
+      {
+         if ( (verdicts[n] == true) == corpus.IsSpam(n) )
+            correct++;
+      }
+
+      // the classification doesn't modify the database, so the results must
+      // be the same whatever the number of threads
+      if ( nThreads == 1 )
+      {
+         verdictsFirst = verdicts;
+         msFirst = ms;
+      }
+      else if ( verdicts != verdictsFirst )
+      {
+         ok = false;
+      }
+
+      printf("%s (%ldms, %.1f messages/s, x%.2f, %lu%% correct)\n",
+             ok ? "ok" : "ERROR: results differ",
+             ms, ms ? (1000.*count)/ms : 0.,
+             ms ? (double)msFirst/ms : 0.,
+             (unsigned long)(100*correct/count));
+
+      FreeLearnData(learn);
+   }
+
+   // learning from the messages is serialized, check how long it takes
+   if ( ok )
+   {
+      Classify(*filter, corpus, 1, verdicts, learn);
+
+      printf("Learning from %lu messages: ", count);
+      fflush(stdout);
+
+      wxStopWatch timerLearn;
+      for ( size_t n = 0; n < count; n++ )
+      {
+         if ( learn[n] )
+            filter->DoLearnRaw(*learn[n]);
+      }
+
+      printf("ok (%ldms)\n", timerLearn.Time());
+
+      FreeLearnData(learn);
+   }
+
+   filter->DoEndBatch();
+   filter->DecRef();
+
+   DspamCtx::CloseHashStorage();
+
+   printf("The test database was left in %s\n",
+          (const char *)gs_testHome.mb_str());
+
+   return ok ? 0 : 1;
+}
 
+#endif // TEST_DSPAM_THREADS
@@ -49,10 +49,18 @@
    #undef USE_RBL
 #endif
 
+#include "DnsblLookup.h"
+
+#include <algorithm>
+
 // ----------------------------------------------------------------------------
 // options we use here
 // ----------------------------------------------------------------------------
 
+#ifdef USE_RBL
+extern const MOption MP_RBL_NAMESERVER;
+extern const MOption MP_RBL_TIMEOUT;
+#endif // USE_RBL
 extern const MOption MP_WHITE_LIST;
 
 // ----------------------------------------------------------------------------
@@ -231,6 +239,17 @@ protected:
                                              Profile *profile) const;
 
 
+#ifdef USE_RBL
+   // check if any of the relays in the given Received: header is in a RBL
+   bool CheckRBL(const Profile *profile, const String& received);
+
+   // the object doing the RBL lookups and caching their results
+   DnsblLookup m_dnsbl;
+
+   // the value of MP_RBL_NAMESERVER used by m_dnsbl
+   String m_nameserver;
+#endif // USE_RBL
+
    DECLARE_SPAM_FILTER("headers", _("Heuristic headers test"), 30);
 };
 
@@ -962,64 +981,6 @@ static bool CheckWhiteList(const Message& msg, String *match)
 
 #ifdef USE_RBL
 
-
-#define __STRICT_ANSI__
-#include <netinet/in.h>
-
-// FreeBSD uses a variable name "class"
-#define class xxclass
-#undef MIN  // defined by glib.h
-#undef MAX  // defined by glib.h
-#include <arpa/nameser.h>
-#undef class
-
-#include <resolv.h>
-#include <netdb.h>
-
-#ifdef OS_SOLARIS
-   extern "C" {
-   // Solaris 2.5.1 has no prototypes for it:
-   extern int res_init(void);
-   extern int res_query(const char *, int , int ,
-                        unsigned char *, int);
-   };
-#endif
-
-#define BUFLEN 512
-
-/* rblcheck()
- * Checks the specified dotted-quad address against the provided RBL
- * domain. If "txt" is non-zero, we perform a TXT record lookup. We
- * return the text returned from a TXT match, or an empty string, on
- * a successful match, or NULL on an unsuccessful match. */
-static
-bool CheckRBL( int a, int b, int c, int d, const String & rblDomain)
-{
-   char * answerBuffer = new char[ BUFLEN ];
-   int len;
-
-   String domain;
-   domain.Printf(_T("%d.%d.%d.%d.%s"), d, c, b, a, rblDomain.c_str() );
-
-   res_init();
-   len = res_query( domain.ToAscii(), C_IN, T_A,
-                    (unsigned char *)answerBuffer, PACKETSZ );
-
-   if ( len != -1 )
-   {
-      if ( len > PACKETSZ ) // buffer was too short, re-alloc:
-      {
-         delete [] answerBuffer;
-         answerBuffer = new char [ len ];
-         // and again:
-         len = res_query( domain.ToAscii(), C_IN, T_A,
-                          (unsigned char *) answerBuffer, len );
-      }
-   }
-   delete [] answerBuffer;
-   return len != -1; // found, so it's known spam
-}
-
 static const wxChar * gs_RblSites[] =
 { _T("rbl.maps.vix.com"), _T("relays.orbs.org"), _T("rbl.dorkslayers.com"), NULL };
 
@@ -1058,6 +1019,63 @@ static bool findIP(String &header,
    return false;
 }
 
+// add all IP addresses found between the given delimiters in the header to
+// the ips array unless they're already there
+static void AddReceivedIPs(const String& header,
+                           char openChar, char closeChar,
+                           std::vector<DnsblLookup::IPv4>& ips)
+{
+   String testHeader = header;
+   int a, b, c, d;
+   while ( findIP(testHeader, openChar, closeChar, &a, &b, &c, &d) )
+   {
+      const DnsblLookup::IPv4 ip = DnsblLookup::MakeIPv4(a, b, c, d);
+      if ( std::find(ips.begin(), ips.end(), ip) == ips.end() )
+         ips.push_back(ip);
+   }
+}
+
+bool HeadersFilter::CheckRBL(const Profile *profile, const String& received)
+{
+   std::vector<DnsblLookup::IPv4> ips;
+   AddReceivedIPs(received, '(', ')', ips);
+   AddReceivedIPs(received, '[', ']', ips);
+
+   /*FIXME: if it is a hostname, maybe do a DNS lookup first? */
+
+   if ( ips.empty() )
+      return false;
+
+   wxArrayString zones;
+   for ( int i = 0; gs_RblSites[i]; ++i )
+      zones.Add(gs_RblSites[i]);
+
+   // changing the name server discards the system ones which would then have
+   // to be retrieved again, so only do it if the option really changed
+   const String nameserver = READ_CONFIG_TEXT(profile, MP_RBL_NAMESERVER);
+   if ( nameserver != m_nameserver )
+   {
+      m_nameserver = nameserver;
+      if ( !m_dnsbl.SetNameServer(nameserver) )
+      {
+         wxLogError(_("Invalid RBL name server address \"%s\", using the "
+                      "system name servers instead."), nameserver.c_str());
+
+         m_dnsbl.SetNameServer(wxEmptyString);
+      }
+   }
+
+   m_dnsbl.SetTimeout(READ_CONFIG(profile, MP_RBL_TIMEOUT));
+
+   String match;
+   if ( !m_dnsbl.IsListed(ips, zones, &match) )
+      return false;
+
+   wxLogTrace(TRACE_SPAM, _T("Relay blacklisted as \"%s\""), match.c_str());
+
+   return true;
+}
+
 #endif // USE_RBL
 
 // ----------------------------------------------------------------------------
@@ -1176,50 +1194,11 @@ HeadersFilter::DoCheckIfSpam(const Profile *profile,
 #ifdef USE_RBL
       else if ( test == spamTestDescs[Spam_Test_RBL].token )
       {
-         msg.GetHeaderLine(_T("Received"), value);
-
-         int a,b,c,d;
-         String testHeader = value;
-
-         bool rc = false;
-         while ( !rc && !testHeader.empty() )
-         {
-            if (findIP(testHeader, '(', ')', &a, &b, &c, &d))
-            {
-               for ( int i = 0; gs_RblSites[i]; ++i )
-               {
-                  if ( CheckRBL(a,b,c,d,gs_RblSites[i]) )
-                  {
-                     rc = true;
-                     break;
-                  }
-               }
-            }
-         }
-
-         if ( !rc )
+         if ( msg.GetHeaderLine(_T("Received"), value) &&
+                  CheckRBL(profile, value) )
          {
-            testHeader = value;
-            while ( !rc && !testHeader.empty() )
-            {
-               if (findIP(testHeader, '[', ']', &a, &b, &c, &d))
-               {
-                  for ( int i = 0; gs_RblSites[i] ; ++i )
-                  {
-                     if ( CheckRBL(a,b,c,d,gs_RblSites[i]) )
-                     {
-                        rc = true;
-                        break;
-                     }
-                  }
-               }
-            }
-         }
-
-         /*FIXME: if it is a hostname, maybe do a DNS lookup first? */
-
-         if ( rc )
             spamResult = _("blacklisted by RBL");
+         }
       }
 #endif // USE_RBL
       //else: simply ignore unknown tests, don't complain as it would be
@@ -0,0 +1,596 @@
+///////////////////////////////////////////////////////////////////////////////
+// Project:     M - cross platform e-mail GUI client
+// File name:   util/DnsblLookup.cpp: DnsblLookup class implementation
+// Purpose:     DnsblLookup checks IP addresses against DNS black lists
+// Author:      M-Team
+// Modified by:
+// Created:     16.10.26
+// CVS-ID:      $Id$
+// Copyright:   (c) 2026 Mahogany Team
+// Licence:     M license
+///////////////////////////////////////////////////////////////////////////////
+
+// ============================================================================
+// declarations
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// headers
+// ----------------------------------------------------------------------------
+
+#include  "Mpch.h"
+
+#ifndef  USE_PCH
+#  include "Mcommon.h"
+#endif // USE_PCH
+
+// RBL checks are not available under Mac, see HeadersFilter.cpp
+#ifdef OS_MAC
+   #undef USE_RBL
+#endif
+
+#include "DnsblLookup.h"
+
+#ifdef USE_RBL
+
+#include <wx/stopwatch.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// FreeBSD uses a variable name "class"
+#define class xxclass
+#undef MIN  // defined by glib.h
+#undef MAX  // defined by glib.h
+#include <arpa/nameser.h>
+#undef class
+
+#include <resolv.h>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+// ----------------------------------------------------------------------------
+// constants
+// ----------------------------------------------------------------------------
+
+// the size of the fixed DNS message header
+static const size_t DNS_HEADER_SIZE = 12;
+
+// the DNS resource record types and response codes we use
+static const unsigned DNS_TYPE_A = 1;
+static const unsigned DNS_TYPE_SOA = 6;
+
+static const unsigned DNS_RCODE_NOERROR = 0;
+static const unsigned DNS_RCODE_NXDOMAIN = 3;
+
+// the time to cache the negative answers without SOA record for
+static const unsigned long DNSBL_NEGATIVE_TTL = 300;
+
+// never cache the answers for longer than this, whatever their TTL is
+static const unsigned long DNSBL_MAX_TTL = 24*60*60;
+
+// the number of cache entries after which the expired ones are removed
+static const size_t DNSBL_CACHE_PURGE_SIZE = 10000;
+
+// ----------------------------------------------------------------------------
+// local functions
+// ----------------------------------------------------------------------------
+
+static inline unsigned GetUInt16(const unsigned char *p)
+{
+   return (p[0] << 8) | p[1];
+}
+
+static inline unsigned long GetUInt32(const unsigned char *p)
+{
+   return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+          ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+// the fields of a resource record we're interested in
+struct DnsRecord
+{
+   unsigned type;
+   unsigned long ttl;
+   const unsigned char *rdata;
+   unsigned rdlength;
+};
+
+// parse the resource record starting at p, return the pointer after it or
+// NULL if the message is malformed
+static const unsigned char *
+ParseRecord(const unsigned char *end,
+            const unsigned char *p,
+            DnsRecord& rr)
+{
+   const int len = dn_skipname(p, end);
+   if ( len < 0 )
+      return NULL;
+
+   p += len;
+
+   // type, class, TTL and RDATA length
+   if ( end - p < 10 )
+      return NULL;
+
+   rr.type = GetUInt16(p);
+   rr.ttl = GetUInt32(p + 4);
+   rr.rdlength = GetUInt16(p + 8);
+   p += 10;
+
+   if ( (size_t)(end - p) < rr.rdlength )
+      return NULL;
+
+   rr.rdata = p;
+
+   return p + rr.rdlength;
+}
+
+// get the negative caching TTL from the SOA record (RFC 2308)
+static unsigned long
+GetNegativeTTL(const DnsRecord& rr)
+{
+   const unsigned char *p = rr.rdata;
+   const unsigned char * const endRR = rr.rdata + rr.rdlength;
+
+   // skip MNAME and RNAME
+   for ( int n = 0; n < 2; n++ )
+   {
+      const int len = dn_skipname(p, endRR);
+      if ( len < 0 )
+         return DNSBL_NEGATIVE_TTL;
+
+      p += len;
+   }
+
+   // MINIMUM is the last of 5 32 bit fields following them
+   if ( endRR - p < 20 )
+      return DNSBL_NEGATIVE_TTL;
+
+   const unsigned long minimum = GetUInt32(p + 16);
+
+   return rr.ttl < minimum ? rr.ttl : minimum;
+}
+
+// ============================================================================
+// DnsblLookup implementation
+// ============================================================================
+
+DnsblLookup::DnsblLookup()
+{
+   m_timeout = 3000;
+
+   // don't always start with the same ID to make the answers to the queries
+   // of the previous program runs less likely to be confused with ours
+   m_nextId = (unsigned short)(time(NULL) ^ getpid());
+}
+
+DnsblLookup::~DnsblLookup()
+{
+}
+
+bool DnsblLookup::SetNameServer(const String& server)
+{
+   m_servers.clear();
+
+   if ( server.empty() )
+      return true;
+
+   String address = server;
+   unsigned long port = 53;
+
+   const size_t posColon = server.find(_T(':'));
+   if ( posColon != String::npos )
+   {
+      address = server.substr(0, posColon);
+      if ( !server.substr(posColon + 1).ToULong(&port) ||
+            port == 0 || port > 0xffff )
+         return false;
+   }
+
+   struct in_addr addr;
+   if ( !inet_aton(address.ToAscii(), &addr) )
+      return false;
+
+   Server s;
+   s.addr = ntohl(addr.s_addr);
+   s.port = (unsigned short)port;
+   m_servers.push_back(s);
+
+   return true;
+}
+
+bool DnsblLookup::InitServers()
+{
+   if ( !m_servers.empty() )
+      return true;
+
+   // we only need to do it once and not before each query
+   if ( res_init() != 0 )
+   {
+      wxLogTrace(TRACE_DNSBL, _T("Failed to initialize the resolver"));
+
+      return false;
+   }
+
+   for ( int n = 0; n < _res.nscount; n++ )
+   {
+      // IPv6 servers are not stored in nsaddr_list and are skipped here
+      const struct sockaddr_in& sa = _res.nsaddr_list[n];
+      if ( sa.sin_family != AF_INET )
+         continue;
+
+      Server server;
+      server.addr = ntohl(sa.sin_addr.s_addr);
+      server.port = ntohs(sa.sin_port);
+      m_servers.push_back(server);
+   }
+
+   if ( m_servers.empty() )
+   {
+      wxLogTrace(TRACE_DNSBL, _T("No IPv4 name servers configured"));
+
+      return false;
+   }
+
+   return true;
+}
+
+/* static */
+std::string DnsblLookup::GetQueryName(IPv4 ip, const String& zone)
+{
+   // the address components are in the reverse order as for in-addr.arpa
+   String name;
+   name.Printf(_T("%lu.%lu.%lu.%lu.%s"),
+               ip & 0xff, (ip >> 8) & 0xff, (ip >> 16) & 0xff, ip >> 24,
+               zone.Lower().c_str());
+
+   return std::string(name.ToAscii());
+}
+
+void DnsblLookup::PurgeCache(time_t now)
+{
+   Cache::iterator i = m_cache.begin();
+   while ( i != m_cache.end() )
+   {
+      if ( i->second.expires <= now )
+         m_cache.erase(i++);
+      else
+         ++i;
+   }
+
+   // if most entries are still valid, we're probably checking too many
+   // different addresses for the cache to be useful anyhow
+   if ( m_cache.size() >= DNSBL_CACHE_PURGE_SIZE )
+      m_cache.clear();
+}
+
+bool DnsblLookup::SendQueries(int sock,
+                              const std::vector<Query>& queries,
+                              const Server& server)
+{
+   struct sockaddr_in sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.sin_family = AF_INET;
+   sa.sin_addr.s_addr = htonl(server.addr);
+   sa.sin_port = htons(server.port);
+
+   bool sentAny = false;
+
+   const size_t count = queries.size();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      const Query& query = queries[n];
+      if ( query.done )
+         continue;
+
+      unsigned char buf[PACKETSZ];
+      const int len = res_mkquery(QUERY, query.name.c_str(), C_IN, T_A,
+                                  NULL, 0, NULL, buf, sizeof(buf));
+      if ( len < (int)DNS_HEADER_SIZE )
+         continue;
+
+      // use our own ID to match the answers with the queries
+      buf[0] = (unsigned char)(query.id >> 8);
+      buf[1] = (unsigned char)(query.id & 0xff);
+
+      if ( sendto(sock, buf, len, 0,
+                  (struct sockaddr *)&sa, sizeof(sa)) == len )
+      {
+         sentAny = true;
+      }
+   }
+
+   return sentAny;
+}
+
+int
+DnsblLookup::ProcessAnswer(const unsigned char *answer,
+                           size_t len,
+                           const std::vector<Query>& queries,
+                           bool *listed)
+{
+   *listed = false;
+
+   if ( len < DNS_HEADER_SIZE )
+      return -1;
+
+   // must be a response to a single question
+   if ( !(answer[2] & 0x80) || GetUInt16(answer + 4) != 1 )
+      return -1;
+
+   const unsigned id = GetUInt16(answer);
+
+   int idx = -1;
+   const size_t count = queries.size();
+   for ( size_t n = 0; n < count; n++ )
+   {
+      if ( queries[n].id == id && !queries[n].done )
+      {
+         idx = n;
+         break;
+      }
+   }
+
+   if ( idx == -1 )
+      return -1;
+
+   const Query& query = queries[idx];
+
+   // check that this is really the answer to our question
+   const unsigned char * const end = answer + len;
+   const unsigned char *p = answer + DNS_HEADER_SIZE;
+
+   char name[MAXDNAME];
+   const int lenName = dn_expand(answer, end, p, name, sizeof(name));
+   if ( lenName < 0 || strcasecmp(name, query.name.c_str()) != 0 )
+      return -1;
+
+   // skip the question type and class
+   p += lenName + 4;
+   if ( p > end )
+      return -1;
+
+   const unsigned rcode = answer[3] & 0x0f;
+   if ( rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN )
+   {
+      // the server failed, this doesn't say anything about the address so
+      // consider that it is not listed but don't cache this answer
+      wxLogTrace(TRACE_DNSBL, _T("Lookup of %s failed (rcode %u)"),
+                 name, rcode);
+
+      return idx;
+   }
+
+   const unsigned countAnswers = GetUInt16(answer + 6),
+                  countAuthority = GetUInt16(answer + 8);
+
+   CacheEntry entry;
+   entry.listed = false;
+
+   unsigned long ttl = DNSBL_MAX_TTL;
+
+   DnsRecord rr;
+   unsigned n;
+   for ( n = 0; n < countAnswers; n++ )
+   {
+      p = ParseRecord(end, p, rr);
+      if ( !p )
+         return idx;
+
+      // the lists use 127.0.0.0/8 addresses for the listed entries but
+      // 127.255.255.0/24 are used for errors (e.g. refused queries) and must
+      // not be taken into account
+      if ( rr.type == DNS_TYPE_A && rr.rdlength == 4 &&
+               rr.rdata[0] == 127 &&
+               !(rr.rdata[1] == 255 && rr.rdata[2] == 255) )
+      {
+         entry.listed = true;
+         if ( rr.ttl < ttl )
+            ttl = rr.ttl;
+      }
+   }
+
+   if ( !entry.listed )
+   {
+      // use the SOA record in the authority section for the negative TTL
+      ttl = DNSBL_NEGATIVE_TTL;
+      for ( n = 0; n < countAuthority; n++ )
+      {
+         p = ParseRecord(end, p, rr);
+         if ( !p )
+            break;
+
+         if ( rr.type == DNS_TYPE_SOA )
+         {
+            ttl = GetNegativeTTL(rr);
+            break;
+         }
+      }
+   }
+
+   if ( ttl > DNSBL_MAX_TTL )
+      ttl = DNSBL_MAX_TTL;
+
+   entry.expires = time(NULL) + ttl;
+   m_cache[query.name] = entry;
+
+   wxLogTrace(TRACE_DNSBL, _T("%s is %slisted (cached for %lus)"),
+              name, entry.listed ? _T("") : _T("not "), ttl);
+
+   *listed = entry.listed;
+
+   return idx;
+}
+
+bool
+DnsblLookup::IsListed(const std::vector<IPv4>& ips,
+                      const wxArrayString& zones,
+                      String *match)
+{
+   const time_t now = time(NULL);
+   if ( m_cache.size() >= DNSBL_CACHE_PURGE_SIZE )
+      PurgeCache(now);
+
+   wxStopWatch sw;
+
+   // use the cached answers if we have them and collect the queries to make
+   // for all the others
+   std::vector<Query> queries;
+
+   const size_t countIPs = ips.size(),
+                countZones = zones.size();
+   for ( size_t i = 0; i < countIPs; i++ )
+   {
+      for ( size_t z = 0; z < countZones; z++ )
+      {
+         const std::string name = GetQueryName(ips[i], zones[z]);
+
+         Cache::const_iterator it = m_cache.find(name);
+         if ( it != m_cache.end() && it->second.expires > now )
+         {
+            if ( it->second.listed )
+            {
+               if ( match )
+                  *match = wxString::FromAscii(name.c_str());
+
+               return true;
+            }
+
+            continue;
+         }
+
+         Query query;
+         query.name = name;
+         query.id = m_nextId++;
+         query.done = false;
+         queries.push_back(query);
+      }
+   }
+
+   const size_t countQueries = queries.size();
+   if ( !countQueries || !InitServers() )
+      return false;
+
+   const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+   if ( sock == -1 )
+   {
+      wxLogTrace(TRACE_DNSBL, _T("Failed to create socket (errno %d)"), errno);
+
+      return false;
+   }
+
+   fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+   // send all queries at once to the first server, the unanswered ones are
+   // resent to the next server (or the same one if there is only one) after
+   // half of the timeout
+   size_t server = 0;
+   SendQueries(sock, queries, m_servers[server]);
+
+   bool resent = false,
+        listed = false;
+   size_t countLeft = countQueries;
+   while ( countLeft && !listed )
+   {
+      const long elapsed = sw.Time();
+      if ( elapsed >= m_timeout )
+         break;
+
+      long wait = m_timeout - elapsed;
+      if ( !resent )
+      {
+         if ( elapsed >= m_timeout / 2 )
+         {
+            server = (server + 1) % m_servers.size();
+            SendQueries(sock, queries, m_servers[server]);
+            resent = true;
+            continue;
+         }
+
+         wait = m_timeout / 2 - elapsed;
+      }
+
+      struct pollfd pfd;
+      pfd.fd = sock;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      const int rc = poll(&pfd, 1, wait);
+      if ( rc == -1 )
+      {
+         if ( errno == EINTR )
+            continue;
+
+         wxLogTrace(TRACE_DNSBL, _T("poll() failed (errno %d)"), errno);
+         break;
+      }
+
+      if ( rc == 0 )
+         continue;
+
+      // process all the answers which have arrived
+      for ( ;; )
+      {
+         unsigned char answer[4096];
+         struct sockaddr_in sa;
+         socklen_t lenAddr = sizeof(sa);
+         const ssize_t len = recvfrom(sock, answer, sizeof(answer), 0,
+                                      (struct sockaddr *)&sa, &lenAddr);
+         if ( len <= 0 )
+            break;
+
+         // ignore the packets not coming from any of our servers
+         const IPv4 from = ntohl(sa.sin_addr.s_addr);
+         bool fromServer = false;
+         for ( size_t n = 0; n < m_servers.size(); n++ )
+         {
+            if ( m_servers[n].addr == from )
+            {
+               fromServer = true;
+               break;
+            }
+         }
+
+         if ( !fromServer )
+            continue;
+
+         bool isListed;
+         const int idx = ProcessAnswer(answer, len, queries, &isListed);
+         if ( idx == -1 )
+            continue;
+
+         queries[idx].done = true;
+         countLeft--;
+
+         if ( isListed )
+         {
+            if ( match )
+               *match = wxString::FromAscii(queries[idx].name.c_str());
+
+            listed = true;
+            break;
+         }
+      }
+   }
+
+   close(sock);
+
+   wxLogTrace(TRACE_DNSBL,
+              _T("Checked %lu addresses in %lu lists: %lu queries, ")
+              _T("%lu unanswered, %ldms"),
+              (unsigned long)countIPs, (unsigned long)countZones,
+              (unsigned long)countQueries,
+              listed ? 0ul : (unsigned long)countLeft, sw.Time());
+
+   return listed;
+}
+
+#endif // USE_RBL